@@ -28,7 +28,26 @@ DRIVER_CONFIGURATION_KNOB g_validConfigurations[] =
     { RX_PERF_COUNTERS_ITERATION_INTERVAL, RX_PERF_COUNTERS_ITERATION_INTERVAL_NAME, 200, 5000, 1000, 0, 0 },
     { EC_UPDATE_PERF_COUNTERS, EC_UPDATE_PERF_COUNTERS_NAME , 0, 1, 0, 0, DRIVER_CONFIG_KNOB_IS_BOOLEAN },
     { ALLOW_DMA_HAL_BYPASS, ALLOW_DMA_HAL_BYPASS_NAME, 0, 1, 1, 0, DRIVER_CONFIG_KNOB_IS_BOOLEAN },
-    { DMA_BOUNCE_POLICY, DMA_BOUNCE_POLICY_NAME, 0, 2, 0, 0, 0 }
+    { DMA_BOUNCE_POLICY, DMA_BOUNCE_POLICY_NAME, 0, 2, 0, 0, 0 },
+    { TX_QUEUE_COUNT, TX_QUEUE_COUNT_NAME, 0, 64, 0, 0, 0 },
+    { TX_BUSY_POLL_WINDOW, TX_BUSY_POLL_WINDOW_NAME, 0, 1000, 0, 0, 0 },
+    { RX_BUSY_POLL_WINDOW, RX_BUSY_POLL_WINDOW_NAME, 0, 1000, 0, 0, 0 },
+    { RX_COPY_BREAK_THRESHOLD, RX_COPY_BREAK_THRESHOLD_NAME, 0, 1024, 0, 0, 0 },
+    { TX_SOFTWARE_LSO_ENABLED, TX_SOFTWARE_LSO_ENABLED_NAME, 0, 1, 0, 0, DRIVER_CONFIG_KNOB_IS_BOOLEAN },
+    { RX_SOFTWARE_CHECKSUM_ENABLED, RX_SOFTWARE_CHECKSUM_ENABLED_NAME, 0, 1, 0, 0, DRIVER_CONFIG_KNOB_IS_BOOLEAN },
+    { TX_COMPLETION_BATCH_COUNT, TX_COMPLETION_BATCH_COUNT_NAME, 1, 1024, 32, 0, 0 },
+    { TX_COMPLETION_BATCH_BYTES, TX_COMPLETION_BATCH_BYTES_NAME, 0, 4194304, 262144, 0, 0 },
+    { TX_COMPLETION_BATCH_TIME, TX_COMPLETION_BATCH_TIME_NAME, 0, 1000, 50, 0, 0 },
+    { TX_DOORBELL_BATCH, TX_DOORBELL_BATCH_NAME, 1, 256, 8, 0, 0 },
+    { TX_DOORBELL_WATERMARK, TX_DOORBELL_WATERMARK_NAME, 0, 100, 50, 0, 0 },
+    { VERIFIER_SAMPLE_RATE, VERIFIER_SAMPLE_RATE_NAME, 0, 1000000, 0, 0, 0 },
+    { VERIFIER_CPU_BUDGET, VERIFIER_CPU_BUDGET_NAME, 1, 1000, 10, 0, 0 },
+    { DATAPATH_POLLER_ENABLED, DATAPATH_POLLER_ENABLED_NAME, 0, 1, 0, 0, DRIVER_CONFIG_KNOB_IS_BOOLEAN },
+    { RX_RSS_REBALANCE_INTERVAL, RX_RSS_REBALANCE_INTERVAL_NAME, 0, 60000, 0, 0, 0 },
+    { RX_RSS_REBALANCE_THRESHOLD, RX_RSS_REBALANCE_THRESHOLD_NAME, 10, 1000, 50, 0, 0 },
+    { RX_SOFTWARE_RSS_PROCESSORS, RX_SOFTWARE_RSS_PROCESSORS_NAME, 0, 64, 0, 0, 0 },
+    { RX_FLOW_STEERING_ENTRIES, RX_FLOW_STEERING_ENTRIES_NAME, 0, 65536, 0, 0, 0 },
+    { RX_FLOW_STEERING_TIMEOUT, RX_FLOW_STEERING_TIMEOUT_NAME, 100, 600000, 10000, 0, 0 }
 };
 
 _IRQL_requires_(PASSIVE_LEVEL)
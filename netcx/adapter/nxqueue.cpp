@@ -12,6 +12,8 @@
 #include "version.hpp"
 #include "verifier.hpp"
 
+#include <NetClientDriverConfigurationImpl.hpp>
+
 void
 NetClientQueueStart(
     NET_CLIENT_QUEUE Queue
@@ -36,6 +38,31 @@ NetClientQueueAdvance(
     reinterpret_cast<NxQueue *>(Queue)->Advance();
 }
 
+static
+void
+CopyRingElements(
+    _Inout_ NET_RING * Destination,
+    _In_ NET_RING const * Source,
+    _In_ UINT32 BeginIndex,
+    _In_ UINT32 EndIndex
+)
+{
+    if (EndIndex < BeginIndex)
+    {
+        RtlCopyMemory(
+            NetRingGetElementAtIndex(Destination, BeginIndex),
+            NetRingGetElementAtIndex(Source, BeginIndex),
+            static_cast<size_t>(Source->NumberOfElements - BeginIndex) * Source->ElementStride);
+
+        BeginIndex = 0;
+    }
+
+    RtlCopyMemory(
+        NetRingGetElementAtIndex(Destination, BeginIndex),
+        NetRingGetElementAtIndex(Source, BeginIndex),
+        static_cast<size_t>(EndIndex - BeginIndex) * Source->ElementStride);
+}
+
 static
 void
 NetClientQueueAdvanceVerifying(
@@ -159,10 +186,11 @@ NxQueue::Start(
         }
     }
 
-    if (m_privateGlobals.CxVerifierOn)
+    if (m_verifierSampleRate != 0)
     {
         m_verifiedPacketIndex = 0;
         m_verifiedFragmentIndex = 0;
+        m_verifiedRingsCurrent = true;
     }
 
     if (m_packetQueueConfig.EvtStart)
@@ -190,95 +218,171 @@ NxQueue::Advance(
     m_packetQueueConfig.EvtAdvance(m_queue);
 }
 
-void
-NxQueue::AdvancePreVerifying(
+bool
+NxQueue::ShouldVerify(
     void
 )
 {
-    auto const pr = NetRingCollectionGetPacketRing(&m_ringCollection);
-    auto const fr = NetRingCollectionGetFragmentRing(&m_ringCollection);
+    // every call is verified when driver verifier is enabled on the client
 
-    if (m_queueType == Type::Rx)
+    if (m_privateGlobals.CxVerifierOn)
     {
-        // poison fields we expect may be written by the driver
+        return true;
+    }
 
-        for (; m_verifiedPacketIndex != pr->EndIndex;
-            m_verifiedPacketIndex = NetRingIncrementIndex(pr, m_verifiedPacketIndex))
-        {
-            auto packet = NetRingGetPacketAtIndex(pr, m_verifiedPacketIndex);
+    if (++m_verifierCalls < m_verifierSampleRate)
+    {
+        return false;
+    }
 
-            packet->FragmentIndex = ~0U;
-            packet->FragmentCount = static_cast<UINT16>(~0U);
-            packet->Layout = { 0x7f, 0x1ff, 0xff, 0xf, 0xf, 0xf };
-        }
+    m_verifierCalls = 0;
 
-        auto const rxCapabilities = m_adapter->GetRxCapabilities();
-        for (; m_verifiedFragmentIndex != fr->EndIndex;
-            m_verifiedFragmentIndex = NetRingIncrementIndex(fr, m_verifiedFragmentIndex))
-        {
-            auto fragment = NetRingGetFragmentAtIndex(fr, m_verifiedFragmentIndex);
+    auto const now = KeQueryPerformanceCounter(nullptr).QuadPart;
+    if (now - m_verifierWindowStart >= m_verifierWindowLength)
+    {
+        m_verifierWindowStart = now;
+        m_verifierWindowCost = 0;
+    }
 
-            // this won't work because these are valid values.
+    // samples are dropped, not deferred, once the window used its budget
 
-            fragment->ValidLength = ~0U;
-            fragment->Offset = ~0U;
-            if (rxCapabilities.AttachmentMode == NetRxFragmentBufferAttachmentModeDriver)
-            {
-                fragment->Capacity = ~0U;
-            }
-        }
+    return m_verifierWindowCost < m_verifierWindowBudget;
+}
+
+LONGLONG
+NxQueue::QueryVerifierTime(
+    void
+) const
+{
+    return m_privateGlobals.CxVerifierOn ? 0 : KeQueryPerformanceCounter(nullptr).QuadPart;
+}
+
+void
+NxQueue::ChargeVerifierTime(
+    LONGLONG StartTime
+)
+{
+    if (! m_privateGlobals.CxVerifierOn)
+    {
+        m_verifierWindowCost += KeQueryPerformanceCounter(nullptr).QuadPart - StartTime;
     }
+}
 
-    auto vpr = m_verifiedRings[NetRingTypePacket].get();
-    auto vfr = m_verifiedRings[NetRingTypeFragment].get();
+static
+void
+PoisonRxElements(
+    _Inout_ NET_RING * PacketRing,
+    _In_ UINT32 PacketIndex,
+    _Inout_ NET_RING * FragmentRing,
+    _In_ UINT32 FragmentIndex,
+    _In_ NET_ADAPTER_RX_CAPABILITIES const & RxCapabilities
+)
+{
+    // poison fields we expect may be written by the driver
 
-    RtlCopyMemory(
-        vpr,
-        pr,
-        pr->ElementStride * pr->NumberOfElements + FIELD_OFFSET(NET_RING, Buffer[0]));
+    for (; PacketIndex != PacketRing->EndIndex;
+        PacketIndex = NetRingIncrementIndex(PacketRing, PacketIndex))
+    {
+        auto packet = NetRingGetPacketAtIndex(PacketRing, PacketIndex);
 
-    RtlCopyMemory(
-        vfr,
-        fr,
-        fr->ElementStride * fr->NumberOfElements + FIELD_OFFSET(NET_RING, Buffer[0]));
+        packet->FragmentIndex = ~0U;
+        packet->FragmentCount = static_cast<UINT16>(~0U);
+        packet->Layout = { 0x7f, 0x1ff, 0xff, 0xf, 0xf, 0xf };
+    }
 
-    if (m_queueType == Type::Rx)
+    for (; FragmentIndex != FragmentRing->EndIndex;
+        FragmentIndex = NetRingIncrementIndex(FragmentRing, FragmentIndex))
     {
-        // poison fields we expect may be written by the driver
+        auto fragment = NetRingGetFragmentAtIndex(FragmentRing, FragmentIndex);
 
-        for (auto verifiedIndex = vpr->BeginIndex; verifiedIndex != vpr->EndIndex;
-            verifiedIndex = NetRingIncrementIndex(vpr, verifiedIndex))
-        {
-            auto packet = NetRingGetPacketAtIndex(vpr, verifiedIndex);
+        // this won't work because these are valid values.
 
-            packet->FragmentIndex = ~0U;
-            packet->FragmentCount = static_cast<UINT16>(~0U);
-            packet->Layout = { 0x7f, 0x1ff, 0xff, 0xf, 0xf, 0xf };
+        fragment->ValidLength = ~0U;
+        fragment->Offset = ~0U;
+        if (RxCapabilities.AttachmentMode == NetRxFragmentBufferAttachmentModeDriver)
+        {
+            fragment->Capacity = ~0U;
         }
+    }
+}
 
-        auto const rxCapabilities = m_adapter->GetRxCapabilities();
-        for (auto verifiedIndex = vfr->BeginIndex; verifiedIndex != vfr->EndIndex;
-            verifiedIndex = NetRingIncrementIndex(vfr, verifiedIndex))
-        {
-            auto fragment = NetRingGetFragmentAtIndex(vfr, verifiedIndex);
+bool
+NxQueue::AdvancePreVerifying(
+    void
+)
+{
+    if (! ShouldVerify())
+    {
+        m_verifiedRingsCurrent = false;
+        return false;
+    }
+
+    auto const startTime = QueryVerifierTime();
+    auto const pr = NetRingCollectionGetPacketRing(&m_ringCollection);
+    auto const fr = NetRingCollectionGetFragmentRing(&m_ringCollection);
+    auto const vpr = m_verifiedRings[NetRingTypePacket].get();
+    auto const vfr = m_verifiedRings[NetRingTypeFragment].get();
+
+    // the verified rings keep the driver range captured by earlier calls, which
+    // was checked on return from each of them and cannot change while the driver
+    // is not running. only elements posted since the last call need capturing.
+    //
+    // after a call that was not sampled the driver may have modified anything it
+    // owns, so the whole driver range is captured again. elements it was handed
+    // then are only poisoned in the copy, they may hold partial driver writes.
+
+    if (! m_verifiedRingsCurrent)
+    {
+        m_verifiedPacketIndex = pr->BeginIndex;
+        m_verifiedFragmentIndex = fr->BeginIndex;
+    }
+    else if (m_queueType == Type::Rx)
+    {
+        PoisonRxElements(
+            pr,
+            m_verifiedPacketIndex,
+            fr,
+            m_verifiedFragmentIndex,
+            m_adapter->GetRxCapabilities());
+    }
 
-            // this won't work because these are valid values.
+    RtlCopyMemory(vpr, pr, FIELD_OFFSET(NET_RING, Buffer[0]));
+    RtlCopyMemory(vfr, fr, FIELD_OFFSET(NET_RING, Buffer[0]));
 
-            fragment->ValidLength = ~0U;
-            fragment->Offset = ~0U;
-            if (rxCapabilities.AttachmentMode == NetRxFragmentBufferAttachmentModeDriver)
-            {
-                fragment->Capacity = ~0U;
-            }
-        }
+    CopyRingElements(vpr, pr, m_verifiedPacketIndex, pr->EndIndex);
+    CopyRingElements(vfr, fr, m_verifiedFragmentIndex, fr->EndIndex);
+
+    if (! m_verifiedRingsCurrent && m_queueType == Type::Rx)
+    {
+        PoisonRxElements(
+            vpr,
+            m_verifiedPacketIndex,
+            vfr,
+            m_verifiedFragmentIndex,
+            m_adapter->GetRxCapabilities());
     }
+
+    m_verifiedPacketIndex = pr->EndIndex;
+    m_verifiedFragmentIndex = fr->EndIndex;
+    m_verifiedRingsCurrent = true;
+
+    // the framework range is rewritten by the translators between calls, it is
+    // captured again for every call
+
+    CopyRingElements(vpr, pr, pr->EndIndex, NetRingAdvanceIndex(pr, pr->BeginIndex, -1));
+    CopyRingElements(vfr, fr, fr->EndIndex, NetRingAdvanceIndex(fr, fr->BeginIndex, -1));
+
+    ChargeVerifierTime(startTime);
+
+    return true;
 }
 
 void
 NxQueue::AdvancePostVerifying(
     void
-) const
+)
 {
+    auto const startTime = QueryVerifierTime();
     auto const pr = NetRingCollectionGetPacketRing(&m_ringCollection);
     auto const fr = NetRingCollectionGetFragmentRing(&m_ringCollection);
 
@@ -340,6 +444,8 @@ NxQueue::AdvancePostVerifying(
         break;
 
     }
+
+    ChargeVerifierTime(startTime);
 }
 
 void
@@ -347,9 +453,15 @@ NxQueue::AdvanceVerifying(
     void
 )
 {
-    AdvancePreVerifying();
+    auto const verifying = AdvancePreVerifying();
 
-    if (++m_toggle & 1)
+    // Alternating the IRQL is a verifier check as well. Calls that are not
+    // sampled run exactly as they do without the verifier dispatch.
+    if (! verifying && ! m_privateGlobals.CxVerifierOn)
+    {
+        Advance();
+    }
+    else if (++m_toggle & 1)
     {
         KIRQL irql;
         KeRaiseIrql(DISPATCH_LEVEL, &irql);
@@ -361,7 +473,10 @@ NxQueue::AdvanceVerifying(
         Advance();
     }
 
-    AdvancePostVerifying();
+    if (verifying)
+    {
+        AdvancePostVerifying();
+    }
 }
 
 void
@@ -377,14 +492,24 @@ NxQueue::CancelVerifying(
     void
 )
 {
-    AdvancePreVerifying();
+    auto const verifying = AdvancePreVerifying();
 
-    KIRQL irql;
-    KeRaiseIrql(DISPATCH_LEVEL, &irql);
-    Cancel();
-    KeLowerIrql(irql);
+    if (! verifying && ! m_privateGlobals.CxVerifierOn)
+    {
+        Cancel();
+    }
+    else
+    {
+        KIRQL irql;
+        KeRaiseIrql(DISPATCH_LEVEL, &irql);
+        Cancel();
+        KeLowerIrql(irql);
+    }
 
-    AdvancePostVerifying();
+    if (verifying)
+    {
+        AdvancePostVerifying();
+    }
 }
 
 
@@ -425,6 +550,32 @@ NxQueue::Initialize(
     _In_ QUEUE_CREATION_CONTEXT & InitContext
 )
 {
+    if (m_privateGlobals.CxVerifierOn)
+    {
+        m_verifierSampleRate = 1;
+    }
+    else
+    {
+        // outside of driver verifier the ring checks can still run on a sample
+        // of the Advance/Cancel calls, bounded by a share of each second
+
+        m_verifierSampleRate = NetClientQueryDriverConfigurationUlong(VERIFIER_SAMPLE_RATE);
+
+        if (m_verifierSampleRate != 0)
+        {
+            LARGE_INTEGER frequency;
+            KeQueryPerformanceCounter(&frequency);
+
+            m_verifierWindowLength = frequency.QuadPart;
+            m_verifierWindowBudget = frequency.QuadPart
+                * NetClientQueryDriverConfigurationUlong(VERIFIER_CPU_BUDGET) / 1000;
+
+            // stagger the queues so they do not all sample the same round
+
+            m_verifierCalls = m_queueId % m_verifierSampleRate;
+        }
+    }
+
     for (auto const & extension : InitContext.Extensions)
     {
         switch (extension.Type)
@@ -466,7 +617,7 @@ NxQueue::Initialize(
             InitContext.ClientQueueConfig->NumberOfPackets,
             NetRingTypePacket));
 
-    if (m_privateGlobals.CxVerifierOn)
+    if (m_verifierSampleRate != 0)
     {
         *InitContext.AdapterDispatch = &QueueDispatchVerifying;
     }
@@ -606,7 +757,7 @@ NxQueue::CreateRing(
     m_rings[RingType].reset(ring);
     m_ringCollection.Rings[RingType] = m_rings[RingType].get();
 
-    if (m_privateGlobals.CxVerifierOn)
+    if (m_verifierSampleRate != 0)
     {
         ring = reinterpret_cast<NET_RING *>(
             ExAllocatePoolWithTag(NonPagedPoolNxCacheAligned, size, 'BRxN'));
@@ -163,7 +163,22 @@ private:
         _In_ NET_RING_TYPE RingType
     );
 
+    bool
+    ShouldVerify(
+        void
+    );
+
+    LONGLONG
+    QueryVerifierTime(
+        void
+    ) const;
+
     void
+    ChargeVerifierTime(
+        _In_ LONGLONG StartTime
+    );
+
+    bool
     AdvancePreVerifying(
         void
     );
@@ -171,7 +186,7 @@ private:
     void
     AdvancePostVerifying(
         void
-    ) const;
+    );
 
     NX_PRIVATE_GLOBALS const &
         m_privateGlobals;
@@ -191,6 +206,29 @@ private:
     KPoolPtr<NET_RING>
         m_verifiedRings[NetRingTypeFragment + 1];
 
+    bool
+        m_verifiedRingsCurrent = true;
+
+    // 0 disables verification, 1 verifies every call, N verifies 1 in N calls
+
+    ULONG
+        m_verifierSampleRate = 0;
+
+    ULONG
+        m_verifierCalls = 0;
+
+    LONGLONG
+        m_verifierWindowStart = 0;
+
+    LONGLONG
+        m_verifierWindowLength = 0;
+
+    LONGLONG
+        m_verifierWindowBudget = 0;
+
+    LONGLONG
+        m_verifierWindowCost = 0;
+
     NET_RING_COLLECTION
         m_verifiedRingCollection;
 
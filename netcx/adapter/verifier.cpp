@@ -1379,21 +1379,22 @@ Verifier_VerifyRingImmutableFrameworkElements(
 {
     // Rx/Tx NET_{PACKET,FRAGMENT} elements shall not be modified outside driver range
 
-    auto const endIndex = NetRingAdvanceIndex(&Before, Before.BeginIndex, -1);
-    for (auto beginIndex = Before.EndIndex; beginIndex != endIndex;
-        beginIndex = NetRingIncrementIndex(&Before, beginIndex))
+    auto const end = NetRingAdvanceIndex(&Before, Before.BeginIndex, -1);
+
+    for (auto index = Before.EndIndex; index != end; index = NetRingIncrementIndex(&Before, index))
     {
-        auto const elementBefore = NetRingGetElementAtIndex(&Before, beginIndex);
-        auto const elementAfter = NetRingGetElementAtIndex(&After, beginIndex);
+        auto const elementAfter = NetRingGetElementAtIndex(&After, index);
 
-        if (! RtlEqualMemory(elementBefore, elementAfter, Before.ElementStride))
+        if (! RtlEqualMemory(NetRingGetElementAtIndex(&Before, index), elementAfter, Before.ElementStride))
         {
             Verifier_ReportViolation(
                 &PrivateGlobals,
                 VerifierAction_BugcheckAlways,
                 FailureCode_InvalidRingImmutableFrameworkElement,
-                reinterpret_cast<ULONG_PTR>(elementBefore),
-                reinterpret_cast<ULONG_PTR>(elementAfter));
+                reinterpret_cast<ULONG_PTR>(elementAfter),
+                static_cast<ULONG_PTR>(index));
+
+            break;
         }
     }
 }
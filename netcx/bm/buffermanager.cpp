@@ -224,8 +224,6 @@ public:
         _In_ size_t Size,
         _In_ NODE_REQUIREMENT PreferredNode)
     {
-        UNREFERENCED_PARAMETER(PreferredNode);
-
         NT_ASSERT(Size != 0);
 
         wistd::unique_ptr<NxPoolMemoryChunk> memoryChunk =
@@ -236,7 +234,29 @@ public:
             return nullptr;
         }
 
-        memoryChunk->m_VirtualAddress = ExAllocatePoolWithTag(NonPagedPoolNx, Size, BUFFER_MANAGER_POOL_TAG);
+#ifdef _KERNEL_MODE
+        if (PreferredNode != MM_ANY_NODE_OK)
+        {
+            // the node is a preference, pool from any node is better than none
+            POOL_EXTENDED_PARAMETER numaParameter = {};
+            numaParameter.Type = PoolExtendedParameterNumaNode;
+            numaParameter.Optional = TRUE;
+            numaParameter.PreferredNode = PreferredNode;
+
+            memoryChunk->m_VirtualAddress = ExAllocatePool3(
+                POOL_FLAG_NON_PAGED,
+                Size,
+                BUFFER_MANAGER_POOL_TAG,
+                &numaParameter,
+                1);
+        }
+        else
+#else
+        UNREFERENCED_PARAMETER(PreferredNode);
+#endif
+        {
+            memoryChunk->m_VirtualAddress = ExAllocatePoolWithTag(NonPagedPoolNx, Size, BUFFER_MANAGER_POOL_TAG);
+        }
 
         if (memoryChunk->m_VirtualAddress == nullptr)
         {
@@ -250,6 +270,139 @@ public:
     }
 };
 
+#ifdef _KERNEL_MODE
+class PAGED NxContiguousMemoryChunk : public INxMemoryChunk
+{
+    friend class NxLargePageAllocator;
+
+public:
+
+    NxContiguousMemoryChunk() {}
+
+    ~NxContiguousMemoryChunk()
+    {
+        if (m_VirtualAddress)
+        {
+            MmFreeContiguousMemory(m_VirtualAddress);
+            m_VirtualAddress = nullptr;
+        }
+    }
+
+    size_t GetLength() const override
+    {
+        return m_Length;
+    }
+
+    PVOID GetVirtualAddress() const override
+    {
+        return m_VirtualAddress;
+    }
+
+    LOGICAL_ADDRESS
+    GetLogicalAddress(
+        void
+    ) const override
+    {
+        return 0ULL;
+    }
+
+    bool
+    IsLargePageAligned(
+        void
+    ) const override
+    {
+        return m_LargePageAligned;
+    }
+
+private:
+
+    PVOID   m_VirtualAddress = nullptr;
+    size_t  m_Length = 0;
+    bool    m_LargePageAligned = false;
+};
+
+//
+// Backs a pool that fits in a single chunk that is a multiple of the large page size
+// with physically contiguous memory, which the memory manager can map with large pages
+// when the virtual and physical ranges line up. Contiguous memory is scarce and
+// fragments quickly, so it is only used for pools of at most NX_MAX_LARGE_PAGE_CHUNK_SIZE.
+// Everything else comes from non-paged pool as before.
+//
+class PAGED NxLargePageAllocator : public INxMemoryChunkAllocator
+{
+public:
+
+    INxMemoryChunk*
+    AllocateMemoryChunk(
+        _In_ size_t Size,
+        _In_ NODE_REQUIREMENT PreferredNode)
+    {
+        return m_PoolAllocator.AllocateMemoryChunk(Size, PreferredNode);
+    }
+
+    size_t
+    GetLargePageSize(
+        void
+    ) const override
+    {
+        return NX_LARGE_PAGE_SIZE;
+    }
+
+    INxMemoryChunk*
+    AllocateLargePageMemoryChunk(
+        _In_ size_t Size,
+        _In_ NODE_REQUIREMENT PreferredNode) override
+    {
+        if (Size % NX_LARGE_PAGE_SIZE != 0 || Size > NX_MAX_LARGE_PAGE_CHUNK_SIZE)
+        {
+            return nullptr;
+        }
+
+        wistd::unique_ptr<NxContiguousMemoryChunk> memoryChunk =
+            wil::make_unique_nothrow<NxContiguousMemoryChunk>();
+
+        if (!memoryChunk)
+        {
+            return nullptr;
+        }
+
+        PHYSICAL_ADDRESS lowestAcceptableAddress = { 0L, 0L };
+        PHYSICAL_ADDRESS highestAcceptableAddress;
+        highestAcceptableAddress.QuadPart = MAXLONGLONG;
+        PHYSICAL_ADDRESS boundaryAddressMultiple = { 0L, 0L };
+
+        memoryChunk->m_VirtualAddress = MmAllocateContiguousNodeMemory(
+            Size,
+            lowestAcceptableAddress,
+            highestAcceptableAddress,
+            boundaryAddressMultiple,
+            PAGE_READWRITE,
+            PreferredNode);
+
+        if (memoryChunk->m_VirtualAddress == nullptr)
+        {
+            return nullptr;
+        }
+
+        memoryChunk->m_Length = Size;
+        memoryChunk->m_LargePageAligned =
+            IS_ALIGNED((ULONG_PTR) memoryChunk->m_VirtualAddress, NX_LARGE_PAGE_SIZE) &&
+            IS_ALIGNED(MmGetPhysicalAddress(memoryChunk->m_VirtualAddress).QuadPart, NX_LARGE_PAGE_SIZE);
+
+        // a chunk that is not aligned cannot be mapped with large pages, so it is
+        // not worth holding on to contiguous memory for it
+        if (!memoryChunk->m_LargePageAligned)
+        {
+            return nullptr;
+        }
+
+        return memoryChunk.release();
+    }
+
+    NxNonPagePoolAllocator m_PoolAllocator;
+};
+#endif
+
 class PAGED NxDmaDomainAllocator : public INxMemoryChunkAllocator
 {
 
@@ -287,7 +440,11 @@ NxBufferManager::InitializeMemoryChunkAllocator()
         }
         case NET_CLIENT_MEMORY_MAPPING_REQUIREMENT_NONE:
         {
+#ifdef _KERNEL_MODE
+            m_MemoryChunkAllocator = wil::make_unique_nothrow<NxLargePageAllocator>();
+#else
             m_MemoryChunkAllocator = wil::make_unique_nothrow<NxNonPagePoolAllocator>();
+#endif
             break;
         }
         default:
@@ -319,10 +476,28 @@ NxBufferManager::AllocateMemoryChunks(
     LoadValueFromTestHookIfPresent(&numMemoryChunks);
 
     auto chunkSize = MinimumRequestedSize / numMemoryChunks;
+    auto const largePageSize = m_MemoryChunkAllocator->GetLargePageSize();
 
     while (MinimumChunkSize < chunkSize)
     {
-        auto const alignedChunkSize = ALIGN_UP_BY(chunkSize, PAGE_SIZE);
+        // Round chunks up to whole large pages when the allocator can use them, as long
+        // as that grows the chunk by no more than an eighth. The extra space just becomes
+        // more buffers in the pool.
+        size_t chunkAlignment = PAGE_SIZE;
+
+        if (largePageSize != 0 && numMemoryChunks == 1 &&
+            chunkSize >= largePageSize && chunkSize <= NX_MAX_LARGE_PAGE_CHUNK_SIZE)
+        {
+            auto const largePageChunkSize = ALIGN_UP_BY(chunkSize, largePageSize);
+
+            if (largePageChunkSize >= chunkSize &&
+                largePageChunkSize - chunkSize <= chunkSize / 8)
+            {
+                chunkAlignment = largePageSize;
+            }
+        }
+
+        auto const alignedChunkSize = ALIGN_UP_BY(chunkSize, chunkAlignment);
 
         CX_RETURN_NTSTATUS_IF(
             STATUS_INTEGER_OVERFLOW,
@@ -336,8 +511,19 @@ NxBufferManager::AllocateMemoryChunks(
         {
             // memory has already been pre-allocated - there's
             // no reason this append call should fail.
-            NT_FRE_ASSERT(MemoryChunks.append(wistd::unique_ptr<INxMemoryChunk>(
-                m_MemoryChunkAllocator->AllocateMemoryChunk(alignedChunkSize, PreferredNode))));
+            INxMemoryChunk * memoryChunk = nullptr;
+
+            if (chunkAlignment == largePageSize)
+            {
+                memoryChunk = m_MemoryChunkAllocator->AllocateLargePageMemoryChunk(alignedChunkSize, PreferredNode);
+            }
+
+            if (memoryChunk == nullptr)
+            {
+                memoryChunk = m_MemoryChunkAllocator->AllocateMemoryChunk(alignedChunkSize, PreferredNode);
+            }
+
+            NT_FRE_ASSERT(MemoryChunks.append(wistd::unique_ptr<INxMemoryChunk>(memoryChunk)));
 
             if (!MemoryChunks[i])
             {
@@ -363,3 +549,13 @@ NxBufferManager::AllocateMemoryChunks(
     return STATUS_SUCCESS;
 }
 
+INxMemoryChunk *
+NxBufferManager::AllocateMemoryChunk(
+    _In_ size_t Size,
+    _In_ NODE_REQUIREMENT PreferredNode)
+{
+    NT_ASSERT(IS_ALIGNED(Size, PAGE_SIZE));
+
+    return m_MemoryChunkAllocator->AllocateMemoryChunk(Size, PreferredNode);
+}
+
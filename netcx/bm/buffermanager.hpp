@@ -12,6 +12,11 @@ Abstract:
 
 class NxBufferPool;
 
+#define NX_LARGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// largest pool that is placed in physically contiguous memory
+#define NX_MAX_LARGE_PAGE_CHUNK_SIZE (32 * NX_LARGE_PAGE_SIZE)
+
 typedef UINT64 LOGICAL_ADDRESS;
 
 class PAGED INxMemoryChunk :
@@ -45,6 +50,18 @@ public:
         void
         ) const = 0;
 
+    //true if the chunk is physically contiguous and both its virtual and physical
+    //ranges are large page aligned. The memory manager can then map it with large
+    //pages, but does not tell whether it did.
+    virtual
+    bool
+    IsLargePageAligned(
+        void
+        ) const
+    {
+        return false;
+    }
+
 private:
 
     NxBufferPool* m_BufferPool;
@@ -66,6 +83,31 @@ public:
         _In_ NODE_REQUIREMENT PreferredNode
         ) = 0;
 
+    //allocators that can back chunks with large pages return the large page size,
+    //chunk sizes that are a multiple of it are then eligible. 0 means 4K pages only.
+    virtual
+    size_t
+    GetLargePageSize(
+        void
+        ) const
+    {
+        return 0;
+    }
+
+    //only used for a pool that fits in a single chunk of at most
+    //NX_MAX_LARGE_PAGE_CHUNK_SIZE, nullptr if the chunk cannot be placed so it
+    //can be mapped with large pages
+    virtual
+    INxMemoryChunk *
+    AllocateLargePageMemoryChunk(
+        _In_ size_t Size,
+        _In_ NODE_REQUIREMENT PreferredNode
+        )
+    {
+        UNREFERENCED_PARAMETER((Size, PreferredNode));
+        return nullptr;
+    }
+
 };
 
 class PAGED NxBufferManager :
@@ -100,6 +142,13 @@ public:
         _Inout_ Rtl::KArray<wistd::unique_ptr<INxMemoryChunk>> & MemoryChunks
         );
 
+    //single chunk of exactly Size bytes, used to grow an elastic pool
+    INxMemoryChunk *
+    AllocateMemoryChunk(
+        _In_ size_t Size,
+        _In_ NODE_REQUIREMENT PreferredNode
+        );
+
 private:
 
     UINT64
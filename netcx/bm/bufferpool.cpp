@@ -13,11 +13,36 @@ Abstract:
 #include "BufferPool.hpp"
 #include "BufferPool.tmh"
 
-NxBufferPool::NxBufferPool()
+namespace {
+
+    NONPAGED
+    ULONG64
+    QueryInterruptTime(
+        void)
+    {
+#ifdef _KERNEL_MODE
+        return KeQueryInterruptTime();
+#else
+        return GetTickCount64() * 10 * 1000;
+#endif
+    }
+}
+
+NxBufferPool::NxBufferPool() :
+    m_MaintenanceWorkItem(this, &NxBufferPool::Maintain)
 {}
 
 NxBufferPool::~NxBufferPool()
 {
+    if (m_Elastic)
+    {
+        // wait out a segment allocation or free still running in the background,
+        // segment chunks themselves are released with m_Segments
+        m_MaintenanceRundown.CloseAndWait();
+
+        wistd::unique_ptr<INxMemoryChunk> retiredChunk(m_RetiredChunk);
+    }
+
     if (m_StitchedMdl)
     {
         MmUnmapReservedMapping(m_BaseVirtualAddress,
@@ -78,6 +103,64 @@ NxBufferPool::Initialize(
     return STATUS_SUCCESS;
 }
 
+NTSTATUS
+NxBufferPool::EnableGrowth(
+    _Inout_ size_t * MinimumSizeRequested)
+{
+    NT_FRE_ASSERT(m_MemoryChunks.count() == 0);
+
+    //
+    // Segments are sized so that the initial part plus every segment covers the
+    // requested pool size. From here on m_RequestedPoolSize is what the initial
+    // chunks must hold, the rest only ever exists while it is being used.
+    //
+    const size_t segmentBufferCount = (m_RequestedPoolSize + SegmentFraction - 1) / SegmentFraction;
+
+    if (m_RequestedPoolSize <= MaxSegments * segmentBufferCount)
+    {
+        // too small to be worth splitting up, keep it fully populated
+        return STATUS_SUCCESS;
+    }
+
+    m_SegmentBufferCount = segmentBufferCount;
+
+    const size_t initialPoolSize = m_RequestedPoolSize - MaxSegments * m_SegmentBufferCount;
+
+    size_t segmentLength;
+    CX_RETURN_IF_NOT_NT_SUCCESS(RtlSizeTMult(m_SegmentBufferCount, m_StrideSize, &segmentLength));
+    CX_RETURN_IF_NOT_NT_SUCCESS(RtlSizeTAdd(segmentLength, m_ChunkOffset, &segmentLength));
+
+    m_SegmentLength = ALIGN_UP_BY(segmentLength, PAGE_SIZE);
+    CX_RETURN_NTSTATUS_IF(STATUS_INTEGER_OVERFLOW, m_SegmentLength < segmentLength);
+
+    size_t minAllocationSize;
+    CX_RETURN_IF_NOT_NT_SUCCESS(RtlSizeTMult(initialPoolSize, m_StrideSize, &minAllocationSize));
+    CX_RETURN_IF_NOT_NT_SUCCESS(RtlSizeTAdd(minAllocationSize, m_ChunkOffset, &minAllocationSize));
+
+    m_RequestedPoolSize = initialPoolSize;
+    m_Elastic = true;
+    *MinimumSizeRequested = minAllocationSize;
+
+    return STATUS_SUCCESS;
+}
+
+bool
+NxBufferPool::IsElastic() const
+{
+    return m_Elastic;
+}
+
+void
+NxBufferPool::SetBufferManager(
+    _In_ wistd::unique_ptr<NxBufferManager> BufferManager,
+    _In_ NODE_REQUIREMENT PreferredNode)
+{
+    NT_FRE_ASSERT(m_Elastic);
+
+    m_BufferManager = wistd::move(BufferManager);
+    m_PreferredNode = PreferredNode;
+}
+
 NONPAGED
 size_t
 NxBufferPool::AvailableBuffersCount()
@@ -196,12 +279,26 @@ NxBufferPool::AddMemoryChunks(
     m_NumMemoryChunks = numMemoryChunks;
     m_MemoryChunkSize = memoryChunkSize;
     m_NumBuffersPerChunk = numBuffersPerChunk;
+    m_InitialPoolSize = newPoolSize;
+
+    //
+    // Descriptors and in-use flags for every segment are set aside now, segments
+    // are adopted and retired at dispatch level where nothing can be allocated
+    //
+    size_t maximumPoolSize = newPoolSize;
+
+    if (m_Elastic)
+    {
+        CX_RETURN_IF_NOT_NT_SUCCESS(RtlSizeTAdd(newPoolSize,
+                                                MaxSegments * m_SegmentBufferCount,
+                                                &maximumPoolSize));
+    }
 
     CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES,
-                          !m_Buffers.reserve(newPoolSize));
+                          !m_Buffers.resize(maximumPoolSize));
 
     CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES,
-                          !m_BuffersInUseFlag.Initialize(newPoolSize));
+                          !m_BuffersInUseFlag.Initialize(maximumPoolSize));
 
     CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES,
                           !m_MemoryChunks.reserve(m_NumMemoryChunks));
@@ -214,9 +311,41 @@ NxBufferPool::AddMemoryChunks(
 
     NT_FRE_ASSERT(m_PopulatedPoolSize == newPoolSize);
 
+    ReportPageCoverage();
+
     return STATUS_SUCCESS;
 }
 
+void
+NxBufferPool::ReportPageCoverage()
+{
+    //
+    // A single chunk is used through its own mapping, so it keeps whatever page size
+    // the memory manager picked for it. Stitched chunks are reached through a reserved
+    // mapping built from 4K PTEs, which gives up any large pages the chunks had.
+    //
+    // The page size of a mapping cannot be queried, so only the length that is eligible
+    // for large pages is reported, not how much of it actually got them.
+    //
+    m_LargePageAlignedLength = 0;
+
+    if (m_NumMemoryChunks == 1 && m_MemoryChunks[0]->IsLargePageAligned())
+    {
+        m_LargePageAlignedLength = m_MemoryChunkSize;
+    }
+
+    TraceLoggingWrite(
+        g_hNetAdapterCxEtwProvider,
+        "NxBufferPoolPageCoverage",
+        TraceLoggingDescription("Length of a buffer pool that is eligible for large pages"),
+        TraceLoggingPointer(this, "BufferPool"),
+        TraceLoggingUInt64(m_PopulatedPoolSize, "BufferCount"),
+        TraceLoggingUInt64(m_NumMemoryChunks, "MemoryChunks"),
+        TraceLoggingUInt64(m_MemoryChunkSize, "MemoryChunkSize"),
+        TraceLoggingUInt64(m_ContiguousVirtualLength, "VirtualLength"),
+        TraceLoggingUInt64(m_LargePageAlignedLength, "LargePageAlignedLength"));
+}
+
 void
 NxBufferPool::FillBufferPool()
 {
@@ -238,7 +367,7 @@ NxBufferPool::FillBufferPool()
             buffer.LogicalAddress =
                 m_MemoryChunkBaseAddresses[chunkIndex].LogicalAddress + bufferOffset;
 
-            m_Buffers.append(buffer);
+            m_Buffers[m_PopulatedPoolSize] = buffer;
 
             m_PopulatedPoolSize++;
         }
@@ -252,6 +381,11 @@ NxBufferPool::Allocate(_Out_ void ** VirtualAddress,
                        _Out_ SIZE_T * Offset,
                        _Out_ SIZE_T * AllocatedSize)
 {
+    if (m_Elastic)
+    {
+        GrowIfLow();
+    }
+
     CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES,
                           m_NumBuffersInUse >= m_PopulatedPoolSize);
 
@@ -260,6 +394,8 @@ NxBufferPool::Allocate(_Out_ void ** VirtualAddress,
     NT_FRE_ASSERT(!m_BuffersInUseFlag.TestBit(bufferIndex));
     m_BuffersInUseFlag.SetBit(bufferIndex);
 
+    OnBufferAllocated(m_Buffers[m_NumBuffersInUse]);
+
     *VirtualAddress = m_Buffers[m_NumBuffersInUse].VirtualAddress;
     *LogicalAddress = m_Buffers[m_NumBuffersInUse].LogicalAddress;
     *Offset = m_AlignmentOffset;
@@ -274,35 +410,472 @@ NONPAGED
 VOID
 NxBufferPool::Free(_In_ PVOID VirtualAddress)
 {
+    NT_FRE_ASSERT(m_NumBuffersInUse > 0);
+
+    auto &buffer = m_Buffers[--m_NumBuffersInUse];
 
+    InitializeDescriptor(buffer, VirtualAddress);
 
+    NT_FRE_ASSERT(m_BuffersInUseFlag.TestBit(buffer.BufferIndex));
+    m_BuffersInUseFlag.ClearBit(buffer.BufferIndex);
 
+    OnBufferFreed(buffer);
 
+    if (m_Elastic)
+    {
+        ShrinkIfIdle();
+    }
+}
 
-    NT_FRE_ASSERT(m_NumBuffersInUse > 0);
+NONPAGED
+size_t
+NxBufferPool::AllocateBatch(
+    _In_ size_t Count,
+    _Out_writes_to_(Count, return) void ** VirtualAddresses,
+    _Out_writes_to_(Count, return) LOGICAL_ADDRESS * LogicalAddresses,
+    _Out_ SIZE_T * Offset,
+    _Out_ SIZE_T * AllocatedSize)
+{
+    *Offset = m_AlignmentOffset;
+    *AllocatedSize = m_StrideSize;
 
-    NT_FRE_ASSERT(VirtualAddress >= m_BaseVirtualAddress);
+    if (m_Elastic && Count > 0)
+    {
+        GrowIfLow();
+    }
 
-    size_t offsetFromBaseVa = ((size_t) VirtualAddress) - ((size_t) m_BaseVirtualAddress);
+    const size_t numBuffers = min(Count, AvailableBuffersCount());
 
-    NT_FRE_ASSERT(offsetFromBaseVa < m_ContiguousVirtualLength);
+    //
+    // Take a run off the top of the descriptor stack. Buffers that were never
+    // handed out sit in index order, so consecutive descriptors usually share
+    // a bitmap word and the in-use flags can be updated a word at a time.
+    //
+    size_t wordIndex = 0;
+    SIZE_T wordMask = 0;
 
-    auto &buffer = m_Buffers[--m_NumBuffersInUse];
+    for (size_t i = 0; i < numBuffers; i++)
+    {
+        auto const &buffer = m_Buffers[m_NumBuffersInUse + i];
+
+        VirtualAddresses[i] = buffer.VirtualAddress;
+        LogicalAddresses[i] = buffer.LogicalAddress;
+
+        OnBufferAllocated(buffer);
+
+        const size_t bufferWordIndex = buffer.BufferIndex / Rtl::KBitmap::BitsPerWord;
+        const SIZE_T bufferMask = SIZE_T(1) << (buffer.BufferIndex % Rtl::KBitmap::BitsPerWord);
+
+        if (wordMask != 0 && bufferWordIndex != wordIndex)
+        {
+            NT_FRE_ASSERT((m_BuffersInUseFlag.GetWord(wordIndex) & wordMask) == 0);
+            m_BuffersInUseFlag.SetWordBits(wordIndex, wordMask);
+            wordMask = 0;
+        }
+
+        NT_FRE_ASSERT((wordMask & bufferMask) == 0);
+
+        wordIndex = bufferWordIndex;
+        wordMask |= bufferMask;
+    }
+
+    if (wordMask != 0)
+    {
+        NT_FRE_ASSERT((m_BuffersInUseFlag.GetWord(wordIndex) & wordMask) == 0);
+        m_BuffersInUseFlag.SetWordBits(wordIndex, wordMask);
+    }
+
+    m_NumBuffersInUse += numBuffers;
+
+    return numBuffers;
+}
+
+NONPAGED
+VOID
+NxBufferPool::FreeBatch(
+    _In_reads_(Count) PVOID const * VirtualAddresses,
+    _In_ size_t Count)
+{
+    NT_FRE_ASSERT(m_NumBuffersInUse >= Count);
+
+    m_NumBuffersInUse -= Count;
+
+    size_t wordIndex = 0;
+    SIZE_T wordMask = 0;
+
+    for (size_t i = 0; i < Count; i++)
+    {
+        auto &buffer = m_Buffers[m_NumBuffersInUse + i];
+
+        InitializeDescriptor(buffer, VirtualAddresses[i]);
+
+        OnBufferFreed(buffer);
+
+        const size_t bufferWordIndex = buffer.BufferIndex / Rtl::KBitmap::BitsPerWord;
+        const SIZE_T bufferMask = SIZE_T(1) << (buffer.BufferIndex % Rtl::KBitmap::BitsPerWord);
+
+        if (wordMask != 0 && bufferWordIndex != wordIndex)
+        {
+            NT_FRE_ASSERT((m_BuffersInUseFlag.GetWord(wordIndex) & wordMask) == wordMask);
+            m_BuffersInUseFlag.ClearWordBits(wordIndex, wordMask);
+            wordMask = 0;
+        }
+
+        // the same buffer must not be freed twice in one batch
+        NT_FRE_ASSERT((wordMask & bufferMask) == 0);
+
+        wordIndex = bufferWordIndex;
+        wordMask |= bufferMask;
+    }
+
+    if (wordMask != 0)
+    {
+        NT_FRE_ASSERT((m_BuffersInUseFlag.GetWord(wordIndex) & wordMask) == wordMask);
+        m_BuffersInUseFlag.ClearWordBits(wordIndex, wordMask);
+    }
+
+    if (m_Elastic && Count > 0)
+    {
+        ShrinkIfIdle();
+    }
+}
+
+NONPAGED
+LOGICAL_ADDRESS
+NxBufferPool::GetLogicalAddress(
+    _In_ PVOID VirtualAddress)
+{
+    NxBufferDescriptor buffer;
+
+    InitializeDescriptor(buffer, VirtualAddress);
+
+    return buffer.LogicalAddress;
+}
 
-    buffer.VirtualAddress = VirtualAddress;
-    buffer.ChunkIndex = offsetFromBaseVa / m_MemoryChunkSize;
+NONPAGED
+void
+NxBufferPool::InitializeDescriptor(
+    _Inout_ NxBufferDescriptor & Buffer,
+    _In_ PVOID VirtualAddress)
+{
+    size_t offsetFromBaseVa = ((size_t) VirtualAddress) - ((size_t) m_BaseVirtualAddress);
 
-    size_t offsetFromChunk = offsetFromBaseVa - (buffer.ChunkIndex * m_MemoryChunkSize);
+    if (offsetFromBaseVa >= m_ContiguousVirtualLength)
+    {
+        InitializeSegmentDescriptor(Buffer, VirtualAddress);
+        return;
+    }
+
+    Buffer.VirtualAddress = VirtualAddress;
+    Buffer.ChunkIndex = offsetFromBaseVa / m_MemoryChunkSize;
 
-    buffer.LogicalAddress =
-        m_MemoryChunkBaseAddresses[buffer.ChunkIndex].LogicalAddress + offsetFromChunk;
+    size_t offsetFromChunk = offsetFromBaseVa - (Buffer.ChunkIndex * m_MemoryChunkSize);
 
-    buffer.BufferIndex =
-        buffer.ChunkIndex * m_NumBuffersPerChunk +
+    Buffer.LogicalAddress =
+        m_MemoryChunkBaseAddresses[Buffer.ChunkIndex].LogicalAddress + offsetFromChunk;
+
+    Buffer.BufferIndex =
+        Buffer.ChunkIndex * m_NumBuffersPerChunk +
         (offsetFromChunk - m_ChunkOffset) / m_StrideSize;
+}
 
 
-    NT_FRE_ASSERT(m_BuffersInUseFlag.TestBit(buffer.BufferIndex));
-    m_BuffersInUseFlag.ClearBit(buffer.BufferIndex);
+NONPAGED
+bool
+NxBufferPool::ContainsAddress(
+    _In_ PVOID VirtualAddress)
+{
+    size_t offsetFromBaseVa = ((size_t) VirtualAddress) - ((size_t) m_BaseVirtualAddress);
+
+    if (offsetFromBaseVa < m_ContiguousVirtualLength)
+    {
+        return true;
+    }
+
+    for (size_t i = 0; i < MaxSegments; i++)
+    {
+        auto const & segment = m_Segments[i];
+        auto const offsetFromSegment = ((size_t) VirtualAddress) - ((size_t) segment.VirtualAddress);
+
+        if (offsetFromSegment < ReadULongPtrAcquire(&segment.Length))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+NONPAGED
+void
+NxBufferPool::InitializeSegmentDescriptor(
+    _Inout_ NxBufferDescriptor & Buffer,
+    _In_ PVOID VirtualAddress)
+{
+    //
+    // Segments are separate allocations outside the stitched range. There are at
+    // most MaxSegments of them, so the lookup stays bounded no matter how large
+    // the pool is.
+    //
+    for (size_t i = 0; i < MaxSegments; i++)
+    {
+        auto const & segment = m_Segments[i];
+        auto const length = ReadULongPtrAcquire(&segment.Length);
+        auto const offsetFromSegment = ((size_t) VirtualAddress) - ((size_t) segment.VirtualAddress);
+
+        if (offsetFromSegment < length)
+        {
+            Buffer.VirtualAddress = VirtualAddress;
+            Buffer.ChunkIndex = m_NumMemoryChunks + i;
+            Buffer.LogicalAddress = segment.LogicalAddress + offsetFromSegment;
+            Buffer.BufferIndex =
+                m_InitialPoolSize + i * m_SegmentBufferCount +
+                (offsetFromSegment - m_ChunkOffset) / m_StrideSize;
+
+            return;
+        }
+    }
+
+    NT_FRE_ASSERT(!"Buffer does not belong to the pool");
+}
+
+NONPAGED
+void
+NxBufferPool::OnBufferAllocated(
+    _In_ NxBufferDescriptor const & Buffer)
+{
+    if (Buffer.ChunkIndex < m_NumMemoryChunks)
+    {
+        return;
+    }
+
+    auto & segment = m_Segments[Buffer.ChunkIndex - m_NumMemoryChunks];
+
+    if (segment.BuffersInUse++ == 0)
+    {
+        segment.IdleSince = 0;
+    }
+}
+
+NONPAGED
+void
+NxBufferPool::OnBufferFreed(
+    _In_ NxBufferDescriptor const & Buffer)
+{
+    if (Buffer.ChunkIndex < m_NumMemoryChunks)
+    {
+        return;
+    }
+
+    auto & segment = m_Segments[Buffer.ChunkIndex - m_NumMemoryChunks];
+
+    NT_FRE_ASSERT(segment.BuffersInUse > 0);
+    segment.BuffersInUse--;
+}
+
+NONPAGED
+void
+NxBufferPool::GrowIfLow()
+{
+    auto const state = ReadAcquire(&m_GrowthState);
+
+    if (state == GrowthReady)
+    {
+        AdoptSegment();
+    }
+    else if (state == GrowthFailed)
+    {
+        // back off for a cool-down before asking for memory again
+        auto const now = QueryInterruptTime();
+
+        if (m_GrowthFailedTime == 0)
+        {
+            m_GrowthFailedTime = now;
+        }
+        else if (now - m_GrowthFailedTime >= SegmentCoolDown)
+        {
+            m_GrowthFailedTime = 0;
+            InterlockedExchange(&m_GrowthState, GrowthIdle);
+        }
+
+        return;
+    }
+    else if (state != GrowthIdle)
+    {
+        return;
+    }
+
+    // start growing while half a segment is still left, so the new buffers
+    // usually land before the pool runs dry
+    if (AvailableBuffersCount() >= m_SegmentBufferCount / 2 + 1 ||
+        m_ActiveSegments == MaxSegments)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < MaxSegments; i++)
+    {
+        if (!m_Segments[i].Chunk)
+        {
+            m_GrowthSegmentIndex = i;
+            InterlockedExchange(&m_GrowthState, GrowthRequested);
+            QueueMaintenance();
+            return;
+        }
+    }
 }
 
+NONPAGED
+void
+NxBufferPool::ShrinkIfIdle()
+{
+    if (m_ActiveSegments == 0 ||
+        ReadPointerAcquire((PVOID volatile *) &m_RetiredChunk) != nullptr)
+    {
+        return;
+    }
+
+    // keep enough free buffers after the shrink that it does not trigger growth
+    if (AvailableBuffersCount() < m_SegmentBufferCount * 2)
+    {
+        return;
+    }
+
+    auto const now = QueryInterruptTime();
+
+    for (size_t i = 0; i < MaxSegments; i++)
+    {
+        auto & segment = m_Segments[i];
+
+        if (segment.Length == 0 || segment.BuffersInUse != 0)
+        {
+            continue;
+        }
+
+        if (segment.IdleSince == 0)
+        {
+            segment.IdleSince = now;
+        }
+        else if (now - segment.IdleSince >= SegmentCoolDown)
+        {
+            RetireSegment(i);
+            return;
+        }
+    }
+}
+
+NONPAGED
+void
+NxBufferPool::AdoptSegment()
+{
+    auto & segment = m_Segments[m_GrowthSegmentIndex];
+    auto const chunkIndex = m_NumMemoryChunks + m_GrowthSegmentIndex;
+    auto const firstBufferIndex = m_InitialPoolSize + m_GrowthSegmentIndex * m_SegmentBufferCount;
+
+    //
+    // New descriptors go to the far end of the free part of the stack, so buffers
+    // already in the pool are reused first and the segment can drain again once
+    // demand drops
+    //
+    for (size_t i = 0; i < m_SegmentBufferCount; i++)
+    {
+        const size_t bufferOffset = m_ChunkOffset + i * m_StrideSize;
+
+        m_Buffers[m_PopulatedPoolSize] =
+        {
+            (PVOID) (((ULONG_PTR) segment.VirtualAddress) + bufferOffset),
+            segment.LogicalAddress + bufferOffset,
+            chunkIndex,
+            firstBufferIndex + i,
+            nullptr
+        };
+
+        m_PopulatedPoolSize++;
+    }
+
+    segment.BuffersInUse = 0;
+    segment.IdleSince = 0;
+    WriteULongPtrRelease(&segment.Length, m_SegmentLength);
+
+    m_ActiveSegments++;
+
+    InterlockedExchange(&m_GrowthState, GrowthIdle);
+}
+
+NONPAGED
+void
+NxBufferPool::RetireSegment(
+    _In_ size_t SegmentIndex)
+{
+    auto & segment = m_Segments[SegmentIndex];
+    auto const chunkIndex = m_NumMemoryChunks + SegmentIndex;
+
+    // pull the segment's descriptors out of the free part of the stack
+    size_t populated = m_NumBuffersInUse;
+
+    for (size_t i = m_NumBuffersInUse; i < m_PopulatedPoolSize; i++)
+    {
+        if (m_Buffers[i].ChunkIndex != chunkIndex)
+        {
+            m_Buffers[populated++] = m_Buffers[i];
+        }
+    }
+
+    NT_FRE_ASSERT(m_PopulatedPoolSize - populated == m_SegmentBufferCount);
+    m_PopulatedPoolSize = populated;
+
+    WriteULongPtrRelease(&segment.Length, 0);
+    m_ActiveSegments--;
+
+    // the chunk may only be freed at passive level, the work item takes it from here
+    InterlockedExchangePointer((PVOID volatile *) &m_RetiredChunk, segment.Chunk.release());
+    QueueMaintenance();
+}
+
+NONPAGED
+void
+NxBufferPool::QueueMaintenance()
+{
+    if (!m_MaintenanceRundown.TryAcquire())
+    {
+        return;
+    }
+
+    // a work item that is already queued holds its own reference
+    if (!m_MaintenanceWorkItem.Queue())
+    {
+        m_MaintenanceRundown.Release();
+    }
+}
+
+_Use_decl_annotations_
+void
+NxBufferPool::Maintain()
+{
+    wistd::unique_ptr<INxMemoryChunk> retiredChunk(
+        static_cast<INxMemoryChunk *>(
+            InterlockedExchangePointer((PVOID volatile *) &m_RetiredChunk, nullptr)));
+
+    retiredChunk.reset();
+
+    if (ReadAcquire(&m_GrowthState) == GrowthRequested)
+    {
+        auto & segment = m_Segments[m_GrowthSegmentIndex];
+
+        segment.Chunk.reset(m_BufferManager->AllocateMemoryChunk(m_SegmentLength, m_PreferredNode));
+
+        if (segment.Chunk)
+        {
+            segment.VirtualAddress = segment.Chunk->GetVirtualAddress();
+            segment.LogicalAddress = segment.Chunk->GetLogicalAddress();
+
+            InterlockedExchange(&m_GrowthState, GrowthReady);
+        }
+        else
+        {
+            InterlockedExchange(&m_GrowthState, GrowthFailed);
+        }
+    }
+
+    m_MaintenanceRundown.Release();
+}
@@ -6,11 +6,17 @@ Abstract:
 
     This is the definition of the NxBufferPool object.
 
+    A pool is normally populated once with enough buffers for the worst case.
+    An elastic pool starts with part of that and adds fixed size segments in
+    the background as it runs low, returning segments that stay idle.
+
 --*/
 
 #pragma once
 
 #include "KBitmap.h"
+#include "KRundown.h"
+#include "KWorkItem.h"
 #include "Mdl.hpp"
 
 class PAGED NxBufferPool :
@@ -37,11 +43,30 @@ public:
         _Out_ size_t * MinimumChunkSize
         );
 
+    //must be called between Initialize and AddMemoryChunks, shrinks the
+    //memory needed up front to the initial part of the pool
+    NTSTATUS
+    EnableGrowth(
+        _Inout_ size_t * MinimumSizeRequested
+        );
+
     NTSTATUS
     AddMemoryChunks(
         _In_ Rtl::KArray<wistd::unique_ptr<INxMemoryChunk>>& MemoryChunks
         );
 
+    bool
+    IsElastic(
+        void
+        ) const;
+
+    //hands an elastic pool the buffer manager it allocates segments from
+    void
+    SetBufferManager(
+        _In_ wistd::unique_ptr<NxBufferManager> BufferManager,
+        _In_ NODE_REQUIREMENT PreferredNode
+        );
+
     NONPAGED
     NTSTATUS
     Allocate(
@@ -57,14 +82,78 @@ public:
         _In_ PVOID VirtualAddress
         );
 
+    NONPAGED
+    size_t
+    AllocateBatch(
+        _In_ size_t Count,
+        _Out_writes_to_(Count, return) void ** VirtualAddresses,
+        _Out_writes_to_(Count, return) LOGICAL_ADDRESS * LogicalAddresses,
+        _Out_ SIZE_T * Offset,
+        _Out_ SIZE_T * AllocatedSize
+        );
+
+    NONPAGED
+    VOID
+    FreeBatch(
+        _In_reads_(Count) PVOID const * VirtualAddresses,
+        _In_ size_t Count
+        );
+
+    NONPAGED
+    LOGICAL_ADDRESS
+    GetLogicalAddress(
+        _In_ PVOID VirtualAddress
+        );
+
     NONPAGED
     size_t
     AvailableBuffersCount(
         void
         );
 
+    NONPAGED
+    bool
+    ContainsAddress(
+        _In_ PVOID VirtualAddress
+        );
+
 private:
 
+    //an elastic pool starts with 1/InitialPoolFraction of the requested buffers
+    //and grows by 1/SegmentFraction at a time, up to the requested size
+    static constexpr size_t
+        InitialPoolFraction = 4;
+
+    static constexpr size_t
+        SegmentFraction = 8;
+
+    static constexpr size_t
+        MaxSegments = SegmentFraction - SegmentFraction / InitialPoolFraction;
+
+    //how long a segment must go unused before it is returned, in 100ns units
+    static constexpr ULONG64
+        SegmentCoolDown = 5 * 1000 * 1000 * 10;
+
+    enum GrowthState : LONG
+    {
+        GrowthIdle,
+        GrowthRequested,
+        GrowthReady,
+        GrowthFailed,
+    };
+
+    struct NxBufferSegment
+    {
+        wistd::unique_ptr<INxMemoryChunk> Chunk;
+        PVOID VirtualAddress;
+        LOGICAL_ADDRESS LogicalAddress;
+        //0 while the segment is not part of the pool. Read without the
+        //owner's serialization by GetLogicalAddress, so it is published last.
+        ULONG_PTR Length;
+        size_t BuffersInUse;
+        ULONG64 IdleSince;
+    };
+
     UINT64
         m_Id = 0;
 
@@ -121,6 +210,54 @@ private:
     size_t
         m_NumBuffersInUse = 0;
 
+    //bytes of the pool's virtual range that are eligible for large pages, see
+    //INxMemoryChunk::IsLargePageAligned
+    size_t
+        m_LargePageAlignedLength = 0;
+
+    bool
+        m_Elastic = false;
+
+    //buffers in the chunks handed to AddMemoryChunks, segments come after them
+    size_t
+        m_InitialPoolSize = 0;
+
+    size_t
+        m_SegmentBufferCount = 0;
+
+    size_t
+        m_SegmentLength = 0;
+
+    size_t
+        m_ActiveSegments = 0;
+
+    NxBufferSegment
+        m_Segments[MaxSegments] = {};
+
+    size_t
+        m_GrowthSegmentIndex = 0;
+
+    LONG volatile
+        m_GrowthState = GrowthIdle;
+
+    ULONG64
+        m_GrowthFailedTime = 0;
+
+    INxMemoryChunk * volatile
+        m_RetiredChunk = nullptr;
+
+    wistd::unique_ptr<NxBufferManager>
+        m_BufferManager;
+
+    NODE_REQUIREMENT
+        m_PreferredNode = MM_ANY_NODE_OK;
+
+    KCoalescingWorkItem<NxBufferPool>
+        m_MaintenanceWorkItem;
+
+    KRundown
+        m_MaintenanceRundown;
+
     struct NxBufferDescriptor
     {
         PVOID VirtualAddress;
@@ -141,7 +278,62 @@ private:
     NTSTATUS
         StitchMemoryChunks();
 
+    NONPAGED
+    void
+        InitializeDescriptor(
+            _Inout_ NxBufferDescriptor & Buffer,
+            _In_ PVOID VirtualAddress
+            );
+
     void
         FillBufferPool();
+
+    void
+        ReportPageCoverage();
+
+    NONPAGED
+    void
+        InitializeSegmentDescriptor(
+            _Inout_ NxBufferDescriptor & Buffer,
+            _In_ PVOID VirtualAddress
+            );
+
+    NONPAGED
+    void
+        OnBufferAllocated(
+            _In_ NxBufferDescriptor const & Buffer
+            );
+
+    NONPAGED
+    void
+        OnBufferFreed(
+            _In_ NxBufferDescriptor const & Buffer
+            );
+
+    NONPAGED
+    void
+        GrowIfLow();
+
+    NONPAGED
+    void
+        ShrinkIfIdle();
+
+    NONPAGED
+    void
+        AdoptSegment();
+
+    NONPAGED
+    void
+        RetireSegment(
+            _In_ size_t SegmentIndex
+            );
+
+    NONPAGED
+    void
+        QueueMaintenance();
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    void
+        Maintain();
 };
 
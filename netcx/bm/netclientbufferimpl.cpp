@@ -12,6 +12,8 @@ Abstract:
 #include "BmPrecomp.hpp"
 #include "BufferManager.hpp"
 #include "BufferPool.hpp"
+#include "SerializedBufferPool.hpp"
+#include "SlabBufferPool.hpp"
 #include "KPtr.h"
 
 #include <net/fragment.h>
@@ -21,6 +23,66 @@ Abstract:
 #define IS_ALIGNED(x, align)     (((x) & ((align) - 1)) == 0)
 #define IS_POWER_OF_TWO(x)       IS_ALIGNED(x, x)
 
+namespace {
+
+    PAGEDX
+    _IRQL_requires_(PASSIVE_LEVEL)
+    NTSTATUS
+    CreatePool(
+        _In_ NET_CLIENT_BUFFER_POOL_CONFIG const * BufferPoolConfig,
+        _In_ size_t BufferCount,
+        _In_ size_t BufferSize,
+        _Out_ KPtr<NxBufferPool> & Pool
+        )
+    {
+        wistd::unique_ptr<NxBufferManager> bufferManager = wil::make_unique_nothrow<NxBufferManager>();
+
+        CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES, !bufferManager);
+
+        CX_RETURN_IF_NOT_NT_SUCCESS(bufferManager->AddMemoryConstraints(BufferPoolConfig->MemoryConstraints));
+
+        CX_RETURN_IF_NOT_NT_SUCCESS(bufferManager->InitializeMemoryChunkAllocator());
+
+        KPtr<NxBufferPool> pool;
+        pool.reset(new (std::nothrow) NxBufferPool());
+        CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES, !pool.get());
+
+        size_t requestedTotalSize = 0;
+        size_t minimumChunkSize = 0;
+        size_t combinedAlignmentRequirement =
+            max(BufferPoolConfig->MemoryConstraints->AlignmentRequirement, BufferPoolConfig->BufferAlignment);
+
+        CX_RETURN_IF_NOT_NT_SUCCESS(pool->Initialize(BufferCount,
+                                                     BufferSize,
+                                                     BufferPoolConfig->BufferAlignmentOffset,
+                                                     combinedAlignmentRequirement,
+                                                     &requestedTotalSize,
+                                                     &minimumChunkSize));
+
+        if (BufferPoolConfig->Flag & NET_CLIENT_BUFFER_POOL_FLAGS_ELASTIC)
+        {
+            CX_RETURN_IF_NOT_NT_SUCCESS(pool->EnableGrowth(&requestedTotalSize));
+        }
+
+        Rtl::KArray<wistd::unique_ptr<INxMemoryChunk>> memoryChunks;
+        CX_RETURN_IF_NOT_NT_SUCCESS(bufferManager->AllocateMemoryChunks(requestedTotalSize,
+                                                                        minimumChunkSize,
+                                                                        BufferPoolConfig->PreferredNode,
+                                                                        memoryChunks));
+
+        CX_RETURN_IF_NOT_NT_SUCCESS(pool->AddMemoryChunks(memoryChunks));
+
+        if (pool->IsElastic())
+        {
+            pool->SetBufferManager(wistd::move(bufferManager), BufferPoolConfig->PreferredNode);
+        }
+
+        Pool = wistd::move(pool);
+
+        return STATUS_SUCCESS;
+    }
+}
+
 EXTERN_C_START
 
 //delete buffer pool also frees the memory chunks
@@ -76,11 +138,34 @@ NetClientFreeBuffers(
 {
     NxBufferPool* pool = reinterpret_cast<NxBufferPool *> (BufferPool);
 
-    for (UINT32 i = 0; i < NumBuffers; i++)
-    {
-        pool->Free(Buffers[i]);
-        Buffers[i] = nullptr;
-    }
+    pool->FreeBatch(Buffers, NumBuffers);
+
+    RtlZeroMemory(Buffers, NumBuffers * sizeof(PVOID));
+}
+
+NONPAGEDX
+_IRQL_requires_min_(PASSIVE_LEVEL)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_IRQL_requires_same_
+ULONG
+NetClientAllocateBuffers(
+    _In_ NET_CLIENT_BUFFER_POOL BufferPool,
+    _In_ ULONG NumBuffers,
+    _Out_writes_to_(NumBuffers, return) void ** VirtualAddresses,
+    _Out_writes_to_(NumBuffers, return) UINT64 * LogicalAddresses,
+    _Out_ SIZE_T * Offset,
+    _Out_ SIZE_T * Capacity
+)
+{
+    auto pool = reinterpret_cast<NxBufferPool *>(BufferPool);
+
+    return static_cast<ULONG>(
+        pool->AllocateBatch(
+            NumBuffers,
+            VirtualAddresses,
+            LogicalAddresses,
+            Offset,
+            Capacity));
 }
 
 static const NET_CLIENT_BUFFER_POOL_DISPATCH PoolDispatch =
@@ -89,6 +174,218 @@ static const NET_CLIENT_BUFFER_POOL_DISPATCH PoolDispatch =
     &NetClientDestroyBufferPool,
     &NetClientAllocateBuffer,
     &NetClientFreeBuffers,
+    &NetClientAllocateBuffers,
+};
+
+PAGEDX
+_IRQL_requires_(PASSIVE_LEVEL)
+_IRQL_requires_same_
+VOID
+NetClientDestroySerializedBufferPool(
+    _In_ NET_CLIENT_BUFFER_POOL BufferPool
+    )
+{
+    PAGED_CODE();
+
+    NxSerializedBufferPool* pool = reinterpret_cast<NxSerializedBufferPool *> (BufferPool);
+    delete pool;
+}
+
+NONPAGEDX
+_IRQL_requires_min_(PASSIVE_LEVEL)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_IRQL_requires_same_
+NTSTATUS
+NetClientAllocateSerializedBuffer(
+    _In_ NET_CLIENT_BUFFER_POOL BufferPool,
+    _Out_ void ** VirtualAddress,
+    _Out_ UINT64 * LogicalAddress,
+    _Out_ SIZE_T * Offset,
+    _Out_ SIZE_T * Capacity
+)
+{
+    auto pool = reinterpret_cast<NxSerializedBufferPool *>(BufferPool);
+
+    CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES,
+                          pool->AllocateBatch(
+                              1,
+                              VirtualAddress,
+                              LogicalAddress,
+                              Offset,
+                              Capacity) == 0);
+
+    return STATUS_SUCCESS;
+}
+
+NONPAGEDX
+_IRQL_requires_min_(PASSIVE_LEVEL)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_IRQL_requires_same_
+VOID
+NetClientFreeSerializedBuffers(
+    _In_ NET_CLIENT_BUFFER_POOL BufferPool,
+    _Inout_updates_(NumBuffers) PVOID * Buffers,
+    _In_ ULONG NumBuffers)
+{
+    auto pool = reinterpret_cast<NxSerializedBufferPool *>(BufferPool);
+
+    pool->FreeBatch(Buffers, NumBuffers);
+
+    RtlZeroMemory(Buffers, NumBuffers * sizeof(PVOID));
+}
+
+NONPAGEDX
+_IRQL_requires_min_(PASSIVE_LEVEL)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_IRQL_requires_same_
+ULONG
+NetClientAllocateSerializedBuffers(
+    _In_ NET_CLIENT_BUFFER_POOL BufferPool,
+    _In_ ULONG NumBuffers,
+    _Out_writes_to_(NumBuffers, return) void ** VirtualAddresses,
+    _Out_writes_to_(NumBuffers, return) UINT64 * LogicalAddresses,
+    _Out_ SIZE_T * Offset,
+    _Out_ SIZE_T * Capacity
+)
+{
+    auto pool = reinterpret_cast<NxSerializedBufferPool *>(BufferPool);
+
+    return static_cast<ULONG>(
+        pool->AllocateBatch(
+            NumBuffers,
+            VirtualAddresses,
+            LogicalAddresses,
+            Offset,
+            Capacity));
+}
+
+static const NET_CLIENT_BUFFER_POOL_DISPATCH SerializedPoolDispatch =
+{
+    sizeof(NET_CLIENT_BUFFER_POOL_DISPATCH),
+    &NetClientDestroySerializedBufferPool,
+    &NetClientAllocateSerializedBuffer,
+    &NetClientFreeSerializedBuffers,
+    &NetClientAllocateSerializedBuffers,
+};
+
+PAGEDX
+_IRQL_requires_(PASSIVE_LEVEL)
+_IRQL_requires_same_
+VOID
+NetClientDestroySlabBufferPool(
+    _In_ NET_CLIENT_BUFFER_POOL BufferPool
+    )
+{
+    PAGED_CODE();
+
+    NxSlabBufferPool* pool = reinterpret_cast<NxSlabBufferPool *> (BufferPool);
+    delete pool;
+}
+
+NONPAGEDX
+_IRQL_requires_min_(PASSIVE_LEVEL)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_IRQL_requires_same_
+ULONG
+NetClientAllocateSizedSlabBuffers(
+    _In_ NET_CLIENT_BUFFER_POOL BufferPool,
+    _In_ SIZE_T Size,
+    _In_ ULONG NumBuffers,
+    _Out_writes_to_(NumBuffers, return) void ** VirtualAddresses,
+    _Out_writes_to_(NumBuffers, return) UINT64 * LogicalAddresses,
+    _Out_ SIZE_T * Offset,
+    _Out_ SIZE_T * Capacity
+)
+{
+    auto pool = reinterpret_cast<NxSlabBufferPool *>(BufferPool);
+
+    return static_cast<ULONG>(
+        pool->AllocateBatch(
+            Size,
+            NumBuffers,
+            VirtualAddresses,
+            LogicalAddresses,
+            Offset,
+            Capacity));
+}
+
+NONPAGEDX
+_IRQL_requires_min_(PASSIVE_LEVEL)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_IRQL_requires_same_
+ULONG
+NetClientAllocateSlabBuffers(
+    _In_ NET_CLIENT_BUFFER_POOL BufferPool,
+    _In_ ULONG NumBuffers,
+    _Out_writes_to_(NumBuffers, return) void ** VirtualAddresses,
+    _Out_writes_to_(NumBuffers, return) UINT64 * LogicalAddresses,
+    _Out_ SIZE_T * Offset,
+    _Out_ SIZE_T * Capacity
+)
+{
+    auto pool = reinterpret_cast<NxSlabBufferPool *>(BufferPool);
+
+    // callers that do not ask for a size get a buffer from the largest class
+    return NetClientAllocateSizedSlabBuffers(
+        BufferPool,
+        pool->GetMaximumBufferSize(),
+        NumBuffers,
+        VirtualAddresses,
+        LogicalAddresses,
+        Offset,
+        Capacity);
+}
+
+NONPAGEDX
+_IRQL_requires_min_(PASSIVE_LEVEL)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_IRQL_requires_same_
+NTSTATUS
+NetClientAllocateSlabBuffer(
+    _In_ NET_CLIENT_BUFFER_POOL BufferPool,
+    _Out_ void ** VirtualAddress,
+    _Out_ UINT64 * LogicalAddress,
+    _Out_ SIZE_T * Offset,
+    _Out_ SIZE_T * Capacity
+)
+{
+    CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES,
+                          NetClientAllocateSlabBuffers(
+                              BufferPool,
+                              1,
+                              VirtualAddress,
+                              LogicalAddress,
+                              Offset,
+                              Capacity) == 0);
+
+    return STATUS_SUCCESS;
+}
+
+NONPAGEDX
+_IRQL_requires_min_(PASSIVE_LEVEL)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_IRQL_requires_same_
+VOID
+NetClientFreeSlabBuffers(
+    _In_ NET_CLIENT_BUFFER_POOL BufferPool,
+    _Inout_updates_(NumBuffers) PVOID * Buffers,
+    _In_ ULONG NumBuffers)
+{
+    auto pool = reinterpret_cast<NxSlabBufferPool *>(BufferPool);
+
+    pool->FreeBatch(Buffers, NumBuffers);
+
+    RtlZeroMemory(Buffers, NumBuffers * sizeof(PVOID));
+}
+
+static const NET_CLIENT_BUFFER_POOL_DISPATCH SlabPoolDispatch =
+{
+    sizeof(NET_CLIENT_BUFFER_POOL_DISPATCH),
+    &NetClientDestroySlabBufferPool,
+    &NetClientAllocateSlabBuffer,
+    &NetClientFreeSlabBuffers,
+    &NetClientAllocateSlabBuffers,
+    &NetClientAllocateSizedSlabBuffers,
 };
 
 PAGEDX
@@ -103,46 +400,65 @@ NetClientCreateBufferPool(
 {
     PAGED_CODE();
 
-    CX_RETURN_NTSTATUS_IF(STATUS_NOT_IMPLEMENTED,
-                          BufferPoolConfig->Flag & NET_CLIENT_BUFFER_POOL_FLAGS_SERIALIZATION);
-
     CX_RETURN_NTSTATUS_IF(STATUS_INVALID_PARAMETER,
                           BufferPoolConfig->BufferAlignment > PAGE_SIZE);
 
     CX_RETURN_NTSTATUS_IF(STATUS_INVALID_PARAMETER,
                           !IS_POWER_OF_TWO(BufferPoolConfig->BufferAlignment));
 
-    wistd::unique_ptr<NxBufferManager> bufferManager = wil::make_unique_nothrow<NxBufferManager>();
+    if (BufferPoolConfig->Flag & NET_CLIENT_BUFFER_POOL_FLAGS_SIZE_CLASSES)
+    {
+        // size classes are meant for a single owner, they are not serialized
+        CX_RETURN_NTSTATUS_IF(STATUS_NOT_SUPPORTED,
+                              BufferPoolConfig->Flag & NET_CLIENT_BUFFER_POOL_FLAGS_SERIALIZATION);
+
+        KPtr<NxSlabBufferPool> slabPool;
+        slabPool.reset(new (std::nothrow) NxSlabBufferPool());
+        CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES, !slabPool.get());
+
+        // a request the small classes cannot serve moves up to the largest
+        // class, which alone holds the configured buffer count
+        auto const smallClassBufferCount =
+            max(BufferPoolConfig->BufferCount / NxSlabBufferPool::SmallClassBufferFraction, static_cast<size_t>(1));
+
+        for (auto const classSize : NxSlabBufferPool::SmallClassSizes)
+        {
+            if (classSize >= BufferPoolConfig->BufferSize)
+            {
+                break;
+            }
+
+            KPtr<NxBufferPool> classPool;
+            CX_RETURN_IF_NOT_NT_SUCCESS(CreatePool(BufferPoolConfig, smallClassBufferCount, classSize, classPool));
+            CX_RETURN_IF_NOT_NT_SUCCESS(slabPool->AddSizeClass(classSize, wistd::move(classPool)));
+        }
+
+        KPtr<NxBufferPool> largestPool;
+        CX_RETURN_IF_NOT_NT_SUCCESS(CreatePool(BufferPoolConfig, BufferPoolConfig->BufferCount, BufferPoolConfig->BufferSize, largestPool));
+        CX_RETURN_IF_NOT_NT_SUCCESS(slabPool->AddSizeClass(BufferPoolConfig->BufferSize, wistd::move(largestPool)));
+
+        *BufferPool = reinterpret_cast<NET_CLIENT_BUFFER_POOL>(slabPool.release());
+        *BufferPoolDispatch = &SlabPoolDispatch;
+
+        return STATUS_SUCCESS;
+    }
+
+    KPtr<NxBufferPool> pool;
+    CX_RETURN_IF_NOT_NT_SUCCESS(CreatePool(BufferPoolConfig, BufferPoolConfig->BufferCount, BufferPoolConfig->BufferSize, pool));
 
-    CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES, !bufferManager);
+    if (BufferPoolConfig->Flag & NET_CLIENT_BUFFER_POOL_FLAGS_SERIALIZATION)
+    {
+        KPtr<NxSerializedBufferPool> serializedPool;
+        serializedPool.reset(new (std::nothrow) NxSerializedBufferPool());
+        CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES, !serializedPool.get());
 
-    CX_RETURN_IF_NOT_NT_SUCCESS(bufferManager->AddMemoryConstraints(BufferPoolConfig->MemoryConstraints));
+        CX_RETURN_IF_NOT_NT_SUCCESS(serializedPool->Initialize(wistd::move(pool)));
 
-    CX_RETURN_IF_NOT_NT_SUCCESS(bufferManager->InitializeMemoryChunkAllocator());
+        *BufferPool = reinterpret_cast<NET_CLIENT_BUFFER_POOL>(serializedPool.release());
+        *BufferPoolDispatch = &SerializedPoolDispatch;
 
-    KPtr<NxBufferPool> pool;
-    pool.reset(new (std::nothrow) NxBufferPool());
-    CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES, !pool.get());
-
-    size_t requestedTotalSize = 0;
-    size_t minimumChunkSize = 0;
-    size_t combinedAlignmentRequirement =
-        max(BufferPoolConfig->MemoryConstraints->AlignmentRequirement, BufferPoolConfig->BufferAlignment);
-
-    CX_RETURN_IF_NOT_NT_SUCCESS(pool->Initialize(BufferPoolConfig->BufferCount,
-                                                 BufferPoolConfig->BufferSize,
-                                                 BufferPoolConfig->BufferAlignmentOffset,
-                                                 combinedAlignmentRequirement,
-                                                 &requestedTotalSize,
-                                                 &minimumChunkSize));
-
-    Rtl::KArray<wistd::unique_ptr<INxMemoryChunk>> memoryChunks;
-    CX_RETURN_IF_NOT_NT_SUCCESS(bufferManager->AllocateMemoryChunks(requestedTotalSize,
-                                                                    minimumChunkSize,
-                                                                    BufferPoolConfig->PreferredNode,
-                                                                    memoryChunks));
-
-    CX_RETURN_IF_NOT_NT_SUCCESS(pool->AddMemoryChunks(memoryChunks));
+        return STATUS_SUCCESS;
+    }
 
     //detach smart ptr
     *BufferPool = reinterpret_cast<NET_CLIENT_BUFFER_POOL>(pool.release());
@@ -0,0 +1,288 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    This is the implementation of the NxSerializedBufferPool object.
+
+--*/
+
+#include "BmPrecomp.hpp"
+#include "BufferManager.hpp"
+#include "BufferPool.hpp"
+#include "SerializedBufferPool.hpp"
+
+#include "SerializedBufferPool.tmh"
+
+NxSerializedBufferPool::NxSerializedBufferPool()
+{
+    InitializeSListHead(&m_FullMagazines);
+    InitializeSListHead(&m_EmptyMagazines);
+}
+
+NxSerializedBufferPool::~NxSerializedBufferPool()
+{
+    // Every magazine is either loaded on a processor or sitting in one of the
+    // depots, walking the backing array returns all cached buffers.
+    for (size_t i = 0; i < m_Magazines.count(); i++)
+    {
+        ReturnMagazineToPool(m_Magazines[i]);
+    }
+}
+
+NTSTATUS
+NxSerializedBufferPool::Initialize(
+    _In_ KPtr<NxBufferPool> Pool
+    )
+{
+    m_Pool = wistd::move(Pool);
+
+#ifdef _KERNEL_MODE
+    const ULONG processorCount = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+#else
+    // User mode cannot pin a thread to a processor, a single cache guarded
+    // by m_CpuCacheLock is used instead
+    const ULONG processorCount = 1;
+#endif
+
+    CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES,
+                          !m_CpuCaches.resize(processorCount));
+
+    // Two magazines loaded on each processor plus as many again for the
+    // depots, enough that a processor can always exchange a magazine
+    // without falling back to the central pool on every boundary
+    CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES,
+                          !m_Magazines.resize(processorCount * 3));
+
+    for (size_t i = 0; i < m_Magazines.count(); i++)
+    {
+        m_Magazines[i].Count = 0;
+    }
+
+    for (ULONG i = 0; i < processorCount; i++)
+    {
+        m_CpuCaches[i].Loaded = &m_Magazines[i * 2];
+        m_CpuCaches[i].Previous = &m_Magazines[i * 2 + 1];
+    }
+
+    for (size_t i = processorCount * 2; i < m_Magazines.count(); i++)
+    {
+        InterlockedPushEntrySList(&m_EmptyMagazines, &m_Magazines[i].Linkage);
+    }
+
+    // Offset and size are fixed for the lifetime of the pool, query them once
+    // so the cached paths can report them without touching the central pool
+    void * virtualAddress;
+    LOGICAL_ADDRESS logicalAddress;
+
+    m_Pool->AllocateBatch(0, &virtualAddress, &logicalAddress, &m_Offset, &m_AllocatedSize);
+
+    return STATUS_SUCCESS;
+}
+
+NONPAGED
+_Use_decl_annotations_
+NxSerializedBufferPool::NxBufferCpuCache &
+NxSerializedBufferPool::AcquireCpuCache(
+    KIRQL * OldIrql
+    )
+{
+#ifdef _KERNEL_MODE
+    *OldIrql = KeRaiseIrqlToDpcLevel();
+
+    return m_CpuCaches[KeGetCurrentProcessorIndex()];
+#else
+    *OldIrql = m_CpuCacheLock.Acquire();
+
+    return m_CpuCaches[0];
+#endif
+}
+
+NONPAGED
+_Use_decl_annotations_
+void
+NxSerializedBufferPool::ReleaseCpuCache(
+    KIRQL OldIrql
+    )
+{
+#ifdef _KERNEL_MODE
+    KeLowerIrql(OldIrql);
+#else
+    m_CpuCacheLock.Release(OldIrql);
+#endif
+}
+
+NONPAGED
+bool
+NxSerializedBufferPool::LoadFullMagazine(
+    _Inout_ NxBufferCpuCache & Cache
+    )
+{
+    // Both magazines on this processor are empty
+    NT_ASSERT(Cache.Loaded->Count == 0);
+    NT_ASSERT(Cache.Previous->Count == 0);
+
+    auto entry = InterlockedPopEntrySList(&m_FullMagazines);
+
+    if (entry != nullptr)
+    {
+        InterlockedPushEntrySList(&m_EmptyMagazines, &Cache.Previous->Linkage);
+
+        Cache.Previous = Cache.Loaded;
+        Cache.Loaded = CONTAINING_RECORD(entry, NxBufferMagazine, Linkage);
+
+        return true;
+    }
+
+    // Depot is empty, refill the loaded magazine straight from the central pool
+    SIZE_T offset;
+    SIZE_T allocatedSize;
+
+    KAcquireSpinLock lock(m_PoolLock);
+
+    Cache.Loaded->Count = static_cast<ULONG>(
+        m_Pool->AllocateBatch(
+            MagazineSize,
+            Cache.Loaded->VirtualAddresses,
+            Cache.Loaded->LogicalAddresses,
+            &offset,
+            &allocatedSize));
+
+    return Cache.Loaded->Count > 0;
+}
+
+NONPAGED
+void
+NxSerializedBufferPool::LoadEmptyMagazine(
+    _Inout_ NxBufferCpuCache & Cache
+    )
+{
+    // Both magazines on this processor are full
+    NT_ASSERT(Cache.Loaded->Count == MagazineSize);
+    NT_ASSERT(Cache.Previous->Count == MagazineSize);
+
+    auto entry = InterlockedPopEntrySList(&m_EmptyMagazines);
+
+    if (entry != nullptr)
+    {
+        InterlockedPushEntrySList(&m_FullMagazines, &Cache.Previous->Linkage);
+
+        Cache.Previous = Cache.Loaded;
+        Cache.Loaded = CONTAINING_RECORD(entry, NxBufferMagazine, Linkage);
+
+        return;
+    }
+
+    // Depot has no empty magazine, spill the loaded one to the central pool
+    ReturnMagazineToPool(*Cache.Loaded);
+}
+
+NONPAGED
+void
+NxSerializedBufferPool::ReturnMagazineToPool(
+    _Inout_ NxBufferMagazine & Magazine
+    )
+{
+    if (Magazine.Count == 0)
+    {
+        return;
+    }
+
+    KAcquireSpinLock lock(m_PoolLock);
+
+    m_Pool->FreeBatch(Magazine.VirtualAddresses, Magazine.Count);
+    Magazine.Count = 0;
+}
+
+NONPAGED
+size_t
+NxSerializedBufferPool::AllocateBatch(
+    _In_ size_t Count,
+    _Out_writes_to_(Count, return) void ** VirtualAddresses,
+    _Out_writes_to_(Count, return) LOGICAL_ADDRESS * LogicalAddresses,
+    _Out_ SIZE_T * Offset,
+    _Out_ SIZE_T * AllocatedSize)
+{
+    *Offset = m_Offset;
+    *AllocatedSize = m_AllocatedSize;
+
+    KIRQL oldIrql;
+    auto & cache = AcquireCpuCache(&oldIrql);
+
+    size_t allocated = 0;
+
+    while (allocated < Count)
+    {
+        auto & magazine = *cache.Loaded;
+
+        if (magazine.Count == 0)
+        {
+            if (cache.Previous->Count > 0)
+            {
+                cache.Loaded = cache.Previous;
+                cache.Previous = &magazine;
+                continue;
+            }
+
+            if (!LoadFullMagazine(cache))
+            {
+                break;
+            }
+
+            continue;
+        }
+
+        const ULONG numBuffers = static_cast<ULONG>(min(Count - allocated, magazine.Count));
+
+        for (ULONG i = 0; i < numBuffers; i++)
+        {
+            magazine.Count--;
+
+            VirtualAddresses[allocated] = magazine.VirtualAddresses[magazine.Count];
+            LogicalAddresses[allocated] = magazine.LogicalAddresses[magazine.Count];
+            allocated++;
+        }
+    }
+
+    ReleaseCpuCache(oldIrql);
+
+    return allocated;
+}
+
+NONPAGED
+VOID
+NxSerializedBufferPool::FreeBatch(
+    _In_reads_(Count) PVOID const * VirtualAddresses,
+    _In_ size_t Count)
+{
+    KIRQL oldIrql;
+    auto & cache = AcquireCpuCache(&oldIrql);
+
+    for (size_t i = 0; i < Count; i++)
+    {
+        if (cache.Loaded->Count == MagazineSize)
+        {
+            if (cache.Previous->Count == 0)
+            {
+                auto full = cache.Loaded;
+                cache.Loaded = cache.Previous;
+                cache.Previous = full;
+            }
+            else
+            {
+                LoadEmptyMagazine(cache);
+            }
+        }
+
+        auto & magazine = *cache.Loaded;
+
+        // Logical addresses are derived from immutable pool layout, no need
+        // to serialize with the central pool
+        magazine.VirtualAddresses[magazine.Count] = VirtualAddresses[i];
+        magazine.LogicalAddresses[magazine.Count] = m_Pool->GetLogicalAddress(VirtualAddresses[i]);
+        magazine.Count++;
+    }
+
+    ReleaseCpuCache(oldIrql);
+}
@@ -0,0 +1,142 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    This is the definition of the NxSerializedBufferPool object, a
+    thread-safe front end to NxBufferPool used when a pool is created with
+    NET_CLIENT_BUFFER_POOL_FLAGS_SERIALIZATION.
+
+    Each processor owns two magazines of buffers that it allocates from and
+    frees into without any interlocked operation. Full and empty magazines
+    are exchanged with lock-free depots, and only when the depots cannot
+    satisfy a request is the central NxBufferPool touched, under a lock.
+
+--*/
+
+#pragma once
+
+#include <KSpinLock.h>
+#include <KPtr.h>
+
+class PAGED NxSerializedBufferPool :
+    public NONPAGED_OBJECT<'psxn'> // 'nxsp'
+{
+
+public:
+
+    NxSerializedBufferPool(
+        void
+        );
+
+    ~NxSerializedBufferPool(
+        void
+        );
+
+    NTSTATUS
+    Initialize(
+        _In_ KPtr<NxBufferPool> Pool
+        );
+
+    NONPAGED
+    size_t
+    AllocateBatch(
+        _In_ size_t Count,
+        _Out_writes_to_(Count, return) void ** VirtualAddresses,
+        _Out_writes_to_(Count, return) LOGICAL_ADDRESS * LogicalAddresses,
+        _Out_ SIZE_T * Offset,
+        _Out_ SIZE_T * AllocatedSize
+        );
+
+    NONPAGED
+    VOID
+    FreeBatch(
+        _In_reads_(Count) PVOID const * VirtualAddresses,
+        _In_ size_t Count
+        );
+
+private:
+
+    static constexpr ULONG
+        MagazineSize = 16;
+
+    struct DECLSPEC_ALIGN(MEMORY_ALLOCATION_ALIGNMENT) NxBufferMagazine
+    {
+        SLIST_ENTRY Linkage;
+        ULONG Count;
+        PVOID VirtualAddresses[MagazineSize];
+        LOGICAL_ADDRESS LogicalAddresses[MagazineSize];
+    };
+
+    // The loaded magazine is the one allocations and frees go to, the
+    // previous one is always either full or empty. Keeping two magazines
+    // per processor avoids thrashing the depots when a processor alternates
+    // between allocating and freeing around a magazine boundary.
+    struct DECLSPEC_CACHEALIGN NxBufferCpuCache
+    {
+        NxBufferMagazine * Loaded;
+        NxBufferMagazine * Previous;
+    };
+
+    NONPAGED
+    _IRQL_raises_(DISPATCH_LEVEL)
+    NxBufferCpuCache &
+    AcquireCpuCache(
+        _Out_ KIRQL * OldIrql
+        );
+
+    NONPAGED
+    _IRQL_requires_(DISPATCH_LEVEL)
+    void
+    ReleaseCpuCache(
+        _In_ _IRQL_restores_ KIRQL OldIrql
+        );
+
+    NONPAGED
+    bool
+    LoadFullMagazine(
+        _Inout_ NxBufferCpuCache & Cache
+        );
+
+    NONPAGED
+    void
+    LoadEmptyMagazine(
+        _Inout_ NxBufferCpuCache & Cache
+        );
+
+    NONPAGED
+    void
+    ReturnMagazineToPool(
+        _Inout_ NxBufferMagazine & Magazine
+        );
+
+    KPtr<NxBufferPool>
+        m_Pool;
+
+    KSpinLock
+        m_PoolLock;
+
+#ifndef _KERNEL_MODE
+    KSpinLock
+        m_CpuCacheLock;
+#endif
+
+    SLIST_HEADER
+        m_FullMagazines;
+
+    SLIST_HEADER
+        m_EmptyMagazines;
+
+    Rtl::KArray<NxBufferCpuCache, NonPagedPoolNxCacheAligned>
+        m_CpuCaches;
+
+    Rtl::KArray<NxBufferMagazine, NonPagedPoolNxCacheAligned>
+        m_Magazines;
+
+    SIZE_T
+        m_Offset = 0;
+
+    SIZE_T
+        m_AllocatedSize = 0;
+};
@@ -0,0 +1,136 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    This is the implementation of the NxSlabBufferPool object.
+
+--*/
+
+#include "BmPrecomp.hpp"
+#include "BufferManager.hpp"
+#include "BufferPool.hpp"
+#include "SlabBufferPool.hpp"
+
+#include "SlabBufferPool.tmh"
+
+NxSlabBufferPool::NxSlabBufferPool()
+{}
+
+NxSlabBufferPool::~NxSlabBufferPool()
+{}
+
+NTSTATUS
+NxSlabBufferPool::AddSizeClass(
+    _In_ size_t BufferSize,
+    _In_ KPtr<NxBufferPool> Pool
+    )
+{
+    CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES,
+                          m_NumClasses == MaxSizeClasses);
+
+    NT_FRE_ASSERT(m_NumClasses == 0 || m_Classes[m_NumClasses - 1].BufferSize < BufferSize);
+
+    m_Classes[m_NumClasses].BufferSize = BufferSize;
+    m_Classes[m_NumClasses].Pool = wistd::move(Pool);
+    m_NumClasses++;
+
+    return STATUS_SUCCESS;
+}
+
+NONPAGED
+size_t
+NxSlabBufferPool::GetMaximumBufferSize() const
+{
+    return m_Classes[m_NumClasses - 1].BufferSize;
+}
+
+NONPAGED
+size_t
+NxSlabBufferPool::AllocateBatch(
+    _In_ size_t Size,
+    _In_ size_t Count,
+    _Out_writes_to_(Count, return) void ** VirtualAddresses,
+    _Out_writes_to_(Count, return) LOGICAL_ADDRESS * LogicalAddresses,
+    _Out_ SIZE_T * Offset,
+    _Out_ SIZE_T * AllocatedSize)
+{
+    *Offset = 0;
+    *AllocatedSize = 0;
+
+    //
+    // Start at the smallest class that fits and move up only when a class is
+    // empty, a batch always comes from a single class so all of it shares one
+    // offset and size
+    //
+    for (size_t i = 0; i < m_NumClasses; i++)
+    {
+        auto & sizeClass = m_Classes[i];
+
+        if (sizeClass.BufferSize < Size)
+        {
+            continue;
+        }
+
+        auto const allocated = sizeClass.Pool->AllocateBatch(
+            Count,
+            VirtualAddresses,
+            LogicalAddresses,
+            Offset,
+            AllocatedSize);
+
+        if (allocated > 0 || Count == 0)
+        {
+            return allocated;
+        }
+    }
+
+    return 0;
+}
+
+NONPAGED
+VOID
+NxSlabBufferPool::FreeBatch(
+    _In_reads_(Count) PVOID const * VirtualAddresses,
+    _In_ size_t Count)
+{
+    // hand back runs of buffers that belong to the same class in one call
+    size_t runStart = 0;
+    size_t runClass = 0;
+
+    for (size_t i = 0; i < Count; i++)
+    {
+        auto const owningClass = FindOwningClass(VirtualAddresses[i]);
+
+        if (i > runStart && owningClass != runClass)
+        {
+            m_Classes[runClass].Pool->FreeBatch(&VirtualAddresses[runStart], i - runStart);
+            runStart = i;
+        }
+
+        runClass = owningClass;
+    }
+
+    if (Count > runStart)
+    {
+        m_Classes[runClass].Pool->FreeBatch(&VirtualAddresses[runStart], Count - runStart);
+    }
+}
+
+NONPAGED
+size_t
+NxSlabBufferPool::FindOwningClass(
+    _In_ PVOID VirtualAddress)
+{
+    for (size_t i = 0; i < m_NumClasses; i++)
+    {
+        if (m_Classes[i].Pool->ContainsAddress(VirtualAddress))
+        {
+            return i;
+        }
+    }
+
+    NT_FRE_ASSERT(!"Buffer does not belong to the pool");
+    return 0;
+}
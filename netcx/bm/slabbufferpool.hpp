@@ -0,0 +1,96 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    This is the definition of the NxSlabBufferPool object, used when a pool
+    is created with NET_CLIENT_BUFFER_POOL_FLAGS_SIZE_CLASSES.
+
+    Buffers come in a few size classes, each backed by its own NxBufferPool.
+    Callers ask for the size they need and get a buffer from the smallest
+    class that fits, frees are routed back to the owning class by address.
+
+--*/
+
+#pragma once
+
+#include <KPtr.h>
+
+class PAGED NxSlabBufferPool :
+    public NONPAGED_OBJECT<'lsxn'> // 'nxsl'
+{
+
+public:
+
+    //the classes below the pool's own buffer size, any of these at or above it
+    //are left out. The largest class is always the configured buffer size.
+    static constexpr size_t
+        SmallClassSizes[] = { 256, 2048 };
+
+    static constexpr size_t
+        MaxSizeClasses = ARRAYSIZE(SmallClassSizes) + 1;
+
+    //each small class holds this fraction of the pool's buffer count
+    static constexpr size_t
+        SmallClassBufferFraction = 4;
+
+    NxSlabBufferPool(
+        void
+        );
+
+    ~NxSlabBufferPool(
+        void
+        );
+
+    //classes must be added in increasing order of buffer size
+    NTSTATUS
+    AddSizeClass(
+        _In_ size_t BufferSize,
+        _In_ KPtr<NxBufferPool> Pool
+        );
+
+    NONPAGED
+    size_t
+    AllocateBatch(
+        _In_ size_t Size,
+        _In_ size_t Count,
+        _Out_writes_to_(Count, return) void ** VirtualAddresses,
+        _Out_writes_to_(Count, return) LOGICAL_ADDRESS * LogicalAddresses,
+        _Out_ SIZE_T * Offset,
+        _Out_ SIZE_T * AllocatedSize
+        );
+
+    NONPAGED
+    VOID
+    FreeBatch(
+        _In_reads_(Count) PVOID const * VirtualAddresses,
+        _In_ size_t Count
+        );
+
+    NONPAGED
+    size_t
+    GetMaximumBufferSize(
+        void
+        ) const;
+
+private:
+
+    NONPAGED
+    size_t
+    FindOwningClass(
+        _In_ PVOID VirtualAddress
+        );
+
+    struct NxSizeClass
+    {
+        size_t BufferSize;
+        KPtr<NxBufferPool> Pool;
+    };
+
+    NxSizeClass
+        m_Classes[MaxSizeClasses];
+
+    size_t
+        m_NumClasses = 0;
+};
@@ -17,6 +17,58 @@ struct FragmentContext
     NET_CLIENT_BUFFER_POOL_DISPATCH const * BufferPoolDispatch;
 };
 
+_Use_decl_annotations_
+size_t
+NxCopyNetBufferData(
+    NET_BUFFER const &NetBuffer,
+    size_t Offset,
+    size_t Length,
+    void *Destination
+)
+{
+    PMDL mdl = NET_BUFFER_CURRENT_MDL(&NetBuffer);
+    size_t mdlOffset = NET_BUFFER_CURRENT_MDL_OFFSET(&NetBuffer) + Offset;
+
+    if (Offset >= NET_BUFFER_DATA_LENGTH(&NetBuffer))
+    {
+        return 0;
+    }
+
+    Length = min(Length, NET_BUFFER_DATA_LENGTH(&NetBuffer) - Offset);
+
+    auto destination = static_cast<UCHAR *>(Destination);
+    size_t copied = 0;
+    for (; mdl != nullptr && copied < Length; mdl = mdl->Next)
+    {
+        size_t const mdlByteCount = MmGetMdlByteCount(mdl);
+        if (mdlOffset >= mdlByteCount)
+        {
+            mdlOffset -= mdlByteCount;
+            continue;
+        }
+
+        size_t const copySize = min(Length - copied, mdlByteCount - mdlOffset);
+
+        auto const sourceBuffer = static_cast<UCHAR *>(MmGetSystemAddressForMdlSafe(mdl, LowPagePriority | MdlMappingNoExecute));
+        if (sourceBuffer == nullptr)
+        {
+            break;
+        }
+
+        // If we make the parsing code optional or parse the packets in
+        // batches we might benefit from using RtlCopyMemoryNonTemporal
+        RtlCopyMemory(
+            destination + copied,
+            sourceBuffer + mdlOffset,
+            copySize);
+
+        mdlOffset = 0;
+        copied += copySize;
+    }
+
+    return copied;
+}
+
 NxBounceBufferPool::NxBounceBufferPool(
     NET_RING_COLLECTION const & Rings,
     NET_EXTENSION const & VirtualAddressExtension,
@@ -35,6 +87,9 @@ NxBounceBufferPool::~NxBounceBufferPool(
 {
     if (m_bufferPool)
     {
+        FlushBufferCache(m_smallBuffers);
+        FlushBufferCache(m_buffers);
+
         m_bufferPoolDispatch->NetClientDestroyBufferPool(m_bufferPool);
         m_bufferPool = nullptr;
     }
@@ -45,7 +100,8 @@ NTSTATUS
 NxBounceBufferPool::Initialize(
     NET_CLIENT_DISPATCH const &ClientDispatch,
     NET_CLIENT_ADAPTER_DATAPATH_CAPABILITIES &DatapathCapabilities,
-    size_t NumberOfBuffers
+    size_t NumberOfBuffers,
+    NODE_REQUIREMENT PreferredNode
 )
 {
     //
@@ -70,8 +126,11 @@ NxBounceBufferPool::Initialize(
         m_bufferSize,
         0,
         0,
-        MM_ANY_NODE_OK,
-        NET_CLIENT_BUFFER_POOL_FLAGS_NONE
+        PreferredNode,
+        // bouncing is the exception, most of the pool sits idle until a
+        // burst of unmappable sends shows up. Size classes let the many
+        // small packets in such a burst use small buffers.
+        NET_CLIENT_BUFFER_POOL_FLAGS_ELASTIC | NET_CLIENT_BUFFER_POOL_FLAGS_SIZE_CLASSES
     };
 
     CX_RETURN_IF_NOT_NT_SUCCESS(
@@ -105,6 +164,33 @@ Remarks:
     If this routine returns false and NetPacket.Ignore is TRUE the
     caller should not try to bounce the buffer again.
 */
+{
+    return BounceNetBufferSegment(
+        NetBuffer,
+        0,
+        0,
+        NET_BUFFER_DATA_LENGTH(&NetBuffer),
+        NetPacket);
+}
+
+_Use_decl_annotations_
+bool
+NxBounceBufferPool::BounceNetBufferSegment(
+    NET_BUFFER const &NetBuffer,
+    size_t HeaderLength,
+    size_t PayloadOffset,
+    size_t PayloadLength,
+    NET_PACKET &NetPacket
+)
+/*
+
+Description:
+
+    Same as BounceNetBuffer, but only bounces the first HeaderLength bytes of
+    NetBuffer followed by PayloadLength bytes starting at PayloadOffset. This
+    is how a single segment of a large send is built.
+
+*/
 {
     auto fr = NetRingCollectionGetFragmentRing(m_rings);
     auto const frOsBegin = fr->EndIndex;
@@ -115,7 +201,7 @@ Remarks:
         return false;
     }
 
-    auto const bytesToCopy = NET_BUFFER_DATA_LENGTH(&NetBuffer);
+    auto const bytesToCopy = HeaderLength + PayloadLength;
     auto const packetSize = bytesToCopy + m_txPayloadBackfill;
 
     if (bytesToCopy == 0 || packetSize > m_bufferSize)
@@ -133,13 +219,12 @@ Remarks:
 
     RtlZeroMemory(fragment, sizeof(NET_FRAGMENT));
 
+    auto & cache = (packetSize <= SmallBufferSize && m_bufferPoolDispatch->NetClientAllocateSizedBuffers != nullptr)
+        ? m_smallBuffers
+        : m_buffers;
+
     SIZE_T offset, capacity;
-    if (STATUS_SUCCESS != m_bufferPoolDispatch->NetClientAllocateBuffer(
-            m_bufferPool,
-            &virtualAddress->VirtualAddress,
-            &logicalAddress->LogicalAddress,
-            &offset,
-            &capacity))
+    if (! AllocateBuffer(cache, packetSize, &virtualAddress->VirtualAddress, &logicalAddress->LogicalAddress, &offset, &capacity))
     {
         return false;
     }
@@ -148,43 +233,25 @@ Remarks:
     fragment->Capacity = capacity;
     fragment->ValidLength = m_txPayloadBackfill;
 
-    PMDL mdl = NET_BUFFER_CURRENT_MDL(&NetBuffer);
-    size_t mdlOffset = NET_BUFFER_CURRENT_MDL_OFFSET(&NetBuffer);
+    auto destination =
+        static_cast<unsigned char *>(virtualAddress->VirtualAddress) +
+        fragment->Offset +
+        m_txPayloadBackfill;
 
-    size_t fragmentOffset = (size_t)fragment->Offset + m_txPayloadBackfill;
-    auto baseFragmentVa = static_cast<unsigned char *>(virtualAddress->VirtualAddress);
-    for (size_t remain = bytesToCopy; remain > 0; mdl = mdl->Next)
+    if (HeaderLength > 0)
     {
-        size_t const mdlByteCount = MmGetMdlByteCount(mdl);
-        if (mdlByteCount == 0)
-        {
-            continue;
-        }
-
-        NT_ASSERT(mdlByteCount > mdlOffset);
-
-        size_t const copySize = min(remain, mdlByteCount - mdlOffset);
-
-        void *sourceBuffer = static_cast<UCHAR *>(MmGetSystemAddressForMdlSafe(mdl, LowPagePriority | MdlMappingNoExecute)) + mdlOffset;
-        void *destinationBuffer = baseFragmentVa + fragmentOffset;
-
-        // If we make the parsing code optional or parse the packets in
-        // batches we might benefit from using RtlCopyMemoryNonTemporal
-        RtlCopyMemory(
-            destinationBuffer,
-            sourceBuffer,
-            copySize);
-
-        fragment->ValidLength += copySize;
-
-        mdlOffset = 0;
-        remain -= copySize;
-        fragmentOffset += copySize;
+        fragment->ValidLength += NxCopyNetBufferData(NetBuffer, 0, HeaderLength, destination);
     }
 
+    fragment->ValidLength += NxCopyNetBufferData(
+        NetBuffer,
+        PayloadOffset,
+        PayloadLength,
+        destination + HeaderLength);
+
     if (fragment->ValidLength != packetSize)
     {
-        m_bufferPoolDispatch->NetClientFreeBuffers(m_bufferPool, &virtualAddress->VirtualAddress, 1);
+        FreeBuffer(fragment->Capacity, virtualAddress->VirtualAddress, logicalAddress->LogicalAddress);
         NetPacket.Ignore = TRUE;
         NetPacket.FragmentCount = 0;
 
@@ -222,16 +289,150 @@ NxBounceBufferPool::FreeBounceBuffers(
         auto & fragmentContext = m_fragmentContext.GetContext<FragmentContext>(index);
         auto virtualAddress = NetExtensionGetFragmentVirtualAddress(
             &m_virtualAddressExtension, index);
+        auto logicalAddress = NetExtensionGetFragmentLogicalAddress(
+            &m_logicalAddressExtension, index);
 
         if (fragmentContext.BufferPool != nullptr)
         {
-            fragmentContext.BufferPoolDispatch->NetClientFreeBuffers(
-                fragmentContext.BufferPool,
-                &virtualAddress->VirtualAddress,
-                1);
+            NT_ASSERT(fragmentContext.BufferPool == m_bufferPool);
+
+            auto const fragment = NetRingGetFragmentAtIndex(fr, index);
+
+            FreeBuffer(fragment->Capacity, virtualAddress->VirtualAddress, logicalAddress->LogicalAddress);
 
             fragmentContext = {};
         }
     }
 }
 
+_Use_decl_annotations_
+bool
+NxBounceBufferPool::AllocateBuffer(
+    BufferCache & Cache,
+    size_t Size,
+    void ** VirtualAddress,
+    UINT64 * LogicalAddress,
+    SIZE_T * Offset,
+    SIZE_T * Capacity
+)
+{
+    if (Cache.Count == 0)
+    {
+        if (&Cache == &m_smallBuffers)
+        {
+            SIZE_T offset, capacity;
+            auto const count = m_bufferPoolDispatch->NetClientAllocateSizedBuffers(
+                m_bufferPool,
+                Size,
+                BufferCacheSize,
+                Cache.VirtualAddresses,
+                Cache.LogicalAddresses,
+                &offset,
+                &capacity);
+
+            if (count == 0)
+            {
+                return false;
+            }
+
+            //
+            // Only this cache allocates from the smallest class, so its first
+            // batch comes from that class and sets the cache capacity. Once the
+            // class runs dry a larger class serves the batch, those buffers are
+            // not cached: one is handed out and the rest go back to the pool.
+            //
+            if (Cache.Capacity != 0 && capacity != Cache.Capacity)
+            {
+                *VirtualAddress = Cache.VirtualAddresses[0];
+                *LogicalAddress = Cache.LogicalAddresses[0];
+                *Offset = offset;
+                *Capacity = capacity;
+
+                if (count > 1)
+                {
+                    m_bufferPoolDispatch->NetClientFreeBuffers(
+                        m_bufferPool,
+                        &Cache.VirtualAddresses[1],
+                        count - 1);
+                }
+
+                return true;
+            }
+
+            Cache.Count = count;
+            Cache.Offset = offset;
+            Cache.Capacity = capacity;
+        }
+        else
+        {
+            Cache.Count = m_bufferPoolDispatch->NetClientAllocateBuffers(
+                m_bufferPool,
+                BufferCacheSize,
+                Cache.VirtualAddresses,
+                Cache.LogicalAddresses,
+                &Cache.Offset,
+                &Cache.Capacity);
+        }
+
+        if (Cache.Count == 0)
+        {
+            return false;
+        }
+    }
+
+    Cache.Count--;
+    *VirtualAddress = Cache.VirtualAddresses[Cache.Count];
+    *LogicalAddress = Cache.LogicalAddresses[Cache.Count];
+    *Offset = Cache.Offset;
+    *Capacity = Cache.Capacity;
+
+    return true;
+}
+
+_Use_decl_annotations_
+void
+NxBounceBufferPool::FreeBuffer(
+    size_t Capacity,
+    void * VirtualAddress,
+    UINT64 LogicalAddress
+)
+{
+    // A small request can be served from a larger class when the small one
+    // runs dry, such a buffer cannot go into either cache and is returned
+    // to the pool right away. The small cache capacity is that of the
+    // smallest class, it never matches a larger buffer.
+    auto & cache = (m_smallBuffers.Capacity != 0 && Capacity == m_smallBuffers.Capacity) ? m_smallBuffers : m_buffers;
+
+    if (Capacity != cache.Capacity)
+    {
+        m_bufferPoolDispatch->NetClientFreeBuffers(m_bufferPool, &VirtualAddress, 1);
+        return;
+    }
+
+    if (cache.Count == BufferCacheSize)
+    {
+        FlushBufferCache(cache);
+    }
+
+    cache.VirtualAddresses[cache.Count] = VirtualAddress;
+    cache.LogicalAddresses[cache.Count] = LogicalAddress;
+    cache.Count++;
+}
+
+_Use_decl_annotations_
+void
+NxBounceBufferPool::FlushBufferCache(
+    BufferCache & Cache
+)
+{
+    if (Cache.Count > 0)
+    {
+        m_bufferPoolDispatch->NetClientFreeBuffers(
+            m_bufferPool,
+            Cache.VirtualAddresses,
+            Cache.Count);
+
+        Cache.Count = 0;
+    }
+}
+
@@ -4,6 +4,16 @@
 #include <net/packet.h>
 #include <NxRingContext.hpp>
 
+// Copies up to Length bytes starting Offset bytes into the NET_BUFFER's data,
+// returns the number of bytes copied.
+size_t
+NxCopyNetBufferData(
+    _In_ NET_BUFFER const &NetBuffer,
+    _In_ size_t Offset,
+    _In_ size_t Length,
+    _Out_writes_bytes_to_(Length, return) void *Destination
+);
+
 class NxBounceBufferPool
 {
 
@@ -23,7 +33,8 @@ public:
     Initialize(
         _In_ NET_CLIENT_DISPATCH const &ClientDispatch,
         _In_ NET_CLIENT_ADAPTER_DATAPATH_CAPABILITIES &DatapathCapabilities,
-        _In_ size_t NumberOfBuffers
+        _In_ size_t NumberOfBuffers,
+        _In_ NODE_REQUIREMENT PreferredNode
     );
 
     bool
@@ -32,6 +43,15 @@ public:
         _Inout_ NET_PACKET &NetPacket
     );
 
+    bool
+    BounceNetBufferSegment(
+        _In_ NET_BUFFER const &NetBuffer,
+        _In_ size_t HeaderLength,
+        _In_ size_t PayloadOffset,
+        _In_ size_t PayloadLength,
+        _Inout_ NET_PACKET &NetPacket
+    );
+
     void
     FreeBounceBuffers(
         _Inout_ NET_PACKET &NetPacket
@@ -39,6 +59,42 @@ public:
 
 private:
 
+    // Buffers are taken from and returned to the pool in batches, this
+    // holds the ones allocated or freed but not yet handed out or returned.
+    // Every buffer in a cache has the same offset and capacity.
+    static constexpr ULONG BufferCacheSize = 32;
+
+    struct BufferCache
+    {
+        void * VirtualAddresses[BufferCacheSize];
+        UINT64 LogicalAddresses[BufferCacheSize];
+        ULONG Count;
+        SIZE_T Offset;
+        SIZE_T Capacity;
+    };
+
+    bool
+    AllocateBuffer(
+        _Inout_ BufferCache & Cache,
+        _In_ size_t Size,
+        _Out_ void ** VirtualAddress,
+        _Out_ UINT64 * LogicalAddress,
+        _Out_ SIZE_T * Offset,
+        _Out_ SIZE_T * Capacity
+    );
+
+    void
+    FreeBuffer(
+        _In_ size_t Capacity,
+        _In_ void * VirtualAddress,
+        _In_ UINT64 LogicalAddress
+    );
+
+    void
+    FlushBufferCache(
+        _Inout_ BufferCache & Cache
+    );
+
     NxRingContext
         m_fragmentContext;
 
@@ -55,5 +111,14 @@ private:
 
     size_t m_bufferSize = 0;
     size_t m_txPayloadBackfill = 0;
+
+    // Packets up to this size are bounced into buffers from the pool's
+    // smallest size class, which keeps ACKs and other small sends from
+    // holding a full MTU buffer each. m_smallBuffers only ever caches
+    // buffers of that class, its capacity is set by the first batch.
+    static constexpr size_t SmallBufferSize = 256;
+
+    BufferCache m_smallBuffers = {};
+    BufferCache m_buffers = {};
 };
 
@@ -0,0 +1,394 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#include "NxXlatPrecomp.hpp"
+#include "NxXlatCommon.hpp"
+
+#include "NxChecksum.tmh"
+#include "NxChecksum.hpp"
+
+#include <net/checksum.h>
+#include <netiodef.h>
+
+#if defined(_M_AMD64)
+// SSE2 is part of the x64 baseline and its state is preserved for kernel
+// code, unlike AVX which would require saving the extended processor state.
+#include <emmintrin.h>
+#define NX_CHECKSUM_SSE2 1
+#endif
+
+#define UDP_HEADER_SIZE 8
+
+UINT64
+NxChecksumAccumulateScalar(
+    UINT64 sum,
+    void const * buffer,
+    size_t length
+)
+{
+    auto bytes = static_cast<UCHAR const *>(buffer);
+
+    // Ones' complement addition is independent of how the buffer is split
+    // in words, summing 32 bit words into 64 bits can't overflow for any
+    // buffer we'd ever see.
+    for (; length >= sizeof(UINT32); length -= sizeof(UINT32), bytes += sizeof(UINT32))
+    {
+        sum += *reinterpret_cast<UINT32 UNALIGNED const *>(bytes);
+    }
+
+    if (length >= sizeof(USHORT))
+    {
+        sum += *reinterpret_cast<USHORT UNALIGNED const *>(bytes);
+        length -= sizeof(USHORT);
+        bytes += sizeof(USHORT);
+    }
+
+    if (length > 0)
+    {
+        sum += *bytes;
+    }
+
+    return sum;
+}
+
+#ifdef NX_CHECKSUM_SSE2
+
+static
+UINT64
+AccumulateSse2(
+    UINT64 sum,
+    _In_reads_bytes_(length) UCHAR const * bytes,
+    size_t length
+)
+{
+    // Each 64 byte iteration adds at most 4 * 0xffff to a 32 bit lane, so
+    // lanes are flushed to the 64 bit sum well before they can overflow
+    size_t const blockSize = 64 * 1024;
+
+    __m128i const zero = _mm_setzero_si128();
+
+    while (length >= 64)
+    {
+        auto const blockLength = min(length, blockSize) & ~size_t{ 63 };
+
+        __m128i acc0 = zero;
+        __m128i acc1 = zero;
+
+        for (size_t i = 0; i < blockLength; i += 64)
+        {
+            auto const v0 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(bytes + i));
+            auto const v1 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(bytes + i + 16));
+            auto const v2 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(bytes + i + 32));
+            auto const v3 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(bytes + i + 48));
+
+            acc0 = _mm_add_epi32(acc0, _mm_unpacklo_epi16(v0, zero));
+            acc1 = _mm_add_epi32(acc1, _mm_unpackhi_epi16(v0, zero));
+            acc0 = _mm_add_epi32(acc0, _mm_unpacklo_epi16(v1, zero));
+            acc1 = _mm_add_epi32(acc1, _mm_unpackhi_epi16(v1, zero));
+            acc0 = _mm_add_epi32(acc0, _mm_unpacklo_epi16(v2, zero));
+            acc1 = _mm_add_epi32(acc1, _mm_unpackhi_epi16(v2, zero));
+            acc0 = _mm_add_epi32(acc0, _mm_unpacklo_epi16(v3, zero));
+            acc1 = _mm_add_epi32(acc1, _mm_unpackhi_epi16(v3, zero));
+        }
+
+        // Widen the 32 bit lanes to 64 bits before adding the accumulators
+        // together
+        auto const wide = _mm_add_epi64(
+            _mm_add_epi64(_mm_unpacklo_epi32(acc0, zero), _mm_unpackhi_epi32(acc0, zero)),
+            _mm_add_epi64(_mm_unpacklo_epi32(acc1, zero), _mm_unpackhi_epi32(acc1, zero)));
+
+        sum += static_cast<UINT64>(_mm_cvtsi128_si64(wide));
+        sum += static_cast<UINT64>(_mm_cvtsi128_si64(_mm_unpackhi_epi64(wide, wide)));
+
+        bytes += blockLength;
+        length -= blockLength;
+    }
+
+    return NxChecksumAccumulateScalar(sum, bytes, length);
+}
+
+#endif // NX_CHECKSUM_SSE2
+
+UINT64
+NxChecksumAccumulate(
+    UINT64 sum,
+    void const * buffer,
+    size_t length
+)
+{
+#ifdef NX_CHECKSUM_SSE2
+    // Not worth setting up the vector loop for short headers
+    if (length >= 128)
+    {
+        return AccumulateSse2(sum, static_cast<UCHAR const *>(buffer), length);
+    }
+#endif
+
+    return NxChecksumAccumulateScalar(sum, buffer, length);
+}
+
+static
+USHORT
+ChecksumFold(
+    UINT64 sum
+)
+{
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+
+    return static_cast<USHORT>(sum);
+}
+
+USHORT
+NxChecksumFinalize(
+    UINT64 sum
+)
+{
+    return static_cast<USHORT>(~ChecksumFold(sum));
+}
+
+static
+bool
+IsIPv4(
+    NET_PACKET_LAYOUT const &layout
+)
+{
+    return
+        layout.Layer3Type >= NetPacketLayer3TypeIPv4UnspecifiedOptions &&
+        layout.Layer3Type <= NetPacketLayer3TypeIPv4NoOptions;
+}
+
+static
+bool
+IsIPv6(
+    NET_PACKET_LAYOUT const &layout
+)
+{
+    return
+        layout.Layer3Type >= NetPacketLayer3TypeIPv6UnspecifiedExtensions &&
+        layout.Layer3Type <= NetPacketLayer3TypeIPv6NoExtensions;
+}
+
+UINT64
+NxChecksumPseudoHeader(
+    NET_PACKET const & packet,
+    UCHAR const * frame,
+    UINT8 protocol,
+    UINT32 layer4Length
+)
+{
+    auto const ip = frame + packet.Layout.Layer2HeaderLength;
+
+    // Values are added in network byte order, the same way they are laid
+    // out in the pseudo-header
+    UINT64 sum =
+        RtlUshortByteSwap(static_cast<USHORT>(protocol)) +
+        RtlUlongByteSwap(layer4Length);
+
+    if (IsIPv4(packet.Layout))
+    {
+        auto const ipv4 = reinterpret_cast<IPV4_HEADER UNALIGNED const *>(ip);
+        sum = NxChecksumAccumulateScalar(sum, &ipv4->SourceAddress, sizeof(IN_ADDR) * 2);
+    }
+    else
+    {
+        auto const ipv6 = reinterpret_cast<IPV6_HEADER UNALIGNED const *>(ip);
+        sum = NxChecksumAccumulateScalar(sum, &ipv6->SourceAddress, sizeof(IN6_ADDR) * 2);
+    }
+
+    return sum;
+}
+
+void
+NxChecksumTxFrame(
+    NET_PACKET const & packet,
+    NET_PACKET_CHECKSUM const & checksum,
+    UCHAR * frame,
+    UINT32 frameLength
+)
+{
+    auto const ipOffset = packet.Layout.Layer2HeaderLength;
+    auto const layer4Offset = ipOffset + packet.Layout.Layer3HeaderLength;
+
+    if (layer4Offset > frameLength)
+    {
+        return;
+    }
+
+    if (checksum.Layer3 == NetPacketTxChecksumActionRequired && IsIPv4(packet.Layout))
+    {
+        auto ip = reinterpret_cast<IPV4_HEADER UNALIGNED *>(frame + ipOffset);
+
+        ip->HeaderChecksum = 0;
+        ip->HeaderChecksum = NxChecksumFinalize(
+            NxChecksumAccumulateScalar(0, ip, packet.Layout.Layer3HeaderLength));
+    }
+
+    if (checksum.Layer4 != NetPacketTxChecksumActionRequired)
+    {
+        return;
+    }
+
+    auto const layer4Length = frameLength - layer4Offset;
+    USHORT UNALIGNED * checksumField;
+    UINT8 protocol;
+
+    switch (packet.Layout.Layer4Type)
+    {
+    case NetPacketLayer4TypeTcp:
+        if (layer4Length < sizeof(TCP_HDR))
+        {
+            return;
+        }
+
+        checksumField = &reinterpret_cast<TCP_HDR UNALIGNED *>(frame + layer4Offset)->th_sum;
+        protocol = IPPROTO_TCP;
+        break;
+
+    case NetPacketLayer4TypeUdp:
+        if (layer4Length < UDP_HEADER_SIZE)
+        {
+            return;
+        }
+
+        // uh_sum is the last field of the 8 byte UDP header
+        checksumField = reinterpret_cast<USHORT UNALIGNED *>(frame + layer4Offset + 6);
+        protocol = IPPROTO_UDP;
+        break;
+
+    default:
+        return;
+    }
+
+    *checksumField = 0;
+
+    auto const sum = NxChecksumAccumulate(
+        NxChecksumPseudoHeader(packet, frame, protocol, layer4Length),
+        frame + layer4Offset,
+        layer4Length);
+
+    auto result = NxChecksumFinalize(sum);
+
+    // A computed UDP checksum of zero is transmitted as all ones, zero means
+    // no checksum
+    if (protocol == IPPROTO_UDP && result == 0)
+    {
+        result = 0xffff;
+    }
+
+    *checksumField = result;
+}
+
+NDIS_TCP_IP_CHECKSUM_NET_BUFFER_LIST_INFO
+NxChecksumValidateRxFrame(
+    NET_PACKET const & packet,
+    UCHAR const * frame,
+    UINT32 frameLength
+)
+{
+    NDIS_TCP_IP_CHECKSUM_NET_BUFFER_LIST_INFO checksumInfo = {};
+
+    auto const ipOffset = packet.Layout.Layer2HeaderLength;
+    auto const layer4Offset = ipOffset + packet.Layout.Layer3HeaderLength;
+
+    if (packet.Layout.Layer3HeaderLength == 0 || layer4Offset > frameLength)
+    {
+        return checksumInfo;
+    }
+
+    // The layer 4 length comes from the IP header, the frame can be longer
+    // than that because of Ethernet padding
+    UINT32 layer4Length;
+
+    if (IsIPv4(packet.Layout))
+    {
+        auto const ip = reinterpret_cast<IPV4_HEADER UNALIGNED const *>(frame + ipOffset);
+
+        if (ChecksumFold(NxChecksumAccumulateScalar(0, ip, packet.Layout.Layer3HeaderLength)) == 0xffff)
+        {
+            checksumInfo.Receive.IpChecksumSucceeded = true;
+        }
+        else
+        {
+            checksumInfo.Receive.IpChecksumFailed = true;
+            return checksumInfo;
+        }
+
+        // Fragments are validated by the stack once reassembled
+        if (ip->MoreFragments || (ip->FlagsOffset & IP4_OFF_MASK) != 0)
+        {
+            return checksumInfo;
+        }
+
+        layer4Length = RtlUshortByteSwap(ip->TotalLength) - packet.Layout.Layer3HeaderLength;
+    }
+    else if (IsIPv6(packet.Layout))
+    {
+        auto const ip = reinterpret_cast<IPV6_HEADER UNALIGNED const *>(frame + ipOffset);
+
+        layer4Length = RtlUshortByteSwap(ip->PayloadLength) + sizeof(IPV6_HEADER) - packet.Layout.Layer3HeaderLength;
+    }
+    else
+    {
+        return checksumInfo;
+    }
+
+    if (layer4Length > frameLength - layer4Offset)
+    {
+        return checksumInfo;
+    }
+
+    UINT8 protocol;
+
+    switch (packet.Layout.Layer4Type)
+    {
+    case NetPacketLayer4TypeTcp:
+        if (layer4Length < sizeof(TCP_HDR))
+        {
+            return checksumInfo;
+        }
+
+        protocol = IPPROTO_TCP;
+        break;
+
+    case NetPacketLayer4TypeUdp:
+        if (layer4Length < UDP_HEADER_SIZE)
+        {
+            return checksumInfo;
+        }
+
+        // A zero UDP checksum over IPv4 means the sender didn't compute one
+        if (IsIPv4(packet.Layout) && *reinterpret_cast<USHORT UNALIGNED const *>(frame + layer4Offset + 6) == 0)
+        {
+            return checksumInfo;
+        }
+
+        protocol = IPPROTO_UDP;
+        break;
+
+    default:
+        return checksumInfo;
+    }
+
+    auto const sum = NxChecksumAccumulate(
+        NxChecksumPseudoHeader(packet, frame, protocol, layer4Length),
+        frame + layer4Offset,
+        layer4Length);
+
+    auto const valid = ChecksumFold(sum) == 0xffff;
+
+    if (protocol == IPPROTO_TCP)
+    {
+        checksumInfo.Receive.TcpChecksumSucceeded = valid;
+        checksumInfo.Receive.TcpChecksumFailed = !valid;
+    }
+    else
+    {
+        checksumInfo.Receive.UdpChecksumSucceeded = valid;
+        checksumInfo.Receive.UdpChecksumFailed = !valid;
+    }
+
+    return checksumInfo;
+}
@@ -0,0 +1,63 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+#pragma once
+
+#include <net/packet.h>
+#include <net/checksumtypes.h>
+
+//
+// Internet checksum (RFC 1071) helpers used when the NIC can't compute or
+// validate a checksum itself. Partial sums are kept in 64 bits and only
+// folded by NxChecksumFinalize, so a sum can be chained over several
+// buffers as long as every buffer but the last has an even length.
+//
+
+UINT64
+NxChecksumAccumulate(
+    UINT64 sum,
+    _In_reads_bytes_(length) void const * buffer,
+    size_t length
+);
+
+// Portable implementation of NxChecksumAccumulate, also used as reference
+// for the vectorized one.
+UINT64
+NxChecksumAccumulateScalar(
+    UINT64 sum,
+    _In_reads_bytes_(length) void const * buffer,
+    size_t length
+);
+
+USHORT
+NxChecksumFinalize(
+    UINT64 sum
+);
+
+// Sum of the TCP/UDP pseudo-header for the IPv4 or IPv6 header of packet.
+// frame points to the layer 2 header.
+UINT64
+NxChecksumPseudoHeader(
+    NET_PACKET const & packet,
+    _In_ UCHAR const * frame,
+    UINT8 protocol,
+    UINT32 layer4Length
+);
+
+// Computes the checksums requested by checksum in place
+void
+NxChecksumTxFrame(
+    NET_PACKET const & packet,
+    NET_PACKET_CHECKSUM const & checksum,
+    _Inout_updates_bytes_(frameLength) UCHAR * frame,
+    UINT32 frameLength
+);
+
+// Validates the IPv4 header and TCP/UDP checksums of a received frame.
+// Checksums that can't be validated, e.g. because the frame is an IP
+// fragment, are left as not checked.
+NDIS_TCP_IP_CHECKSUM_NET_BUFFER_LIST_INFO
+NxChecksumValidateRxFrame(
+    NET_PACKET const & packet,
+    _In_reads_bytes_(frameLength) UCHAR const * frame,
+    UINT32 frameLength
+);
@@ -12,6 +12,7 @@ Abstract:
 #include "NxXlatCommon.hpp"
 #include "NxExecutionContext.tmh"
 #include "NxExecutionContext.hpp"
+#include "NxPoller.hpp"
 
 #include <netioapi.h>
 
@@ -58,6 +59,63 @@ NxExecutionContext::Initialize(PVOID context, EC_START_ROUTINE *callback)
     return STATUS_SUCCESS;
 }
 
+NTSTATUS
+NxExecutionContext::InitializeHosted(
+    void * context,
+    EC_POLL_ROUTINE * pollRoutine,
+    NxPoller & poller
+)
+{
+    m_pollContext = context;
+    m_pollRoutine = pollRoutine;
+
+    CX_RETURN_IF_NOT_NT_SUCCESS_MSG(
+        poller.Register(*this),
+        "Failed to register execution context with poller. ExecutionContext=%p", this);
+
+    m_poller = &poller;
+    m_nextPoller = &poller;
+    m_ecIdentifier = poller.GetExecutionContextIdentifier();
+
+    return STATUS_SUCCESS;
+}
+
+bool
+NxExecutionContext::IsHosted() const
+{
+    return m_poller != nullptr;
+}
+
+void
+NxExecutionContext::SetPoller(
+    _In_ NxPoller & poller
+)
+{
+    WIN_ASSERT(IsHosted());
+
+    m_nextPoller = &poller;
+}
+
+bool
+NxExecutionContext::Poll()
+{
+    if (! m_runAgain && ! InterlockedExchange(&m_workSignaled, 0))
+    {
+        return false;
+    }
+
+    // a stopped EC is signaled again when it is started
+    if (m_ecState == EcState::Stopped || m_ecState == EcState::Terminated)
+    {
+        m_runAgain = false;
+        return false;
+    }
+
+    m_runAgain = m_pollRoutine(m_pollContext);
+
+    return m_runAgain;
+}
+
 NxExecutionContext::EcState
 NxExecutionContext::SetState(EcState newState)
 {
@@ -113,6 +171,12 @@ NxExecutionContext::Terminate()
 {
     SetTerminated();
 
+    if (IsHosted())
+    {
+        m_poller->Unregister(*this);
+        m_poller = nullptr;
+    }
+
     if (m_workerThreadObject)
     {
 #if _KERNEL_MODE
@@ -135,6 +199,25 @@ NxExecutionContext::Terminate()
 void
 NxExecutionContext::Start()
 {
+    // Pollers never run a stopped EC, so it can sit on both of them for a
+    // moment. Registering with the new one first keeps it where it was if
+    // that fails.
+    if (IsHosted() && m_nextPoller != m_poller)
+    {
+        auto const poller = m_nextPoller;
+
+        if (NT_SUCCESS(poller->Register(*this)))
+        {
+            m_poller->Unregister(*this);
+            m_poller = poller;
+            m_ecIdentifier = poller->GetExecutionContextIdentifier();
+        }
+        else
+        {
+            m_nextPoller = m_poller;
+        }
+    }
+
     SetStarted();
 }
 
@@ -153,12 +236,23 @@ NxExecutionContext::Stop()
 void
 NxExecutionContext::SignalWork()
 {
-    m_work.Set();
+    if (IsHosted())
+    {
+        InterlockedExchange(&m_workSignaled, 1);
+        m_poller->SignalWork();
+    }
+    else
+    {
+        m_work.Set();
+    }
 }
 
 void
 NxExecutionContext::WaitForWork()
 {
+    // hosted ECs return to their poller instead of blocking
+    WIN_ASSERT(! IsHosted());
+
     m_work.Wait();
 }
 
@@ -180,6 +274,77 @@ NxExecutionContext::IsTerminated()
     return m_ecState == EcState::Terminated;
 }
 
+ULONG64
+NxExecutionContext::QueryTime() const
+{
+#if _KERNEL_MODE
+    return KeQueryInterruptTimePrecise(nullptr);
+#else
+    ULONGLONG interruptTime;
+    QueryInterruptTimePrecise(&interruptTime);
+
+    return interruptTime;
+#endif
+}
+
+void
+NxExecutionContext::SetBusyPollWindow(
+    _In_ ULONG MaximumMicroseconds)
+{
+    m_busyPollMaximum = static_cast<ULONG64>(MaximumMicroseconds) * 10;
+    m_busyPollWindow = m_busyPollMaximum;
+    m_averageIdleTime = 0;
+    m_idleStartTime = 0;
+}
+
+void
+NxExecutionContext::NotifyProgress()
+{
+    if (m_idleStartTime == 0)
+    {
+        return;
+    }
+
+    // The time from the first idle iteration to the next productive one
+    // approximates the inter-arrival time of work. Keep a moving average
+    // of it and spin for about twice that long, as long as that fits in the
+    // configured window. Sleeping is cheaper than spinning through gaps that
+    // are longer than the window anyway.
+    auto const idleTime = QueryTime() - m_idleStartTime;
+    m_idleStartTime = 0;
+
+    m_averageIdleTime = (m_averageIdleTime * 7 + idleTime) / 8;
+
+    m_busyPollWindow = m_averageIdleTime <= m_busyPollMaximum
+        ? min(m_averageIdleTime * 2, m_busyPollMaximum)
+        : 0;
+}
+
+bool
+NxExecutionContext::BusyPoll()
+{
+    if (m_busyPollMaximum == 0)
+    {
+        return false;
+    }
+
+    auto const now = QueryTime();
+
+    if (m_idleStartTime == 0)
+    {
+        m_idleStartTime = now;
+    }
+
+    if (m_ecState == EcState::Stopping || now - m_idleStartTime >= m_busyPollWindow)
+    {
+        return false;
+    }
+
+    YieldProcessor();
+
+    return true;
+}
+
 void
 NxExecutionContext::SetDebugNameHint(
     _In_ PCWSTR usage,
@@ -224,3 +389,35 @@ NxExecutionContext::GetExecutionContextIdentifier() const
 {
     return m_ecIdentifier;
 }
+
+NODE_REQUIREMENT
+NxExecutionContext::QueryAffinityNode(
+    _In_ GROUP_AFFINITY const & Affinity
+)
+{
+#if _KERNEL_MODE
+    if (Affinity.Mask == 0 || Affinity.Mask == static_cast<KAFFINITY>(-1))
+    {
+        return MM_ANY_NODE_OK;
+    }
+
+    // a mask spanning several processors is placed on the node of the lowest one
+    PROCESSOR_NUMBER processor = {};
+    processor.Group = Affinity.Group;
+    processor.Number = static_cast<UCHAR>(RtlFindLeastSignificantBit(Affinity.Mask));
+
+    SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX information;
+    ULONG length = sizeof(information);
+
+    if (! NT_SUCCESS(KeQueryLogicalProcessorRelationship(&processor, RelationNumaNode, &information, &length)))
+    {
+        return MM_ANY_NODE_OK;
+    }
+
+    return information.NumaNode.NodeNumber;
+#else
+    UNREFERENCED_PARAMETER(Affinity);
+
+    return MM_ANY_NODE_OK;
+#endif
+}
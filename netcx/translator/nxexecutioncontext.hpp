@@ -60,6 +60,12 @@ using EC_START_ROUTINE = wistd::remove_pointer<PTHREAD_START_ROUTINE>::type;
 using EC_RETURN = DWORD;
 #endif
 
+class NxPoller;
+
+/// Runs one iteration of a hosted EC without blocking. Returns true if the EC
+/// should be polled again even if nobody signals it.
+using EC_POLL_ROUTINE = bool(void * context);
+
 /// Encapsulates single-threaded execution of a task that can be suspended and
 /// resumed
 class NxExecutionContext
@@ -72,6 +78,34 @@ public:
         EC_START_ROUTINE * callback
     );
 
+    /// Hosts the EC on a poller shared with other ECs instead of giving it a
+    /// thread of its own. The poller calls pollRoutine whenever the EC is
+    /// signaled or asked to run again.
+    NTSTATUS
+    InitializeHosted(
+        void * context,
+        EC_POLL_ROUTINE * pollRoutine,
+        NxPoller & poller
+    );
+
+    bool
+    IsHosted(
+        void
+    ) const;
+
+    /// Moves a hosted EC to another poller the next time it is started
+    void
+    SetPoller(
+        _In_ NxPoller & poller
+    );
+
+    /// Called only by the poller hosting the EC. Returns true if the EC
+    /// should be polled again on the next pass.
+    bool
+    Poll(
+        void
+    );
+
     void
     Start(
         void
@@ -125,6 +159,28 @@ public:
         void
     );
 
+    /// Sets the upper bound, in microseconds, of the busy poll window. A value
+    /// of zero disables busy polling.
+    void
+    SetBusyPollWindow(
+        _In_ ULONG MaximumMicroseconds
+    );
+
+    /// Called only by code running in the EC when an iteration made forward
+    /// progress.
+    void
+    NotifyProgress(
+        void
+    );
+
+    /// Called only by code running in the EC when an iteration made no forward
+    /// progress. Returns true if the EC should poll again instead of arming
+    /// notifications and waiting for a signal.
+    bool
+    BusyPoll(
+        void
+    );
+
     void
     SetDebugNameHint(
         _In_ PCWSTR usage,
@@ -135,6 +191,19 @@ public:
     ULONG
     GetExecutionContextIdentifier() const;
 
+    // NUMA node of the processors in Affinity, MM_ANY_NODE_OK if unaffinitized
+    static
+    NODE_REQUIREMENT
+    QueryAffinityNode(
+        _In_ GROUP_AFFINITY const & Affinity
+    );
+
+    // Current interrupt time, in 100ns units
+    ULONG64
+    QueryTime(
+        void
+    ) const;
+
 private:
 
     enum EcState : LONG
@@ -181,5 +250,21 @@ private:
 #endif
 
     ULONG m_ecIdentifier = 0;
+
+    // Hosted mode state. m_workSignaled is set by SignalWork and consumed by
+    // Poll, m_runAgain is only touched by the poller.
+    NxPoller * m_poller = nullptr;
+    NxPoller * volatile m_nextPoller = nullptr;
+    EC_POLL_ROUTINE * m_pollRoutine = nullptr;
+    void * m_pollContext = nullptr;
+    volatile LONG m_workSignaled = 0;
+    bool m_runAgain = false;
+
+    // Busy poll state, all in 100ns units. Only touched by the EC thread
+    // except for m_busyPollMaximum which is set before the EC is started.
+    ULONG64 m_busyPollMaximum = 0;
+    ULONG64 m_busyPollWindow = 0;
+    ULONG64 m_averageIdleTime = 0;
+    ULONG64 m_idleStartTime = 0;
 };
 
@@ -0,0 +1,469 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    Flow table used to steer received flows to the receive queue whose
+    processor consumes them.
+
+--*/
+
+#include "NxXlatPrecomp.hpp"
+#include "NxXlatCommon.hpp"
+#include "NxFlowSteering.tmh"
+#include "NxFlowSteering.hpp"
+
+#include <netiodef.h>
+
+#include "NxPacketLayout.hpp"
+
+// Enough for an Ethernet header with a VLAN tag, an IPv6 header and a TCP
+// header with options
+#define MAX_SEND_HEADER_SIZE 128
+
+namespace
+{
+    ULONG64
+    QueryInterruptTime(
+        void
+    )
+    {
+#ifdef _KERNEL_MODE
+        return KeQueryInterruptTime();
+#else
+        return GetTickCount64() * 10 * 1000;
+#endif
+    }
+}
+
+static
+bool
+IsIPv4(
+    NET_PACKET_LAYOUT const &layout
+)
+{
+    return
+        layout.Layer3Type >= NetPacketLayer3TypeIPv4UnspecifiedOptions &&
+        layout.Layer3Type <= NetPacketLayer3TypeIPv4NoOptions;
+}
+
+static
+bool
+IsIPv6(
+    NET_PACKET_LAYOUT const &layout
+)
+{
+    return
+        layout.Layer3Type >= NetPacketLayer3TypeIPv6UnspecifiedExtensions &&
+        layout.Layer3Type <= NetPacketLayer3TypeIPv6NoExtensions;
+}
+
+static
+ULONG
+GatherSendHeaders(
+    _In_ NET_BUFFER const * NetBuffer,
+    _Out_writes_bytes_to_(MAX_SEND_HEADER_SIZE, return) UCHAR * Headers
+)
+{
+    auto const length = min(static_cast<size_t>(NET_BUFFER_DATA_LENGTH(NetBuffer)), static_cast<size_t>(MAX_SEND_HEADER_SIZE));
+    size_t mdlOffset = NET_BUFFER_CURRENT_MDL_OFFSET(NetBuffer);
+    size_t copied = 0;
+
+    for (auto mdl = NET_BUFFER_CURRENT_MDL(NetBuffer); mdl != nullptr && copied < length; mdl = mdl->Next)
+    {
+        size_t const mdlByteCount = MmGetMdlByteCount(mdl);
+        if (mdlOffset >= mdlByteCount)
+        {
+            mdlOffset -= mdlByteCount;
+            continue;
+        }
+
+        size_t const copySize = min(length - copied, mdlByteCount - mdlOffset);
+
+        auto const sourceBuffer = static_cast<UCHAR *>(MmGetSystemAddressForMdlSafe(mdl, LowPagePriority | MdlMappingNoExecute));
+        if (sourceBuffer == nullptr)
+        {
+            break;
+        }
+
+        RtlCopyMemory(Headers + copied, sourceBuffer + mdlOffset, copySize);
+
+        mdlOffset = 0;
+        copied += copySize;
+    }
+
+    return static_cast<ULONG>(copied);
+}
+
+_Use_decl_annotations_
+bool
+NxGetFlowKey(
+    NET_PACKET_LAYOUT const & Layout,
+    UCHAR const * Frame,
+    UINT32 FrameLength,
+    NxFlowKey & Key
+)
+{
+    RtlZeroMemory(&Key, sizeof(Key));
+
+    if (Layout.Layer4Type != NetPacketLayer4TypeTcp && Layout.Layer4Type != NetPacketLayer4TypeUdp)
+    {
+        return false;
+    }
+
+    auto const ipOffset = Layout.Layer2HeaderLength;
+    auto const layer4Offset = ipOffset + Layout.Layer3HeaderLength;
+
+    if (Layout.Layer3HeaderLength == 0 || layer4Offset + 2 * sizeof(USHORT) > FrameLength)
+    {
+        return false;
+    }
+
+    // A reported Layer3HeaderLength shorter than the fixed header would let
+    // the addresses below be read past the frame
+    if (IsIPv4(Layout))
+    {
+        if (Layout.Layer3HeaderLength < sizeof(IPV4_HEADER))
+        {
+            return false;
+        }
+
+        auto const ip = reinterpret_cast<IPV4_HEADER UNALIGNED const *>(Frame + ipOffset);
+
+        // The fragments without ports could not follow the first one
+        if (ip->MoreFragments || (ip->FlagsOffset & IP4_OFF_MASK) != 0)
+        {
+            return false;
+        }
+
+        RtlCopyMemory(Key.SourceAddress, &ip->SourceAddress, sizeof(ip->SourceAddress));
+        RtlCopyMemory(Key.DestinationAddress, &ip->DestinationAddress, sizeof(ip->DestinationAddress));
+        Key.Version = 4;
+    }
+    else if (IsIPv6(Layout))
+    {
+        if (Layout.Layer3HeaderLength < sizeof(IPV6_HEADER))
+        {
+            return false;
+        }
+
+        auto const ip = reinterpret_cast<IPV6_HEADER UNALIGNED const *>(Frame + ipOffset);
+
+        RtlCopyMemory(Key.SourceAddress, &ip->SourceAddress, sizeof(ip->SourceAddress));
+        RtlCopyMemory(Key.DestinationAddress, &ip->DestinationAddress, sizeof(ip->DestinationAddress));
+        Key.Version = 6;
+    }
+    else
+    {
+        return false;
+    }
+
+    RtlCopyMemory(&Key.SourcePort, Frame + layer4Offset, sizeof(Key.SourcePort));
+    RtlCopyMemory(&Key.DestinationPort, Frame + layer4Offset + sizeof(USHORT), sizeof(Key.DestinationPort));
+    Key.Protocol = static_cast<UCHAR>(Layout.Layer4Type);
+
+    return true;
+}
+
+_Use_decl_annotations_
+bool
+NxGetSendFlowKey(
+    NDIS_MEDIUM MediaType,
+    NET_BUFFER_LIST * NetBufferList,
+    NxFlowKey & Key
+)
+{
+    UCHAR headers[MAX_SEND_HEADER_SIZE];
+    auto const length = GatherSendHeaders(NET_BUFFER_LIST_FIRST_NB(NetBufferList), headers);
+    auto const layout = NxGetFrameLayout(MediaType, headers, length);
+
+    NxFlowKey sendKey;
+    if (! NxGetFlowKey(layout, headers, length, sendKey))
+    {
+        RtlZeroMemory(&Key, sizeof(Key));
+        return false;
+    }
+
+    Key = sendKey;
+    RtlCopyMemory(Key.SourceAddress, sendKey.DestinationAddress, sizeof(Key.SourceAddress));
+    RtlCopyMemory(Key.DestinationAddress, sendKey.SourceAddress, sizeof(Key.DestinationAddress));
+    Key.SourcePort = sendKey.DestinationPort;
+    Key.DestinationPort = sendKey.SourcePort;
+
+    return true;
+}
+
+_Use_decl_annotations_
+NTSTATUS
+NxFlowSteering::Initialize(
+    ULONG NumberOfEntries,
+    ULONG64 Timeout
+)
+{
+    m_timeout = Timeout;
+    m_refreshInterval = Timeout / 8;
+
+    if (NumberOfEntries == 0)
+    {
+        return STATUS_SUCCESS;
+    }
+
+    // a power of two number of sets so a set is picked with a mask
+    size_t numberOfSets = 1;
+    while (numberOfSets * Ways < NumberOfEntries)
+    {
+        numberOfSets <<= 1;
+    }
+
+    CX_RETURN_NTSTATUS_IF(
+        STATUS_INSUFFICIENT_RESOURCES,
+        ! m_sets.resize(numberOfSets));
+
+    for (auto & set : m_sets)
+    {
+        RtlZeroMemory(set.Entries, sizeof(set.Entries));
+    }
+
+    return STATUS_SUCCESS;
+}
+
+bool
+NxFlowSteering::IsEnabled(
+    void
+) const
+{
+    return m_sets.count() != 0;
+}
+
+bool
+NxFlowSteering::IsEmpty(
+    void
+) const
+{
+    return ReadNoFence(&m_count) == 0;
+}
+
+_Use_decl_annotations_
+NxFlowSteering::EntrySet &
+NxFlowSteering::GetSet(
+    NxFlowKey const & Key
+)
+{
+    // FNV-1a, the table only needs the flows spread over the sets
+    auto const bytes = reinterpret_cast<UCHAR const *>(&Key);
+    ULONG hash = 2166136261U;
+
+    for (size_t i = 0; i < sizeof(Key); i++)
+    {
+        hash = (hash ^ bytes[i]) * 16777619U;
+    }
+
+    return m_sets[hash & (m_sets.count() - 1)];
+}
+
+_Use_decl_annotations_
+NxFlowSteering::FlowEntry *
+NxFlowSteering::Find(
+    EntrySet & Set,
+    NxFlowKey const & Key
+) const
+{
+    for (auto & entry : Set.Entries)
+    {
+        if (entry.Valid && RtlEqualMemory(&entry.Key, &Key, sizeof(Key)))
+        {
+            return &entry;
+        }
+    }
+
+    return nullptr;
+}
+
+_Use_decl_annotations_
+bool
+NxFlowSteering::IsExpired(
+    ULONG64 LastUsed,
+    ULONG64 Now
+) const
+{
+    return Now - LastUsed > m_timeout;
+}
+
+_Use_decl_annotations_
+void
+NxFlowSteering::Invalidate(
+    FlowEntry & Entry
+)
+{
+    Entry.Valid = false;
+    InterlockedDecrement(&m_count);
+}
+
+_Use_decl_annotations_
+NxFlowSteering::FlowEntry *
+NxFlowSteering::Claim(
+    EntrySet & Set,
+    ULONG64 Now
+)
+{
+    auto oldest = &Set.Entries[0];
+
+    for (auto & entry : Set.Entries)
+    {
+        if (! entry.Valid)
+        {
+            return &entry;
+        }
+
+        if (IsExpired(entry.LastUsed, Now))
+        {
+            Invalidate(entry);
+            return &entry;
+        }
+
+        if (entry.LastUsed < oldest->LastUsed)
+        {
+            oldest = &entry;
+        }
+    }
+
+    Invalidate(*oldest);
+
+    return oldest;
+}
+
+_Use_decl_annotations_
+void
+NxFlowSteering::Learn(
+    NxFlowKey const & Key,
+    size_t QueueId
+)
+{
+    if (! IsEnabled())
+    {
+        return;
+    }
+
+    auto const now = QueryInterruptTime();
+    auto & set = GetSet(Key);
+
+    KAcquireSpinLock lock(set.Lock);
+
+    InterlockedIncrement(&set.Sequence);
+
+    auto entry = Find(set, Key);
+
+    if (entry == nullptr)
+    {
+        entry = Claim(set, now);
+        entry->Key = Key;
+        entry->Valid = true;
+        InterlockedIncrement(&m_count);
+    }
+
+    entry->QueueId = QueueId;
+    entry->LastUsed = now;
+
+    InterlockedIncrement(&set.Sequence);
+}
+
+_Use_decl_annotations_
+bool
+NxFlowSteering::Lookup(
+    NxFlowKey const & Key,
+    size_t * QueueId
+)
+{
+    if (IsEmpty())
+    {
+        return false;
+    }
+
+    auto const now = QueryInterruptTime();
+    auto & set = GetSet(Key);
+
+    //
+    // The set is read without its lock. A read that overlapped an update,
+    // seen as a change of the set's sequence, is retried. Expired entries
+    // are left for Learn and Sweep to reclaim.
+    //
+    FlowEntry * entry;
+    size_t queueId = 0;
+    ULONG64 lastUsed = 0;
+
+    for (;;)
+    {
+        auto const sequence = ReadAcquire(&set.Sequence);
+
+        if (sequence & 1)
+        {
+            YieldProcessor();
+            continue;
+        }
+
+        entry = Find(set, Key);
+
+        if (entry != nullptr)
+        {
+            queueId = entry->QueueId;
+            lastUsed = entry->LastUsed;
+        }
+
+        MemoryBarrier();
+
+        if (ReadNoFence(&set.Sequence) == sequence)
+        {
+            break;
+        }
+    }
+
+    if (entry == nullptr || IsExpired(lastUsed, now))
+    {
+        return false;
+    }
+
+    // Losing the race against another refresh or an update is harmless
+    if (now - lastUsed > m_refreshInterval)
+    {
+        InterlockedCompareExchange64(
+            reinterpret_cast<LONG64 volatile *>(&entry->LastUsed),
+            static_cast<LONG64>(now),
+            static_cast<LONG64>(lastUsed));
+    }
+
+    *QueueId = queueId;
+
+    return true;
+}
+
+_Use_decl_annotations_
+void
+NxFlowSteering::Sweep(
+    void
+)
+{
+    if (IsEmpty())
+    {
+        return;
+    }
+
+    auto const now = QueryInterruptTime();
+
+    for (auto & set : m_sets)
+    {
+        KAcquireSpinLock lock(set.Lock);
+
+        InterlockedIncrement(&set.Sequence);
+
+        for (auto & entry : set.Entries)
+        {
+            if (entry.Valid && IsExpired(entry.LastUsed, now))
+            {
+                Invalidate(entry);
+            }
+        }
+
+        InterlockedIncrement(&set.Sequence);
+    }
+}
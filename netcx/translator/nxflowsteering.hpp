@@ -0,0 +1,210 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    Flow table used to steer received flows to the receive queue whose
+    processor consumes them.
+
+--*/
+
+#pragma once
+
+#include <net/packet.h>
+
+#include <KArray.h>
+#include <KSpinLock.h>
+
+/// Identifies a TCP or UDP flow in the receive direction. Addresses and ports
+/// are kept in network byte order, IPv4 addresses use the first four bytes of
+/// the address fields. Unused bytes must be zero, keys are compared as memory.
+struct NxFlowKey
+{
+    UCHAR
+        SourceAddress[16];
+
+    UCHAR
+        DestinationAddress[16];
+
+    USHORT
+        SourcePort;
+
+    USHORT
+        DestinationPort;
+
+    // NET_PACKET_LAYER4_TYPE of the flow
+    UCHAR
+        Protocol;
+
+    // IP version, 4 or 6
+    UCHAR
+        Version;
+
+    USHORT
+        Reserved;
+};
+
+/// Builds the key of a received frame from its parsed layout. Returns false
+/// if the frame is not TCP or UDP, or is a fragment without ports.
+_IRQL_requires_max_(DISPATCH_LEVEL)
+bool
+NxGetFlowKey(
+    _In_ NET_PACKET_LAYOUT const & Layout,
+    _In_reads_bytes_(FrameLength) UCHAR const * Frame,
+    _In_ UINT32 FrameLength,
+    _Out_ NxFlowKey & Key
+);
+
+/// Builds the key under which the replies to a send NBL are received, that
+/// is with source and destination swapped.
+_IRQL_requires_max_(DISPATCH_LEVEL)
+bool
+NxGetSendFlowKey(
+    _In_ NDIS_MEDIUM MediaType,
+    _In_ NET_BUFFER_LIST * NetBufferList,
+    _Out_ NxFlowKey & Key
+);
+
+/// A bounded table mapping flows to receive queue ids.
+///
+/// The table is set associative, a flow can only be stored in one of the Ways
+/// entries of the set its key hashes to. Every set has its own lock, which
+/// only updates take. Lookups read a set without writing it, retrying if an
+/// update ran meanwhile, so the receive queues never contend on a set they
+/// only read. Flows are only learned,
+/// there is no interface to pin one. A flow that was not looked up for the
+/// timeout expires; expired entries are reused when their set is visited
+/// and reclaimed by Sweep, which the owner calls periodically so the table
+/// empties once no flow is steered. When a set is full the least recently
+/// used flow is replaced.
+class NxFlowSteering
+{
+
+public:
+
+    static constexpr size_t
+        Ways = 4;
+
+    // Timeout is in 100ns units
+    _IRQL_requires_(PASSIVE_LEVEL)
+    NTSTATUS
+    Initialize(
+        _In_ ULONG NumberOfEntries,
+        _In_ ULONG64 Timeout
+    );
+
+    bool
+    IsEnabled(
+        void
+    ) const;
+
+    // Lets the receive path skip parsing frames while no flow is steered
+    bool
+    IsEmpty(
+        void
+    ) const;
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    void
+    Learn(
+        _In_ NxFlowKey const & Key,
+        _In_ size_t QueueId
+    );
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    bool
+    Lookup(
+        _In_ NxFlowKey const & Key,
+        _Out_ size_t * QueueId
+    );
+
+    // Invalidates every expired entry
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    void
+    Sweep(
+        void
+    );
+
+private:
+
+    struct FlowEntry
+    {
+        NxFlowKey
+            Key;
+
+        // interrupt time of the last lookup or update, at the granularity of
+        // m_refreshInterval
+        ULONG64
+            LastUsed;
+
+        size_t
+            QueueId;
+
+        bool
+            Valid;
+    };
+
+    struct DECLSPEC_CACHEALIGN EntrySet
+    {
+        KSpinLock
+            Lock;
+
+        // odd while an update holding Lock modifies Entries
+        LONG volatile
+            Sequence = 0;
+
+        FlowEntry
+            Entries[Ways];
+    };
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    EntrySet &
+    GetSet(
+        _In_ NxFlowKey const & Key
+    );
+
+    // Called with Set.Lock held, or by a lookup that validates the result
+    // against Set.Sequence
+    FlowEntry *
+    Find(
+        _In_ EntrySet & Set,
+        _In_ NxFlowKey const & Key
+    ) const;
+
+    // Returns the entry a new flow goes into
+    _Requires_lock_held_(Set.Lock)
+    FlowEntry *
+    Claim(
+        _In_ EntrySet & Set,
+        _In_ ULONG64 Now
+    );
+
+    bool
+    IsExpired(
+        _In_ ULONG64 LastUsed,
+        _In_ ULONG64 Now
+    ) const;
+
+    void
+    Invalidate(
+        _In_ FlowEntry & Entry
+    );
+
+    Rtl::KArray<EntrySet, NonPagedPoolNxCacheAligned>
+        m_sets;
+
+    ULONG64
+        m_timeout = 0;
+
+    // A lookup only refreshes LastUsed once it is older than this, so the
+    // lookups of a busy flow do not write its entry every frame. Flows then
+    // expire up to this much later than the timeout.
+    ULONG64
+        m_refreshInterval = 0;
+
+    // number of valid entries
+    LONG volatile
+        m_count = 0;
+
+};
@@ -5,8 +5,10 @@
 
 #include "NxLargeSend.tmh"
 #include "NxLargeSend.hpp"
+#include "NxChecksum.hpp"
 
 #include <net/lso.h>
+#include <netiodef.h>
 
 NET_PACKET_LSO
 NxTranslateTxPacketLargeSendSegmentation(
@@ -47,3 +49,58 @@ NxTranslateTxPacketLargeSendSegmentation(
 
     return lso;
 }
+
+void
+NxFixupLargeSendSegment(
+    NET_PACKET const & packet,
+    UCHAR * frame,
+    UINT32 frameLength,
+    UINT32 sequenceOffset,
+    UINT16 segmentIndex,
+    bool lastSegment
+)
+{
+    ASSERT(packet.Layout.Layer4Type == NetPacketLayer4TypeTcp);
+
+    auto const ipOffset = packet.Layout.Layer2HeaderLength;
+    auto const tcpOffset = ipOffset + packet.Layout.Layer3HeaderLength;
+
+    auto tcp = reinterpret_cast<TCP_HDR UNALIGNED *>(frame + tcpOffset);
+
+    if (NetPacketIsIpv4(&packet))
+    {
+        auto ip = reinterpret_cast<IPV4_HEADER UNALIGNED *>(frame + ipOffset);
+
+        ip->TotalLength = RtlUshortByteSwap(static_cast<USHORT>(frameLength - ipOffset));
+        ip->Identification = RtlUshortByteSwap(static_cast<USHORT>(RtlUshortByteSwap(ip->Identification) + segmentIndex));
+    }
+    else
+    {
+        ASSERT(NetPacketIsIpv6(&packet));
+
+        auto ip = reinterpret_cast<IPV6_HEADER UNALIGNED *>(frame + ipOffset);
+
+        ip->PayloadLength = RtlUshortByteSwap(static_cast<USHORT>(frameLength - ipOffset - sizeof(IPV6_HEADER)));
+    }
+
+    tcp->th_seq = RtlUlongByteSwap(RtlUlongByteSwap(tcp->th_seq) + sequenceOffset);
+
+    // FIN and PSH belong to the last segment only, CWR to the first one only
+    if (!lastSegment)
+    {
+        tcp->th_flags &= ~(TH_FIN | TH_PSH);
+    }
+
+    if (segmentIndex != 0)
+    {
+        tcp->th_flags &= ~TH_CWR;
+    }
+
+    // The pseudo-header checksum NDIS leaves in th_sum for a large send does
+    // not cover the segment length, so the checksums are computed from scratch
+    NET_PACKET_CHECKSUM checksum = {};
+    checksum.Layer3 = NetPacketTxChecksumActionRequired;
+    checksum.Layer4 = NetPacketTxChecksumActionRequired;
+
+    NxChecksumTxFrame(packet, checksum, frame, frameLength);
+}
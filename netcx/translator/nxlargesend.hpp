@@ -11,3 +11,16 @@ NxTranslateTxPacketLargeSendSegmentation(
     NDIS_TCP_LARGE_SEND_OFFLOAD_NET_BUFFER_LIST_INFO const & info
 );
 
+// Rewrites the IP and TCP headers of one software segment of a large send so
+// it can go on the wire as is, including the IP and TCP checksums. frame
+// points to the layer 2 header of the segment.
+void
+NxFixupLargeSendSegment(
+    NET_PACKET const & packet,
+    _Inout_updates_bytes_(frameLength) UCHAR * frame,
+    UINT32 frameLength,
+    UINT32 sequenceOffset,
+    UINT16 segmentIndex,
+    bool lastSegment
+);
+
@@ -17,28 +17,50 @@ Abstract:
 PAGED
 NxNblQueue::NxNblQueue()
 {
-    ndisInitializeNblQueue(&m_nblQueue.Queue);
 }
 
 _IRQL_requires_max_(DISPATCH_LEVEL)
 void
 NxNblQueue::Enqueue(_In_ PNET_BUFFER_LIST pNbl)
 {
-    SIZE_T nblCount = 0;
-    auto lastNbl = ndisLastNblInNblChainWithCount(pNbl, &nblCount);
+    // Reverse the chain so that the first NBL ends up at the tail; the
+    // consumer will reverse the whole list again and restore FIFO order.
+    auto const last = pNbl;
+    NET_BUFFER_LIST *first = nullptr;
+    LONG64 nblCount = 0;
 
-    KAcquireSpinLock lock(m_SpinLock);
-    m_nblQueue.NblCount += nblCount;
-    ndisAppendNblChainToNblQueueFast(&m_nblQueue.Queue, pNbl, lastNbl);
+    for (auto nbl = pNbl; nbl; nblCount++)
+    {
+        auto next = nbl->Next;
+        nbl->Next = first;
+        first = nbl;
+        nbl = next;
+    }
+
+    // Producers only ever push and the consumer only ever takes the whole
+    // list, so a plain compare-exchange is not subject to ABA.
+    NET_BUFFER_LIST *head;
+    do
+    {
+        head = m_head;
+        last->Next = head;
+    } while (InterlockedCompareExchangePointer(
+        reinterpret_cast<PVOID volatile *>(&m_head), first, head) != head);
+
+    InterlockedAddNoFence64(&m_nblCount, nblCount);
 }
 
 _IRQL_requires_max_(DISPATCH_LEVEL)
 void
 NxNblQueue::Enqueue(_Inout_ NBL_COUNTED_QUEUE *queue)
 {
-    KAcquireSpinLock lock(m_SpinLock);
-    ndisAppendNblQueueToNblQueueFast(&m_nblQueue.Queue, &(queue->Queue));
-    m_nblQueue.NblCount += queue->NblCount;
+    auto const nblChain = ndisPopAllFromNblQueue(&queue->Queue);
+    queue->NblCount = 0;
+
+    if (nblChain)
+    {
+        Enqueue(nblChain);
+    }
 }
 
 _IRQL_requires_max_(DISPATCH_LEVEL)
@@ -46,24 +68,50 @@ void
 NxNblQueue::DequeueAll(
     _Out_ NBL_QUEUE *destination)
 {
-    KAcquireSpinLock lock(m_SpinLock);
     ndisInitializeNblQueue(destination);
-    ndisAppendNblQueueToNblQueueFast(destination, &m_nblQueue.Queue);
-    m_nblQueue.NblCount = 0;
+
+    auto nbl = static_cast<NET_BUFFER_LIST *>(
+        InterlockedExchangePointer(reinterpret_cast<PVOID volatile *>(&m_head), nullptr));
+
+    if (! nbl)
+    {
+        return;
+    }
+
+    auto const last = nbl;
+    NET_BUFFER_LIST *first = nullptr;
+    LONG64 nblCount = 0;
+
+    for (; nbl; nblCount++)
+    {
+        auto next = nbl->Next;
+        nbl->Next = first;
+        first = nbl;
+        nbl = next;
+    }
+
+    ndisAppendNblChainToNblQueueFast(destination, first, last);
+
+    InterlockedAddNoFence64(&m_nblCount, -nblCount);
 }
 
 _IRQL_requires_max_(DISPATCH_LEVEL)
 NET_BUFFER_LIST *
 NxNblQueue::DequeueAll()
 {
-    KAcquireSpinLock lock(m_SpinLock);
-    m_nblQueue.NblCount = 0;
-    return ndisPopAllFromNblQueue(&m_nblQueue.Queue);
+    NBL_QUEUE queue;
+    DequeueAll(&queue);
+
+    return queue.First;
 }
 
 _IRQL_requires_max_(DISPATCH_LEVEL)
 ULONG64
 NxNblQueue::GetNblQueueDepth() const
 {
-    return m_nblQueue.NblCount;
+    // A consumer can observe NBLs before the producer accounted for them,
+    // which makes the count transiently negative.
+    auto const nblCount = ReadNoFence64(&m_nblCount);
+
+    return nblCount > 0 ? static_cast<ULONG64>(nblCount) : 0;
 }
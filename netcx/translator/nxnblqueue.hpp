@@ -7,11 +7,15 @@ Abstract:
     The NxNblQueue is a FIFO queues of NET_BUFFER_LISTs, with
     built-in synchronization.
 
+    Any number of producers may enqueue concurrently, but only a single
+    consumer may dequeue at a time. Producers push their chain in reverse
+    order onto an atomic list head, the consumer takes the whole list in one
+    exchange and reverses it back, so no lock is needed on either side.
+
 --*/
 
 #pragma once
 
-#include <KSpinLock.h>
 #include <nblutil.h>
 
 class NxNblQueue
@@ -37,6 +41,9 @@ public:
 
 private:
 
-    NBL_COUNTED_QUEUE m_nblQueue;
-    KSpinLock m_SpinLock;
+    // Most recently enqueued NBL first
+    NET_BUFFER_LIST * volatile m_head = nullptr;
+
+    // May briefly lag behind m_head, see Enqueue
+    volatile LONG64 m_nblCount = 0;
 };
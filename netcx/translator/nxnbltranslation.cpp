@@ -13,13 +13,24 @@
 #include <net/mdl_p.h>
 #include <net/rsc_p.h>
 #include <net/virtualaddress_p.h>
+#include <netiodef.h>
 
 #include "NxPacketLayout.hpp"
 #include "NxChecksumInfo.hpp"
+#include "NxChecksum.hpp"
 #include "NxLargeSend.hpp"
 #include "NxReceiveCoalescing.hpp"
 #include "NxStatistics.hpp"
 
+// Enough to reach the inner L4 header of an encapsulated IPv6 frame
+#define MAX_CHECKSUM_HEADER_SIZE 256
+
+// An L4 header further in the frame than an Ethernet header with a VLAN tag
+// and an IPv4 header with options is encapsulated
+#define MAX_IPV4_LAYER4_OFFSET 78
+
+#define MAX_TCP_HEADER_SIZE 60
+
 MdlTranlationResult::MdlTranlationResult(
     NxNblTranslationStatus XlatStatus
 )
@@ -45,6 +56,7 @@ NxNblTranslator::NxNblTranslator(
     NxNblTranslationStats &Stats,
     NET_RING_COLLECTION * Rings,
     const NET_CLIENT_ADAPTER_DATAPATH_CAPABILITIES & DatapathCapabilities,
+    const NET_CLIENT_OFFLOAD_CHECKSUM_CAPABILITIES & ChecksumCapabilities,
     const NxDmaAdapter *DmaAdapter,
     const NxRingContext & ContextBuffer,
     NDIS_MEDIUM MediaType,
@@ -54,6 +66,7 @@ NxNblTranslator::NxNblTranslator(
     m_stats(Stats),
     m_rings(Rings),
     m_datapathCapabilities(DatapathCapabilities),
+    m_checksumCapabilities(ChecksumCapabilities),
     m_contextBuffer(ContextBuffer),
     m_mediaType(MediaType),
     m_dmaAdapter(DmaAdapter),
@@ -82,6 +95,212 @@ NxNblTranslator::RequiresDmaMapping(
     return m_datapathCapabilities.TxMemoryConstraints.MappingRequirement == NET_CLIENT_MEMORY_MAPPING_REQUIREMENT_DMA_MAPPED;
 }
 
+_Use_decl_annotations_
+bool
+NxNblTranslator::RequiresSoftwareSegmentation(
+    NET_BUFFER_LIST const &NetBufferList
+) const
+{
+    // Large sends are handed to the NIC as is only if it segments them
+    // itself, otherwise they are segmented here
+    auto const &lsoInfo =
+        *(NDIS_TCP_LARGE_SEND_OFFLOAD_NET_BUFFER_LIST_INFO const *)
+        &NetBufferList.NetBufferListInfo[TcpLargeSendNetBufferListInfo];
+
+    return lsoInfo.Value != 0 && !m_extensions.Extension.Lso.Enabled;
+}
+
+static
+bool
+IsIPv6(
+    NET_PACKET_LAYOUT const &layout
+)
+{
+    return
+        layout.Layer3Type >= NetPacketLayer3TypeIPv6UnspecifiedExtensions &&
+        layout.Layer3Type <= NetPacketLayer3TypeIPv6NoExtensions;
+}
+
+// Finds the IP and L4 headers the checksum request of a send applies to.
+// These are the outermost headers, FrameLayout, unless the protocol placed
+// the L4 header further in the frame, as it does for encapsulated frames.
+// The inner IP header is then the one ending right before it. HeaderOffset
+// is where the returned layout starts, it has no layer 2 header in the
+// inner case.
+static
+bool
+GetChecksumLayout(
+    _In_ NDIS_TCP_IP_CHECKSUM_NET_BUFFER_LIST_INFO const &ChecksumInfo,
+    _In_reads_bytes_(Length) UCHAR const *Frame,
+    _In_ ULONG Length,
+    _In_ NET_PACKET_LAYOUT const &FrameLayout,
+    _Out_ NET_PACKET_LAYOUT &Layout,
+    _Out_ ULONG &HeaderOffset
+)
+{
+    Layout = FrameLayout;
+    HeaderOffset = 0;
+
+    auto const layer4Offset = (ULONG)ChecksumInfo.Transmit.TcpHeaderOffset;
+
+    if ((! ChecksumInfo.Transmit.TcpChecksum && ! ChecksumInfo.Transmit.UdpChecksum) ||
+        layer4Offset == 0 ||
+        layer4Offset == (ULONG)(Layout.Layer2HeaderLength + Layout.Layer3HeaderLength))
+    {
+        return true;
+    }
+
+    if (layer4Offset >= Length)
+    {
+        return false;
+    }
+
+    // IPv4 header lengths are multiples of 4 bytes up to 60, inner IPv6
+    // headers are only located without extension headers
+    ULONG const minimumLength = ChecksumInfo.Transmit.IsIPv6 ? sizeof(IPV6_HEADER) : sizeof(IPV4_HEADER);
+    ULONG const maximumLength = ChecksumInfo.Transmit.IsIPv6 ? sizeof(IPV6_HEADER) : 60;
+
+    for (auto ipLength = minimumLength; ipLength <= maximumLength && ipLength <= layer4Offset; ipLength += 4)
+    {
+        auto const ipOffset = layer4Offset - ipLength;
+        auto const inner = NxGetFrameLayout(NdisMediumIP, Frame + ipOffset, Length - ipOffset);
+
+        if (inner.Layer3HeaderLength == ipLength &&
+            IsIPv6(inner) == !!ChecksumInfo.Transmit.IsIPv6 &&
+            inner.Layer4Type != NetPacketLayer4TypeUnspecified)
+        {
+            Layout = inner;
+            HeaderOffset = ipOffset;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+_Use_decl_annotations_
+bool
+NxNblTranslator::RequiresSoftwareChecksum(
+    NET_BUFFER_LIST const &NetBufferList,
+    NET_BUFFER &NetBuffer,
+    NET_PACKET_LAYOUT &Layout
+) const
+{
+    Layout = {};
+
+    auto const &checksumInfo =
+        *(NDIS_TCP_IP_CHECKSUM_NET_BUFFER_LIST_INFO const *)
+        &NetBufferList.NetBufferListInfo[TcpIpChecksumNetBufferListInfo];
+
+    auto const checksumRequested =
+        checksumInfo.Transmit.IpHeaderChecksum ||
+        checksumInfo.Transmit.TcpChecksum ||
+        checksumInfo.Transmit.UdpChecksum;
+
+    if (! checksumRequested)
+    {
+        return false;
+    }
+
+    if (! m_extensions.Extension.Checksum.Enabled)
+    {
+        return true;
+    }
+
+    // The NIC only computes the checksums it advertised
+    if ((checksumInfo.Transmit.IpHeaderChecksum && ! m_checksumCapabilities.IPv4) ||
+        (checksumInfo.Transmit.TcpChecksum && ! m_checksumCapabilities.Tcp) ||
+        (checksumInfo.Transmit.UdpChecksum && ! m_checksumCapabilities.Udp))
+    {
+        return true;
+    }
+
+    // and only over a plain IP header. IPv4 headers, with or without
+    // options, are covered unless the L4 header lies beyond them.
+    auto const layer4Offset = (ULONG)checksumInfo.Transmit.TcpHeaderOffset;
+
+    if (! checksumInfo.Transmit.IsIPv6 && layer4Offset <= MAX_IPV4_LAYER4_OFFSET)
+    {
+        return false;
+    }
+
+    // IPv6 extension headers and the inner headers of an encapsulated frame
+    // are not covered. The headers are parsed in place when contiguous and
+    // the layout handed back for the NET_PACKET.
+    auto const length = (ULONG)min(
+        (size_t)NET_BUFFER_DATA_LENGTH(&NetBuffer),
+        layer4Offset != 0
+            ? min((size_t)layer4Offset + MAX_TCP_HEADER_SIZE, (size_t)MAX_CHECKSUM_HEADER_SIZE)
+            : (size_t)MAX_CHECKSUM_HEADER_SIZE);
+
+    UCHAR storage[MAX_CHECKSUM_HEADER_SIZE];
+    auto const headers = static_cast<UCHAR const *>(NdisGetDataBuffer(&NetBuffer, length, storage, 1, 0));
+
+    if (headers == nullptr)
+    {
+        return true;
+    }
+
+    Layout = NxGetFrameLayout(m_mediaType, headers, length);
+
+    NET_PACKET_LAYOUT checksumLayout;
+    ULONG headerOffset;
+
+    return
+        ! GetChecksumLayout(checksumInfo, headers, length, Layout, checksumLayout, headerOffset) ||
+        headerOffset != 0 ||
+        checksumLayout.Layer3Type == NetPacketLayer3TypeIPv6WithExtensions;
+}
+
+_Use_decl_annotations_
+void
+NxNblTranslator::ChecksumBouncedPacket(
+    NET_BUFFER_LIST const &NetBufferList,
+    NET_PACKET const &Packet,
+    UINT32 PacketIndex
+) const
+{
+    // The NET_BUFFER's memory belongs to the protocol, checksums are only
+    // written to our own copy of the frame
+    NT_ASSERT(Packet.FragmentCount == 1);
+
+    auto const &checksumInfo =
+        *(NDIS_TCP_IP_CHECKSUM_NET_BUFFER_LIST_INFO const *)
+        &NetBufferList.NetBufferListInfo[TcpIpChecksumNetBufferListInfo];
+
+    auto const fr = NetRingCollectionGetFragmentRing(m_rings);
+    auto const fragment = NetRingGetFragmentAtIndex(fr, Packet.FragmentIndex);
+    auto const virtualAddress = NetExtensionGetFragmentVirtualAddress(
+        &m_extensions.Extension.VirtualAddress, Packet.FragmentIndex);
+    auto const backfill = (ULONG)m_datapathCapabilities.TxPayloadBackfill;
+    auto const frame = static_cast<UCHAR *>(virtualAddress->VirtualAddress) + fragment->Offset + backfill;
+    auto const frameLength = (ULONG)fragment->ValidLength - backfill;
+
+    // The checksums are all computed here, the NIC must not touch them again
+    auto const & checksumExtension = m_extensions.Extension.Checksum;
+    if (checksumExtension.Enabled)
+    {
+        RtlZeroMemory(
+            NetExtensionGetPacketChecksum(&checksumExtension, PacketIndex),
+            NET_PACKET_EXTENSION_CHECKSUM_VERSION_1_SIZE);
+    }
+
+    NET_PACKET packet = Packet;
+    ULONG headerOffset;
+
+    if (! GetChecksumLayout(checksumInfo, frame, frameLength, Packet.Layout, packet.Layout, headerOffset))
+    {
+        m_stats.Packet.UnlocatedChecksum += 1;
+        return;
+    }
+
+    NxChecksumTxFrame(
+        packet,
+        NxTranslateTxPacketChecksum(packet, checksumInfo),
+        frame + headerOffset,
+        frameLength - headerOffset);
+}
+
 _Use_decl_annotations_
 void
 NxNblTranslator::TranslateNetBufferListOOBDataToNetPacketExtensions(
@@ -761,6 +980,160 @@ GetPacketBytes(
     return bytes;
 }
 
+_Use_decl_annotations_
+NxNblTranslationStatus
+NxNblTranslator::SegmentNetBuffer(
+    NET_BUFFER_LIST const &NetBufferList,
+    NET_BUFFER const &NetBuffer,
+    NxBounceBufferPool &BouncePool
+) const
+/*
+
+Description:
+
+    Slices a large send NET_BUFFER into MSS sized NET_PACKETs, each bounced
+    into a single fragment with its own copy of the headers. Either all
+    segments are posted or none of them are.
+
+Return value:
+
+    Segmented - The segments were posted. The packet ring's EndIndex points
+    to the last segment, which the caller is responsible to advance past.
+
+*/
+{
+    auto const &lsoInfo =
+        *(NDIS_TCP_LARGE_SEND_OFFLOAD_NET_BUFFER_LIST_INFO const *)
+        &NetBufferList.NetBufferListInfo[TcpLargeSendNetBufferListInfo];
+
+    ULONG mss;
+    ULONG tcpHeaderOffset;
+
+    switch (lsoInfo.Transmit.Type)
+    {
+    case NDIS_TCP_LARGE_SEND_OFFLOAD_V1_TYPE:
+        mss = lsoInfo.LsoV1Transmit.MSS;
+        tcpHeaderOffset = lsoInfo.LsoV1Transmit.TcpHeaderOffset;
+        break;
+    default:
+        mss = lsoInfo.LsoV2Transmit.MSS;
+        tcpHeaderOffset = lsoInfo.LsoV2Transmit.TcpHeaderOffset;
+        break;
+    }
+
+    TCP_HDR tcp;
+    if (mss == 0 ||
+        NxCopyNetBufferData(NetBuffer, tcpHeaderOffset, sizeof(tcp), &tcp) != sizeof(tcp))
+    {
+        return NxNblTranslationStatus::CannotTranslate;
+    }
+
+    auto const tcpHeaderLength = (ULONG)tcp.th_len * 4;
+    auto const headerLength = tcpHeaderOffset + tcpHeaderLength;
+    auto const dataLength = NET_BUFFER_DATA_LENGTH(&NetBuffer);
+
+    if (tcpHeaderLength < sizeof(TCP_HDR) || dataLength <= headerLength)
+    {
+        return NxNblTranslationStatus::CannotTranslate;
+    }
+
+    auto const payloadLength = dataLength - headerLength;
+    auto const segmentCount = (payloadLength + mss - 1) / mss;
+
+    auto pr = NetRingCollectionGetPacketRing(m_rings);
+    auto fr = NetRingCollectionGetFragmentRing(m_rings);
+
+    if (segmentCount > pr->NumberOfElements - 1 || segmentCount > fr->NumberOfElements - 1)
+    {
+        return NxNblTranslationStatus::CannotTranslate;
+    }
+
+    if (NetRingGetRangeCount(pr, pr->EndIndex, (pr->OSReserved0 - 1) & pr->ElementIndexMask) < segmentCount ||
+        NetRingGetRangeCount(fr, fr->EndIndex, (fr->BeginIndex - 1) & fr->ElementIndexMask) < segmentCount)
+    {
+        return NxNblTranslationStatus::InsufficientResources;
+    }
+
+    auto const packetBegin = pr->EndIndex;
+    auto const fragmentBegin = fr->EndIndex;
+    auto const backfill = (ULONG)m_datapathCapabilities.TxPayloadBackfill;
+
+    // Returns whatever was posted so far if the whole NET_BUFFER can't be
+    // segmented in one go
+    auto const unwind = [&](UINT32 Count)
+    {
+        for (UINT32 i = 0; i < Count; i++)
+        {
+            auto packet = NetRingGetPacketAtIndex(pr, NetRingAdvanceIndex(pr, packetBegin, i));
+
+            if (packet->FragmentCount != 0)
+            {
+                BouncePool.FreeBounceBuffers(*packet);
+            }
+
+            RtlZeroMemory(packet, pr->ElementStride);
+        }
+
+        fr->EndIndex = fragmentBegin;
+    };
+
+    for (UINT32 i = 0; i < segmentCount; i++)
+    {
+        auto const packetIndex = NetRingAdvanceIndex(pr, packetBegin, i);
+        auto packet = NetRingGetPacketAtIndex(pr, packetIndex);
+        auto const payloadOffset = i * mss;
+
+        if (!BouncePool.BounceNetBufferSegment(
+            NetBuffer,
+            headerLength,
+            headerLength + payloadOffset,
+            min(mss, payloadLength - payloadOffset),
+            *packet))
+        {
+            auto const ignore = packet->Ignore;
+            unwind(i + 1);
+
+            if (ignore)
+            {
+                return NxNblTranslationStatus::CannotTranslate;
+            }
+
+            m_stats.Packet.BounceFailure += 1;
+            return NxNblTranslationStatus::InsufficientResources;
+        }
+
+        packet->Layout = NxGetPacketLayout(m_mediaType, m_rings, m_extensions.Extension.VirtualAddress, packet, backfill);
+
+        if (packet->Layout.Layer4Type != NetPacketLayer4TypeTcp ||
+            packet->Layout.Layer2HeaderLength + packet->Layout.Layer3HeaderLength != tcpHeaderOffset)
+        {
+            unwind(i + 1);
+            return NxNblTranslationStatus::CannotTranslate;
+        }
+
+        auto const fragment = NetRingGetFragmentAtIndex(fr, packet->FragmentIndex);
+        auto const virtualAddress = NetExtensionGetFragmentVirtualAddress(
+            &m_extensions.Extension.VirtualAddress, packet->FragmentIndex);
+
+        NxFixupLargeSendSegment(
+            *packet,
+            static_cast<UCHAR *>(virtualAddress->VirtualAddress) + fragment->Offset + backfill,
+            (UINT32)fragment->ValidLength - backfill,
+            payloadOffset,
+            static_cast<UINT16>(i),
+            i == segmentCount - 1);
+
+        TranslateNetBufferListOOBDataToNetPacketExtensions(NetBufferList, packet, packetIndex);
+        m_genStats.Increment(NxStatisticsCounters::NumberOfPackets);
+        m_genStats.IncrementBy(NxStatisticsCounters::BytesOfData, (ULONG64)fragment->ValidLength - backfill);
+    }
+
+    m_stats.Packet.SoftwareSegments += segmentCount;
+    pr->EndIndex = NetRingAdvanceIndex(pr, packetBegin, segmentCount - 1);
+
+    return NxNblTranslationStatus::Segmented;
+}
+
 _Use_decl_annotations_
 ULONG
 NxNblTranslator::TranslateNbls(
@@ -781,8 +1154,26 @@ NxNblTranslator::TranslateNbls(
 
         auto currentPacket = NetRingGetPacketAtIndex(pr, pr->EndIndex);
 
-        switch (TranslateNetBufferToNetPacket(*currentNetBuffer, currentPacket))
+        // Checksums the NIC can't compute for this packet are filled in a
+        // bounced copy of the frame
+        // A layout parsed to decide on the checksum is reused for the packet
+        NET_PACKET_LAYOUT layout = {};
+        auto const softwareSegmentation = RequiresSoftwareSegmentation(*currentNbl);
+        auto const softwareChecksum =
+            ! softwareSegmentation &&
+            RequiresSoftwareChecksum(*currentNbl, *currentNetBuffer, layout);
+
+        auto const status =
+            softwareSegmentation ? SegmentNetBuffer(*currentNbl, *currentNetBuffer, BouncePool) :
+            softwareChecksum ? NxNblTranslationStatus::BounceRequired :
+            TranslateNetBufferToNetPacket(*currentNetBuffer, currentPacket);
+
+        switch (status)
         {
+        case NxNblTranslationStatus::Segmented:
+            // The segments were fully translated, the last one is at EndIndex
+            break;
+
         case NxNblTranslationStatus::BounceRequired:
             // The buffers in the NET_BUFFER's MDL chain cannot be transmitted as is. As such we need
             // to bounce the packet
@@ -811,8 +1202,16 @@ NxNblTranslator::TranslateNbls(
             __fallthrough;
 
         case NxNblTranslationStatus::Success:
-            currentPacket->Layout = NxGetPacketLayout(m_mediaType, m_rings, m_extensions.Extension.VirtualAddress, currentPacket, m_datapathCapabilities.TxPayloadBackfill);
+            currentPacket->Layout = layout.Layer2Type != NetPacketLayer2TypeUnspecified
+                ? layout
+                : NxGetPacketLayout(m_mediaType, m_rings, m_extensions.Extension.VirtualAddress, currentPacket, m_datapathCapabilities.TxPayloadBackfill);
             TranslateNetBufferListOOBDataToNetPacketExtensions(*currentNbl, currentPacket, pr->EndIndex);
+
+            if (softwareChecksum)
+            {
+                ChecksumBouncedPacket(*currentNbl, *currentPacket, pr->EndIndex);
+            }
+
             m_genStats.Increment(NxStatisticsCounters::NumberOfPackets);
             m_genStats.IncrementBy(NxStatisticsCounters::BytesOfData, (ULONG64)GetPacketBytes(m_rings, currentPacket));
             break;
@@ -861,7 +1260,49 @@ NxNblTranslator::TranslateNetPacketExtensionsCompletionToNetBufferList(
 ) const
 {
     auto const & lsoExtension = m_extensions.Extension.Lso;
-    if (lsoExtension.Enabled && netPacket->Layout.Layer4Type == NetPacketLayer4TypeTcp)
+    if (!lsoExtension.Enabled)
+    {
+        // Any large send was segmented in software
+        auto &lsoInfo =
+            *reinterpret_cast<NDIS_TCP_LARGE_SEND_OFFLOAD_NET_BUFFER_LIST_INFO*>(
+                &netBufferList->NetBufferListInfo[TcpLargeSendNetBufferListInfo]);
+
+        if (lsoInfo.Value != 0)
+        {
+            auto const lsoType = lsoInfo.Transmit.Type;
+            lsoInfo.Value = 0;
+
+            switch (lsoType)
+            {
+            case NDIS_TCP_LARGE_SEND_OFFLOAD_V1_TYPE:
+                {
+                    // Every NET_BUFFER carries the same headers as the last
+                    // segment posted for the NBL
+                    auto const headerLength =
+                        netPacket->Layout.Layer2HeaderLength +
+                        netPacket->Layout.Layer3HeaderLength +
+                        netPacket->Layout.Layer4HeaderLength;
+
+                    ULONG tcpPayload = 0;
+                    for (auto nb = NET_BUFFER_LIST_FIRST_NB(netBufferList); nb; nb = NET_BUFFER_NEXT_NB(nb))
+                    {
+                        if (NET_BUFFER_DATA_LENGTH(nb) > headerLength)
+                        {
+                            tcpPayload += NET_BUFFER_DATA_LENGTH(nb) - headerLength;
+                        }
+                    }
+
+                    lsoInfo.LsoV1TransmitComplete.Type = lsoType;
+                    lsoInfo.LsoV1TransmitComplete.TcpPayload = tcpPayload;
+                }
+                break;
+            case NDIS_TCP_LARGE_SEND_OFFLOAD_V2_TYPE:
+                lsoInfo.LsoV2TransmitComplete.Type = lsoType;
+                break;
+            }
+        }
+    }
+    else if (netPacket->Layout.Layer4Type == NetPacketLayer4TypeTcp)
     {
         // lso requires special markings upon completion.
         auto &lsoInfo =
@@ -934,6 +1375,12 @@ NxNblTranslator::CompletePackets(
         // Free any bounce buffers allocated for this packet
         BouncePool.FreeBounceBuffers(*packet);
 
+        auto fr = NetRingCollectionGetFragmentRing(m_rings);
+        for (UINT32 i = 0; i < packet->FragmentCount; i++)
+        {
+            result.CompletedBytes += NetRingGetFragmentAtIndex(fr, NetRingAdvanceIndex(fr, packet->FragmentIndex, i))->ValidLength;
+        }
+
         if (auto completedNbl = extension.NetBufferListToComplete)
         {
             extension.NetBufferListToComplete = nullptr;
@@ -942,6 +1389,11 @@ NxNblTranslator::CompletePackets(
             completedNbl->Next = result.CompletedChain;
             result.CompletedChain = completedNbl;
 
+            if (!result.CompletedChainTail)
+            {
+                result.CompletedChainTail = completedNbl;
+            }
+
             TranslateNetPacketExtensionsCompletionToNetBufferList(
                 packet,
                 completedNbl);
@@ -20,6 +20,8 @@ struct NxNblTranslationStats
         UINT64 BounceFailure = 0;
         UINT64 CannotTranslate = 0;
         UINT64 UnalignedBuffer = 0;
+        UINT64 SoftwareSegments = 0;
+        UINT64 UnlocatedChecksum = 0;
     } Packet;
 
     struct
@@ -37,7 +39,8 @@ enum class NxNblTranslationStatus
     Success,
     InsufficientResources,
     BounceRequired,
-    CannotTranslate
+    CannotTranslate,
+    Segmented
 };
 
 struct MdlTranlationResult
@@ -67,9 +70,15 @@ struct TxPacketCompletionStatus
     NET_BUFFER_LIST *
         CompletedChain = nullptr;
 
+    NET_BUFFER_LIST *
+        CompletedChainTail = nullptr;
+
     ULONG
         NumCompletedNbls = 0;
 
+    ULONG64
+        CompletedBytes = 0;
+
     ULONG
         CompletedPackets = 0;
 
@@ -96,6 +105,7 @@ class NONPAGED NxNblTranslator
     const NDIS_MEDIUM m_mediaType;
     NET_RING_COLLECTION * m_rings;
     const NET_CLIENT_ADAPTER_DATAPATH_CAPABILITIES & m_datapathCapabilities;
+    const NET_CLIENT_OFFLOAD_CHECKSUM_CAPABILITIES & m_checksumCapabilities;
     size_t m_maxFragmentsPerPacket;
     NxStatistics & m_genStats;
 
@@ -117,6 +127,34 @@ class NONPAGED NxNblTranslator
         void
     ) const;
 
+    bool
+    RequiresSoftwareSegmentation(
+        _In_ NET_BUFFER_LIST const &NetBufferList
+    ) const;
+
+    // Layout is the frame's layout if its headers had to be parsed to
+    // decide, zeroed otherwise
+    bool
+    RequiresSoftwareChecksum(
+        _In_ NET_BUFFER_LIST const &NetBufferList,
+        _In_ NET_BUFFER &NetBuffer,
+        _Out_ NET_PACKET_LAYOUT &Layout
+    ) const;
+
+    void
+    ChecksumBouncedPacket(
+        _In_ NET_BUFFER_LIST const &NetBufferList,
+        _In_ NET_PACKET const &Packet,
+        _In_ UINT32 PacketIndex
+    ) const;
+
+    NxNblTranslationStatus
+    SegmentNetBuffer(
+        _In_ NET_BUFFER_LIST const &NetBufferList,
+        _In_ NET_BUFFER const &NetBuffer,
+        _In_ NxBounceBufferPool &BouncePool
+    ) const;
+
     bool
     ShouldBounceFragment(
         _In_ NET_FRAGMENT const * const Fragment,
@@ -178,6 +216,7 @@ public:
         NxNblTranslationStats &Stats,
         NET_RING_COLLECTION * Rings,
         const NET_CLIENT_ADAPTER_DATAPATH_CAPABILITIES & DatapathCapabilities,
+        const NET_CLIENT_OFFLOAD_CHECKSUM_CAPABILITIES & ChecksumCapabilities,
         const NxDmaAdapter *DmaAdapter,
         const NxRingContext & ContextBuffer,
         NDIS_MEDIUM MediaType,
@@ -11,6 +11,16 @@
 
 #include "NxTranslationApp.hpp"
 
+static
+NET_CLIENT_OFFLOAD_LSO_CAPABILITIES const
+SoftwareLsoCapabilities = {
+    sizeof(NET_CLIENT_OFFLOAD_LSO_CAPABILITIES),
+    TRUE,
+    TRUE,
+    64000,
+    2
+};
+
 _Use_decl_annotations_
 NxTaskOffload::NxTaskOffload(
     NxTranslationApp & App,
@@ -24,7 +34,7 @@ NxTaskOffload::NxTaskOffload(
 _Use_decl_annotations_
 NTSTATUS
 NxTaskOffload::Initialize(
-    void
+    bool EnableSoftwareLso
 )
 {
     //
@@ -67,6 +77,21 @@ NxTaskOffload::Initialize(
         m_app.GetAdapter(),
         &m_activeLsoCapabilities);
 
+    //
+    // If the NIC can't segment, advertise LSO to NDIS anyway and have the
+    // Tx translator segment large sends. The client driver is never told
+    // about it.
+    //
+
+    m_softwareLso = EnableSoftwareLso && !lsoHardwareCapabilities.IPv4 && !lsoHardwareCapabilities.IPv6;
+
+    if (m_softwareLso)
+    {
+        lsoHardwareCapabilities = SoftwareLsoCapabilities;
+        lsoDefaultCapabilities = SoftwareLsoCapabilities;
+        m_activeLsoCapabilities = SoftwareLsoCapabilities;
+    }
+
     //
     // RSC hardware and default capabilities to indicate to NDIS
     //
@@ -201,7 +226,14 @@ NxTaskOffload::CheckActiveCapabilities(
     }
 
     NET_CLIENT_OFFLOAD_LSO_CAPABILITIES lsoCapabilities = {};
-    m_dispatch.GetLsoDefaultCapabilities(m_app.GetAdapter(), &lsoCapabilities);
+    if (m_softwareLso)
+    {
+        lsoCapabilities = SoftwareLsoCapabilities;
+    }
+    else
+    {
+        m_dispatch.GetLsoDefaultCapabilities(m_app.GetAdapter(), &lsoCapabilities);
+    }
 
     if ((lsoCapabilities.IPv4 == FALSE && 
         OffloadParameters.LsoV1 == NDIS_OFFLOAD_PARAMETERS_LSOV1_ENABLED &&
@@ -551,9 +583,12 @@ NxTaskOffload::SetActiveCapabilities(
 
     m_activeChecksumCapabilities = ChecksumCapabilities;
 
-    m_dispatch.SetLsoActiveCapabilities(
-        m_app.GetAdapter(),
-        &LsoCapabilities);
+    if (!m_softwareLso)
+    {
+        m_dispatch.SetLsoActiveCapabilities(
+            m_app.GetAdapter(),
+            &LsoCapabilities);
+    }
 
     m_activeLsoCapabilities = LsoCapabilities;
 
@@ -731,6 +766,11 @@ NxTaskOffload::IsLsoOffloadSupported(
     void
 ) const
 {
+    if (m_softwareLso)
+    {
+        return true;
+    }
+
     NET_CLIENT_OFFLOAD_LSO_CAPABILITIES lsoHardwareCapabilities = {};
     m_dispatch.GetLsoHardwareCapabilities(m_app.GetAdapter(), &lsoHardwareCapabilities);
 
@@ -33,7 +33,7 @@ public:
     _IRQL_requires_(PASSIVE_LEVEL)
     NTSTATUS
     Initialize(
-        void
+        _In_ bool EnableSoftwareLso
     );
 
 private:
@@ -53,6 +53,11 @@ private:
     NET_CLIENT_OFFLOAD_RSC_CAPABILITIES
         m_activeRscCapabilities = {};
 
+    // The NIC has no LSO hardware and large sends are segmented by the
+    // Tx translator instead
+    bool
+        m_softwareLso = false;
+
     //
     // Methods to translate the offload capabilities between different 
     // NDIS and NetAdapter representations
@@ -13,55 +13,17 @@
 #define IP_VERSION_4 4
 #define IP_VERSION_6 6
 
-_Success_(return)
-bool
-NxGetPacketEtherType(
-    _In_ NET_RING_COLLECTION const * descriptor,
-    _In_ NET_EXTENSION const & virtualAddressExtension,
-    _In_ NET_PACKET const *packet,
-    _Out_ USHORT *ethertype)
-{
-    auto fr = NetRingCollectionGetFragmentRing(descriptor);
-    auto const fragment = NetRingGetFragmentAtIndex(fr, packet->FragmentIndex);
-    auto const virtualAddress = NetExtensionGetFragmentVirtualAddress(
-        &virtualAddressExtension, packet->FragmentIndex);
-    auto buffer = (UCHAR const*)virtualAddress->VirtualAddress + fragment->Offset;
-    auto bytesRemaining = (ULONG)fragment->ValidLength;
-
-    if (bytesRemaining < sizeof(ETHERNET_HEADER))
-        return false;
-
-    auto ethernet = (ETHERNET_HEADER UNALIGNED const*)buffer;
-    *ethertype = RtlUshortByteSwap(ethernet->Type);
-
-    if (*ethertype >= ETHERNET_TYPE_MINIMUM)
-    {
-        return true;
-    }
-    else if (bytesRemaining >= sizeof(SNAP_HEADER))
-    {
-        auto snap = (SNAP_HEADER UNALIGNED const *)(ethernet + 1);
-        if (snap->Control == SNAP_CONTROL &&
-            snap->Dsap == SNAP_DSAP &&
-            snap->Ssap == SNAP_SSAP &&
-            snap->Oui[0] == SNAP_OUI &&
-            snap->Oui[1] == SNAP_OUI &&
-            snap->Oui[2] == SNAP_OUI)
-        {
-            *ethertype = RtlUshortByteSwap(snap->Type);
-            return true;
-        }
-    }
-
-    return false;
-}
+// Enough for an Ethernet + SNAP header, an IPv4 header with options and a TCP
+// header with options, or an IPv6 header with a few extension headers.
+#define MAX_GATHERED_HEADER_SIZE 256
 
 static
 void
 ParseEthernetHeader(
     _Outref_result_bytebuffer_(bytesRemaining) UCHAR const *&buffer,
     _Inout_ ULONG &bytesRemaining,
-    _Out_ NET_PACKET_LAYOUT &layout)
+    _Out_ NET_PACKET_LAYOUT &layout,
+    _Out_ USHORT &etherType)
 {
     if (bytesRemaining < sizeof(ETHERNET_HEADER))
         return;
@@ -105,6 +67,8 @@ ParseEthernetHeader(
         return;
     }
 
+    etherType = ethertype;
+
     switch (ethertype)
     {
     case ETHERNET_TYPE_IPV4:
@@ -171,7 +135,10 @@ ParseIPv4Header(
 
     auto ip = (IPV4_HEADER UNALIGNED const*)buffer;
     auto length = Ip4HeaderLengthInBytes(ip);
-    if (bytesRemaining < length || length > MAX_IPV4_HLEN)
+    if (ip->Version != IP_VERSION_4 ||
+        length < sizeof(IPV4_HEADER) ||
+        length > MAX_IPV4_HLEN ||
+        bytesRemaining < length)
     {
         layout.Layer3Type = NetPacketLayer3TypeUnspecified;
         return;
@@ -181,7 +148,11 @@ ParseIPv4Header(
         ? NetPacketLayer3TypeIPv4NoOptions
         : NetPacketLayer3TypeIPv4WithOptions;
     layout.Layer3HeaderLength = length;
-    layout.Layer4Type = GetLayer4Type(ip->Protocol);
+
+    // Only the first fragment of a datagram carries the layer 4 header
+    layout.Layer4Type = ((ip->FlagsOffset & IP4_OFF_MASK) == 0)
+        ? GetLayer4Type(ip->Protocol)
+        : NetPacketLayer4TypeUnspecified;
     buffer += length;
     bytesRemaining -= length;
 }
@@ -245,7 +216,11 @@ ParseIPv6ExtensionHeader(
             return IPv6ExtensionParseResult::MalformedExtension;
         }
 
-        *nextHeaderType = extension->NextHeader;
+        // Only the first fragment of a datagram carries the upper layer
+        // header, report anything else as having no next header.
+        *nextHeaderType = ((extension->OffsetAndFlags & IP6F_OFF_MASK) == 0)
+            ? extension->NextHeader
+            : IPPROTO_NONE;
         *length = sizeof(IPV6_FRAGMENT_HEADER);
         return IPv6ExtensionParseResult::Ok;
     }
@@ -268,6 +243,12 @@ ParseIPv6Header(
     }
 
     auto ip = (IPV6_HEADER UNALIGNED const*)buffer;
+    if ((buffer[0] >> 4) != IP_VERSION_6)
+    {
+        layout.Layer3Type = NetPacketLayer3TypeUnspecified;
+        return;
+    }
+
     auto nextHeader = (ULONG)ip->NextHeader;
 
     auto offset = (ULONG)sizeof(IPV6_HEADER);
@@ -324,7 +305,7 @@ ParseTcpHeader(
 
     auto tcp = (TCP_HDR UNALIGNED const *)buffer;
     auto length = (ULONG)tcp->th_len * 4;
-    if (bytesRemaining < length || length > TH_MAX_LEN)
+    if (length < sizeof(TCP_HDR) || length > TH_MAX_LEN || bytesRemaining < length)
     {
         layout.Layer4Type = NetPacketLayer4TypeUnspecified;
         return;
@@ -355,31 +336,52 @@ ParseUdpHeader(
     bytesRemaining -= UDP_HEADER_SIZE;
 }
 
-NET_PACKET_LAYOUT
-NxGetPacketLayout(
-    _In_ NDIS_MEDIUM mediaType,
+static
+ULONG
+GatherPacketHeaders(
     _In_ NET_RING_COLLECTION const * descriptor,
     _In_ NET_EXTENSION const & virtualAddressExtension,
     _In_ NET_PACKET const *packet,
-    _In_ size_t PayloadBackfill)
+    _In_reads_bytes_(firstFragmentLength) UCHAR const *firstFragment,
+    _In_ ULONG firstFragmentLength,
+    _Out_writes_bytes_to_(MAX_GATHERED_HEADER_SIZE, return) UCHAR *headers)
 {
-    NT_ASSERT(packet->FragmentCount != 0);
-
     auto fr = NetRingCollectionGetFragmentRing(descriptor);
-    auto const fragment = NetRingGetFragmentAtIndex(fr, packet->FragmentIndex);
-    auto const virtualAddress = NetExtensionGetFragmentVirtualAddress(
-        &virtualAddressExtension, packet->FragmentIndex);
+    auto gathered = firstFragmentLength;
 
-    // Skip the backfill space
-    auto buffer = (UCHAR const*)virtualAddress->VirtualAddress + fragment->Offset + PayloadBackfill;
-    auto bytesRemaining = (ULONG)fragment->ValidLength - (ULONG)PayloadBackfill;
+    RtlCopyMemory(headers, firstFragment, gathered);
 
-    NET_PACKET_LAYOUT layout = { };
+    for (UINT32 i = 1; i < packet->FragmentCount && gathered < MAX_GATHERED_HEADER_SIZE; i++)
+    {
+        auto const index = NetRingAdvanceIndex(fr, packet->FragmentIndex, i);
+        auto const fragment = NetRingGetFragmentAtIndex(fr, index);
+        auto const virtualAddress = NetExtensionGetFragmentVirtualAddress(
+            &virtualAddressExtension, index);
+        auto const length = (ULONG)min(fragment->ValidLength, (UINT64)(MAX_GATHERED_HEADER_SIZE - gathered));
+
+        RtlCopyMemory(
+            headers + gathered,
+            (UCHAR const*)virtualAddress->VirtualAddress + fragment->Offset,
+            length);
+        gathered += length;
+    }
 
+    return gathered;
+}
+
+static
+void
+ParseFrame(
+    _In_ NDIS_MEDIUM mediaType,
+    _In_reads_bytes_(bytesRemaining) UCHAR const *buffer,
+    _In_ ULONG bytesRemaining,
+    _Out_ NET_PACKET_LAYOUT &layout,
+    _Out_ USHORT &etherType)
+{
     switch (mediaType)
     {
     case NdisMedium802_3:
-        ParseEthernetHeader(buffer, bytesRemaining, layout);
+        ParseEthernetHeader(buffer, bytesRemaining, layout, etherType);
         break;
     case NdisMediumIP:
     case NdisMediumWiMAX:
@@ -407,6 +409,76 @@ NxGetPacketLayout(
         ParseUdpHeader(buffer, bytesRemaining, layout);
         break;
     }
+}
+
+NET_PACKET_LAYOUT
+NxGetFrameLayout(
+    _In_ NDIS_MEDIUM mediaType,
+    _In_reads_bytes_(length) UCHAR const *frame,
+    _In_ ULONG length)
+{
+    NET_PACKET_LAYOUT layout = { };
+    USHORT etherType = 0;
+
+    ParseFrame(mediaType, frame, length, layout, etherType);
+
+    return layout;
+}
+
+NET_PACKET_LAYOUT
+NxGetPacketLayout(
+    _In_ NDIS_MEDIUM mediaType,
+    _In_ NET_RING_COLLECTION const * descriptor,
+    _In_ NET_EXTENSION const & virtualAddressExtension,
+    _In_ NET_PACKET const *packet,
+    _In_ size_t PayloadBackfill)
+{
+    USHORT etherType;
+
+    return NxGetPacketLayout(mediaType, descriptor, virtualAddressExtension, packet, &etherType, PayloadBackfill);
+}
+
+NET_PACKET_LAYOUT
+NxGetPacketLayout(
+    _In_ NDIS_MEDIUM mediaType,
+    _In_ NET_RING_COLLECTION const * descriptor,
+    _In_ NET_EXTENSION const & virtualAddressExtension,
+    _In_ NET_PACKET const *packet,
+    _Out_ USHORT *etherType,
+    _In_ size_t PayloadBackfill)
+{
+    *etherType = 0;
+
+    NT_ASSERT(packet->FragmentCount != 0);
+
+    auto fr = NetRingCollectionGetFragmentRing(descriptor);
+    auto const fragment = NetRingGetFragmentAtIndex(fr, packet->FragmentIndex);
+    auto const virtualAddress = NetExtensionGetFragmentVirtualAddress(
+        &virtualAddressExtension, packet->FragmentIndex);
+
+    NET_PACKET_LAYOUT layout = { };
+
+    if (fragment->ValidLength < PayloadBackfill)
+    {
+        return layout;
+    }
+
+    // Skip the backfill space
+    auto buffer = (UCHAR const*)virtualAddress->VirtualAddress + fragment->Offset + PayloadBackfill;
+    auto bytesRemaining = (ULONG)fragment->ValidLength - (ULONG)PayloadBackfill;
+
+    // The headers may be split across fragments, e.g. a send whose Ethernet
+    // header sits in its own MDL. Gather the start of the frame so the code
+    // below parses every layer in a single pass over contiguous memory.
+    UCHAR headers[MAX_GATHERED_HEADER_SIZE];
+    if (bytesRemaining < sizeof(headers) && packet->FragmentCount > 1)
+    {
+        bytesRemaining = GatherPacketHeaders(
+            descriptor, virtualAddressExtension, packet, buffer, bytesRemaining, headers);
+        buffer = headers;
+    }
+
+    ParseFrame(mediaType, buffer, bytesRemaining, layout, *etherType);
 
     return layout;
 }
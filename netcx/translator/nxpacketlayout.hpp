@@ -4,18 +4,30 @@
 
 #include <net/packet.h>
 
-_Success_(return)
-bool
-NxGetPacketEtherType(
+NET_PACKET_LAYOUT
+NxGetPacketLayout(
+    _In_ NDIS_MEDIUM mediaType,
     _In_ NET_RING_COLLECTION const *descriptor,
     _In_ NET_EXTENSION const & virtualAddressExtension,
     _In_ NET_PACKET const *packet,
-    _Out_ USHORT *ethertype);
+    _In_ size_t PayloadBackfill = 0);
 
+// Same as above, also returns the EtherType found while parsing the layer 2
+// header (host byte order, 0 if there is none) so callers don't have to read
+// the header a second time.
 NET_PACKET_LAYOUT
 NxGetPacketLayout(
     _In_ NDIS_MEDIUM mediaType,
     _In_ NET_RING_COLLECTION const *descriptor,
     _In_ NET_EXTENSION const & virtualAddressExtension,
     _In_ NET_PACKET const *packet,
+    _Out_ USHORT *etherType,
     _In_ size_t PayloadBackfill = 0);
+
+// Parses a frame that is already contiguous in memory, e.g. the headers of a
+// send NBL retrieved with NdisGetDataBuffer.
+NET_PACKET_LAYOUT
+NxGetFrameLayout(
+    _In_ NDIS_MEDIUM mediaType,
+    _In_reads_bytes_(length) UCHAR const *frame,
+    _In_ ULONG length);
@@ -0,0 +1,304 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    Implements the per-processor datapath poller.
+
+--*/
+
+#include "NxXlatPrecomp.hpp"
+#include "NxXlatCommon.hpp"
+#include "NxPoller.tmh"
+#include "NxPoller.hpp"
+
+namespace
+{
+
+class NxPollerCollection :
+    public NxNonpagedAllocation<'cPxN'>
+{
+
+public:
+
+    ~NxPollerCollection(
+        void
+    )
+    {
+        for (auto & poller : m_pollers)
+        {
+            if (poller != nullptr)
+            {
+                delete poller;
+                poller = nullptr;
+            }
+        }
+    }
+
+    NTSTATUS
+    Initialize(
+        void
+    )
+    {
+        CX_RETURN_NTSTATUS_IF(
+            STATUS_INSUFFICIENT_RESOURCES,
+            ! m_pollers.resize(KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS)));
+
+        for (auto & poller : m_pollers)
+        {
+            poller = nullptr;
+        }
+
+        return STATUS_SUCCESS;
+    }
+
+    NTSTATUS
+    Get(
+        _In_ ULONG ProcessorIndex,
+        _In_ ULONG Priority,
+        _Out_ NxPoller ** Poller
+    )
+    {
+        CX_RETURN_NTSTATUS_IF(STATUS_INVALID_PARAMETER, ProcessorIndex >= m_pollers.count());
+
+        KLockThisExclusive lock(m_lock);
+
+        if (m_pollers[ProcessorIndex] == nullptr)
+        {
+            auto poller = wil::make_unique_nothrow<NxPoller>(ProcessorIndex, Priority);
+            CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES, ! poller);
+
+            CX_RETURN_IF_NOT_NT_SUCCESS(poller->Initialize());
+
+            m_pollers[ProcessorIndex] = poller.release();
+        }
+
+        *Poller = m_pollers[ProcessorIndex];
+
+        return STATUS_SUCCESS;
+    }
+
+private:
+
+    KPushLock
+        m_lock;
+
+    Rtl::KArray<NxPoller *, NonPagedPoolNx>
+        m_pollers;
+};
+
+NxPollerCollection *
+    g_pollerCollection = nullptr;
+
+}
+
+_Use_decl_annotations_
+NTSTATUS
+NxPoller::InitializeCollection(
+    void
+)
+{
+    auto collection = wil::make_unique_nothrow<NxPollerCollection>();
+    CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES, ! collection);
+
+    CX_RETURN_IF_NOT_NT_SUCCESS(collection->Initialize());
+
+    g_pollerCollection = collection.release();
+
+    return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+void
+NxPoller::CleanupCollection(
+    void
+)
+{
+    if (g_pollerCollection != nullptr)
+    {
+        delete g_pollerCollection;
+        g_pollerCollection = nullptr;
+    }
+}
+
+_Use_decl_annotations_
+NTSTATUS
+NxPoller::Get(
+    ULONG ProcessorIndex,
+    ULONG Priority,
+    NxPoller ** Poller
+)
+{
+    CX_RETURN_NTSTATUS_IF(STATUS_INVALID_DEVICE_STATE, g_pollerCollection == nullptr);
+
+    return g_pollerCollection->Get(ProcessorIndex, Priority, Poller);
+}
+
+_Use_decl_annotations_
+NxPoller::NxPoller(
+    ULONG ProcessorIndex,
+    ULONG Priority
+) noexcept :
+    m_processorIndex(ProcessorIndex),
+    m_priority(Priority)
+{
+}
+
+static EC_START_ROUTINE NetAdapterPollerThread;
+
+static
+EC_RETURN
+NetAdapterPollerThread(
+    PVOID StartContext
+)
+{
+    reinterpret_cast<NxPoller*>(StartContext)->PollerThread();
+    return EC_RETURN();
+}
+
+NTSTATUS
+NxPoller::Initialize(
+    void
+)
+{
+    CX_RETURN_IF_NOT_NT_SUCCESS_MSG(
+        m_executionContext.Initialize(this, NetAdapterPollerThread),
+        "Failed to start poller execution context. NxPoller=%p", this);
+
+    m_executionContext.Start();
+
+    return STATUS_SUCCESS;
+}
+
+NxPoller::~NxPoller(
+    void
+)
+{
+    // every hosted EC unregisters when its queue is destroyed
+    NT_FRE_ASSERT(m_contexts.count() == 0);
+
+    m_executionContext.Cancel();
+    m_executionContext.Stop();
+    m_executionContext.Terminate();
+}
+
+_Use_decl_annotations_
+NTSTATUS
+NxPoller::Register(
+    NxExecutionContext & ExecutionContext
+)
+{
+    KLockThisExclusive lock(m_lock);
+
+    CX_RETURN_NTSTATUS_IF(
+        STATUS_INSUFFICIENT_RESOURCES,
+        ! m_contexts.append(&ExecutionContext));
+
+    return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+void
+NxPoller::Unregister(
+    NxExecutionContext & ExecutionContext
+)
+{
+    // waits for the pass in progress, if any, to be done with the EC
+    KLockThisExclusive lock(m_lock);
+
+    for (size_t i = 0; i < m_contexts.count(); i++)
+    {
+        if (m_contexts[i] == &ExecutionContext)
+        {
+            m_contexts.eraseAt(i);
+            m_nextContext = 0;
+
+            return;
+        }
+    }
+
+    NT_FRE_ASSERT(false);
+}
+
+void
+NxPoller::SignalWork(
+    void
+)
+{
+    m_executionContext.SignalWork();
+}
+
+ULONG
+NxPoller::GetExecutionContextIdentifier(
+    void
+) const
+{
+    return m_executionContext.GetExecutionContextIdentifier();
+}
+
+void
+NxPoller::SetupThreadProperties(
+    void
+)
+{
+#if _KERNEL_MODE
+    KeSetBasePriorityThread(KeGetCurrentThread(), m_priority - (LOW_REALTIME_PRIORITY + LOW_PRIORITY) / 2);
+
+    PROCESSOR_NUMBER processor = {};
+    if (NT_SUCCESS(KeGetProcessorNumberFromIndex(m_processorIndex, &processor)))
+    {
+        GROUP_AFFINITY affinity = {};
+        affinity.Group = processor.Group;
+        affinity.Mask = AFFINITY_MASK(processor.Number);
+
+        KeSetSystemGroupAffinityThread(&affinity, nullptr);
+    }
+#endif
+}
+
+bool
+NxPoller::PollOnce(
+    void
+)
+{
+    KLockThisShared lock(m_lock);
+
+    auto const count = m_contexts.count();
+    auto busy = false;
+
+    // Each EC gets one iteration per pass, which is bounded by the size of its
+    // rings, before the next one gets a turn
+    for (size_t i = 0; i < count; i++)
+    {
+        busy |= m_contexts[(m_nextContext + i) % count]->Poll();
+    }
+
+    m_nextContext = count > 0 ? (m_nextContext + 1) % count : 0;
+
+    return busy;
+}
+
+void
+NxPoller::PollerThread(
+    void
+)
+{
+    SetupThreadProperties();
+
+    while (! m_executionContext.IsTerminated())
+    {
+        while (! m_executionContext.IsStopping())
+        {
+            // A hosted EC flags itself before signaling the poller, so work
+            // that shows up after this pass leaves the event set and the wait
+            // returns right away
+            if (! PollOnce())
+            {
+                m_executionContext.WaitForWork();
+            }
+        }
+
+        m_executionContext.SignalStopped();
+    }
+}
@@ -0,0 +1,130 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    Defines a per-processor poller that runs the datapath of several queues,
+    possibly belonging to different adapters, on a single thread.
+
+--*/
+
+#pragma once
+
+#include <KLockHolder.h>
+
+#include "NxExecutionContext.hpp"
+
+/// Drives every hosted execution context registered with it from one thread
+/// affinitized to a processor. Each pass visits the registered ECs round-robin
+/// and runs a single iteration of each one that has work, so no queue can
+/// starve the others. The thread sleeps only once a whole pass found every
+/// queue idle.
+class NxPoller :
+    public NxNonpagedAllocation<'oPxN'>
+{
+
+public:
+
+    /// Called once while the translator is loaded and after all queues are gone
+    /// respectively
+    static
+    NTSTATUS
+    InitializeCollection(
+        void
+    );
+
+    static
+    void
+    CleanupCollection(
+        void
+    );
+
+    /// Returns the poller for a processor, creating it the first time. Priority
+    /// only applies when the poller is created. Pollers live until the
+    /// collection is cleaned up.
+    _IRQL_requires_(PASSIVE_LEVEL)
+    static
+    NTSTATUS
+    Get(
+        _In_ ULONG ProcessorIndex,
+        _In_ ULONG Priority,
+        _Out_ NxPoller ** Poller
+    );
+
+    NxPoller(
+        _In_ ULONG ProcessorIndex,
+        _In_ ULONG Priority
+    ) noexcept;
+
+    ~NxPoller(
+        void
+    );
+
+    NTSTATUS
+    Initialize(
+        void
+    );
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    NTSTATUS
+    Register(
+        _In_ NxExecutionContext & ExecutionContext
+    );
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    void
+    Unregister(
+        _In_ NxExecutionContext & ExecutionContext
+    );
+
+    void
+    SignalWork(
+        void
+    );
+
+    ULONG
+    GetExecutionContextIdentifier(
+        void
+    ) const;
+
+    // the EC thread function
+    void
+    PollerThread(
+        void
+    );
+
+private:
+
+    void
+    SetupThreadProperties(
+        void
+    );
+
+    // Returns true if any hosted EC asked to run again
+    bool
+    PollOnce(
+        void
+    );
+
+    ULONG const
+        m_processorIndex;
+
+    ULONG const
+        m_priority;
+
+    NxExecutionContext
+        m_executionContext;
+
+    // Held shared for a whole pass, exclusive to add or remove an EC
+    KPushLock
+        m_lock;
+
+    Rtl::KArray<NxExecutionContext *, NonPagedPoolNx>
+        m_contexts;
+
+    // Where the next pass begins, rotated so that the order of the queues does
+    // not favor any of them
+    size_t
+        m_nextContext = 0;
+};
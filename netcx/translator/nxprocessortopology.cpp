@@ -0,0 +1,366 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    Implements the processor topology model.
+
+--*/
+
+#include "NxXlatPrecomp.hpp"
+#include "NxXlatCommon.hpp"
+#include "NxProcessorTopology.tmh"
+#include "NxProcessorTopology.hpp"
+
+namespace
+{
+
+_IRQL_requires_(PASSIVE_LEVEL)
+NTSTATUS
+QueryRelationships(
+    _Out_writes_bytes_to_opt_(*Length, *Length) SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX * Information,
+    _Inout_ ULONG * Length
+)
+{
+#if _KERNEL_MODE
+    return KeQueryLogicalProcessorRelationship(nullptr, RelationAll, Information, Length);
+#else
+    DWORD length = *Length;
+
+    if (! GetLogicalProcessorInformationEx(RelationAll, Information, &length))
+    {
+        *Length = length;
+
+        return GetLastError() == ERROR_INSUFFICIENT_BUFFER
+            ? STATUS_INFO_LENGTH_MISMATCH
+            : STATUS_UNSUCCESSFUL;
+    }
+
+    *Length = length;
+
+    return STATUS_SUCCESS;
+#endif
+}
+
+template <typename Function>
+void
+ForEachProcessor(
+    _In_ GROUP_AFFINITY const & Affinity,
+    _In_ Function Callback
+)
+{
+    for (UCHAR number = 0; number < sizeof(Affinity.Mask) * 8; number++)
+    {
+        if (Affinity.Mask & (static_cast<KAFFINITY>(1) << number))
+        {
+            PROCESSOR_NUMBER const processor = { Affinity.Group, number, 0 };
+            Callback(processor);
+        }
+    }
+}
+
+}
+
+_Use_decl_annotations_
+NTSTATUS
+NxProcessorTopology::Initialize(
+    void
+)
+{
+    // The topology may grow between the two calls if a processor is added
+    for (size_t attempt = 0; attempt < 3; attempt++)
+    {
+        ULONG length = 0;
+        auto status = QueryRelationships(nullptr, &length);
+
+        CX_RETURN_NTSTATUS_IF(status, status != STATUS_INFO_LENGTH_MISMATCH);
+
+        auto information = MakeSizedPoolPtrNP<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX>(
+            'tPxN',
+            max(length, static_cast<ULONG>(sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX))));
+        CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES, ! information);
+
+        status = QueryRelationships(information.get(), &length);
+
+        if (status == STATUS_INFO_LENGTH_MISMATCH)
+        {
+            continue;
+        }
+
+        CX_RETURN_IF_NOT_NT_SUCCESS_MSG(status, "Failed to query processor relationships.");
+
+        return Parse(information.get(), length);
+    }
+
+    return STATUS_INFO_LENGTH_MISMATCH;
+}
+
+_Use_decl_annotations_
+NTSTATUS
+NxProcessorTopology::Initialize(
+    Processor const * Processors,
+    size_t NumberOfProcessors
+)
+{
+    CX_RETURN_NTSTATUS_IF(
+        STATUS_INSUFFICIENT_RESOURCES,
+        ! m_processors.resize(NumberOfProcessors));
+
+    for (size_t i = 0; i < NumberOfProcessors; i++)
+    {
+        m_processors[i] = Processors[i];
+    }
+
+    return BuildLookup();
+}
+
+_Use_decl_annotations_
+NTSTATUS
+NxProcessorTopology::Parse(
+    SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX const * Information,
+    ULONG Length
+)
+{
+    auto const begin = reinterpret_cast<UCHAR const *>(Information);
+    auto const end = begin + Length;
+
+    // The records come in no particular order. Processors are enumerated
+    // from the cores first, which also tells the deepest cache level.
+    ULONG core = 0;
+    BYTE cacheLevel = 0;
+
+    for (auto current = begin; current < end;)
+    {
+        auto const record = reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX const *>(current);
+
+        if (record->Relationship == RelationProcessorCore)
+        {
+            for (WORD i = 0; i < record->Processor.GroupCount; i++)
+            {
+                bool appended = true;
+
+                ForEachProcessor(record->Processor.GroupMask[i], [&](PROCESSOR_NUMBER const & Number)
+                {
+                    Processor const processor = { Number, core, ~0UL, 0 };
+                    appended = appended && m_processors.append(processor);
+                });
+
+                CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES, ! appended);
+            }
+
+            core++;
+        }
+        else if (record->Relationship == RelationCache &&
+            record->Cache.Type != CacheInstruction &&
+            record->Cache.Level > cacheLevel)
+        {
+            cacheLevel = record->Cache.Level;
+        }
+
+        current += record->Size;
+    }
+
+    CX_RETURN_IF_NOT_NT_SUCCESS(BuildLookup());
+
+    ULONG cache = 0;
+
+    for (auto current = begin; current < end;)
+    {
+        auto const record = reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX const *>(current);
+
+        if (record->Relationship == RelationCache &&
+            record->Cache.Type != CacheInstruction &&
+            record->Cache.Level == cacheLevel)
+        {
+            ForEachProcessor(record->Cache.GroupMask, [&](PROCESSOR_NUMBER const & Number)
+            {
+                auto const index = Find(Number);
+
+                if (index != NotFound)
+                {
+                    m_processors[index].Cache = cache;
+                }
+            });
+
+            cache++;
+        }
+        else if (record->Relationship == RelationNumaNode)
+        {
+            ForEachProcessor(record->NumaNode.GroupMask, [&](PROCESSOR_NUMBER const & Number)
+            {
+                auto const index = Find(Number);
+
+                if (index != NotFound)
+                {
+                    m_processors[index].Node = static_cast<USHORT>(record->NumaNode.NodeNumber);
+                }
+            });
+        }
+
+        current += record->Size;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+NTSTATUS
+NxProcessorTopology::BuildLookup(
+    void
+)
+{
+    USHORT groups = 0;
+
+    for (auto const & processor : m_processors)
+    {
+        groups = max(groups, static_cast<USHORT>(processor.Number.Group + 1));
+    }
+
+    CX_RETURN_NTSTATUS_IF(
+        STATUS_INSUFFICIENT_RESOURCES,
+        ! m_lookup.resize(groups * MAXIMUM_PROC_PER_GROUP));
+
+    for (auto & index : m_lookup)
+    {
+        index = ~0UL;
+    }
+
+    for (size_t i = 0; i < m_processors.count(); i++)
+    {
+        auto const & number = m_processors[i].Number;
+
+        CX_RETURN_NTSTATUS_IF(STATUS_INVALID_PARAMETER, number.Number >= MAXIMUM_PROC_PER_GROUP);
+
+        m_lookup[number.Group * MAXIMUM_PROC_PER_GROUP + number.Number] = static_cast<ULONG>(i);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+size_t
+NxProcessorTopology::GetCount(
+    void
+) const
+{
+    return m_processors.count();
+}
+
+_Use_decl_annotations_
+NxProcessorTopology::Processor const &
+NxProcessorTopology::GetProcessor(
+    size_t Index
+) const
+{
+    return m_processors[Index];
+}
+
+_Use_decl_annotations_
+size_t
+NxProcessorTopology::Find(
+    PROCESSOR_NUMBER const & Number
+) const
+{
+    auto const key = static_cast<size_t>(Number.Group) * MAXIMUM_PROC_PER_GROUP + Number.Number;
+
+    if (Number.Number >= MAXIMUM_PROC_PER_GROUP || key >= m_lookup.count() || m_lookup[key] == ~0UL)
+    {
+        return NotFound;
+    }
+
+    return m_lookup[key];
+}
+
+_Use_decl_annotations_
+NxProcessorTopology::Distance
+NxProcessorTopology::GetDistance(
+    PROCESSOR_NUMBER const & A,
+    PROCESSOR_NUMBER const & B
+) const
+{
+    auto const a = Find(A);
+    auto const b = Find(B);
+
+    if (a == NotFound || b == NotFound)
+    {
+        return Distance::Remote;
+    }
+
+    auto const & processorA = m_processors[a];
+    auto const & processorB = m_processors[b];
+
+    if (a == b)
+    {
+        return Distance::Same;
+    }
+
+    if (processorA.Core == processorB.Core)
+    {
+        return Distance::Core;
+    }
+
+    if (processorA.Cache != ~0UL && processorA.Cache == processorB.Cache)
+    {
+        return Distance::Cache;
+    }
+
+    if (processorA.Node == processorB.Node)
+    {
+        return Distance::Node;
+    }
+
+    return Distance::Remote;
+}
+
+_Use_decl_annotations_
+bool
+NxProcessorTopology::IsPrimaryThread(
+    size_t Index
+) const
+{
+    for (size_t i = 0; i < Index; i++)
+    {
+        if (m_processors[i].Core == m_processors[Index].Core)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+_Use_decl_annotations_
+size_t
+NxProcessorTopology::SelectProcessors(
+    NODE_REQUIREMENT Node,
+    size_t NumberOfProcessors,
+    PROCESSOR_NUMBER * Processors
+) const
+{
+    size_t selected = 0;
+
+    // Pass 0 and 1 take one processor per core, on Node then elsewhere.
+    // Pass 2 and 3 take the SMT siblings left over in the same order.
+    for (size_t pass = 0; pass < 4; pass++)
+    {
+        for (size_t i = 0; i < m_processors.count(); i++)
+        {
+            if (selected == NumberOfProcessors)
+            {
+                return selected;
+            }
+
+            auto const local = Node == MM_ANY_NODE_OK || m_processors[i].Node == Node;
+
+            if (local != (pass % 2 == 0) || IsPrimaryThread(i) != (pass < 2))
+            {
+                continue;
+            }
+
+            Processors[selected++] = m_processors[i].Number;
+        }
+    }
+
+    return selected;
+}
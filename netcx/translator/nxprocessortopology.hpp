@@ -0,0 +1,136 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    Defines a model of the processor topology, which processors share a
+    physical core, a last level cache or a NUMA node.
+
+--*/
+
+#pragma once
+
+#include <KArray.h>
+
+/// Snapshot of the topology of the active processors. It is either read from
+/// the system or built from a synthetic description, so the policies built on
+/// it can be exercised in user mode against any topology.
+class NxProcessorTopology
+{
+
+public:
+
+    // How close two processors are, closest first
+    enum class Distance : UINT8
+    {
+        Same,
+        Core,
+        Cache,
+        Node,
+        Remote,
+    };
+
+    struct Processor
+    {
+        PROCESSOR_NUMBER
+            Number;
+
+        // Processors with the same Core are SMT siblings
+        ULONG
+            Core;
+
+        // Processors with the same Cache share the last level cache, ~0 if
+        // unknown
+        ULONG
+            Cache;
+
+        USHORT
+            Node;
+    };
+
+    static constexpr size_t
+        NotFound = ~0ULL;
+
+    /// Reads the topology of the active processors from the system
+    _IRQL_requires_(PASSIVE_LEVEL)
+    NTSTATUS
+    Initialize(
+        void
+    );
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    NTSTATUS
+    Initialize(
+        _In_reads_(NumberOfProcessors) Processor const * Processors,
+        _In_ size_t NumberOfProcessors
+    );
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    size_t
+    GetCount(
+        void
+    ) const;
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    Processor const &
+    GetProcessor(
+        _In_ size_t Index
+    ) const;
+
+    /// Returns the index of a processor, NotFound if it is not known
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    size_t
+    Find(
+        _In_ PROCESSOR_NUMBER const & Number
+    ) const;
+
+    /// Processors that are not known are Remote to any other
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    Distance
+    GetDistance(
+        _In_ PROCESSOR_NUMBER const & A,
+        _In_ PROCESSOR_NUMBER const & B
+    ) const;
+
+    /// Returns true for the first processor of each physical core
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    bool
+    IsPrimaryThread(
+        _In_ size_t Index
+    ) const;
+
+    /// Fills Processors with up to NumberOfProcessors processors: one per
+    /// physical core on Node, one per physical core elsewhere, then the SMT
+    /// siblings in the same order. Node may be MM_ANY_NODE_OK. Returns how
+    /// many were filled in.
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    size_t
+    SelectProcessors(
+        _In_ NODE_REQUIREMENT Node,
+        _In_ size_t NumberOfProcessors,
+        _Out_writes_to_(NumberOfProcessors, return) PROCESSOR_NUMBER * Processors
+    ) const;
+
+private:
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    NTSTATUS
+    Parse(
+        _In_reads_bytes_(Length) SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX const * Information,
+        _In_ ULONG Length
+    );
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    NTSTATUS
+    BuildLookup(
+        void
+    );
+
+    Rtl::KArray<Processor, NonPagedPoolNx>
+        m_processors;
+
+    // Group * MAXIMUM_PROC_PER_GROUP + Number to index in m_processors
+    Rtl::KArray<ULONG, NonPagedPoolNx>
+        m_lookup;
+};
@@ -18,6 +18,38 @@
 
 #endif // _KERNEL_MODE
 
+namespace
+{
+    ULONG64
+    QueryInterruptTime(
+        void
+    )
+    {
+#ifdef _KERNEL_MODE
+        return KeQueryInterruptTime();
+#else
+        return GetTickCount64() * 10 * 1000;
+#endif
+    }
+
+    PROCESSOR_NUMBER
+    GetFirstProcessor(
+        GROUP_AFFINITY const & Affinity
+    )
+    {
+        PROCESSOR_NUMBER processor = {};
+        processor.Group = Affinity.Group;
+
+        while (processor.Number < sizeof(Affinity.Mask) * 8 - 1 &&
+            ! (Affinity.Mask & (static_cast<KAFFINITY>(1) << processor.Number)))
+        {
+            processor.Number++;
+        }
+
+        return processor;
+    }
+}
+
 _Use_decl_annotations_
 NxReceiveScaling::NxReceiveScaling(
     NxTranslationApp & App,
@@ -26,10 +58,18 @@ NxReceiveScaling::NxReceiveScaling(
 ) noexcept :
     m_app(App),
     m_queues(Queues),
-    m_dispatch(Dispatch)
+    m_dispatch(Dispatch),
+    m_rebalanceWorkItem(this, &NxReceiveScaling::Rebalance)
 {
 }
 
+NxReceiveScaling::~NxReceiveScaling(
+    void
+)
+{
+    StopRebalancing();
+}
+
 _Use_decl_annotations_
 size_t
 NxReceiveScaling::GetNumberOfQueues(
@@ -42,6 +82,8 @@ NxReceiveScaling::GetNumberOfQueues(
 _Use_decl_annotations_
 NTSTATUS
 NxReceiveScaling::Initialize(
+    NxProcessorTopology::Processor const * Processors,
+    size_t NumberOfProcessors
 )
 {
     auto const capabilities = m_app.GetReceiveScalingCapabilities();
@@ -140,8 +182,85 @@ NxReceiveScaling::Initialize(
     CX_RETURN_IF_NOT_NT_SUCCESS(
         readParameter(NumRssQueues, numberOfQueues, defaultQueues, defaultQueues));
     m_numberOfQueues = numberOfQueues;
+
+    m_localNode = QueryLocalNode(m_app.GetProperties().NdisAdapterHandle);
+#endif // _KERNEL_MODE
+
+    if (Processors != nullptr)
+    {
+        CX_RETURN_IF_NOT_NT_SUCCESS_MSG(
+            m_topology.Initialize(Processors, NumberOfProcessors),
+            "Failed to build the processor topology.");
+    }
+    else
+    {
+        CX_RETURN_IF_NOT_NT_SUCCESS_MSG(
+            m_topology.Initialize(),
+            "Failed to read the processor topology.");
+    }
+
+    //
+    // Queues NDIS has not placed yet start on the default processor, keep it
+    // on the node of the NIC and on a core of its own.
+    //
+    auto const defaultIndex = m_topology.Find(m_defaultProcessor);
+    if (m_localNode != MM_ANY_NODE_OK &&
+        (defaultIndex == NxProcessorTopology::NotFound ||
+         m_topology.GetProcessor(defaultIndex).Node != m_localNode))
+    {
+        for (size_t i = 0; i < m_topology.GetCount(); i++)
+        {
+            auto const & processor = m_topology.GetProcessor(i);
+            auto const processorIndex = EnumerateProcessor(processor.Number.Group, processor.Number.Number);
+
+            if (processor.Node == m_localNode &&
+                m_topology.IsPrimaryThread(i) &&
+                processorIndex >= m_minProcessorIndex &&
+                processorIndex < m_maxProcessorIndex)
+            {
+                m_defaultProcessor = processor.Number;
+                break;
+            }
+        }
+    }
+
+    auto const dispatch = m_app.GetDispatch();
+    m_rebalanceInterval =
+        static_cast<ULONG64>(dispatch->NetClientQueryDriverConfigurationUlong(RX_RSS_REBALANCE_INTERVAL)) * 10 * 1000;
+    m_rebalanceThreshold =
+        dispatch->NetClientQueryDriverConfigurationUlong(RX_RSS_REBALANCE_THRESHOLD);
+
+    m_mediaType = m_app.GetProperties().MediaType;
+
+    auto const flowSteeringEntries =
+        dispatch->NetClientQueryDriverConfigurationUlong(RX_FLOW_STEERING_ENTRIES);
+    auto const flowSteeringTimeout =
+        static_cast<ULONG64>(dispatch->NetClientQueryDriverConfigurationUlong(RX_FLOW_STEERING_TIMEOUT)) * 10 * 1000;
+    CX_RETURN_IF_NOT_NT_SUCCESS_MSG(
+        m_flowSteering.Initialize(
+            flowSteeringEntries,
+            flowSteeringTimeout),
+        "Failed to allocate the flow steering table. Entries=%u", flowSteeringEntries);
+
+    m_passInterval = m_rebalanceInterval;
+
+    if (m_passInterval == 0 && m_flowSteering.IsEnabled())
+    {
+        m_passInterval = flowSteeringTimeout;
+    }
+
+#ifdef _KERNEL_MODE
+    if (flowSteeringEntries != 0)
+    {
+        CX_RETURN_NTSTATUS_IF(
+            STATUS_INSUFFICIENT_RESOURCES,
+            ! m_flowSamples.resize(KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS)));
+    }
 #endif // _KERNEL_MODE
 
+    // no rebalance pass may be queued until the queues are started
+    m_rebalanceRundown.CloseAndWait();
+
     CX_RETURN_NTSTATUS_IF(
         STATUS_INSUFFICIENT_RESOURCES,
         ! m_affinitizedQueues.resize(m_maxProcessorIndex - m_minProcessorIndex));
@@ -320,7 +439,21 @@ NxReceiveScaling::GetAffinitizedQueue(
     size_t Index
 ) const
 {
-    return m_affinitizedQueues[Index].Queue;
+    return static_cast<NxRxXlat *>(
+        ReadPointerAcquire(reinterpret_cast<PVOID volatile *>(&m_affinitizedQueues[Index].Queue)));
+}
+
+_Use_decl_annotations_
+void
+NxReceiveScaling::ClearAffinitizedQueue(
+    size_t Index
+)
+{
+    auto & affinitizedQueue = m_affinitizedQueues[Index];
+
+    WritePointerRelease(reinterpret_cast<PVOID volatile *>(&affinitizedQueue.Queue), nullptr);
+    affinitizedQueue.QueueId = 0;
+    affinitizedQueue.Affinity = {};
 }
 
 _Use_decl_annotations_
@@ -332,7 +465,101 @@ NxReceiveScaling::SetAffinitizedQueue(
 )
 {
     Queue->SetGroupAffinity(Affinity);
-    m_affinitizedQueues[Index] = { Queue, Queue->GetQueueId(), Affinity };
+
+    auto & affinitizedQueue = m_affinitizedQueues[Index];
+    affinitizedQueue.QueueId = Queue->GetQueueId();
+    affinitizedQueue.Affinity = Affinity;
+
+    WritePointerRelease(reinterpret_cast<PVOID volatile *>(&affinitizedQueue.Queue), Queue);
+}
+
+_Use_decl_annotations_
+void
+NxReceiveScaling::ShareAffinitizedQueue(
+    size_t Index,
+    size_t Owner
+)
+{
+    auto const & owner = m_affinitizedQueues[Owner];
+    auto & affinitizedQueue = m_affinitizedQueues[Index];
+
+    // Configure restores the affinity of every entry, a shared entry must
+    // not move the queue to its own processor
+    affinitizedQueue.QueueId = owner.QueueId;
+    affinitizedQueue.Affinity = owner.Affinity;
+
+    WritePointerRelease(reinterpret_cast<PVOID volatile *>(&affinitizedQueue.Queue), owner.Queue);
+}
+
+_Use_decl_annotations_
+NODE_REQUIREMENT
+NxReceiveScaling::QueryLocalNode(
+    NDIS_HANDLE NdisAdapterHandle
+)
+{
+#ifdef _KERNEL_MODE
+    NDIS_CONFIGURATION_OBJECT configurationObject = {
+        {
+            NDIS_OBJECT_TYPE_CONFIGURATION_OBJECT,
+            NDIS_CONFIGURATION_OBJECT_REVISION_1,
+            NDIS_SIZEOF_CONFIGURATION_OBJECT_REVISION_1
+        },
+        NdisAdapterHandle,
+        0,
+    };
+
+    NDIS_HANDLE handle;
+    if (NdisOpenConfigurationEx(&configurationObject, &handle) != NDIS_STATUS_SUCCESS)
+    {
+        return MM_ANY_NODE_OK;
+    }
+
+    auto configurationHandle = wil::unique_any<NDIS_HANDLE,
+        decltype(&::NdisCloseConfiguration), &::NdisCloseConfiguration>(handle);
+
+    NDIS_STRING NumaNodeIdStr = NDIS_STRING_CONST("*NumaNodeId");
+    NDIS_STATUS status;
+    NDIS_CONFIGURATION_PARAMETER * parameter;
+    NdisReadConfiguration(&status, &parameter, handle, &NumaNodeIdStr, NdisParameterInteger);
+
+    if (status == NDIS_STATUS_SUCCESS && parameter->ParameterData.IntegerData < 0xffff)
+    {
+        return parameter->ParameterData.IntegerData;
+    }
+#else
+    UNREFERENCED_PARAMETER(NdisAdapterHandle);
+#endif // _KERNEL_MODE
+
+    return MM_ANY_NODE_OK;
+}
+
+_Use_decl_annotations_
+size_t
+NxReceiveScaling::FindAffinitizedQueue(
+    PROCESSOR_NUMBER const & Processor,
+    NxProcessorTopology::Distance MaximumDistance
+) const
+{
+    auto found = NxProcessorTopology::NotFound;
+    auto foundDistance = MaximumDistance;
+
+    for (size_t i = 0; i < m_affinitizedQueues.count(); i++)
+    {
+        auto const & affinitizedQueue = m_affinitizedQueues[i];
+        if (! affinitizedQueue.Queue)
+        {
+            continue;
+        }
+
+        auto const distance = m_topology.GetDistance(Processor, GetFirstProcessor(affinitizedQueue.Affinity));
+        if (distance < foundDistance || (distance == foundDistance && found == NxProcessorTopology::NotFound))
+        {
+            found = i;
+            foundDistance = distance;
+        }
+    }
+
+    return found;
 }
 
 _Use_decl_annotations_
@@ -354,6 +581,19 @@ NxReceiveScaling::MapAffinitizedQueue(
         return queue;
     }
 
+    //
+    // SMT siblings share a queue, one queue per physical core. Two EC threads
+    // on the same core would compete for its execution units and caches.
+    //
+    auto const targetProcessor = GetFirstProcessor(Affinity);
+    auto const sibling = FindAffinitizedQueue(targetProcessor, NxProcessorTopology::Distance::Core);
+    if (sibling != NxProcessorTopology::NotFound)
+    {
+        ShareAffinitizedQueue(Index, sibling);
+
+        return GetAffinitizedQueue(Index);
+    }
+
     //
     // find an unmapped queue and map it to the target processor
     //
@@ -368,23 +608,56 @@ NxReceiveScaling::MapAffinitizedQueue(
         }
     }
 
-#ifdef _KERNEL_MODE
     //
-    // if we reach here there are no unmapped queues. remap the
-    // queue mapped to the source processor to the target processor.
+    // if we reach here there are no unmapped queues. a queue on a processor
+    // sharing the last level cache with the target serves it without moving.
+    //
+    auto const nearby = FindAffinitizedQueue(targetProcessor, NxProcessorTopology::Distance::Cache);
+    if (nearby != NxProcessorTopology::NotFound)
+    {
+        ShareAffinitizedQueue(Index, nearby);
+
+        return GetAffinitizedQueue(Index);
+    }
+
+    //
+    // otherwise remap the queue mapped to the source processor to the target
+    // processor, or share the closest queue if the source has none.
     //
+    NxRxXlat * sourceQueue = nullptr;
+
+#ifdef _KERNEL_MODE
     PROCESSOR_NUMBER processorNumber;
     (void)KeGetCurrentProcessorNumberEx(&processorNumber);
     auto const processorIndex = EnumerateProcessor(processorNumber);
-    auto sourceQueue = GetAffinitizedQueue(processorIndex);
+    if (processorIndex < m_affinitizedQueues.count())
+    {
+        sourceQueue = GetAffinitizedQueue(processorIndex);
+    }
+#endif // _KERNEL_MODE
+
+    if (! sourceQueue)
+    {
+        auto const nearest = FindAffinitizedQueue(targetProcessor, NxProcessorTopology::Distance::Remote);
+        NT_FRE_ASSERT(nearest != NxProcessorTopology::NotFound);
+
+        ShareAffinitizedQueue(Index, nearest);
+
+        return GetAffinitizedQueue(Index);
+    }
+
+    // the siblings sharing the queue lose it along with the source
+    for (size_t i = 0; i < m_affinitizedQueues.count(); i++)
+    {
+        if (GetAffinitizedQueue(i) == sourceQueue)
+        {
+            ClearAffinitizedQueue(i);
+        }
+    }
 
-    m_affinitizedQueues[processorIndex] = {};
     SetAffinitizedQueue(Index, sourceQueue, Affinity);
 
     return sourceQueue;
-#else
-    return nullptr;
-#endif // _KERNEL_MODE
 }
 
 _Use_decl_annotations_
@@ -462,6 +735,10 @@ NxReceiveScaling::SetIndirectionEntries(
         // cached indirection table state to match adapter.
         //
 
+        KAcquireSpinLock lock(m_indirectionTableLock);
+
+        m_rebalanceRaced = m_rebalanceRaced || m_rebalanceInFlight;
+
         size_t j = 0;
         for (size_t i = 0; i < NumberOfEntries; i++)
         {
@@ -507,6 +784,10 @@ NxReceiveScaling::SetIndirectionEntries(
 // we must first establish a mapping from a queue to a processor. The mapping
 // is achieved by affinitizing a queue (in translator) to a specific processor.
 //
+// NDIS tends to resend entries that did not change, and every entry pushed
+// down costs the adapter an update of its hardware table. Only entries that
+// steer a bucket to a different queue than the cached table are pushed.
+//
 _Use_decl_annotations_
 NTSTATUS
 NxReceiveScaling::SetIndirectionEntries(
@@ -535,7 +816,21 @@ NxReceiveScaling::SetIndirectionEntries(
         (! (tableEnd > table)) || tableEnd > buffer + length,
         "RssEntryTable does not start and finish within the InformationBuffer.");
 
-    TranslatedIndirectionEntries translatedEntries = {};
+    CX_RETURN_NTSTATUS_IF_MSG(
+        STATUS_INVALID_PARAMETER,
+        parameters->NumberOfRssEntries > ARRAYSIZE(m_translatedEntries.Entries),
+        "NumberOfRssEntries exceeds the indirection table size.");
+
+    //
+    // The changes are applied to the cached table and snapshotted under the
+    // lock, the client driver is called without it.
+    //
+    KAcquireSpinLock lock(m_indirectionTableLock);
+
+    m_rebalanceRaced = m_rebalanceRaced || m_rebalanceInFlight;
+
+    auto & translatedEntries = m_translatedEntries;
+    size_t numberOfChanges = 0;
     auto const entries = reinterpret_cast<NDIS_RSS_SET_INDIRECTION_ENTRY const *>(table);
     for (size_t i = 0; i < parameters->NumberOfRssEntries; i++)
     {
@@ -560,18 +855,34 @@ NxReceiveScaling::SetIndirectionEntries(
 
         NT_FRE_ASSERT(queue);
 
+        //
+        // the adapter already steers this index to the queue
+        //
+        if (m_indirectionTable[indirectionTableIndex] == queue->GetQueueId())
+        {
+            continue;
+        }
+
         //
         // build an indirection entry for the Cx, keep the current queue
         // at the cached indirection table index in case we need to restore it.
         //
-        translatedEntries.Restore[i] = static_cast<UINT32>(m_indirectionTable[indirectionTableIndex]);
-        translatedEntries.Entries[i] = { queue->GetQueue(), STATUS_SUCCESS, indirectionTableIndex };
+        translatedEntries.Restore[numberOfChanges] = static_cast<UINT32>(m_indirectionTable[indirectionTableIndex]);
+        translatedEntries.Entries[numberOfChanges] = { queue->GetQueue(), STATUS_SUCCESS, indirectionTableIndex };
+        numberOfChanges++;
 
         m_indirectionTable[indirectionTableIndex] = queue->GetQueueId();
     }
 
+    lock.Release();
+
+    if (numberOfChanges == 0)
+    {
+        return STATUS_SUCCESS;
+    }
+
     return SetIndirectionEntries(
-        parameters->NumberOfRssEntries,
+        numberOfChanges,
         0,
         translatedEntries);
 }
@@ -602,10 +913,19 @@ NxReceiveScaling::Configure(
                 m_defaultProcessor.Group
                 };
 
-            (void)MapAffinitizedQueue(m_minProcessorIndex, groupAffinity);
+            (void)MapAffinitizedQueue(EnumerateProcessor(m_defaultProcessor), groupAffinity);
         }
     }
 
+    CX_RETURN_NTSTATUS_IF(
+        STATUS_INSUFFICIENT_RESOURCES,
+        ! m_queueLoads.resize(m_queues.count()));
+
+    for (auto & queue : m_queues)
+    {
+        queue->SetReceiveScaling(this);
+    }
+
     //
     // Restore the pointers to translator queues.
     //
@@ -628,7 +948,9 @@ NxReceiveScaling::Configure(
     // This pushes the cached indirection table back down to the adapter. This
     // is done even if receive scaling is disabled.
     //
-    TranslatedIndirectionEntries translatedEntries = {};
+    KAcquireSpinLock lock(m_indirectionTableLock);
+
+    auto & translatedEntries = m_translatedEntries;
     for (size_t i = 0; i < m_indirectionTable.count(); i++)
     {
         auto const queueIndex = m_indirectionTable[i];
@@ -638,6 +960,8 @@ NxReceiveScaling::Configure(
         translatedEntries.Entries[i] = { queue->GetQueue(), STATUS_SUCCESS, static_cast<UINT32>(i) };
     }
 
+    lock.Release();
+
     CX_RETURN_IF_NOT_NT_SUCCESS(
         SetIndirectionEntries(
             m_indirectionTable.count(),
@@ -659,3 +983,383 @@ NxReceiveScaling::Configure(
     return STATUS_SUCCESS;
 }
 
+
+_Use_decl_annotations_
+void
+NxReceiveScaling::StartRebalancing(
+    void
+)
+{
+    if (m_passInterval == 0 || m_rebalancing)
+    {
+        return;
+    }
+
+    m_rebalancePrimed = false;
+    m_rebalanceHotQueue = ~0ULL;
+    m_rebalanceStreak = 0;
+    m_rebalanceCoolDown = 0;
+
+    InterlockedExchange64(
+        &m_nextRebalanceTime,
+        static_cast<LONG64>(QueryInterruptTime() + m_passInterval));
+
+    m_rebalancing = true;
+    m_rebalanceRundown.Reinitialize();
+}
+
+_Use_decl_annotations_
+void
+NxReceiveScaling::StopRebalancing(
+    void
+)
+{
+    if (! m_rebalancing)
+    {
+        return;
+    }
+
+    m_rebalanceRundown.CloseAndWait();
+    m_rebalancing = false;
+}
+
+_Use_decl_annotations_
+void
+NxReceiveScaling::NotifyIteration(
+    void
+)
+{
+    if (m_passInterval == 0)
+    {
+        return;
+    }
+
+    auto const now = static_cast<LONG64>(QueryInterruptTime());
+    auto const next = ReadNoFence64(&m_nextRebalanceTime);
+
+    if (now < next)
+    {
+        return;
+    }
+
+    // only the queue that moves the deadline forward queues the pass
+    if (InterlockedCompareExchange64(
+            &m_nextRebalanceTime,
+            now + static_cast<LONG64>(m_passInterval),
+            next) != next)
+    {
+        return;
+    }
+
+    if (! m_rebalanceRundown.TryAcquire())
+    {
+        return;
+    }
+
+    // a work item that is already queued holds its own reference
+    if (! m_rebalanceWorkItem.Queue())
+    {
+        m_rebalanceRundown.Release();
+    }
+}
+
+_Use_decl_annotations_
+void
+NxReceiveScaling::LearnFlow(
+    NET_BUFFER_LIST * NetBufferList
+)
+{
+#ifdef _KERNEL_MODE
+    if (! m_flowSteering.IsEnabled())
+    {
+        return;
+    }
+
+    //
+    // The replies of a flow are best received on the processor that sends
+    // on it, that is where the application consumes them. Learning needs
+    // the frame parsed, so it is done for a sample of the sends only, which
+    // still catches every flow that carries enough traffic to matter.
+    //
+    // The count is not interlocked, a sample lost to preemption is harmless.
+    //
+    PROCESSOR_NUMBER processor;
+    auto const sampleIndex = KeGetCurrentProcessorNumberEx(&processor);
+
+    if (sampleIndex >= m_flowSamples.count() ||
+        ++m_flowSamples[sampleIndex].Count % FlowSampleRate != 0)
+    {
+        return;
+    }
+
+    auto const processorIndex = EnumerateProcessor(processor);
+
+    if (processorIndex >= m_affinitizedQueues.count())
+    {
+        return;
+    }
+
+    auto const queue = GetAffinitizedQueue(processorIndex);
+
+    if (queue == nullptr)
+    {
+        return;
+    }
+
+    NxFlowKey key;
+    if (NxGetSendFlowKey(m_mediaType, NetBufferList, key))
+    {
+        m_flowSteering.Learn(key, queue->GetQueueId());
+    }
+#else
+    UNREFERENCED_PARAMETER(NetBufferList);
+#endif // _KERNEL_MODE
+}
+
+bool
+NxReceiveScaling::IsFlowSteeringActive(
+    void
+) const
+{
+    return ! m_flowSteering.IsEmpty();
+}
+
+_Use_decl_annotations_
+NxRxXlat *
+NxReceiveScaling::GetFlowQueue(
+    NxFlowKey const & Key
+)
+{
+    size_t queueId;
+
+    if (! m_flowSteering.Lookup(Key, &queueId) || queueId >= m_queues.count())
+    {
+        return nullptr;
+    }
+
+    return m_queues[queueId].get();
+}
+
+_Use_decl_annotations_
+void
+NxReceiveScaling::SampleQueueLoads(
+    void
+)
+{
+    auto const count = min(m_queues.count(), m_queueLoads.count());
+
+    for (size_t i = 0; i < count; i++)
+    {
+        auto const & statistics = m_queues[i]->GetStatistics();
+        auto & load = m_queueLoads[i];
+
+        auto const packetsCompleted = statistics.GetCounter(NxStatisticsCounters::PacketsCompleted);
+        auto const queueDepth = statistics.GetCounter(NxStatisticsCounters::QueueDepth);
+        auto const iterationCount = statistics.GetCounter(NxStatisticsCounters::IterationCount);
+        auto const iterations = iterationCount - load.IterationCount;
+
+        load.Packets = packetsCompleted - load.PacketsCompleted;
+        load.AverageDepth = iterations != 0 ? (queueDepth - load.QueueDepth) / iterations : 0;
+
+        load.PacketsCompleted = packetsCompleted;
+        load.QueueDepth = queueDepth;
+        load.IterationCount = iterationCount;
+    }
+}
+
+//
+// Rebalance runs once per pass interval while the queues are started. It
+// first sweeps the expired flows out of the flow steering table.
+//
+// A queue is hot when it completed the most packets in the last interval,
+// and is backed up more than the coldest queue. A bucket moves from the hot
+// queue to the cold one when the hot queue exceeds the cold one by the
+// configured threshold for RebalanceConfirmations passes in a row.
+//
+_Use_decl_annotations_
+void
+NxReceiveScaling::Rebalance(
+    void
+)
+{
+    m_flowSteering.Sweep();
+
+    if (m_rebalanceInterval == 0)
+    {
+        m_rebalanceRundown.Release();
+        return;
+    }
+
+    SampleQueueLoads();
+
+    auto const count = min(m_queues.count(), m_queueLoads.count());
+
+    // the first sample only establishes a baseline
+    if (! m_rebalancePrimed || count < 2)
+    {
+        m_rebalancePrimed = true;
+        m_rebalanceRundown.Release();
+        return;
+    }
+
+    if (m_rebalanceCoolDown > 0)
+    {
+        m_rebalanceCoolDown--;
+        m_rebalanceRundown.Release();
+        return;
+    }
+
+    size_t hot = 0;
+    size_t cold = 0;
+
+    for (size_t i = 1; i < count; i++)
+    {
+        if (m_queueLoads[i].Packets > m_queueLoads[hot].Packets)
+        {
+            hot = i;
+        }
+
+        if (m_queueLoads[i].Packets < m_queueLoads[cold].Packets)
+        {
+            cold = i;
+        }
+    }
+
+    auto const & hotLoad = m_queueLoads[hot];
+    auto const & coldLoad = m_queueLoads[cold];
+
+    auto const imbalanced =
+        hot != cold &&
+        hotLoad.Packets >= RebalanceMinimumPackets &&
+        hotLoad.AverageDepth > coldLoad.AverageDepth &&
+        hotLoad.Packets * 100 > coldLoad.Packets * (100 + m_rebalanceThreshold);
+
+    if (! imbalanced || hot != m_rebalanceHotQueue)
+    {
+        m_rebalanceHotQueue = imbalanced ? hot : ~0ULL;
+        m_rebalanceStreak = imbalanced ? 1 : 0;
+        m_rebalanceRundown.Release();
+        return;
+    }
+
+    if (++m_rebalanceStreak >= RebalanceConfirmations)
+    {
+        m_rebalanceHotQueue = ~0ULL;
+        m_rebalanceStreak = 0;
+        m_rebalanceCoolDown = RebalanceCoolDown;
+
+        MoveIndirectionEntry(hot, cold);
+    }
+
+    m_rebalanceRundown.Release();
+}
+
+//
+// Moves one indirection table bucket from Source to Destination.
+//
+// The move is applied to the cached table under the lock and pushed to the
+// adapter without it. An NDIS update racing with the push may reach the
+// adapter in either order, the cached entry is then pushed again.
+//
+// Packets of the flows hashing to the bucket may still sit in Source when
+// the adapter starts steering the bucket to Destination. To keep them in
+// order Destination holds back its indications, once the move is committed,
+// until Source has indicated the buffers it had posted by then.
+//
+_Use_decl_annotations_
+void
+NxReceiveScaling::MoveIndirectionEntry(
+    size_t Source,
+    size_t Destination
+)
+{
+    auto & sourceQueue = *m_queues[Source];
+    auto & destinationQueue = *m_queues[Destination];
+    auto const tableSize = m_indirectionTable.count();
+
+    KAcquireSpinLock lock(m_indirectionTableLock);
+
+    // a queue serving a single bucket only moves its load elsewhere
+    size_t buckets = 0;
+    size_t index = tableSize;
+    for (size_t i = 0; i < tableSize; i++)
+    {
+        auto const candidate = (m_rebalanceCursor + i) % tableSize;
+        if (m_indirectionTable[candidate] == Source)
+        {
+            if (index == tableSize)
+            {
+                index = candidate;
+            }
+
+            buckets++;
+        }
+    }
+
+    if (buckets < 2)
+    {
+        return;
+    }
+
+    m_rebalanceCursor = index + 1;
+    m_rebalanceInFlight = true;
+    m_rebalanceRaced = false;
+    m_indirectionTable[index] = Destination;
+
+    NET_CLIENT_RECEIVE_SCALING_INDIRECTION_ENTRY entry = {
+        destinationQueue.GetQueue(),
+        STATUS_SUCCESS,
+        static_cast<UINT32>(index),
+    };
+
+    NET_CLIENT_RECEIVE_SCALING_INDIRECTION_ENTRIES const entries = {
+        &entry,
+        1,
+    };
+
+    lock.Release();
+
+    auto const status = m_dispatch.SetIndirectionEntries(m_app.GetAdapter(), &entries);
+
+    lock.Acquire();
+
+    if (! NT_SUCCESS(status) && m_indirectionTable[index] == Destination)
+    {
+        m_indirectionTable[index] = Source;
+    }
+
+    while (m_rebalanceRaced)
+    {
+        m_rebalanceRaced = false;
+        entry = { m_queues[m_indirectionTable[index]]->GetQueue(), STATUS_SUCCESS, static_cast<UINT32>(index) };
+
+        lock.Release();
+
+        (void)m_dispatch.SetIndirectionEntries(m_app.GetAdapter(), &entries);
+
+        lock.Acquire();
+    }
+
+    m_rebalanceInFlight = false;
+    auto const moved = NT_SUCCESS(status) && m_indirectionTable[index] == Destination;
+
+    lock.Release();
+
+    if (moved)
+    {
+        // Packets of the bucket the adapter received before the move are in
+        // the buffers Source had posted by now, the hold lasts until they
+        // are indicated
+        destinationQueue.HoldIndications(sourceQueue, QueryInterruptTime() + RebalanceHoldTimeout);
+        destinationQueue.ReleaseIndicationsAfter(sourceQueue.GetPostedPacketIndex());
+    }
+
+    TraceLoggingWrite(
+        g_hNetAdapterCxXlatProvider,
+        "NxReceiveScalingRebalance",
+        TraceLoggingDescription("Indirection table bucket moved from a busy receive queue to an idle one"),
+        TraceLoggingUInt32(static_cast<UINT32>(index), "IndirectionTableIndex"),
+        TraceLoggingUInt64(Source, "SourceQueueId"),
+        TraceLoggingUInt64(Destination, "DestinationQueueId"),
+        TraceLoggingNTStatus(status, "Status"));
+}
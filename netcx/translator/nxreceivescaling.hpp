@@ -3,8 +3,12 @@
 #pragma once
 
 #include <KArray.h>
+#include <KRundown.h>
+#include <KWorkItem.h>
 
 #include "NxRxXlat.hpp"
+#include "NxProcessorTopology.hpp"
+#include "NxFlowSteering.hpp"
 
 class NxTranslationApp;
 
@@ -27,10 +31,22 @@ public:
         void
     ) const;
 
+    // Processors describes the topology the queues are placed on, the
+    // topology of the system is read if it is nullptr
     _IRQL_requires_(PASSIVE_LEVEL)
     NTSTATUS
     Initialize(
-        void
+        _In_reads_opt_(NumberOfProcessors) NxProcessorTopology::Processor const * Processors = nullptr,
+        _In_ size_t NumberOfProcessors = 0
+    );
+
+    // NUMA node of the NIC from its *NumaNodeId keyword, MM_ANY_NODE_OK if
+    // it is not set
+    static
+    _IRQL_requires_(PASSIVE_LEVEL)
+    NODE_REQUIREMENT
+    QueryLocalNode(
+        _In_ NDIS_HANDLE NdisAdapterHandle
     );
 
     _IRQL_requires_(PASSIVE_LEVEL)
@@ -51,11 +67,83 @@ public:
         _In_ NDIS_OID_REQUEST const & Request
     );
 
+    // Rebalancing runs only between these two calls, while the queues are
+    // started
+    _IRQL_requires_(PASSIVE_LEVEL)
+    void
+    StartRebalancing(
+        void
+    );
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    void
+    StopRebalancing(
+        void
+    );
+
+    // Called by the Rx queues every iteration, queues a rebalance pass once
+    // the rebalance interval has elapsed
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    void
+    NotifyIteration(
+        void
+    );
+
+    // Flow steering sends the frames of a flow to the queue of the processor
+    // that consumes them, whichever queue the NIC delivered them to. Flows
+    // are learned from the processor that sends on them.
+    //
+    // Called by the send path for every NBL, only a sample is learned from
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    void
+    LearnFlow(
+        _In_ NET_BUFFER_LIST * NetBufferList
+    );
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    bool
+    IsFlowSteeringActive(
+        void
+    ) const;
+
+    // Called by the Rx queues, nullptr if the flow is not steered
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NxRxXlat *
+    GetFlowQueue(
+        _In_ NxFlowKey const & Key
+    );
+
+    ~NxReceiveScaling(
+        void
+    );
+
 private:
 
+    // Queue counters at the last rebalance pass and their change since the
+    // one before
+    struct QueueLoad
+    {
+        ULONG64
+            PacketsCompleted = 0;
+
+        ULONG64
+            QueueDepth = 0;
+
+        ULONG64
+            IterationCount = 0;
+
+        ULONG64
+            Packets = 0;
+
+        ULONG64
+            AverageDepth = 0;
+    };
+
+    // Queue is read without holding any lock. Writers fill in the other
+    // fields first and publish Queue last.
     struct AffinitizedQueue
     {
-        NxRxXlat *
+        NxRxXlat * volatile
             Queue = nullptr;
 
         size_t
@@ -65,6 +153,14 @@ private:
             Affinity = {};
     };
 
+    // Sends seen on a processor, padded so processors do not share the
+    // cache line they count on
+    struct DECLSPEC_CACHEALIGN FlowSample
+    {
+        ULONG
+            Count = 0;
+    };
+
     struct TranslatedIndirectionEntries
     {
         NET_CLIENT_RECEIVE_SCALING_INDIRECTION_ENTRY
@@ -92,7 +188,10 @@ private:
         void
     );
 
-    _IRQL_requires_(DISPATCH_LEVEL)
+    // Called without m_indirectionTableLock held, the client driver is
+    // called at the caller's IRQL
+    _Requires_lock_not_held_(this->m_indirectionTableLock)
+    _IRQL_requires_max_(DISPATCH_LEVEL)
     NTSTATUS
     SetIndirectionEntries(
         _In_ size_t NumberOfEntries,
@@ -119,6 +218,13 @@ private:
         size_t Index
     ) const;
 
+    _Requires_lock_held_(this->m_receiveScalingLock)
+    _IRQL_requires_(DISPATCH_LEVEL)
+    void
+    ClearAffinitizedQueue(
+        size_t Index
+    );
+
     _Requires_lock_held_(this->m_receiveScalingLock)
     _IRQL_requires_(DISPATCH_LEVEL)
     void
@@ -128,6 +234,26 @@ private:
         GROUP_AFFINITY const & Affinity
     );
 
+    // Maps Index to the queue already mapped at Owner, leaving the queue
+    // affinity alone
+    _Requires_lock_held_(this->m_receiveScalingLock)
+    _IRQL_requires_(DISPATCH_LEVEL)
+    void
+    ShareAffinitizedQueue(
+        size_t Index,
+        size_t Owner
+    );
+
+    // Returns the index of the mapped queue closest to Processor and no
+    // further than MaximumDistance, NxProcessorTopology::NotFound if none
+    _Requires_lock_held_(this->m_receiveScalingLock)
+    _IRQL_requires_(DISPATCH_LEVEL)
+    size_t
+    FindAffinitizedQueue(
+        _In_ PROCESSOR_NUMBER const & Processor,
+        _In_ NxProcessorTopology::Distance MaximumDistance
+    ) const;
+
     _IRQL_requires_(DISPATCH_LEVEL)
     NxRxXlat *
     MapAffinitizedQueue(
@@ -153,9 +279,34 @@ private:
         NDIS_RECEIVE_SCALE_PARAMETERS_V2 const & Parameters
     );
 
+    _IRQL_requires_(PASSIVE_LEVEL)
+    void
+    Rebalance(
+        void
+    );
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    void
+    SampleQueueLoads(
+        void
+    );
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    void
+    MoveIndirectionEntry(
+        _In_ size_t Source,
+        _In_ size_t Destination
+    );
+
     KSpinLock
         m_receiveScalingLock;
 
+    // Guards the cached indirection table. Never held across calls into
+    // the client driver: updates are diffed and applied to the cache under
+    // the lock, pushed down without it and rolled back under it on failure.
+    KSpinLock
+        m_indirectionTableLock;
+
     NxTranslationApp &
         m_app;
 
@@ -171,6 +322,12 @@ private:
     Rtl::KArray<size_t, NonPagedPoolNx>
         m_indirectionTable;
 
+    // Scratch space for the entries pushed to the adapter by the OID and
+    // Configure, which NDIS never runs concurrently. Too large to build on
+    // the stack of every indirection table update.
+    TranslatedIndirectionEntries
+        m_translatedEntries;
+
     bool
         m_enabled = false;
 
@@ -198,5 +355,100 @@ private:
     PROCESSOR_NUMBER
         m_defaultProcessor = {};
 
+    NxProcessorTopology
+        m_topology;
+
+    // NUMA node of the NIC, MM_ANY_NODE_OK if not known
+    NODE_REQUIREMENT
+        m_localNode = MM_ANY_NODE_OK;
+
+    // Rebalancing moves single indirection table buckets from the busiest
+    // queue to the least busy one. A move needs the imbalance to persist for
+    // RebalanceConfirmations passes in a row and is followed by
+    // RebalanceCoolDown passes without moves, so short bursts do not cause
+    // buckets to bounce between queues.
+    static constexpr ULONG
+        RebalanceConfirmations = 2;
+
+    static constexpr ULONG
+        RebalanceCoolDown = 4;
+
+    // Below this many packets per interval the busiest queue is not worth
+    // relieving
+    static constexpr ULONG64
+        RebalanceMinimumPackets = 1024;
+
+    // Longest a destination queue holds back indications for a moved bucket,
+    // in 100ns units. An idle source may never fill the buffers the hold
+    // waits for, releases at the deadline are counted in HoldDeadlines.
+    static constexpr ULONG64
+        RebalanceHoldTimeout = 5 * 1000 * 10;
+
+    // 100ns units, zero if rebalancing is disabled
+    ULONG64
+        m_rebalanceInterval = 0;
+
+    // 100ns units, how often the rebalance work item runs. It also sweeps the
+    // flow steering table, so it runs while steering is enabled even if
+    // rebalancing is not. Zero if neither is enabled.
+    ULONG64
+        m_passInterval = 0;
+
+    // percent by which the busiest queue must exceed the least busy one
+    ULONG
+        m_rebalanceThreshold = 0;
+
+    LONG64 volatile
+        m_nextRebalanceTime = 0;
+
+    bool
+        m_rebalancing = false;
+
+    bool
+        m_rebalancePrimed = false;
+
+    size_t
+        m_rebalanceHotQueue = ~0ULL;
+
+    ULONG
+        m_rebalanceStreak = 0;
+
+    ULONG
+        m_rebalanceCoolDown = 0;
+
+    // where the search for the next bucket to move starts
+    size_t
+        m_rebalanceCursor = 0;
+
+    // A bucket move is being pushed to the adapter, and NDIS updated the
+    // indirection table while it was. Guarded by m_indirectionTableLock.
+    bool
+        m_rebalanceInFlight = false;
+
+    bool
+        m_rebalanceRaced = false;
+
+    Rtl::KArray<QueueLoad, NonPagedPoolNx>
+        m_queueLoads;
+
+    KCoalescingWorkItem<NxReceiveScaling>
+        m_rebalanceWorkItem;
+
+    KRundown
+        m_rebalanceRundown;
+
+    NxFlowSteering
+        m_flowSteering;
+
+    NDIS_MEDIUM
+        m_mediaType = NdisMedium802_3;
+
+    // One in FlowSampleRate sends on a processor is parsed to learn its flow
+    static constexpr ULONG
+        FlowSampleRate = 32;
+
+    Rtl::KArray<FlowSample, NonPagedPoolNxCacheAligned>
+        m_flowSamples;
+
 };
 
@@ -28,7 +28,12 @@ Abstract:
 
 #include "NxPerfTuner.hpp"
 #include "NxPacketLayout.hpp"
+#include "NxPoller.hpp"
+#include "NxReceiveScaling.hpp"
+#include "NxSoftwareReceiveScaling.hpp"
+#include "NxFlowSteering.hpp"
 #include "NxChecksumInfo.hpp"
+#include "NxChecksum.hpp"
 #include "NxReceiveCoalescing.hpp"
 #include "NxNblSequence.h"
 
@@ -95,6 +100,8 @@ NET_CLIENT_EXTENSION RxQueueExtensions[] = {
 struct RX_NBL_CONTEXT
 {
     NxRxXlat* Queue;
+    // pre-built MDL describing this NBL's copy break buffer, if any
+    PMDL CopyBreakMdl;
 };
 
 RX_NBL_CONTEXT*
@@ -107,27 +114,6 @@ GetRxContextFromNbl(PNET_BUFFER_LIST Nbl)
 static_assert(sizeof(RX_NBL_CONTEXT) <= FIELD_SIZE(NET_BUFFER_LIST, MiniportReserved),
               "the size of RX_NBL_CONTEXT struct is larger than available space on NBL reserved for miniport");
 
-struct RX_NB_CONTEXT
-{
-    union
-    {
-        //used when system fully manages the Rx buffers (doing both allocate and attach)
-        UINT64 DmaLogicalAddress;
-        //used when driver manages the buffers
-        NET_FRAGMENT_RETURN_CONTEXT_HANDLE RxBufferReturnContext;
-    } DUMMYUNIONNAME;
-};
-
-RX_NB_CONTEXT*
-GetRxContextFromNb(PNET_BUFFER Nb)
-{
-    return
-        reinterpret_cast<RX_NB_CONTEXT*>(&NET_BUFFER_MINIPORT_RESERVED(Nb)[0]);
-}
-
-static_assert(sizeof(RX_NB_CONTEXT) <= FIELD_SIZE(NET_BUFFER, MiniportReserved),
-              "the size of RX_NB_CONTEXT struct is larger than available space on NB reserved for miniport");
-
 static
 void
 NetClientQueueNotify(
@@ -237,7 +223,8 @@ NxRxXlat::NxRxXlat(
     m_adapterDispatch(AdapterDispatch),
     m_packetContext(m_rings, NetRingTypePacket),
     m_fragmentContext(m_rings, NetRingTypeFragment),
-    m_statistics(Statistics)
+    m_statistics(Statistics),
+    m_bufferPoolWorkItem(this, &NxRxXlat::CreatePendingBufferPool)
 {
     m_adapterDispatch->GetProperties(m_adapter, &m_adapterProperties);
     m_nblDispatcher = static_cast<INxNblDispatcher *>(m_adapterProperties.NblDispatcher);
@@ -280,12 +267,80 @@ NxRxXlat::SetGroupAffinity(
     (void)InterlockedExchange(&m_groupAffinityChanged, 1);
 }
 
+_Use_decl_annotations_
+void
+NxRxXlat::SetReceiveScaling(
+    NxReceiveScaling * ReceiveScaling
+)
+{
+    m_receiveScaling = ReceiveScaling;
+}
+
+NxStatistics const &
+NxRxXlat::GetStatistics(
+    void
+) const
+{
+    return m_statistics;
+}
+
+_Use_decl_annotations_
+ULONG
+NxRxXlat::GetPostedPacketIndex(
+    void
+) const
+{
+    return ReadULongAcquire(&m_postedPacketIndex);
+}
+
+_Use_decl_annotations_
+ULONG
+NxRxXlat::GetIndicatedPacketIndex(
+    void
+) const
+{
+    return ReadULongAcquire(&m_indicatedPacketIndex);
+}
+
+_Use_decl_annotations_
+void
+NxRxXlat::HoldIndications(
+    NxRxXlat & Source,
+    ULONG64 Deadline
+)
+{
+    m_holdDeadline = Deadline;
+    WriteBooleanRelease(&m_holdPacketIndexSet, FALSE);
+    WritePointerRelease(reinterpret_cast<PVOID volatile *>(&m_holdSource), &Source);
+}
+
+_Use_decl_annotations_
+void
+NxRxXlat::ReleaseIndicationsAfter(
+    ULONG SourcePacketIndex
+)
+{
+    m_holdPacketIndex = SourcePacketIndex;
+    WriteBooleanRelease(&m_holdPacketIndexSet, TRUE);
+}
+
+_Use_decl_annotations_
+void
+NxRxXlat::ReleaseIndications(
+    void
+)
+{
+    WritePointerRelease(reinterpret_cast<PVOID volatile *>(&m_holdSource), nullptr);
+}
+
 NxRxXlat::ArmedNotifications
 NxRxXlat::GetNotificationsToArm()
 {
     ArmedNotifications notifications;
 
-    if (m_completedPackets == 0 && m_returnedNbls == 0)
+    // Nothing signals the EC when a hold ends, a held queue keeps polling
+    if (! m_indicationsHeld &&
+        m_completedPackets == 0 && m_returnedNbls == 0 && m_indicatedSteeredNbls == 0)
     {
         notifications.Flags.ShouldArmNblReturned = m_outstandingNbls != 0;
 
@@ -309,6 +364,9 @@ NxRxXlat::ArmNotifications(
     if (notifications.Flags.ShouldArmRxIndication)
     {
         ArmAdapterRxNotification();
+
+        // NBLs other queues steer here are receives as well
+        m_steeredNblNotification.Set();
     }
 }
 
@@ -348,18 +406,20 @@ NxRxXlat::EcPrepareBuffersForNetAdapter()
 {
     auto pr = NetRingCollectionGetPacketRing(&m_rings);
     auto fr = NetRingCollectionGetFragmentRing(&m_rings);
-    auto const lastIndex = (pr->OSReserved0 - 1) & pr->ElementIndexMask;
+    auto const lastPacketIndex = (pr->OSReserved0 - 1) & pr->ElementIndexMask;
+    auto const lastFragmentIndex = (fr->OSReserved0 - 1) & fr->ElementIndexMask;
+    auto const packetEndIndex = pr->EndIndex;
 
-    NT_FRE_ASSERT(pr->EndIndex == fr->EndIndex);
-    NT_FRE_ASSERT(pr->OSReserved0 == fr->OSReserved0);
-
-    for (; ! NblStackIsEmpty() && pr->EndIndex != lastIndex;
-        fr->EndIndex = pr->EndIndex = NetRingIncrementIndex(pr, pr->EndIndex))
+    //
+    // A packet may span several fragments, so the two rings are replenished
+    // independently. Packets only carry the NBL the frame is indicated in,
+    // the data buffers are posted in the fragment ring.
+    //
+    for (; ! NblStackIsEmpty() && pr->EndIndex != lastPacketIndex;
+        pr->EndIndex = NetRingIncrementIndex(pr, pr->EndIndex))
     {
-
         auto & context = m_packetContext.GetContext<PacketContext>(pr->EndIndex);
         auto packet = NetRingGetPacketAtIndex(pr, pr->EndIndex);
-        auto fragment = NetRingGetFragmentAtIndex(fr, fr->EndIndex);
 
         NT_FRE_ASSERT(context.NetBufferList == nullptr);
 
@@ -368,26 +428,48 @@ NxRxXlat::EcPrepareBuffersForNetAdapter()
 
         // XXX we need to review whether we zero the entire packet + extension
         RtlZeroMemory(packet, pr->ElementStride);
+    }
+
+    // published before the adapter can see the new packets
+    WriteULongRelease(
+        &m_postedPacketIndex,
+        m_postedPacketIndex + NetRingGetRangeCount(pr, packetEndIndex, pr->EndIndex));
+
+    for (; fr->EndIndex != lastFragmentIndex;
+        fr->EndIndex = NetRingIncrementIndex(fr, fr->EndIndex))
+    {
+        auto fragment = NetRingGetFragmentAtIndex(fr, fr->EndIndex);
 
         // XXX we need to review whether we zero the entire fragment
         if (m_rxBufferAllocationMode == NET_CLIENT_MEMORY_MANAGEMENT_MODE_OS_ALLOCATE_AND_ATTACH)
         {
-            auto nb = NET_BUFFER_LIST_FIRST_NB(context.NetBufferList);
-            auto mdl = NET_BUFFER_CURRENT_MDL(nb);
+            if (MdlStackIsEmpty())
+            {
+                break;
+            }
+
+            auto & context = m_fragmentContext.GetContext<FragmentContext>(fr->EndIndex);
             auto virtualAddress = NetExtensionGetFragmentVirtualAddress(
                 &m_extensions.Extension.VirtualAddress, fr->EndIndex);
 
-            fragment->Capacity = MmGetMdlByteCount(mdl);
+            NT_FRE_ASSERT(context.Mdl == nullptr);
+
+            context.Mdl = MdlStackPop();
+
+            // the MDL is trimmed to the received data when chained to an NBL
+            context.Mdl->ByteCount = static_cast<ULONG>(m_rxDataBufferCapacity);
+
+            fragment->Capacity = m_rxDataBufferCapacity;
             fragment->Offset = m_backfillSize;
             fragment->Scratch = 0;
 
-            virtualAddress->VirtualAddress = MmGetMdlVirtualAddress(mdl);
+            virtualAddress->VirtualAddress = MmGetMdlVirtualAddress(context.Mdl);
 
             if (m_extensions.Extension.LogicalAddress.Enabled)
             {
                 auto logicalAddress = NetExtensionGetFragmentLogicalAddress(
                     &m_extensions.Extension.LogicalAddress, fr->EndIndex);
-                logicalAddress->LogicalAddress = GetRxContextFromNb(nb)->DmaLogicalAddress;
+                logicalAddress->LogicalAddress = GetMdlContext(context.Mdl).DmaLogicalAddress;
             }
         }
         else
@@ -405,9 +487,95 @@ NxRxXlat::EcUpdateAffinity()
         while (InterlockedExchange(&m_groupAffinityChanged, 0))
         {
 #ifdef _KERNEL_MODE
-            KeSetSystemGroupAffinityThread(&m_groupAffinity, NULL);
+            // a hosted EC follows its affinity when the queue is next started
+            if (! m_executionContext.IsHosted())
+            {
+                KeSetSystemGroupAffinityThread(&m_groupAffinity, NULL);
+            }
 #endif
         }
+
+        // only buffers attached to an MDL can be followed back to their pool
+        if (m_rxBufferAllocationMode == NET_CLIENT_MEMORY_MANAGEMENT_MODE_OS_ALLOCATE_AND_ATTACH)
+        {
+            m_targetBufferNode = NxExecutionContext::QueryAffinityNode(m_groupAffinity);
+        }
+    }
+
+    if (m_targetBufferNode != m_bufferNode)
+    {
+        EcMigrateBufferPool();
+    }
+}
+
+void
+NxRxXlat::EcMigrateBufferPool()
+{
+    // a migration in progress must finish before the next one starts
+    if (m_retiredBufferPool != nullptr)
+    {
+        return;
+    }
+
+    if (! m_bufferPoolPending)
+    {
+        if (! m_bufferPoolRundown.TryAcquire())
+        {
+            return;
+        }
+
+        m_pendingBufferNode = m_targetBufferNode;
+        m_bufferPoolPending = true;
+
+        // the last run may not have finished yet, retried next iteration
+        if (! m_bufferPoolWorkItem.Queue())
+        {
+            m_bufferPoolPending = false;
+            m_bufferPoolRundown.Release();
+        }
+
+        return;
+    }
+
+    if (! ReadBooleanAcquire(&m_pendingBufferPoolReady))
+    {
+        return;
+    }
+
+    auto const bufferPool = m_pendingBufferPool;
+    m_pendingBufferPool = nullptr;
+    m_pendingBufferPoolReady = FALSE;
+    m_bufferPoolPending = false;
+
+    if (bufferPool == nullptr)
+    {
+        // stay where we are until RSS moves the queue again
+        if (m_targetBufferNode == m_pendingBufferNode)
+        {
+            m_targetBufferNode = m_bufferNode;
+        }
+
+        return;
+    }
+
+    // RSS moved the queue again while the pool was created, the next
+    // iteration creates one on the current node
+    if (m_targetBufferNode != m_pendingBufferNode)
+    {
+        m_bufferPoolDispatch->NetClientDestroyBufferPool(bufferPool);
+        return;
+    }
+
+    m_retiredBufferPool = m_bufferPool;
+    m_retiredBuffers = m_mdlStack.count();
+    m_bufferPool = bufferPool;
+    m_bufferNode = m_pendingBufferNode;
+    m_bufferPoolGeneration++;
+
+    // buffers not posted to the NIC or indicated up can move right away
+    for (size_t i = 0; i < m_mdlStackIndex; i++)
+    {
+        MigrateFragmentBuffer(m_mdlStack[i]);
     }
 }
 
@@ -460,17 +628,39 @@ void
 NxRxXlat::EcIndicateNblsToNdis()
 {
     auto pr = NetRingCollectionGetPacketRing(&m_rings);
-    auto fr = NetRingCollectionGetFragmentRing(&m_rings);
-
-    NT_FRE_ASSERT(pr->OSReserved0 == fr->OSReserved0);
-    NT_FRE_ASSERT(pr->BeginIndex == fr->BeginIndex);
 
     NxNblSequence nblsToIndicate;
 
+    // Consecutive NBLs steered to the same queue are handed over together
+    auto const flowSteering = m_receiveScaling != nullptr && m_receiveScaling->IsFlowSteeringActive();
+    NxRxXlat * steerTo = nullptr;
+    NBL_COUNTED_QUEUE nblsToSteer;
+    ndisInitializeNblQueue(&nblsToSteer.Queue);
+    nblsToSteer.NblCount = 0;
+
+    auto const flushSteeredNbls = [this, &nblsToIndicate, &steerTo, &nblsToSteer]()
+    {
+        if (nblsToSteer.NblCount != 0 && ! EcSteerNbls(steerTo, &nblsToSteer))
+        {
+            // the queue is winding down, indicate them here
+            auto nbl = ndisPopAllFromNblQueue(&nblsToSteer.Queue);
+            while (nbl != nullptr)
+            {
+                auto const next = nbl->Next;
+                nbl->Next = nullptr;
+                nblsToIndicate.AddNbl(nbl);
+                nbl = next;
+            }
+        }
+
+        ndisInitializeNblQueue(&nblsToSteer.Queue);
+        nblsToSteer.NblCount = 0;
+    };
+
     m_completedPackets = NetRingGetRangeCount(pr, pr->OSReserved0, pr->BeginIndex);
 
     for (; pr->OSReserved0 != pr->BeginIndex;
-        fr->OSReserved0 = pr->OSReserved0 = NetRingIncrementIndex(pr, pr->OSReserved0))
+        pr->OSReserved0 = NetRingIncrementIndex(pr, pr->OSReserved0))
     {
         auto & context = m_packetContext.GetContext<PacketContext>(pr->OSReserved0);
         auto packet = NetRingGetPacketAtIndex(pr, pr->OSReserved0);
@@ -481,7 +671,25 @@ NxRxXlat::EcIndicateNblsToNdis()
         if (! packet->Ignore &&
             TransferDataBufferFromNetPacketToNbl(packet, context.NetBufferList, pr->OSReserved0))
         {
-            nblsToIndicate.AddNbl(context.NetBufferList);
+            auto const flowQueue = flowSteering ? EcGetFlowQueue(packet) : nullptr;
+
+            if (flowQueue != nullptr && flowQueue != this)
+            {
+                if (flowQueue != steerTo)
+                {
+                    flushSteeredNbls();
+                    steerTo = flowQueue;
+                }
+
+                ndisAppendSingleNblToNblQueue(&nblsToSteer.Queue, context.NetBufferList);
+                nblsToSteer.NblCount++;
+            }
+            else if (m_softwareReceiveScaling == nullptr ||
+                ! m_softwareReceiveScaling->Steer(context.NetBufferList))
+            {
+                nblsToIndicate.AddNbl(context.NetBufferList);
+            }
+
             m_statistics.Increment(NxStatisticsCounters::NumberOfPackets);
         }
         else
@@ -492,6 +700,18 @@ NxRxXlat::EcIndicateNblsToNdis()
         context.NetBufferList = nullptr;
     }
 
+    // Fragments of ignored or dropped packets were not chained to an NBL
+    ReclaimUnclaimedFragments();
+
+    // steered flows are indicated by the queues they are steered to
+    flushSteeredNbls();
+
+    // steered NBLs are indicated by the workers of their processors
+    if (m_softwareReceiveScaling != nullptr)
+    {
+        m_outstandingNbls += m_softwareReceiveScaling->Flush();
+    }
+
     if (nblsToIndicate)
     {
         m_outstandingNbls += nblsToIndicate.GetCount();
@@ -510,6 +730,191 @@ NxRxXlat::EcIndicateNblsToNdis()
             ndisAppendNblQueueToNblQueueFast(&m_discardedNbl, &nblsToIndicate.GetNblQueue());
         }
     }
+
+    WriteULongRelease(&m_indicatedPacketIndex, m_indicatedPacketIndex + m_completedPackets);
+}
+
+NxRxXlat *
+NxRxXlat::EcGetFlowQueue(
+    NET_PACKET const * Packet
+)
+{
+    if (Packet->FragmentCount == 0)
+    {
+        return nullptr;
+    }
+
+    // the headers of a steered flow are expected in the first fragment
+    auto const fr = NetRingCollectionGetFragmentRing(&m_rings);
+    auto const fragment = NetRingGetFragmentAtIndex(fr, Packet->FragmentIndex);
+    auto const virtualAddress = NetExtensionGetFragmentVirtualAddress(
+        &m_extensions.Extension.VirtualAddress, Packet->FragmentIndex);
+
+    NxFlowKey key;
+    if (! NxGetFlowKey(
+            Packet->Layout,
+            static_cast<UCHAR const *>(virtualAddress->VirtualAddress) + fragment->Offset,
+            static_cast<UINT32>(fragment->ValidLength),
+            key))
+    {
+        return nullptr;
+    }
+
+    return m_receiveScaling->GetFlowQueue(key);
+}
+
+bool
+NxRxXlat::EcSteerNbls(
+    NxRxXlat * Queue,
+    NBL_COUNTED_QUEUE * Nbls
+)
+{
+    auto const count = static_cast<ULONG>(Nbls->NblCount);
+
+    // accounted for before the other queue can see them
+    InterlockedAdd(&m_steeredNbls, static_cast<LONG>(count));
+
+    if (! Queue->EnqueueSteeredNbls(Nbls))
+    {
+        InterlockedAdd(&m_steeredNbls, -static_cast<LONG>(count));
+        return false;
+    }
+
+    m_outstandingNbls += count;
+
+    return true;
+}
+
+void
+NxRxXlat::EcIndicateSteeredNbls()
+{
+    m_indicatedSteeredNbls = 0;
+
+    NBL_QUEUE steeredNbls;
+    m_steeredNblQueue.DequeueAll(&steeredNbls);
+
+    for (auto nbl = steeredNbls.First; nbl != nullptr;)
+    {
+        NBL_QUEUE span;
+        NxRxXlat * owner;
+        ULONG numberOfNbls;
+        nbl = GetLongestSpanWithSameQueue(nbl, &span, &owner, &numberOfNbls);
+
+        NxNblSequence nblsToIndicate;
+        for (auto current = span.First; current != nullptr;)
+        {
+            auto const next = current->Next;
+            current->Next = nullptr;
+            nblsToIndicate.AddNbl(current);
+            current = next;
+        }
+
+        if (!m_nblDispatcher->IndicateReceiveNetBufferLists(
+                nblsToIndicate.GetNblQueue().First,
+                NDIS_DEFAULT_PORT_NUMBER,
+                numberOfNbls,
+                nblsToIndicate.GetReceiveFlags()))
+        {
+            // The NBL packet gate closed, see EcIndicateNblsToNdis
+            owner->QueueReturnedNetBufferLists(&nblsToIndicate.GetNblQueue());
+        }
+
+        owner->CompleteSteeredNbls(numberOfNbls);
+        m_indicatedSteeredNbls += numberOfNbls;
+    }
+}
+
+void
+NxRxXlat::EcCloseSteeredNblQueue()
+{
+    // Once closed other queues indicate their steered flows themselves,
+    // what they steered here before is indicated one last time
+    m_steeredNblRundown.CloseAndWait();
+    m_steeredNblQueueClosed = true;
+
+    EcIndicateSteeredNbls();
+}
+
+bool
+NxRxXlat::EcSteeredNblsDrained()
+{
+    if (ReadAcquire(&m_steeredNbls) == 0)
+    {
+        return true;
+    }
+
+    // arm, then check again in case the last of them completed in between
+    m_steeredNblsDrainedNotification.Set();
+
+    return ReadAcquire(&m_steeredNbls) == 0;
+}
+
+_Use_decl_annotations_
+bool
+NxRxXlat::EnqueueSteeredNbls(
+    NBL_COUNTED_QUEUE * Nbls
+)
+{
+    if (! m_steeredNblRundown.TryAcquire())
+    {
+        return false;
+    }
+
+    m_steeredNblQueue.Enqueue(Nbls);
+
+    if (m_steeredNblNotification.TestAndClear())
+    {
+        m_executionContext.SignalWork();
+    }
+
+    m_steeredNblRundown.Release();
+
+    return true;
+}
+
+_Use_decl_annotations_
+void
+NxRxXlat::CompleteSteeredNbls(
+    ULONG NumberOfNbls
+)
+{
+    if (InterlockedAdd(&m_steeredNbls, -static_cast<LONG>(NumberOfNbls)) == 0 &&
+        m_steeredNblsDrainedNotification.TestAndClear())
+    {
+        m_executionContext.SignalWork();
+    }
+}
+
+bool
+NxRxXlat::EcIndicationsHeld()
+{
+    auto const source = static_cast<NxRxXlat *>(
+        ReadPointerAcquire(reinterpret_cast<PVOID volatile *>(&m_holdSource)));
+
+    if (source == nullptr)
+    {
+        return false;
+    }
+
+    auto const expired = m_executionContext.QueryTime() >= m_holdDeadline;
+
+    if (m_executionContext.IsStopping() ||
+        expired ||
+        (ReadBooleanAcquire(&m_holdPacketIndexSet) &&
+            static_cast<LONG>(source->GetIndicatedPacketIndex() - m_holdPacketIndex) >= 0))
+    {
+        if (expired)
+        {
+            m_statistics.Increment(NxStatisticsCounters::HoldDeadlines);
+        }
+
+        InterlockedCompareExchangePointer(
+            reinterpret_cast<PVOID volatile *>(&m_holdSource), nullptr, source);
+
+        return false;
+    }
+
+    return true;
 }
 
 void
@@ -521,6 +926,21 @@ NxRxXlat::EcUpdatePerfCounter()
     m_statistics.IncrementBy(NxStatisticsCounters::NblPending, m_outstandingNbls);
     m_statistics.IncrementBy(NxStatisticsCounters::PacketsCompleted, m_returnedNbls);
     m_statistics.IncrementBy(NxStatisticsCounters::QueueDepth, NetRingGetRangeCount(pr, pr->BeginIndex, pr->EndIndex));
+
+    if (m_perfCountersInterval != 0 &&
+        m_statistics.GetCounter(NxStatisticsCounters::IterationCount) % m_perfCountersInterval == 0)
+    {
+        TraceLoggingWrite(
+            g_hNetAdapterCxXlatProvider,
+            "NxRxQueuePerfCounters",
+            TraceLoggingDescription("Receive queue counters, reported every RX_PERF_COUNTERS_ITERATION_INTERVAL iterations"),
+            TraceLoggingUInt64(GetQueueId(), "QueueId"),
+            TraceLoggingUInt64(m_statistics.GetCounter(NxStatisticsCounters::IterationCount), "IterationCount"),
+            TraceLoggingUInt64(m_statistics.GetCounter(NxStatisticsCounters::PacketsCompleted), "PacketsCompleted"),
+            TraceLoggingUInt64(m_statistics.GetCounter(NxStatisticsCounters::CopiedPackets), "CopiedPackets"),
+            TraceLoggingUInt64(m_statistics.GetCounter(NxStatisticsCounters::ZeroCopyPackets), "ZeroCopyPackets"),
+            TraceLoggingUInt64(m_statistics.GetCounter(NxStatisticsCounters::HoldDeadlines), "HoldDeadlines"));
+    }
 }
 
 void
@@ -528,12 +948,32 @@ NxRxXlat::EcWaitForWork()
 {
     auto notificationsToArm = GetNotificationsToArm();
 
+    // Before arming notifications give new work a chance to show up by
+    // polling for a short while. The execution context decides how long
+    // based on how far apart work has recently been arriving.
+    if (notificationsToArm.Value == 0)
+    {
+        m_executionContext.NotifyProgress();
+    }
+    else if (m_lastArmedNotifications.Value == 0 && m_executionContext.BusyPoll())
+    {
+        return;
+    }
+
     // In order to handle race conditions, the notifications that should
     // be armed at halt cannot change between the halt preparation and the
     // actual halt. If they do change, re-arm the necessary notifications
     // and loop again.
     if (notificationsToArm.Value != 0 && notificationsToArm.Value == m_lastArmedNotifications.Value)
     {
+        // A hosted EC goes back to its poller and picks up from here once
+        // signaled, see ReceivePoll
+        if (m_executionContext.IsHosted())
+        {
+            m_halted = true;
+            return;
+        }
+
         m_executionContext.WaitForWork();
 
         // after halting, don't arm any notifications
@@ -557,35 +997,124 @@ NetAdapterReceiveThread(
     return EC_RETURN();
 }
 
+static EC_POLL_ROUTINE NetAdapterReceivePoll;
+
+static
+bool
+NetAdapterReceivePoll(
+    PVOID Context
+)
+{
+    return reinterpret_cast<NxRxXlat*>(Context)->ReceivePoll();
+}
+
 void
 NxRxXlat::SetupRxThreadProperties()
 {
 #if _KERNEL_MODE
-    // setup thread prioirty;
-    ULONG threadPriority =
-        m_dispatch->NetClientQueryDriverConfigurationUlong(RX_THREAD_PRIORITY);
+    // a hosted EC runs on its poller's thread, which has its own priority and affinity
+    if (! m_executionContext.IsHosted())
+    {
+        // setup thread prioirty;
+        ULONG threadPriority =
+            m_dispatch->NetClientQueryDriverConfigurationUlong(RX_THREAD_PRIORITY);
 
-    KeSetBasePriorityThread(KeGetCurrentThread(), threadPriority - (LOW_REALTIME_PRIORITY + LOW_PRIORITY) / 2);
+        KeSetBasePriorityThread(KeGetCurrentThread(), threadPriority - (LOW_REALTIME_PRIORITY + LOW_PRIORITY) / 2);
 
-    BOOLEAN setThreadAffinity =
-        m_dispatch->NetClientQueryDriverConfigurationBoolean(RX_THREAD_AFFINITY_ENABLED);
+        BOOLEAN setThreadAffinity =
+            m_dispatch->NetClientQueryDriverConfigurationBoolean(RX_THREAD_AFFINITY_ENABLED);
 
-    ULONG threadAffinity =
-        m_dispatch->NetClientQueryDriverConfigurationUlong(RX_THREAD_AFFINITY);
+        ULONG threadAffinity =
+            m_dispatch->NetClientQueryDriverConfigurationUlong(RX_THREAD_AFFINITY);
 
-    if (setThreadAffinity != FALSE)
-    {
-        GROUP_AFFINITY Affinity = { 0 };
-        GROUP_AFFINITY old;
-        PROCESSOR_NUMBER CpuNum = { 0 };
-        KeGetProcessorNumberFromIndex(threadAffinity, &CpuNum);
-        Affinity.Group = CpuNum.Group;
-        Affinity.Mask =
-            (threadAffinity != THREAD_AFFINITY_NO_MASK) ?
-                AFFINITY_MASK(CpuNum.Number) : ((ULONG_PTR)-1);
-        KeSetSystemGroupAffinityThread(&Affinity, &old);
+        if (setThreadAffinity != FALSE)
+        {
+            GROUP_AFFINITY Affinity = { 0 };
+            GROUP_AFFINITY old;
+            PROCESSOR_NUMBER CpuNum = { 0 };
+            KeGetProcessorNumberFromIndex(threadAffinity, &CpuNum);
+            Affinity.Group = CpuNum.Group;
+            Affinity.Mask =
+                (threadAffinity != THREAD_AFFINITY_NO_MASK) ?
+                    AFFINITY_MASK(CpuNum.Number) : ((ULONG_PTR)-1);
+            KeSetSystemGroupAffinityThread(&Affinity, &old);
+        }
     }
 #endif
+
+    m_executionContext.SetBusyPollWindow(
+        m_dispatch->NetClientQueryDriverConfigurationUlong(RX_BUSY_POLL_WINDOW));
+}
+
+// Returns true once the queue has wound down after being cancelled
+bool
+NxRxXlat::EcRunIteration(
+    bool & CancelIssued
+)
+{
+    EcReturnBuffers();
+
+    // provide buffers to NetAdapter only if running
+    if (! m_executionContext.IsStopping())
+    {
+        EcPrepareBuffersForNetAdapter();
+    }
+
+    EcUpdateAffinity();
+    EcYieldToNetAdapter();
+
+    // the NBLs other queues steered here wait for a hold as well, or they
+    // could be indicated ahead of the frames the hold is for
+    m_indicationsHeld = EcIndicationsHeld();
+
+    if (! m_indicationsHeld)
+    {
+        EcIndicateNblsToNdis();
+        EcIndicateSteeredNbls();
+    }
+
+    if (m_receiveScaling != nullptr)
+    {
+        m_receiveScaling->NotifyIteration();
+    }
+
+    EcUpdatePerfCounter();
+    EcWaitForWork();
+
+    // This represents the wind down of Rx
+    if (m_executionContext.IsStopping())
+    {
+        if (!CancelIssued)
+        {
+            // Indicate cancellation to the adapter
+            // and drop all outstanding NBLs.
+            //
+            // One NBL may remain that has been partially programmed into the NIC.
+            // So that NBL is kept around until the end.
+
+            m_queueDispatch->Cancel(m_queue);
+
+            CancelIssued = true;
+        }
+
+        // The termination condition is that all packets have been returned from the NIC
+        // and that software RSS workers and the queues flows were steered to are done
+        // with the NBLs handed to them.
+        auto const pr = NetRingCollectionGetPacketRing(&m_rings);
+        auto const fr = NetRingCollectionGetFragmentRing(&m_rings);
+        if (pr->BeginIndex == pr->EndIndex && fr->BeginIndex == fr->EndIndex &&
+            (m_softwareReceiveScaling == nullptr || m_softwareReceiveScaling->IsDrained()) &&
+            EcSteeredNblsDrained())
+        {
+            EcCloseSteeredNblQueue();
+            EcRecoverBuffers();
+            m_queueDispatch->Stop(m_queue);
+            m_executionContext.SignalStopped();
+            return true;
+        }
+    }
+
+    return false;
 }
 
 void
@@ -599,51 +1128,38 @@ NxRxXlat::ReceiveThread()
 
         auto cancelIssued = false;
 
-        while (true)
+        while (! EcRunIteration(cancelIssued))
         {
-            EcReturnBuffers();
-
-            // provide buffers to NetAdapter only if running
-            if (! m_executionContext.IsStopping())
-            {
-                EcPrepareBuffersForNetAdapter();
-            }
-
-            EcUpdateAffinity();
-            EcYieldToNetAdapter();
-            EcIndicateNblsToNdis();
-            EcUpdatePerfCounter();
-            EcWaitForWork();
+        }
+    }
+}
 
-            // This represents the wind down of Rx
-            if (m_executionContext.IsStopping())
-            {
-                if (!cancelIssued)
-                {
-                    // Indicate cancellation to the adapter
-                    // and drop all outstanding NBLs.
-                    //
-                    // One NBL may remain that has been partially programmed into the NIC.
-                    // So that NBL is kept around until the end.
+bool
+NxRxXlat::ReceivePoll()
+{
+    if (! m_queueStarted)
+    {
+        m_queueDispatch->Start(m_queue);
 
-                    m_queueDispatch->Cancel(m_queue);
+        m_queueStarted = true;
+        m_cancelIssued = false;
+        m_halted = false;
+    }
 
-                    cancelIssued = true;
-                }
+    // same as the EC thread waking up from a halt
+    if (m_halted)
+    {
+        m_halted = false;
+        m_lastArmedNotifications.Value = 0;
+    }
 
-                // The termination condition is that all packets have been returned from the NIC.
-                auto const pr = NetRingCollectionGetPacketRing(&m_rings);
-                auto const fr = NetRingCollectionGetFragmentRing(&m_rings);
-                if (pr->BeginIndex == pr->EndIndex && fr->BeginIndex == fr->EndIndex)
-                {
-                    EcRecoverBuffers();
-                    m_queueDispatch->Stop(m_queue);
-                    m_executionContext.SignalStopped();
-                    break;
-                }
-            }
-        }
+    if (EcRunIteration(m_cancelIssued))
+    {
+        m_queueStarted = false;
+        return false;
     }
+
+    return ! m_halted;
 }
 
 NTSTATUS
@@ -694,11 +1210,58 @@ NxRxXlat::Initialize(
         m_fragmentContext.Initialize(sizeof(FragmentContext)),
         "Failed to initialize private fragment context.");
 
-    CX_RETURN_IF_NOT_NT_SUCCESS_MSG(
-        m_executionContext.Initialize(this, NetAdapterReceiveThread),
-        "Failed to start Rx execution context. NxRxXlat=%p", this);
+    if (m_dispatch->NetClientQueryDriverConfigurationBoolean(DATAPATH_POLLER_ENABLED))
+    {
+        NxPoller * poller;
+        CX_RETURN_IF_NOT_NT_SUCCESS_MSG(
+            NxPoller::Get(
+                static_cast<ULONG>(GetQueueId() % KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS)),
+                m_dispatch->NetClientQueryDriverConfigurationUlong(RX_THREAD_PRIORITY),
+                &poller),
+            "Failed to get datapath poller. NxRxXlat=%p", this);
+
+        CX_RETURN_IF_NOT_NT_SUCCESS_MSG(
+            m_executionContext.InitializeHosted(this, NetAdapterReceivePoll, *poller),
+            "Failed to host Rx execution context. NxRxXlat=%p", this);
+
+        SetupRxThreadProperties();
+    }
+    else
+    {
+        CX_RETURN_IF_NOT_NT_SUCCESS_MSG(
+            m_executionContext.Initialize(this, NetAdapterReceiveThread),
+            "Failed to start Rx execution context. NxRxXlat=%p", this);
+
+        m_executionContext.SetDebugNameHint(L"Receive", GetQueueId(), m_adapterProperties.NetLuid);
+    }
 
-    m_executionContext.SetDebugNameHint(L"Receive", GetQueueId(), m_adapterProperties.NetLuid);
+    // NDIS only configures RSS on adapters that advertise it, without it
+    // every frame arrives on queue 0 and would be processed by one processor
+    auto const softwareReceiveScalingProcessors =
+        m_dispatch->NetClientQueryDriverConfigurationUlong(RX_SOFTWARE_RSS_PROCESSORS);
+
+    if (GetQueueId() == 0 && softwareReceiveScalingProcessors > 1)
+    {
+        NET_CLIENT_ADAPTER_RECEIVE_SCALING_CAPABILITIES capabilities = {};
+        m_adapterDispatch->GetReceiveScalingCapabilities(m_adapter, &capabilities);
+
+        if (capabilities.NumberOfIndirectionQueues == 0)
+        {
+            m_softwareReceiveScaling = wil::make_unique_nothrow<NxSoftwareReceiveScaling>(
+                *this,
+                m_executionContext,
+                *m_nblDispatcher);
+
+            CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES, ! m_softwareReceiveScaling);
+
+            CX_RETURN_IF_NOT_NT_SUCCESS_MSG(
+                m_softwareReceiveScaling->Initialize(
+                    softwareReceiveScalingProcessors,
+                    m_dispatch->NetClientQueryDriverConfigurationUlong(RX_THREAD_PRIORITY),
+                    NxReceiveScaling::QueryLocalNode(m_adapterProperties.NdisAdapterHandle)),
+                "Failed to initialize software RSS. NxRxXlat=%p", this);
+        }
+    }
 
     return STATUS_SUCCESS;
 }
@@ -709,6 +1272,32 @@ NxRxXlat::Start(
     void
 )
 {
+#ifdef _KERNEL_MODE
+    // follow the RSS affinity onto the poller of its first processor
+    if (m_executionContext.IsHosted() && m_groupAffinity.Mask != 0)
+    {
+        PROCESSOR_NUMBER processor = {};
+        processor.Group = m_groupAffinity.Group;
+        processor.Number = static_cast<UCHAR>(RtlFindLeastSignificantBit(m_groupAffinity.Mask));
+
+        NxPoller * poller;
+        if (NT_SUCCESS(NxPoller::Get(
+                KeGetProcessorIndexFromNumber(&processor),
+                m_dispatch->NetClientQueryDriverConfigurationUlong(RX_THREAD_PRIORITY),
+                &poller)))
+        {
+            m_executionContext.SetPoller(*poller);
+        }
+    }
+#endif
+
+    // reopened for other queues to steer flows here
+    if (m_steeredNblQueueClosed)
+    {
+        m_steeredNblRundown.Reinitialize();
+        m_steeredNblQueueClosed = false;
+    }
+
     m_executionContext.Start();
 }
 
@@ -746,11 +1335,18 @@ NxRxXlat::CreateVariousPools()
     NX_PERF_RX_NIC_CHARACTERISTICS perfCharacteristics = {};
     NX_PERF_RX_TUNING_PARAMETERS perfParameters;
     perfCharacteristics.Nic.IsDriverVerifierEnabled = !!m_adapterProperties.DriverIsVerifying;
-    perfCharacteristics.Nic.MediaType = m_mediaType;
+    perfCharacteristics.Nic.MediaType = m_adapterProperties.MediaType;
     perfCharacteristics.FragmentRingNumberOfElementsHint = datapathCapabilities.PreferredRxFragmentRingSize;
     perfCharacteristics.MaximumFragmentBufferSize = datapathCapabilities.MaximumRxFragmentSize;
     perfCharacteristics.NominalLinkSpeed = datapathCapabilities.NominalMaxRxLinkSpeed;
-    perfCharacteristics.MaxPacketSizeWithRsc = datapathCapabilities.MaximumRxFragmentSize + m_backfillSize;
+
+    //
+    // Let the tuner size the fragment ring for the largest frame rather than
+    // for a single buffer, the same way the ring size reported to NDIS is
+    // computed.
+    //
+    auto const maximumFrameSize = NxGetMaxPacketSizeWithRsc(m_adapterProperties.MediaType, datapathCapabilities);
+    perfCharacteristics.MaxPacketSizeWithRsc = maximumFrameSize;
 
     NxPerfTunerCalculateRxParameters(&perfCharacteristics, &perfParameters);
     m_rxNumPackets = perfParameters.PacketRingElementCount;
@@ -759,6 +1355,26 @@ NxRxXlat::CreateVariousPools()
     m_backfillSize = 0;
     m_rxDataBufferSize = datapathCapabilities.MaximumRxFragmentSize + m_backfillSize;
     m_rxBufferAllocationMode = datapathCapabilities.RxMemoryManagementMode;
+    m_rxMaxFragmentsPerPacket = m_rxDataBufferSize == 0
+        ? 1
+        : (maximumFrameSize + m_rxDataBufferSize - 1) / m_rxDataBufferSize;
+
+    //
+    // Each outstanding NBL may hold as many MDLs as a full sized frame needs,
+    // and in attach mode every buffer posted in the fragment ring owns one as
+    // well. A frame exceeding the estimate (e.g. an RSC super-packet) is
+    // still accepted as long as spare MDLs are available.
+    //
+    size_t numberOfMdls = 0;
+    CX_RETURN_IF_NOT_NT_SUCCESS(
+        RtlSizeTMult(perfParameters.NumberOfNbls, m_rxMaxFragmentsPerPacket, &numberOfMdls));
+
+    if (m_rxBufferAllocationMode == NET_CLIENT_MEMORY_MANAGEMENT_MODE_OS_ALLOCATE_AND_ATTACH)
+    {
+        CX_RETURN_IF_NOT_NT_SUCCESS(RtlSizeTAdd(numberOfMdls, m_rxNumFragments, &numberOfMdls));
+    }
+
+    numberOfMdls = max(numberOfMdls, static_cast<size_t>(perfParameters.NumberOfBuffers));
 
     NET_BUFFER_LIST_POOL_PARAMETERS poolParameters = {};
 
@@ -780,35 +1396,119 @@ NxRxXlat::CreateVariousPools()
     CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES, !m_nblStorage);
 
     size_t totalSize = 0;
-    size_t mdlSize = ALIGN_UP(MmSizeOfMdl(DUMMY_VA, m_rxDataBufferSize), PVOID);
-    CX_RETURN_IF_NOT_NT_SUCCESS(RtlSizeTMult(mdlSize, perfParameters.NumberOfBuffers, &totalSize));
+    m_mdlSize = ALIGN_UP(MmSizeOfMdl(DUMMY_VA, m_rxDataBufferSize), PVOID);
+    CX_RETURN_IF_NOT_NT_SUCCESS(RtlSizeTMult(m_mdlSize, numberOfMdls, &totalSize));
 
     m_MdlPool = MakeSizedPoolPtrNP<MDL>('prxc', totalSize);
     CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES, !m_MdlPool);
     RtlZeroMemory(m_MdlPool.get(), totalSize);
 
-    if (m_rxBufferAllocationMode != NET_CLIENT_MEMORY_MANAGEMENT_MODE_DRIVER)
+    CX_RETURN_NTSTATUS_IF(
+        STATUS_INSUFFICIENT_RESOURCES,
+        ! m_mdlStack.resize(numberOfMdls));
+
+    CX_RETURN_NTSTATUS_IF(
+        STATUS_INSUFFICIENT_RESOURCES,
+        ! m_mdlContext.resize(numberOfMdls));
+
+    m_copyBreakThreshold = m_dispatch->NetClientQueryDriverConfigurationUlong(RX_COPY_BREAK_THRESHOLD);
+
+    if (m_dispatch->NetClientQueryDriverConfigurationBoolean(RX_REPORT_PERF_COUNTERS))
     {
-        // create buffer pool if the driver wants the OS to allocate Rx buffer
-        NET_CLIENT_BUFFER_POOL_CONFIG bufferPoolConfig = {
-            &datapathCapabilities.RxMemoryConstraints,
-            perfParameters.NumberOfBuffers,
-            m_rxDataBufferSize,
-            m_backfillSize,
-            0,
-            MM_ANY_NODE_OK,                      //default numa node
-            NET_CLIENT_BUFFER_POOL_FLAGS_NONE   //non-serialized version
-        };
+        m_perfCountersInterval =
+            m_dispatch->NetClientQueryDriverConfigurationUlong(RX_PERF_COUNTERS_ITERATION_INTERVAL);
+    }
+    m_softwareChecksum = !!m_dispatch->NetClientQueryDriverConfigurationBoolean(RX_SOFTWARE_CHECKSUM_ENABLED);
+
+    size_t copyBreakBufferSize = 0;
+    size_t copyBreakMdlSize = 0;
+
+    if (m_copyBreakThreshold != 0)
+    {
+        // one buffer per NBL, cache aligned so neighbours don't share lines
+        copyBreakBufferSize = ALIGN_UP_BY(m_copyBreakThreshold, SYSTEM_CACHE_ALIGNMENT_SIZE);
+        copyBreakMdlSize = ALIGN_UP(MmSizeOfMdl(DUMMY_VA, copyBreakBufferSize), PVOID);
+
+        CX_RETURN_IF_NOT_NT_SUCCESS(RtlSizeTMult(copyBreakBufferSize, perfParameters.NumberOfNbls, &totalSize));
+
+        m_copyBreakBuffers = MakeSizedPoolPtrNP<UCHAR>('prxc', totalSize);
+        CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES, !m_copyBreakBuffers);
 
+        CX_RETURN_IF_NOT_NT_SUCCESS(RtlSizeTMult(copyBreakMdlSize, perfParameters.NumberOfNbls, &totalSize));
+
+        m_copyBreakMdlPool = MakeSizedPoolPtrNP<MDL>('prxc', totalSize);
+        CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES, !m_copyBreakMdlPool);
+        RtlZeroMemory(m_copyBreakMdlPool.get(), totalSize);
+    }
+
+    if (m_rxBufferAllocationMode != NET_CLIENT_MEMORY_MANAGEMENT_MODE_DRIVER)
+    {
+        // create buffer pool if the driver wants the OS to allocate Rx buffer.
+        // the queue is not affinitized yet, the buffers follow it once it is
         CX_RETURN_IF_NOT_NT_SUCCESS(
-            m_dispatch->NetClientCreateBufferPool(&bufferPoolConfig,
-                                                  &m_bufferPool,
-                                                  &m_bufferPoolDispatch));
+            CreateBufferPool(datapathCapabilities, m_bufferNode, &m_bufferPool, &m_bufferPoolDispatch));
     }
 
     NET_CLIENT_ADAPTER_PROPERTIES adapterProperties;
     m_adapterDispatch->GetProperties(m_adapter, &adapterProperties);
 
+    //
+    // Rx buffers are pulled from the pool in batches. Any buffer left over
+    // from the last batch when this routine fails is returned to the pool.
+    //
+    void * addresses[64];
+    UINT64 logicalAddresses[ARRAYSIZE(addresses)];
+    ULONG batchCount = 0;
+    ULONG batchIndex = 0;
+    SIZE_T offset, capacity;
+
+    auto freeUnusedBuffers = wil::scope_exit([&]()
+    {
+        if (batchIndex < batchCount)
+        {
+            m_bufferPoolDispatch->NetClientFreeBuffers(m_bufferPool,
+                                                       &addresses[batchIndex],
+                                                       batchCount - batchIndex);
+        }
+    });
+
+    for (size_t i = 0; i < numberOfMdls; i++)
+    {
+        PMDL mdl = reinterpret_cast<PMDL>(((size_t) m_MdlPool.get()) + i * m_mdlSize);
+
+        if (m_rxBufferAllocationMode == NET_CLIENT_MEMORY_MANAGEMENT_MODE_OS_ALLOCATE_AND_ATTACH)
+        {
+            //
+            // pre-built MDL if the driver wants the OS to automatic attach the Rx buffer
+            // to the NET_PACKETs
+            //
+            if (batchIndex == batchCount)
+            {
+                batchIndex = 0;
+                batchCount = m_bufferPoolDispatch->NetClientAllocateBuffers(
+                    m_bufferPool,
+                    static_cast<ULONG>(min(ARRAYSIZE(addresses), numberOfMdls - i)),
+                    addresses,
+                    logicalAddresses,
+                    &offset,
+                    &capacity);
+
+                CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES, batchCount == 0);
+            }
+
+            auto const address = addresses[batchIndex];
+            m_mdlContext[i].DmaLogicalAddress = logicalAddresses[batchIndex];
+            batchIndex++;
+
+            MmInitializeMdl(mdl, address, capacity);
+            MmBuildMdlForNonPagedPool(mdl);
+
+            m_rxDataBufferCapacity = capacity;
+        }
+
+        MdlStackPush(mdl);
+    }
+
     for (size_t i = 0; i < perfParameters.NumberOfNbls; i++)
     {
         PNET_BUFFER_LIST nbl =
@@ -821,40 +1521,26 @@ NxRxXlat::CreateVariousPools()
 
         CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES, !nbl);
 
+        // MDLs are chained to the NB when a packet is received
         PNET_BUFFER nb = NET_BUFFER_LIST_FIRST_NB(nbl);
-        PMDL mdl = reinterpret_cast<PMDL>(((size_t) m_MdlPool.get()) + i * mdlSize);
-        NET_BUFFER_FIRST_MDL(nb) = NET_BUFFER_CURRENT_MDL(nb) = mdl;
+        NET_BUFFER_FIRST_MDL(nb) = NET_BUFFER_CURRENT_MDL(nb) = nullptr;
 
-        auto internalAllocationOffset = (UCHAR*)nb - (UCHAR*)nbl;
-        if (internalAllocationOffset < 4 * sizeof(NET_BUFFER_LIST))
-            g_NetBufferOffset = internalAllocationOffset;
+        GetRxContextFromNbl(nbl)->CopyBreakMdl = nullptr;
 
-        if (m_rxBufferAllocationMode == NET_CLIENT_MEMORY_MANAGEMENT_MODE_OS_ALLOCATE_AND_ATTACH)
+        if (m_copyBreakThreshold != 0)
         {
-            //
-            // pre-built MDL if the driver wants the OS to automatic attach the Rx buffer
-            // to the NET_PACKETs
-            //
-
-
-
+            PMDL mdl = reinterpret_cast<PMDL>(((size_t) m_copyBreakMdlPool.get()) + i * copyBreakMdlSize);
 
-
-
-            void * address;
-            SIZE_T offset, capacity;
-            CX_RETURN_IF_NOT_NT_SUCCESS(
-                m_bufferPoolDispatch->NetClientAllocateBuffer(
-                    m_bufferPool,
-                    &address,
-                    &GetRxContextFromNb(nb)->DmaLogicalAddress,
-                    &offset,
-                    &capacity));
-
-            MmInitializeMdl(mdl, address, capacity);
+            MmInitializeMdl(mdl, m_copyBreakBuffers.get() + i * copyBreakBufferSize, copyBreakBufferSize);
             MmBuildMdlForNonPagedPool(mdl);
+
+            GetRxContextFromNbl(nbl)->CopyBreakMdl = mdl;
         }
 
+        auto internalAllocationOffset = (UCHAR*)nb - (UCHAR*)nbl;
+        if (internalAllocationOffset < 4 * sizeof(NET_BUFFER_LIST))
+            g_NetBufferOffset = internalAllocationOffset;
+
         NblStackPush(nbl);
 
         if (adapterProperties.MediaType == NdisMediumNative802_11)
@@ -878,6 +1564,55 @@ NxRxXlat::CreateVariousPools()
     return STATUS_SUCCESS;
 }
 
+_Use_decl_annotations_
+NTSTATUS
+NxRxXlat::CreateBufferPool(
+    NET_CLIENT_ADAPTER_DATAPATH_CAPABILITIES & DatapathCapabilities,
+    NODE_REQUIREMENT PreferredNode,
+    NET_CLIENT_BUFFER_POOL * BufferPool,
+    NET_CLIENT_BUFFER_POOL_DISPATCH const ** BufferPoolDispatch
+)
+{
+    NET_CLIENT_BUFFER_POOL_CONFIG bufferPoolConfig = {
+        &DatapathCapabilities.RxMemoryConstraints,
+        m_mdlStack.count(),
+        m_rxDataBufferSize,
+        m_backfillSize,
+        0,
+        PreferredNode,
+        NET_CLIENT_BUFFER_POOL_FLAGS_NONE   //non-serialized version
+    };
+
+    return m_dispatch->NetClientCreateBufferPool(
+        &bufferPoolConfig,
+        BufferPool,
+        BufferPoolDispatch);
+}
+
+_Use_decl_annotations_
+void
+NxRxXlat::CreatePendingBufferPool(
+    void
+)
+{
+    NET_CLIENT_ADAPTER_DATAPATH_CAPABILITIES datapathCapabilities;
+    m_adapterDispatch->GetDatapathCapabilities(m_adapter, &datapathCapabilities);
+
+    // the EC owns m_bufferPoolDispatch, the dispatch returned here is the same
+    NET_CLIENT_BUFFER_POOL bufferPool;
+    NET_CLIENT_BUFFER_POOL_DISPATCH const * bufferPoolDispatch;
+    if (! NT_SUCCESS(CreateBufferPool(datapathCapabilities, m_pendingBufferNode, &bufferPool, &bufferPoolDispatch)))
+    {
+        bufferPool = nullptr;
+    }
+
+    m_pendingBufferPool = bufferPool;
+    WriteBooleanRelease(&m_pendingBufferPoolReady, TRUE);
+
+    m_executionContext.SignalWork();
+    m_bufferPoolRundown.Release();
+}
+
 void
 NxRxXlat::Notify()
 {
@@ -893,59 +1628,48 @@ NxRxXlat::EcRecoverBuffers()
     auto pr = NetRingCollectionGetPacketRing(&m_rings);
     auto fr = NetRingCollectionGetFragmentRing(&m_rings);
 
-    NT_FRE_ASSERT(pr->OSReserved0 == fr->OSReserved0);
-    NT_FRE_ASSERT(pr->BeginIndex == fr->BeginIndex);
-    NT_FRE_ASSERT(pr->EndIndex == fr->EndIndex);
-
     for (; pr->OSReserved0 != pr->BeginIndex;
-        fr->OSReserved0 = pr->OSReserved0 = NetRingIncrementIndex(pr, pr->OSReserved0))
+        pr->OSReserved0 = NetRingIncrementIndex(pr, pr->OSReserved0))
     {
 
         auto & context = m_packetContext.GetContext<PacketContext>(pr->OSReserved0);
-        auto packet = NetRingGetPacketAtIndex(pr, pr->OSReserved0);
 
         NT_FRE_ASSERT(context.NetBufferList != nullptr);
 
         NblStackPush(context.NetBufferList);
         context.NetBufferList = nullptr;
-
-        if (! packet->Ignore &&
-             m_rxBufferAllocationMode == NET_CLIENT_MEMORY_MANAGEMENT_MODE_DRIVER)
-        {
-            for (UINT32 i = 0; i < packet->FragmentCount; i++)
-            {
-                auto returnContext = NetExtensionGetFragmentReturnContext(
-                    &m_extensions.Extension.ReturnContext, fr->OSReserved0);
-
-                m_adapterDispatch->ReturnRxBuffer(
-                    m_adapter,
-                    returnContext->Handle);
-                returnContext->Handle = nullptr;
-            }
-        }
     }
 
+    ReclaimUnclaimedFragments();
+
     NT_FRE_ASSERT(pr->BeginIndex == pr->EndIndex);
+    NT_FRE_ASSERT(fr->BeginIndex == fr->EndIndex);
     NT_FRE_ASSERT(m_nblStackIndex == m_nblStack.count());
+    NT_FRE_ASSERT(m_mdlStackIndex == m_mdlStack.count());
 }
 
 NxRxXlat::~NxRxXlat()
 {
+    // no pool is created for a migration once the EC winds down
+    m_bufferPoolRundown.CloseAndWait();
+
     // stop the EC and wait for wind down.
     m_executionContext.Terminate();
 
+    // the workers are idle once the EC stopped
+    m_softwareReceiveScaling.reset();
+
+    // a pool created for a migration the EC did not take
+    if (m_pendingBufferPool)
+    {
+        m_bufferPoolDispatch->NetClientDestroyBufferPool(m_pendingBufferPool);
+        m_pendingBufferPool = nullptr;
+    }
+
     while (! NblStackIsEmpty())
     {
         auto nbl = NblStackPop();
 
-        if (m_rxBufferAllocationMode == NET_CLIENT_MEMORY_MANAGEMENT_MODE_OS_ALLOCATE_AND_ATTACH)
-        {
-            PVOID va = MmGetMdlVirtualAddress(NET_BUFFER_CURRENT_MDL(NET_BUFFER_LIST_FIRST_NB(nbl)));
-            m_bufferPoolDispatch->NetClientFreeBuffers(m_bufferPool,
-                                                       &va,
-                                                       1);
-        }
-
         if (nbl->NetBufferListInfo[MediaSpecificInformation] != nullptr)
         {
             ExFreePool(nbl->NetBufferListInfo[MediaSpecificInformation]);
@@ -954,6 +1678,28 @@ NxRxXlat::~NxRxXlat()
         NdisFreeNetBufferList(nbl);
     }
 
+    if (m_rxBufferAllocationMode == NET_CLIENT_MEMORY_MANAGEMENT_MODE_OS_ALLOCATE_AND_ATTACH)
+    {
+        while (! MdlStackIsEmpty())
+        {
+            auto const mdl = MdlStackPop();
+            auto const bufferPool = GetMdlContext(mdl).BufferPoolGeneration == m_bufferPoolGeneration
+                ? m_bufferPool
+                : m_retiredBufferPool;
+
+            PVOID va = MmGetMdlVirtualAddress(mdl);
+            m_bufferPoolDispatch->NetClientFreeBuffers(bufferPool,
+                                                       &va,
+                                                       1);
+        }
+    }
+
+    if (m_retiredBufferPool)
+    {
+        m_bufferPoolDispatch->NetClientDestroyBufferPool(m_retiredBufferPool);
+        m_retiredBufferPool = nullptr;
+    }
+
     if (m_bufferPool)
     {
         m_bufferPoolDispatch->NetClientDestroyBufferPool(m_bufferPool);
@@ -993,11 +1739,26 @@ CalculateNblFrameTypeForEthernetPacket(
 {
     NT_ASSERT(packet->Layout.Layer2HeaderLength >= sizeof(ETHERNET_HEADER));
 
-    USHORT ethertype;
-    if (!NxGetPacketEtherType(descriptor, virtualAddressExtension, packet, &ethertype))
+    auto fr = NetRingCollectionGetFragmentRing(descriptor);
+    auto const fragment = NetRingGetFragmentAtIndex(fr, packet->FragmentIndex);
+    auto const virtualAddress = NetExtensionGetFragmentVirtualAddress(
+        &virtualAddressExtension, packet->FragmentIndex);
+
+    if (fragment->ValidLength < packet->Layout.Layer2HeaderLength)
         return 0;
 
-    return RtlUshortByteSwap(ethertype);
+    // The layout already tells where the layer 2 header ends, the EtherType
+    // is its last field with or without a SNAP header
+    auto const ethertype = *(USHORT UNALIGNED const *)(
+        (UCHAR const *)virtualAddress->VirtualAddress +
+        fragment->Offset +
+        packet->Layout.Layer2HeaderLength -
+        sizeof(USHORT));
+
+    if (RtlUshortByteSwap(ethertype) < ETHERNET_TYPE_MINIMUM)
+        return 0;
+
+    return ethertype;
 }
 
 static
@@ -1042,6 +1803,52 @@ CalculateNblFrameTypeForPacket(
     }
 }
 
+static
+bool
+IsPacketLayoutConsistent(
+    _In_ NET_PACKET_LAYOUT const & Reported,
+    _In_ NET_PACKET_LAYOUT const & Parsed
+)
+{
+    if (Reported.Layer2Type != Parsed.Layer2Type ||
+        Reported.Layer2HeaderLength != Parsed.Layer2HeaderLength)
+    {
+        return false;
+    }
+
+    // Upper layers are only checked if the driver reported them
+    if (Reported.Layer3HeaderLength != 0 &&
+        Reported.Layer3HeaderLength != Parsed.Layer3HeaderLength)
+    {
+        return false;
+    }
+
+    if (Reported.Layer4Type != NetPacketLayer4TypeUnspecified &&
+        Reported.Layer4Type != Parsed.Layer4Type)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+static
+bool
+IsPacketLayoutInRange(
+    _In_ NET_PACKET_LAYOUT const & Reported,
+    _In_ SIZE_T FirstFragmentLength
+)
+{
+    // The stack reads the headers straight from the first fragment, the
+    // reported lengths can only be trusted when they all fit in it
+    SIZE_T const headerLength =
+        SIZE_T{ Reported.Layer2HeaderLength } +
+        SIZE_T{ Reported.Layer3HeaderLength } +
+        SIZE_T{ Reported.Layer4HeaderLength };
+
+    return headerLength <= FirstFragmentLength;
+}
+
 bool
 NxRxXlat::TransferDataBufferFromNetPacketToNbl(
     _In_ NET_PACKET * Packet,
@@ -1049,7 +1856,7 @@ NxRxXlat::TransferDataBufferFromNetPacketToNbl(
     _In_ UINT32 PacketIndex)
 {
     PNET_BUFFER nb = NET_BUFFER_LIST_FIRST_NB(Nbl);
-    bool shouldIndicate = false;
+    bool shouldIndicate = Packet->FragmentCount > 0;
     // ensure the NBL chain is broken
     Nbl->Next = nullptr;
 
@@ -1057,21 +1864,58 @@ NxRxXlat::TransferDataBufferFromNetPacketToNbl(
     auto const firstFragment = NetRingGetFragmentAtIndex(fr, Packet->FragmentIndex);
     auto const firstVirtualAddress = NetExtensionGetFragmentVirtualAddress(
         &m_extensions.Extension.VirtualAddress, Packet->FragmentIndex);
-    auto const firstReturnContext = NetExtensionGetFragmentReturnContext(
-        &m_extensions.Extension.ReturnContext, Packet->FragmentIndex);
     PrefetchPacketPayloadForReceiveIndication(firstVirtualAddress->VirtualAddress, firstFragment->Offset);
 
-    // Used for populating statistics
-    auto frameSize = firstFragment->ValidLength;
-
     //
     //1. packet metadata
+    //
 
+    //
+    // Use the layout reported by the client driver when there is one and
+    // only parse the frame in software otherwise. A reported layout whose
+    // headers do not fit in the first fragment is discarded and the frame
+    // parsed instead. With driver verifier enabled the frame is always
+    // parsed and the reported layout checked. The frame type comes out of
+    // the same parse, the headers are not read a second time.
+    //
+    USHORT frameType = 0;
 
+    if (Packet->FragmentCount > 0 &&
+        (Packet->Layout.Layer2Type == NetPacketLayer2TypeUnspecified ||
+         ! IsPacketLayoutInRange(Packet->Layout, firstFragment->ValidLength) ||
+         m_adapterProperties.DriverIsVerifying))
+    {
+        USHORT etherType;
+        auto const layout = NxGetPacketLayout(
+            m_adapterProperties.MediaType,
+            &m_rings,
+            m_extensions.Extension.VirtualAddress,
+            Packet,
+            &etherType);
+
+        NT_ASSERTMSG("The packet layout reported by the client driver does not match the frame",
+            Packet->Layout.Layer2Type == NetPacketLayer2TypeUnspecified ||
+            IsPacketLayoutConsistent(Packet->Layout, layout));
+
+        Packet->Layout = layout;
+
+        frameType = etherType != 0
+            ? RtlUshortByteSwap(etherType)
+            : CalculateNblFrameTypeForPacket(&m_rings, m_extensions.Extension.VirtualAddress, *Packet);
+    }
+    else
+    {
+        frameType = CalculateNblFrameTypeForPacket(&m_rings, m_extensions.Extension.VirtualAddress, *Packet);
+    }
 
-
-    // Always compute packet layout in software on RX path now.
-    Packet->Layout = NxGetPacketLayout(m_adapterProperties.MediaType, &m_rings, m_extensions.Extension.VirtualAddress, Packet);
+    if (m_softwareReceiveScaling != nullptr && Packet->FragmentCount > 0)
+    {
+        m_softwareReceiveScaling->HashFrame(
+            *Packet,
+            static_cast<UCHAR const *>(firstVirtualAddress->VirtualAddress) + firstFragment->Offset,
+            static_cast<UINT32>(firstFragment->ValidLength),
+            Nbl);
+    }
 
     Nbl->NetBufferListInfo[TcpIpChecksumNetBufferListInfo] = 0;
 
@@ -1082,6 +1926,24 @@ NxRxXlat::TransferDataBufferFromNetPacketToNbl(
             NxTranslateRxPacketChecksum(Packet, &checksumExtension, PacketIndex).Value;
     }
 
+    // Only single fragment frames are validated, the checksum library
+    // works on contiguous memory
+    if (m_softwareChecksum &&
+        Nbl->NetBufferListInfo[TcpIpChecksumNetBufferListInfo] == 0 &&
+        Packet->FragmentCount == 1)
+    {
+        auto const fr = NetRingCollectionGetFragmentRing(&m_rings);
+        auto const fragment = NetRingGetFragmentAtIndex(fr, Packet->FragmentIndex);
+        auto const virtualAddress = NetExtensionGetFragmentVirtualAddress(
+            &m_extensions.Extension.VirtualAddress, Packet->FragmentIndex);
+
+        Nbl->NetBufferListInfo[TcpIpChecksumNetBufferListInfo] =
+            NxChecksumValidateRxFrame(
+                *Packet,
+                static_cast<UCHAR const *>(virtualAddress->VirtualAddress) + fragment->Offset,
+                static_cast<UINT32>(fragment->ValidLength)).Value;
+    }
+
     auto const & rscExtension = m_extensions.Extension.Rsc;
     if (rscExtension.Enabled)
     {
@@ -1100,7 +1962,6 @@ NxRxXlat::TransferDataBufferFromNetPacketToNbl(
 
     Nbl->NblFlags = 0;
 
-    auto frameType = CalculateNblFrameTypeForPacket(&m_rings, m_extensions.Extension.VirtualAddress, *Packet);
     Nbl->NetBufferListInfo[NetBufferListFrameType] = (PVOID)frameType;
     switch (frameType)
     {
@@ -1118,179 +1979,345 @@ NxRxXlat::TransferDataBufferFromNetPacketToNbl(
     GetRxContextFromNbl(Nbl)->Queue = this;
 
     //
-    //2. packet's first fragment
+    //2. small frames are copied out, their fragments are left unclaimed
     //
 
-    PMDL currMdl = NET_BUFFER_CURRENT_MDL(nb);
-    NET_BUFFER_DATA_LENGTH(nb) = firstFragment->ValidLength;
-    NET_BUFFER_DATA_OFFSET(nb) = firstFragment->Offset;
-
-    NET_BUFFER_CURRENT_MDL_OFFSET(nb) = firstFragment->Offset;
-
-    shouldIndicate = ReInitializeMdlForDataBuffer(
-        nb,
-        firstFragment,
-        firstVirtualAddress,
-        firstReturnContext,
-        currMdl,
-        true);
+    if (CopyFragmentsToNbl(Packet, Nbl))
+    {
+        return true;
+    }
 
     //
-    //3. packet's additonal fragments
+    //3. packet's fragments, each one described by its own MDL in the chain
     //
 
-    for (UINT32 i = 1; i < Packet->FragmentCount; ++i)
+    NET_BUFFER_DATA_LENGTH(nb) = 0;
+    NET_BUFFER_DATA_OFFSET(nb) = firstFragment->Offset;
+    NET_BUFFER_CURRENT_MDL_OFFSET(nb) = firstFragment->Offset;
+
+    PMDL * nextMdl = &NET_BUFFER_FIRST_MDL(nb);
+
+    for (UINT32 i = 0; i < Packet->FragmentCount; ++i)
     {
         auto const index = (Packet->FragmentIndex + i) & fr->ElementIndexMask;
         auto const fragment = NetRingGetFragmentAtIndex(fr, index);
-        auto const virtualAddress = NetExtensionGetFragmentVirtualAddress(
-            &m_extensions.Extension.VirtualAddress, index);
-        auto const returnContext = NetExtensionGetFragmentReturnContext(
-            &m_extensions.Extension.ReturnContext, index);
-
-        NET_BUFFER_DATA_LENGTH(nb) += (ULONG)fragment->ValidLength;
-
 
+        // only the first fragment can have an offset
+        if (i != 0 && fragment->Offset != 0)
+        {
+            shouldIndicate = false;
+        }
 
-        NT_ASSERT(false);
+        // Fragments left unclaimed are given back by ReclaimUnclaimedFragments
+        auto const mdl = ClaimFragmentBuffer(index);
 
-        currMdl = NDIS_MDL_LINKAGE(currMdl);
+        if (mdl == nullptr)
+        {
+            shouldIndicate = false;
+            break;
+        }
 
-        shouldIndicate &= ReInitializeMdlForDataBuffer(nb,
-            fragment,
-            virtualAddress,
-            returnContext,
-            currMdl,
-            false);
+        *nextMdl = mdl;
+        nextMdl = &NDIS_MDL_LINKAGE(mdl);
 
-        frameSize += fragment->ValidLength;
+        NET_BUFFER_DATA_LENGTH(nb) += static_cast<ULONG>(fragment->ValidLength);
     }
 
-    m_statistics.IncrementBy(NxStatisticsCounters::BytesOfData, frameSize);
+    *nextMdl = nullptr;
+    NET_BUFFER_CURRENT_MDL(nb) = NET_BUFFER_FIRST_MDL(nb);
+
+    m_statistics.Increment(NxStatisticsCounters::ZeroCopyPackets);
+    m_statistics.IncrementBy(NxStatisticsCounters::BytesOfData, NET_BUFFER_DATA_LENGTH(nb));
     return shouldIndicate;
 }
 
 bool
-NxRxXlat::ReInitializeMdlForDataBuffer(
-    _In_ PNET_BUFFER nb,
-    _In_ NET_FRAGMENT const * fragment,
-    _In_ NET_FRAGMENT_VIRTUAL_ADDRESS const * VirtualAddress,
-    _In_ NET_FRAGMENT_RETURN_CONTEXT const * ReturnContext,
-    _In_ PMDL fragmentMdl,
-    _In_ bool isFirstFragment)
+NxRxXlat::CopyFragmentsToNbl(
+    _In_ NET_PACKET const * Packet,
+    _In_ PNET_BUFFER_LIST Nbl)
 {
-    bool mdlBuilt = false;
+    if (m_copyBreakThreshold == 0 || Packet->FragmentCount == 0)
+    {
+        return false;
+    }
+
+    auto const fr = NetRingCollectionGetFragmentRing(&m_rings);
 
-    if (isFirstFragment || (fragment->Offset == 0)) //only the first fragment can have an offset
+    size_t frameLength = 0;
+
+    for (UINT32 i = 0; i < Packet->FragmentCount; ++i)
     {
-        if (m_rxBufferAllocationMode == NET_CLIENT_MEMORY_MANAGEMENT_MODE_OS_ALLOCATE_AND_ATTACH) //data buffer allocated by the translator
+        auto const index = (Packet->FragmentIndex + i) & fr->ElementIndexMask;
+
+        frameLength += NetRingGetFragmentAtIndex(fr, index)->ValidLength;
+
+        if (frameLength > m_copyBreakThreshold)
         {
-            //all MDLs are pre-built
-            mdlBuilt = true;
+            return false;
         }
-        else //data buffer allocated by the NIC
-        {
-            //the data buffer size must confront to the rx capability declared by the NIC
-            if (fragment->Capacity <= m_rxDataBufferSize)
-            {
-                MmInitializeMdl(fragmentMdl, VirtualAddress->VirtualAddress, fragment->Capacity);
-                MmBuildMdlForNonPagedPool(fragmentMdl);
+    }
 
-                NT_ASSERT(fragmentMdl->Next == nullptr);
+    auto const mdl = GetRxContextFromNbl(Nbl)->CopyBreakMdl;
+    auto buffer = static_cast<UCHAR *>(MmGetMdlVirtualAddress(mdl));
 
-                if (m_rxBufferAllocationMode == NET_CLIENT_MEMORY_MANAGEMENT_MODE_DRIVER)
-                {
-                    if (isFirstFragment)
-                    {
-                        //first fragment's rx return context will be used for all fragments
-                        GetRxContextFromNb(nb)->RxBufferReturnContext = ReturnContext->Handle;
-                        mdlBuilt = true;
-                    }
-                    else
-                    {
-                        //if the NB has more than 1 fragment, all framgents must have the same
-                        //return context
-                        if (GetRxContextFromNb(nb)->RxBufferReturnContext == ReturnContext->Handle)
-                        {
-                            mdlBuilt = true;
-                        }
-                        else
-                        {
-                            //if the return context doesn't match, mark this packet to be dropped
-                            mdlBuilt = false;
-                        }
-                    }
-                }
-            }
-            else
-            {
-                //if the packet received is larger than the driver claimed to be able to support,
-                //mark this packet to be dropped
-                mdlBuilt = false;
+    for (UINT32 i = 0; i < Packet->FragmentCount; ++i)
+    {
+        auto const index = (Packet->FragmentIndex + i) & fr->ElementIndexMask;
+        auto const fragment = NetRingGetFragmentAtIndex(fr, index);
+        auto const virtualAddress = NetExtensionGetFragmentVirtualAddress(
+            &m_extensions.Extension.VirtualAddress, index);
 
-                //we still need to return the rx data buffer of the dropped packet back to the NIC
-                GetRxContextFromNb(nb)->RxBufferReturnContext = ReturnContext->Handle;
-            }
-        }
+        RtlCopyMemory(
+            buffer,
+            static_cast<UCHAR const *>(virtualAddress->VirtualAddress) + fragment->Offset,
+            static_cast<size_t>(fragment->ValidLength));
+
+        buffer += fragment->ValidLength;
     }
-    else
+
+    mdl->ByteCount = static_cast<ULONG>(frameLength);
+    mdl->Next = nullptr;
+
+    PNET_BUFFER nb = NET_BUFFER_LIST_FIRST_NB(Nbl);
+    NET_BUFFER_FIRST_MDL(nb) = NET_BUFFER_CURRENT_MDL(nb) = mdl;
+    NET_BUFFER_DATA_LENGTH(nb) = static_cast<ULONG>(frameLength);
+    NET_BUFFER_DATA_OFFSET(nb) = 0;
+    NET_BUFFER_CURRENT_MDL_OFFSET(nb) = 0;
+
+    m_statistics.Increment(NxStatisticsCounters::CopiedPackets);
+    m_statistics.IncrementBy(NxStatisticsCounters::BytesOfData, frameLength);
+    return true;
+}
+
+PMDL
+NxRxXlat::ClaimFragmentBuffer(
+    _In_ UINT32 FragmentIndex)
+{
+    auto const fr = NetRingCollectionGetFragmentRing(&m_rings);
+    auto const fragment = NetRingGetFragmentAtIndex(fr, FragmentIndex);
+
+    // When chained, each MDL must end where the fragment's data ends or the
+    // frame would continue into the unused tail of the buffer
+    auto const byteCount = static_cast<ULONG>(fragment->Offset + fragment->ValidLength);
+
+    if (m_rxBufferAllocationMode == NET_CLIENT_MEMORY_MANAGEMENT_MODE_OS_ALLOCATE_AND_ATTACH)
     {
-        mdlBuilt = false;
+        //all MDLs are pre-built, the buffer travels with its MDL
+        auto & context = m_fragmentContext.GetContext<FragmentContext>(FragmentIndex);
+        auto const mdl = context.Mdl;
+
+        NT_FRE_ASSERT(mdl != nullptr);
+        NT_FRE_ASSERT(byteCount <= m_rxDataBufferCapacity);
+
+        context.Mdl = nullptr;
+        mdl->ByteCount = byteCount;
+
+        return mdl;
     }
 
-    return mdlBuilt;
-}
+    //the data buffer size must confront to the rx capability declared by the NIC
+    if (fragment->Capacity > m_rxDataBufferSize || MdlStackIsEmpty())
+    {
+        return nullptr;
+    }
 
+    auto const virtualAddress = NetExtensionGetFragmentVirtualAddress(
+        &m_extensions.Extension.VirtualAddress, FragmentIndex);
 
-PNET_BUFFER_LIST
-NxRxXlat::FreeReceivedDataBuffer(PNET_BUFFER_LIST nbl)
+    auto const mdl = MdlStackPop();
+
+    MmInitializeMdl(mdl, virtualAddress->VirtualAddress, byteCount);
+    MmBuildMdlForNonPagedPool(mdl);
+
+    NT_ASSERT(mdl->Next == nullptr);
+
+    // the buffer is now owned by the MDL
+    virtualAddress->VirtualAddress = nullptr;
+
+    if (m_rxBufferAllocationMode == NET_CLIENT_MEMORY_MANAGEMENT_MODE_DRIVER)
+    {
+        auto const returnContext = NetExtensionGetFragmentReturnContext(
+            &m_extensions.Extension.ReturnContext, FragmentIndex);
+
+        GetMdlContext(mdl).RxBufferReturnContext = returnContext->Handle;
+        returnContext->Handle = nullptr;
+    }
+
+    return mdl;
+}
+
+void
+NxRxXlat::ReleaseFragmentBuffer(
+    _In_ PMDL Mdl)
 {
     switch (m_rxBufferAllocationMode)
     {
         case NET_CLIENT_MEMORY_MANAGEMENT_MODE_OS_ALLOCATE_AND_ATTACH:
-            NOTHING
+            MigrateFragmentBuffer(Mdl);
             break;
 
         case NET_CLIENT_MEMORY_MANAGEMENT_MODE_OS_ONLY_ALLOCATE:
         {
-            PMDL currMdl = NET_BUFFER_CURRENT_MDL(NET_BUFFER_LIST_FIRST_NB(nbl));
+            PVOID va = MmGetMdlVirtualAddress(Mdl);
 
-            while (currMdl)
-            {
-                PVOID va = MmGetMdlVirtualAddress(currMdl);
+            m_bufferPoolDispatch->NetClientFreeBuffers(m_bufferPool,
+                                                       &va,
+                                                       1);
 
-                m_bufferPoolDispatch->NetClientFreeBuffers(m_bufferPool,
-                                                           &va,
-                                                           1);
+            break;
+        }
 
-                currMdl = NDIS_MDL_LINKAGE(currMdl);
-            }
+        case NET_CLIENT_MEMORY_MANAGEMENT_MODE_DRIVER:
+        {
+            auto & context = GetMdlContext(Mdl);
+
+            m_adapterDispatch->ReturnRxBuffer(
+                m_adapter,
+                context.RxBufferReturnContext);
+
+            context.RxBufferReturnContext = nullptr;
 
             break;
         }
+    }
 
-        case NET_CLIENT_MEMORY_MANAGEMENT_MODE_DRIVER:
+    Mdl->Next = nullptr;
+    MdlStackPush(Mdl);
+}
+
+void
+NxRxXlat::ReclaimUnclaimedFragments()
+{
+    auto fr = NetRingCollectionGetFragmentRing(&m_rings);
+
+    for (; fr->OSReserved0 != fr->BeginIndex;
+        fr->OSReserved0 = NetRingIncrementIndex(fr, fr->OSReserved0))
+    {
+        switch (m_rxBufferAllocationMode)
         {
-            PNET_BUFFER nb = NET_BUFFER_LIST_FIRST_NB(nbl);
+            case NET_CLIENT_MEMORY_MANAGEMENT_MODE_OS_ALLOCATE_AND_ATTACH:
+            {
+                auto & context = m_fragmentContext.GetContext<FragmentContext>(fr->OSReserved0);
 
-            PMDL currMdl = NET_BUFFER_CURRENT_MDL(NET_BUFFER_LIST_FIRST_NB(nbl));
+                if (context.Mdl != nullptr)
+                {
+                    MigrateFragmentBuffer(context.Mdl);
+                    MdlStackPush(context.Mdl);
+                    context.Mdl = nullptr;
+                }
 
-            NT_ASSERT(currMdl->Next == nullptr);
+                break;
+            }
 
-            while (currMdl)
+            case NET_CLIENT_MEMORY_MANAGEMENT_MODE_OS_ONLY_ALLOCATE:
             {
-                m_adapterDispatch->ReturnRxBuffer(
-                    m_adapter,
-                    GetRxContextFromNb(nb)->RxBufferReturnContext);
+                auto virtualAddress = NetExtensionGetFragmentVirtualAddress(
+                    &m_extensions.Extension.VirtualAddress, fr->OSReserved0);
+
+                if (virtualAddress->VirtualAddress != nullptr)
+                {
+                    PVOID va = virtualAddress->VirtualAddress;
+
+                    m_bufferPoolDispatch->NetClientFreeBuffers(m_bufferPool,
+                                                               &va,
+                                                               1);
+
+                    virtualAddress->VirtualAddress = nullptr;
+                }
 
-                currMdl = NDIS_MDL_LINKAGE(currMdl);
+                break;
             }
 
-            GetRxContextFromNb(nb)->RxBufferReturnContext = nullptr;
+            case NET_CLIENT_MEMORY_MANAGEMENT_MODE_DRIVER:
+            {
+                auto returnContext = NetExtensionGetFragmentReturnContext(
+                    &m_extensions.Extension.ReturnContext, fr->OSReserved0);
 
-            break;
+                if (returnContext->Handle != nullptr)
+                {
+                    m_adapterDispatch->ReturnRxBuffer(
+                        m_adapter,
+                        returnContext->Handle);
+
+                    returnContext->Handle = nullptr;
+                }
+
+                break;
+            }
         }
     }
+}
+
+void
+NxRxXlat::MigrateFragmentBuffer(
+    _In_ PMDL Mdl
+)
+{
+    auto & context = GetMdlContext(Mdl);
+
+    if (context.BufferPoolGeneration == m_bufferPoolGeneration)
+    {
+        return;
+    }
+
+    void * address;
+    UINT64 logicalAddress;
+    SIZE_T offset, capacity;
+
+    auto const count = m_bufferPoolDispatch->NetClientAllocateBuffers(
+        m_bufferPool,
+        1,
+        &address,
+        &logicalAddress,
+        &offset,
+        &capacity);
+
+    // keep the old buffer, migration is retried when it comes back again
+    if (count == 0)
+    {
+        return;
+    }
+
+    PVOID va = MmGetMdlVirtualAddress(Mdl);
+    m_bufferPoolDispatch->NetClientFreeBuffers(m_retiredBufferPool,
+                                               &va,
+                                               1);
+
+    MmInitializeMdl(Mdl, address, capacity);
+    MmBuildMdlForNonPagedPool(Mdl);
+
+    context.DmaLogicalAddress = logicalAddress;
+    context.BufferPoolGeneration = m_bufferPoolGeneration;
+
+    if (--m_retiredBuffers == 0)
+    {
+        m_bufferPoolDispatch->NetClientDestroyBufferPool(m_retiredBufferPool);
+        m_retiredBufferPool = nullptr;
+    }
+}
+
+PNET_BUFFER_LIST
+NxRxXlat::FreeReceivedDataBuffer(PNET_BUFFER_LIST nbl)
+{
+    PNET_BUFFER nb = NET_BUFFER_LIST_FIRST_NB(nbl);
+    PMDL currMdl = NET_BUFFER_FIRST_MDL(nb);
+
+    // the copy break buffer belongs to the NBL, there is nothing to return
+    if (currMdl == GetRxContextFromNbl(nbl)->CopyBreakMdl)
+    {
+        currMdl = nullptr;
+    }
+
+    while (currMdl)
+    {
+        auto const nextMdl = NDIS_MDL_LINKAGE(currMdl);
+
+        ReleaseFragmentBuffer(currMdl);
+
+        currMdl = nextMdl;
+    }
+
+    NET_BUFFER_FIRST_MDL(nb) = NET_BUFFER_CURRENT_MDL(nb) = nullptr;
 
     PNET_BUFFER_LIST next = nbl->Next;
     NblStackPush(nbl);
@@ -1298,6 +2325,44 @@ NxRxXlat::FreeReceivedDataBuffer(PNET_BUFFER_LIST nbl)
     return next;
 }
 
+NxRxXlat::MdlContext &
+NxRxXlat::GetMdlContext(
+    _In_ PMDL Mdl
+)
+{
+    auto const index = (reinterpret_cast<size_t>(Mdl) - reinterpret_cast<size_t>(m_MdlPool.get())) / m_mdlSize;
+
+    return m_mdlContext[index];
+}
+
+PMDL
+NxRxXlat::MdlStackPop(
+    void
+)
+{
+    NT_FRE_ASSERT(! MdlStackIsEmpty());
+
+    return m_mdlStack[--m_mdlStackIndex];
+}
+
+void
+NxRxXlat::MdlStackPush(
+    _In_ PMDL Mdl
+)
+{
+    NT_FRE_ASSERT(m_mdlStackIndex != m_mdlStack.count());
+
+    m_mdlStack[m_mdlStackIndex++] = Mdl;
+}
+
+bool
+NxRxXlat::MdlStackIsEmpty(
+    void
+) const
+{
+    return m_mdlStackIndex == 0;
+}
+
 NET_BUFFER_LIST *
 NxRxXlat::NblStackPop(
     void
@@ -26,6 +26,8 @@ Abstract:
 #include "NxStatistics.hpp"
 
 #include <KArray.h>
+#include <KRundown.h>
+#include <KWorkItem.h>
 
 using unique_nbl = wistd::unique_ptr<NET_BUFFER_LIST, wil::function_deleter<decltype(&NdisFreeNetBufferList), NdisFreeNetBufferList>>;
 using unique_nbl_pool = wil::unique_any<NDIS_HANDLE, decltype(&::NdisFreeNetBufferListPool), &::NdisFreeNetBufferListPool>;
@@ -45,6 +47,9 @@ class NxNblRx :
     );
 };
 
+class NxReceiveScaling;
+class NxSoftwareReceiveScaling;
+
 class NxRxXlat :
     public NxNonpagedAllocation<'lXRN'>
 {
@@ -101,6 +106,12 @@ public:
         void
     );
 
+    // the EC poll routine when hosted on a poller
+    bool
+    ReceivePoll(
+        void
+    );
+
     NET_CLIENT_QUEUE
     GetQueue(
         void
@@ -118,6 +129,55 @@ public:
         GROUP_AFFINITY const & GroupAffinity
     );
 
+    _IRQL_requires_(PASSIVE_LEVEL)
+    void
+    SetReceiveScaling(
+        _In_ NxReceiveScaling * ReceiveScaling
+    );
+
+    NxStatistics const &
+    GetStatistics(
+        void
+    ) const;
+
+    // Packet ring indices without wrap around: how many packets the EC has
+    // posted to the adapter, and how many of them it has indicated
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    ULONG
+    GetPostedPacketIndex(
+        void
+    ) const;
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    ULONG
+    GetIndicatedPacketIndex(
+        void
+    ) const;
+
+    // Holds back indications while an indirection table bucket moves here
+    // from Source, so packets of a flow in the bucket that Source has not
+    // indicated yet are not overtaken. The hold ends once Source has
+    // indicated up to the packet index given to ReleaseIndicationsAfter, or
+    // at Deadline regardless.
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    void
+    HoldIndications(
+        _In_ NxRxXlat & Source,
+        _In_ ULONG64 Deadline
+    );
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    void
+    ReleaseIndicationsAfter(
+        _In_ ULONG SourcePacketIndex
+    );
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    void
+    ReleaseIndications(
+        void
+    );
+
     void
     Notify(
         void
@@ -128,6 +188,22 @@ public:
         _In_ NBL_QUEUE* NblChain
     );
 
+    // Hands NBLs received by another queue to this one for indication, see
+    // NxReceiveScaling::GetFlowQueue. Fails once this queue is winding down,
+    // the caller then indicates them itself.
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    bool
+    EnqueueSteeredNbls(
+        _In_ NBL_COUNTED_QUEUE * Nbls
+    );
+
+    // Called by the queue that indicated NBLs steered away from this one
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    void
+    CompleteSteeredNbls(
+        _In_ ULONG NumberOfNbls
+    );
+
 private:
 
     size_t
@@ -141,28 +217,32 @@ private:
 
     struct PAGED PacketContext
     {
-        //
-        // this NBL's NET_BUFFER_MINIPORT_RESERVED(NET_BUFFER_LIST_FIRST_NB)[0]
-        // field is used for the following purpose:
-        //
-        // if Rx buffer allocation mode is none, it's storing the rx buffer
-        // return context supplied by the NIC driver
-        //
-        // if Rx buffer allocation mode is automatic, it's storing the
-        // DMA logical address of the Rx buffer automatically chose by the
-        // OS
-        //
-        // if Rx buffer allocation mode is manual, it's not used
-        //
         PNET_BUFFER_LIST NetBufferList;
     };
 
     struct PAGED FragmentContext
     {
+        // Rx buffer posted in this fragment when the OS allocates and
+        // attaches the buffers, nullptr once it has been chained to an NBL
         MDL *
             Mdl;
     };
 
+    struct MdlContext
+    {
+        union
+        {
+            // used when the OS allocates and attaches the Rx buffers
+            UINT64 DmaLogicalAddress;
+            // used when the driver manages the Rx buffers
+            NET_FRAGMENT_RETURN_CONTEXT_HANDLE RxBufferReturnContext;
+        } DUMMYUNIONNAME;
+
+        // buffer pool generation the attached Rx buffer was allocated from
+        ULONG
+            BufferPoolGeneration = 0;
+    };
+
     struct ArmedNotifications
     {
         union
@@ -186,6 +266,16 @@ private:
     NxExecutionContext
         m_executionContext;
 
+    // Loop state kept across polls when the EC is hosted on a poller
+    bool
+        m_queueStarted = false;
+
+    bool
+        m_cancelIssued = false;
+
+    bool
+        m_halted = false;
+
     NET_CLIENT_DISPATCH const *
         m_dispatch = nullptr;
 
@@ -204,6 +294,49 @@ private:
     NET_CLIENT_BUFFER_POOL_DISPATCH const *
         m_bufferPoolDispatch = nullptr;
 
+    // Rx buffers are allocated on the NUMA node of the processor RSS affinitized
+    // the queue to. When the queue moves to another node a new pool is created
+    // there and attached buffers migrate to it as they come back, the retired
+    // pool is destroyed once the last of its buffers was replaced.
+    NODE_REQUIREMENT
+        m_bufferNode = MM_ANY_NODE_OK;
+
+    NODE_REQUIREMENT
+        m_targetBufferNode = MM_ANY_NODE_OK;
+
+    ULONG
+        m_bufferPoolGeneration = 0;
+
+    NET_CLIENT_BUFFER_POOL
+        m_retiredBufferPool = nullptr;
+
+    size_t
+        m_retiredBuffers = 0;
+
+    // Creating a pool allocates and maps all of its buffers, so the pool for
+    // a new node is created by a work item at passive level. The EC only
+    // swaps it in once m_pendingBufferPoolReady is set.
+    KCoalescingWorkItem<NxRxXlat>
+        m_bufferPoolWorkItem;
+
+    KRundown
+        m_bufferPoolRundown;
+
+    // set by the EC when it queues the work item, cleared when it takes the
+    // result
+    bool
+        m_bufferPoolPending = false;
+
+    NODE_REQUIREMENT
+        m_pendingBufferNode = MM_ANY_NODE_OK;
+
+    // nullptr once ready if the pool could not be created
+    NET_CLIENT_BUFFER_POOL
+        m_pendingBufferPool = nullptr;
+
+    BOOLEAN volatile
+        m_pendingBufferPoolReady = FALSE;
+
     NDIS_MEDIUM
         m_mediaType;
 
@@ -213,6 +346,41 @@ private:
     KPoolPtrNP<MDL>
         m_MdlPool;
 
+    size_t
+        m_mdlSize = 0;
+
+    // Every fragment of a received packet is described by its own MDL, the
+    // MDLs of a packet are chained on the NBL until it is returned
+    Rtl::KArray<PMDL, NonPagedPoolNx>
+        m_mdlStack;
+
+    size_t
+        m_mdlStackIndex = 0;
+
+    Rtl::KArray<MdlContext, NonPagedPoolNx>
+        m_mdlContext;
+
+    // Frames no larger than the copy break threshold are copied into a
+    // buffer owned by the NBL, so their fragment buffers are recycled to
+    // the NIC in the same iteration instead of waiting for the NBL return
+    ULONG
+        m_copyBreakThreshold = 0;
+
+    // Iterations between two reports of the queue counters, zero unless
+    // RX_REPORT_PERF_COUNTERS is set
+    ULONG
+        m_perfCountersInterval = 0;
+
+    KPoolPtrNP<UCHAR>
+        m_copyBreakBuffers;
+
+    KPoolPtrNP<MDL>
+        m_copyBreakMdlPool;
+
+    // Validate in software the checksums the NIC did not check
+    bool
+        m_softwareChecksum = false;
+
     unique_nbl_pool
         m_nblStorage;
 
@@ -228,6 +396,12 @@ private:
     size_t
         m_rxDataBufferSize = 0;
 
+    size_t
+        m_rxDataBufferCapacity = 0;
+
+    size_t
+        m_rxMaxFragmentsPerPacket = 1;
+
     UINT32
         m_rxNumPackets = 0;
 
@@ -278,6 +452,62 @@ private:
     NxStatistics &
         m_statistics;
 
+    // set once receive scaling may rebalance this queue
+    NxReceiveScaling *
+        m_receiveScaling = nullptr;
+
+    // see GetPostedPacketIndex
+    ULONG volatile
+        m_postedPacketIndex = 0;
+
+    ULONG volatile
+        m_indicatedPacketIndex = 0;
+
+    // queue whose epoch gates indications here, see HoldIndications
+    NxRxXlat * volatile
+        m_holdSource = nullptr;
+
+    ULONG volatile
+        m_holdPacketIndex = 0;
+
+    // whether m_holdPacketIndex is known yet
+    BOOLEAN volatile
+        m_holdPacketIndexSet = FALSE;
+
+    bool
+        m_indicationsHeld = false;
+
+    ULONG64 volatile
+        m_holdDeadline = 0;
+
+    // set on queue 0 when frames are spread across processors in software
+    wistd::unique_ptr<NxSoftwareReceiveScaling>
+        m_softwareReceiveScaling;
+
+    // NBLs other queues steered here, indicated by this queue's EC. The
+    // rundown keeps other queues from adding to it once the EC winds down.
+    NxNblQueue
+        m_steeredNblQueue;
+
+    NxInterlockedFlag
+        m_steeredNblNotification;
+
+    KRundown
+        m_steeredNblRundown;
+
+    bool
+        m_steeredNblQueueClosed = false;
+
+    ULONG
+        m_indicatedSteeredNbls = 0;
+
+    // NBLs this queue steered to others that were not indicated yet
+    LONG volatile
+        m_steeredNbls = 0;
+
+    NxInterlockedFlag
+        m_steeredNblsDrainedNotification;
+
     ArmedNotifications
     GetNotificationsToArm(
         void
@@ -309,15 +539,51 @@ private:
     );
 
     bool
-    ReInitializeMdlForDataBuffer(
-        _In_ PNET_BUFFER nb,
-        _In_ NET_FRAGMENT const * fragment,
-        _In_ NET_FRAGMENT_VIRTUAL_ADDRESS const * VirtualAddress,
-        _In_ NET_FRAGMENT_RETURN_CONTEXT const * ReturnContext,
-        _In_ PMDL fragmentMdl,
-        _In_ bool isFirstFragment
+    CopyFragmentsToNbl(
+        _In_ NET_PACKET const * Packet,
+        _In_ PNET_BUFFER_LIST Nbl
     );
 
+    PMDL
+    ClaimFragmentBuffer(
+        _In_ UINT32 FragmentIndex
+    );
+
+    void
+    ReleaseFragmentBuffer(
+        _In_ PMDL Mdl
+    );
+
+    void
+    ReclaimUnclaimedFragments(
+        void
+    );
+
+    void
+    MigrateFragmentBuffer(
+        _In_ PMDL Mdl
+    );
+
+    MdlContext &
+    GetMdlContext(
+        _In_ PMDL Mdl
+    );
+
+    PMDL
+    MdlStackPop(
+        void
+    );
+
+    void
+    MdlStackPush(
+        _In_ PMDL Mdl
+    );
+
+    bool
+    MdlStackIsEmpty(
+        void
+    ) const;
+
     NET_BUFFER_LIST *
     NblStackPop(
         void
@@ -359,6 +625,17 @@ private:
         void
     );
 
+    void
+    EcMigrateBufferPool(
+        void
+    );
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    void
+    CreatePendingBufferPool(
+        void
+    );
+
     void
     EcYieldToNetAdapter(
         void
@@ -369,6 +646,37 @@ private:
         void
     );
 
+    bool
+    EcIndicationsHeld(
+        void
+    );
+
+    NxRxXlat *
+    EcGetFlowQueue(
+        _In_ NET_PACKET const * Packet
+    );
+
+    bool
+    EcSteerNbls(
+        _In_ NxRxXlat * Queue,
+        _Inout_ NBL_COUNTED_QUEUE * Nbls
+    );
+
+    void
+    EcIndicateSteeredNbls(
+        void
+    );
+
+    void
+    EcCloseSteeredNblQueue(
+        void
+    );
+
+    bool
+    EcSteeredNblsDrained(
+        void
+    );
+
     void
     EcUpdatePerfCounter(
         void
@@ -379,11 +687,24 @@ private:
         void
     );
 
+    bool
+    EcRunIteration(
+        _Inout_ bool & CancelIssued
+    );
+
     NTSTATUS
     CreateVariousPools(
         void
     );
 
+    NTSTATUS
+    CreateBufferPool(
+        _In_ NET_CLIENT_ADAPTER_DATAPATH_CAPABILITIES & DatapathCapabilities,
+        _In_ NODE_REQUIREMENT PreferredNode,
+        _Out_ NET_CLIENT_BUFFER_POOL * BufferPool,
+        _Out_ NET_CLIENT_BUFFER_POOL_DISPATCH const ** BufferPoolDispatch
+    );
+
     void
     SetupRxThreadProperties(
         void
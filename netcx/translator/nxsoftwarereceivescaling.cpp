@@ -0,0 +1,429 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    Implements receive side scaling in software.
+
+--*/
+
+#include "NxXlatPrecomp.hpp"
+#include "NxXlatCommon.hpp"
+#include "NxSoftwareReceiveScaling.tmh"
+#include "NxSoftwareReceiveScaling.hpp"
+
+#include <netiodef.h>
+
+#include "NxRxXlat.hpp"
+#include "NxPoller.hpp"
+#include "NxProcessorTopology.hpp"
+#include "NxNblSequence.h"
+
+// The default key of the RSS specification, the one NICs ship with
+static UCHAR const DefaultHashSecretKey[] =
+{
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+    0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+    0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+    0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+    0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa,
+};
+
+static_assert(sizeof(DefaultHashSecretKey) >= NxToeplitzHash::MinimumKeyLength);
+
+static
+bool
+IsIPv4(
+    NET_PACKET_LAYOUT const &layout
+)
+{
+    return
+        layout.Layer3Type >= NetPacketLayer3TypeIPv4UnspecifiedOptions &&
+        layout.Layer3Type <= NetPacketLayer3TypeIPv4NoOptions;
+}
+
+static
+bool
+IsIPv6(
+    NET_PACKET_LAYOUT const &layout
+)
+{
+    return
+        layout.Layer3Type >= NetPacketLayer3TypeIPv6UnspecifiedExtensions &&
+        layout.Layer3Type <= NetPacketLayer3TypeIPv6NoExtensions;
+}
+
+static EC_POLL_ROUTINE ReceiveWorkerPoll;
+
+static
+bool
+ReceiveWorkerPoll(
+    PVOID Context
+)
+{
+    return reinterpret_cast<NxReceiveWorker *>(Context)->Poll();
+}
+
+_Use_decl_annotations_
+NxReceiveWorker::NxReceiveWorker(
+    NxSoftwareReceiveScaling & Owner
+) noexcept :
+    m_owner(Owner)
+{
+    ndisInitializeNblQueue(&m_batch.Queue);
+    m_batch.NblCount = 0;
+}
+
+NxReceiveWorker::~NxReceiveWorker(
+    void
+)
+{
+    if (m_started)
+    {
+        m_executionContext.Cancel();
+        m_executionContext.Stop();
+    }
+
+    m_executionContext.Terminate();
+
+    NT_ASSERT(m_batch.NblCount == 0);
+    NT_ASSERT(m_pendingNbls.GetNblQueueDepth() == 0);
+}
+
+_Use_decl_annotations_
+NTSTATUS
+NxReceiveWorker::Initialize(
+    ULONG ProcessorIndex,
+    ULONG Priority
+)
+{
+    NxPoller * poller;
+    CX_RETURN_IF_NOT_NT_SUCCESS_MSG(
+        NxPoller::Get(ProcessorIndex, Priority, &poller),
+        "Failed to get poller for software RSS worker. ProcessorIndex=%u", ProcessorIndex);
+
+    CX_RETURN_IF_NOT_NT_SUCCESS_MSG(
+        m_executionContext.InitializeHosted(this, ReceiveWorkerPoll, *poller),
+        "Failed to host software RSS worker. ProcessorIndex=%u", ProcessorIndex);
+
+    m_executionContext.Start();
+    m_started = true;
+
+    return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+void
+NxReceiveWorker::Append(
+    NET_BUFFER_LIST * Nbl
+)
+{
+    ndisAppendSingleNblToNblQueue(&m_batch.Queue, Nbl);
+    m_batch.NblCount++;
+}
+
+ULONG
+NxReceiveWorker::GetBatchCount(
+    void
+) const
+{
+    return static_cast<ULONG>(m_batch.NblCount);
+}
+
+void
+NxReceiveWorker::Flush(
+    void
+)
+{
+    m_pendingNbls.Enqueue(&m_batch);
+    m_executionContext.SignalWork();
+}
+
+bool
+NxReceiveWorker::Poll(
+    void
+)
+{
+    NBL_QUEUE nbls;
+    m_pendingNbls.DequeueAll(&nbls);
+
+    auto const busy = nbls.First != nullptr;
+
+    if (busy)
+    {
+        Indicate(nbls.First);
+    }
+
+    // the owner queue only goes away once every NBL handed here came back,
+    // so there is nothing left to wind down
+    if (m_executionContext.IsStopping())
+    {
+        m_executionContext.SignalStopped();
+        return false;
+    }
+
+    // keep polling while NBLs keep coming
+    return busy;
+}
+
+_Use_decl_annotations_
+void
+NxReceiveWorker::Indicate(
+    NET_BUFFER_LIST * NblChain
+)
+{
+    NxNblSequence nbls;
+
+    for (auto nbl = NblChain; nbl != nullptr;)
+    {
+        auto const next = nbl->Next;
+        nbl->Next = nullptr;
+        nbls.AddNbl(nbl);
+        nbl = next;
+    }
+
+    auto const count = nbls.GetCount();
+
+    if (! m_owner.GetNblDispatcher().IndicateReceiveNetBufferLists(
+            nbls.GetNblQueue().First,
+            NDIS_DEFAULT_PORT_NUMBER,
+            count,
+            nbls.GetReceiveFlags()))
+    {
+        // The NBL packet gate closed because the queue is being stopped, see
+        // NxRxXlat::EcIndicateNblsToNdis
+        m_owner.ReturnNetBufferLists(&nbls.GetNblQueue());
+    }
+
+    m_owner.CompleteIndication(count);
+}
+
+_Use_decl_annotations_
+NxSoftwareReceiveScaling::NxSoftwareReceiveScaling(
+    NxRxXlat & Queue,
+    NxExecutionContext & QueueExecutionContext,
+    INxNblDispatcher & NblDispatcher
+) noexcept :
+    m_queue(Queue),
+    m_queueExecutionContext(QueueExecutionContext),
+    m_nblDispatcher(NblDispatcher)
+{
+}
+
+NxSoftwareReceiveScaling::~NxSoftwareReceiveScaling(
+    void
+)
+{
+    NT_ASSERT(m_pendingNbls == 0);
+}
+
+_Use_decl_annotations_
+NTSTATUS
+NxSoftwareReceiveScaling::Initialize(
+    ULONG NumberOfProcessors,
+    ULONG Priority,
+    NODE_REQUIREMENT Node
+)
+{
+    m_hash.Initialize(DefaultHashSecretKey, sizeof(DefaultHashSecretKey));
+
+    // One worker per physical core before any SMT sibling gets one, the
+    // frames of two workers on the same core would compete for its caches
+    NxProcessorTopology topology;
+    CX_RETURN_IF_NOT_NT_SUCCESS(topology.Initialize());
+
+    PROCESSOR_NUMBER processors[IndirectionTableSize];
+    auto const numberOfWorkers = topology.SelectProcessors(
+        Node,
+        min(static_cast<size_t>(NumberOfProcessors), ARRAYSIZE(processors)),
+        processors);
+
+    CX_RETURN_NTSTATUS_IF(STATUS_NOT_SUPPORTED, numberOfWorkers == 0);
+
+    CX_RETURN_NTSTATUS_IF(
+        STATUS_INSUFFICIENT_RESOURCES,
+        ! m_workers.reserve(numberOfWorkers));
+
+    for (size_t i = 0; i < numberOfWorkers; i++)
+    {
+        auto worker = wil::make_unique_nothrow<NxReceiveWorker>(*this);
+        CX_RETURN_NTSTATUS_IF(STATUS_INSUFFICIENT_RESOURCES, ! worker);
+
+#if _KERNEL_MODE
+        auto const processorIndex = KeGetProcessorIndexFromNumber(&processors[i]);
+#else
+        auto const processorIndex = static_cast<ULONG>(i);
+#endif
+
+        CX_RETURN_IF_NOT_NT_SUCCESS(worker->Initialize(processorIndex, Priority));
+
+        CX_RETURN_NTSTATUS_IF(
+            STATUS_INSUFFICIENT_RESOURCES,
+            ! m_workers.append(wistd::move(worker)));
+    }
+
+    // Buckets are dealt round-robin, the same default spread NDIS asks of a
+    // NIC when RSS is enabled
+    for (size_t bucket = 0; bucket < ARRAYSIZE(m_indirectionTable); bucket++)
+    {
+        m_indirectionTable[bucket] = static_cast<UCHAR>(bucket % numberOfWorkers);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+void
+NxSoftwareReceiveScaling::HashFrame(
+    NET_PACKET const & Packet,
+    UCHAR const * Frame,
+    UINT32 FrameLength,
+    NET_BUFFER_LIST * Nbl
+) const
+{
+    // NBLs are recycled, clear whatever hash the last frame had
+    Nbl->NetBufferListInfo[NetBufferListHashValue] = nullptr;
+    Nbl->NetBufferListInfo[NetBufferListHashInfo] = nullptr;
+
+    auto const & layout = Packet.Layout;
+    auto const ipOffset = layout.Layer2HeaderLength;
+    auto const layer4Offset = ipOffset + layout.Layer3HeaderLength;
+
+    if (layout.Layer3HeaderLength == 0 || layer4Offset > FrameLength)
+    {
+        return;
+    }
+
+    // The hash input is the source and destination addresses followed by
+    // the source and destination ports, all in network byte order
+    ULONG hash;
+    ULONG hashType;
+    size_t addressesLength;
+    bool fragment = false;
+
+    if (IsIPv4(layout))
+    {
+        auto const ip = reinterpret_cast<IPV4_HEADER UNALIGNED const *>(Frame + ipOffset);
+
+        addressesLength = sizeof(ip->SourceAddress) + sizeof(ip->DestinationAddress);
+        hash = m_hash.Compute(reinterpret_cast<UCHAR const *>(&ip->SourceAddress), addressesLength);
+        hashType = NDIS_HASH_IPV4;
+
+        // Only the first fragment has ports, all fragments must hash the same
+        fragment = ip->MoreFragments || (ip->FlagsOffset & IP4_OFF_MASK) != 0;
+    }
+    else if (IsIPv6(layout))
+    {
+        auto const ip = reinterpret_cast<IPV6_HEADER UNALIGNED const *>(Frame + ipOffset);
+
+        addressesLength = sizeof(ip->SourceAddress) + sizeof(ip->DestinationAddress);
+        hash = m_hash.Compute(reinterpret_cast<UCHAR const *>(&ip->SourceAddress), addressesLength);
+        hashType = NDIS_HASH_IPV6;
+    }
+    else
+    {
+        return;
+    }
+
+    if (layout.Layer4Type == NetPacketLayer4TypeTcp &&
+        ! fragment &&
+        FrameLength - layer4Offset >= 2 * sizeof(USHORT))
+    {
+        hash ^= m_hash.Compute(Frame + layer4Offset, 2 * sizeof(USHORT), addressesLength);
+        hashType = hashType == NDIS_HASH_IPV4 ? NDIS_HASH_TCP_IPV4 : NDIS_HASH_TCP_IPV6;
+    }
+
+    NET_BUFFER_LIST_SET_HASH_VALUE(Nbl, hash);
+    NET_BUFFER_LIST_SET_HASH_TYPE(Nbl, hashType);
+    NET_BUFFER_LIST_SET_HASH_FUNCTION(Nbl, NdisHashFunctionToeplitz);
+}
+
+_Use_decl_annotations_
+bool
+NxSoftwareReceiveScaling::Steer(
+    NET_BUFFER_LIST * Nbl
+)
+{
+    if (NET_BUFFER_LIST_GET_HASH_FUNCTION(Nbl) == 0)
+    {
+        return false;
+    }
+
+    auto const bucket = NET_BUFFER_LIST_GET_HASH_VALUE(Nbl) & (IndirectionTableSize - 1);
+    m_workers[m_indirectionTable[bucket]]->Append(Nbl);
+
+    return true;
+}
+
+ULONG
+NxSoftwareReceiveScaling::Flush(
+    void
+)
+{
+    ULONG handedOff = 0;
+
+    for (auto & worker : m_workers)
+    {
+        auto const count = worker->GetBatchCount();
+
+        if (count == 0)
+        {
+            continue;
+        }
+
+        // accounted for before the worker can see them
+        InterlockedAdd(&m_pendingNbls, static_cast<LONG>(count));
+        worker->Flush();
+
+        handedOff += count;
+    }
+
+    return handedOff;
+}
+
+bool
+NxSoftwareReceiveScaling::IsDrained(
+    void
+)
+{
+    if (ReadAcquire(&m_pendingNbls) == 0)
+    {
+        return true;
+    }
+
+    // arm, then check again in case the last worker finished in between
+    m_drainedNotification.Set();
+
+    return ReadAcquire(&m_pendingNbls) == 0;
+}
+
+INxNblDispatcher &
+NxSoftwareReceiveScaling::GetNblDispatcher(
+    void
+) const
+{
+    return m_nblDispatcher;
+}
+
+_Use_decl_annotations_
+void
+NxSoftwareReceiveScaling::ReturnNetBufferLists(
+    NBL_QUEUE * Nbls
+)
+{
+    m_queue.QueueReturnedNetBufferLists(Nbls);
+}
+
+_Use_decl_annotations_
+void
+NxSoftwareReceiveScaling::CompleteIndication(
+    ULONG NumberOfNbls
+)
+{
+    if (InterlockedAdd(&m_pendingNbls, -static_cast<LONG>(NumberOfNbls)) == 0 &&
+        m_drainedNotification.TestAndClear())
+    {
+        m_queueExecutionContext.SignalWork();
+    }
+}
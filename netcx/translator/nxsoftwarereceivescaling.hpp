@@ -0,0 +1,208 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    Defines receive side scaling done in software for adapters whose NIC has
+    a single receive queue and no RSS of its own.
+
+--*/
+
+#pragma once
+
+#include <net/packet.h>
+
+#include <KArray.h>
+
+#include "NxExecutionContext.hpp"
+#include "NxSignal.hpp"
+#include "NxNblQueue.hpp"
+#include "NxToeplitz.hpp"
+
+class NxRxXlat;
+class NxSoftwareReceiveScaling;
+
+/// Indicates to NDIS, from its processor, the NBLs steered to that processor.
+/// Runs as a hosted EC on the poller of the processor.
+class NxReceiveWorker :
+    public NxNonpagedAllocation<'wRxN'>
+{
+
+public:
+
+    NxReceiveWorker(
+        _In_ NxSoftwareReceiveScaling & Owner
+    ) noexcept;
+
+    ~NxReceiveWorker(
+        void
+    );
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    NTSTATUS
+    Initialize(
+        _In_ ULONG ProcessorIndex,
+        _In_ ULONG Priority
+    );
+
+    /// Called only by the Rx EC of the owner queue. NBLs are batched until
+    /// the next Flush.
+    void
+    Append(
+        _In_ NET_BUFFER_LIST * Nbl
+    );
+
+    ULONG
+    GetBatchCount(
+        void
+    ) const;
+
+    /// Called only by the Rx EC of the owner queue. Hands the batch to the
+    /// worker.
+    void
+    Flush(
+        void
+    );
+
+    // the EC poll routine
+    bool
+    Poll(
+        void
+    );
+
+private:
+
+    void
+    Indicate(
+        _In_ NET_BUFFER_LIST * NblChain
+    );
+
+    NxSoftwareReceiveScaling &
+        m_owner;
+
+    NxExecutionContext
+        m_executionContext;
+
+    bool
+        m_started = false;
+
+    NxNblQueue
+        m_pendingNbls;
+
+    // Filled by the Rx EC between flushes
+    NBL_COUNTED_QUEUE
+        m_batch;
+};
+
+/// Spreads the frames received on queue 0 across processors the way a NIC
+/// with RSS would. The Rx EC computes the Toeplitz hash of every IP frame and
+/// sets the NBL hash information, then steers the NBL to the worker of the
+/// processor the hash maps to in the software indirection table. Frames of a
+/// flow always land on the same worker, so they are indicated in order.
+class NxSoftwareReceiveScaling :
+    public NxNonpagedAllocation<'sRxN'>
+{
+
+public:
+
+    // Buckets in the software indirection table, a power of two
+    static constexpr size_t IndirectionTableSize = 128;
+
+    NxSoftwareReceiveScaling(
+        _In_ NxRxXlat & Queue,
+        _In_ NxExecutionContext & QueueExecutionContext,
+        _In_ INxNblDispatcher & NblDispatcher
+    ) noexcept;
+
+    ~NxSoftwareReceiveScaling(
+        void
+    );
+
+    /// Creates a worker on each of NumberOfProcessors processors, spread
+    /// over physical cores first, those on Node before any other. Node is
+    /// the NUMA node of the NIC, or MM_ANY_NODE_OK.
+    _IRQL_requires_(PASSIVE_LEVEL)
+    NTSTATUS
+    Initialize(
+        _In_ ULONG NumberOfProcessors,
+        _In_ ULONG Priority,
+        _In_ NODE_REQUIREMENT Node
+    );
+
+    /// Called only by the Rx EC. Frame points to the layer 2 header of the
+    /// first fragment of Packet.
+    void
+    HashFrame(
+        _In_ NET_PACKET const & Packet,
+        _In_reads_bytes_(FrameLength) UCHAR const * Frame,
+        _In_ UINT32 FrameLength,
+        _Inout_ NET_BUFFER_LIST * Nbl
+    ) const;
+
+    /// Called only by the Rx EC. Returns false if the NBL has no hash and
+    /// should be indicated by the Rx EC itself.
+    bool
+    Steer(
+        _In_ NET_BUFFER_LIST * Nbl
+    );
+
+    /// Called only by the Rx EC once per iteration. Returns how many NBLs
+    /// were handed to workers.
+    ULONG
+    Flush(
+        void
+    );
+
+    /// Called only by the Rx EC while stopping. Returns true once the workers
+    /// are done with every NBL handed to them, otherwise the Rx EC is
+    /// signaled when they are.
+    bool
+    IsDrained(
+        void
+    );
+
+    // Called by the workers
+    INxNblDispatcher &
+    GetNblDispatcher(
+        void
+    ) const;
+
+    void
+    ReturnNetBufferLists(
+        _In_ NBL_QUEUE * Nbls
+    );
+
+    void
+    CompleteIndication(
+        _In_ ULONG NumberOfNbls
+    );
+
+private:
+
+    NxRxXlat &
+        m_queue;
+
+    NxExecutionContext &
+        m_queueExecutionContext;
+
+    INxNblDispatcher &
+        m_nblDispatcher;
+
+    NxToeplitzHash
+        m_hash;
+
+    Rtl::KArray<wistd::unique_ptr<NxReceiveWorker>, NonPagedPoolNx>
+        m_workers;
+
+    // Bucket to index in m_workers
+    UCHAR
+        m_indirectionTable[IndirectionTableSize] = {};
+
+    // NBLs handed to workers and not indicated yet
+    LONG volatile
+        m_pendingNbls = 0;
+
+    NxInterlockedFlag
+        m_drainedNotification;
+};
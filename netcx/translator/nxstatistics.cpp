@@ -40,6 +40,6 @@ _Use_decl_annotations_
 void
 NxStatistics::GetPerfCounter(NETADAPTER_QUEUE_PC* perfCounter) const
 {
-    RtlCopyMemory(perfCounter, m_statistics, sizeof(m_statistics));
+    RtlCopyMemory(perfCounter, m_statistics, s_NumberOfPerfCounters * sizeof(ULONG64));
     perfCounter->IterationCountBase = (UINT32) perfCounter->IterationCount;
 }
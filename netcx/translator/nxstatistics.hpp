@@ -11,6 +11,19 @@ enum class NxStatisticsCounters {
     QueueDepth,         // # of packets own by the client driver
     NblPending,         // # of NBL pending
     PacketsCompleted,   // # of packets done processing
+// Rx copy break, not part of the queue perf counter set
+    CopiedPackets,      // # of packets copied out of their fragment buffers
+    ZeroCopyPackets,    // # of packets indicated in their fragment buffers
+// Tx completion batching, not part of the queue perf counter set
+    CompletionBatchesOf1,       // # of completion batches of a single NBL
+    CompletionBatchesOf2To8,    // # of completion batches of 2 to 8 NBLs
+    CompletionBatchesOf9To32,   // # of completion batches of 9 to 32 NBLs
+    CompletionBatchesOver32,    // # of completion batches of more than 32 NBLs
+// Tx doorbell batching, not part of the queue perf counter set
+    Doorbells,          // # of times new packets were handed to the client driver
+    DeferredDoorbells,  // # of times handing new packets over was deferred
+// Rx rebalancing, not part of the queue perf counter set
+    HoldDeadlines,      // # of indication holds released by their deadline
     NumberofStatisticsCounters
 };
 
@@ -39,8 +52,11 @@ private:
     ULONG64
         m_statistics[static_cast<int>(NxStatisticsCounters::NumberofStatisticsCounters)] = {};
 
-    static_assert(sizeof(NETADAPTER_QUEUE_PC) >= sizeof(m_statistics),
-                  "NETADAPTER_QUEUE_PC must be large enough to store all counters");
+    static constexpr size_t
+        s_NumberOfPerfCounters = static_cast<size_t>(NxStatisticsCounters::PacketsCompleted) + 1;
+
+    static_assert(sizeof(NETADAPTER_QUEUE_PC) >= s_NumberOfPerfCounters * sizeof(ULONG64),
+                  "NETADAPTER_QUEUE_PC must be large enough to store all perf counters");
 public:
 
     const ULONG 
@@ -0,0 +1,91 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    Implements the table driven Toeplitz hash.
+
+--*/
+
+#include "NxXlatPrecomp.hpp"
+#include "NxXlatCommon.hpp"
+#include "NxToeplitz.tmh"
+#include "NxToeplitz.hpp"
+
+static
+ULONG
+KeyWindow(
+    _In_reads_bytes_(NxToeplitzHash::MinimumKeyLength) UCHAR const * Key,
+    _In_ size_t Bit
+)
+{
+    // The 32 bits of the key starting at Bit, counting from the most
+    // significant bit of the first byte. They span at most five bytes.
+    auto const byte = Bit / 8;
+
+    UINT64 const bits =
+        (static_cast<UINT64>(Key[byte]) << 32) |
+        (static_cast<UINT64>(Key[byte + 1]) << 24) |
+        (static_cast<UINT64>(Key[byte + 2]) << 16) |
+        (static_cast<UINT64>(Key[byte + 3]) << 8) |
+        static_cast<UINT64>(Key[byte + 4]);
+
+    return static_cast<ULONG>(bits >> (8 - Bit % 8));
+}
+
+_Use_decl_annotations_
+void
+NxToeplitzHash::Initialize(
+    UCHAR const * Key,
+    size_t KeyLength
+)
+{
+    NT_FRE_ASSERT(KeyLength >= MinimumKeyLength);
+    UNREFERENCED_PARAMETER(KeyLength);
+
+    for (size_t position = 0; position < MaximumInputLength; position++)
+    {
+        ULONG windows[8];
+
+        for (size_t bit = 0; bit < ARRAYSIZE(windows); bit++)
+        {
+            windows[bit] = KeyWindow(Key, position * 8 + bit);
+        }
+
+        for (size_t value = 0; value < ARRAYSIZE(m_table[position]); value++)
+        {
+            ULONG hash = 0;
+
+            for (size_t bit = 0; bit < ARRAYSIZE(windows); bit++)
+            {
+                if (value & (0x80 >> bit))
+                {
+                    hash ^= windows[bit];
+                }
+            }
+
+            m_table[position][value] = hash;
+        }
+    }
+}
+
+_Use_decl_annotations_
+ULONG
+NxToeplitzHash::Compute(
+    UCHAR const * Input,
+    size_t Length,
+    size_t Offset
+) const
+{
+    NT_ASSERT(Offset + Length <= MaximumInputLength);
+
+    ULONG hash = 0;
+
+    for (size_t i = 0; i < Length; i++)
+    {
+        hash ^= m_table[Offset + i][Input[i]];
+    }
+
+    return hash;
+}
@@ -0,0 +1,47 @@
+// Copyright (C) Microsoft Corporation. All rights reserved.
+
+/*++
+
+Abstract:
+
+    Table driven Toeplitz hash, the hash function used by RSS.
+
+--*/
+
+#pragma once
+
+/// Computes the Toeplitz hash of up to MaximumInputLength bytes one byte at a
+/// time. The contribution of every possible byte value at every input position
+/// is precomputed from the secret key, hashing a byte is then a table lookup
+/// and an XOR instead of eight shifts of the key window.
+class NxToeplitzHash
+{
+
+public:
+
+    // Enough for the IPv6 source and destination addresses and both ports
+    static constexpr size_t MaximumInputLength = 36;
+
+    // The key must cover a 32 bit window starting at the last input bit
+    static constexpr size_t MinimumKeyLength = MaximumInputLength + sizeof(ULONG);
+
+    void
+    Initialize(
+        _In_reads_bytes_(KeyLength) UCHAR const * Key,
+        _In_ size_t KeyLength
+    );
+
+    /// Hashes Input as if it started Offset bytes into the hash input, so that
+    /// discontiguous fields can be hashed separately and their results XORed.
+    ULONG
+    Compute(
+        _In_reads_bytes_(Length) UCHAR const * Input,
+        _In_ size_t Length,
+        _In_ size_t Offset = 0
+    ) const;
+
+private:
+
+    ULONG
+        m_table[MaximumInputLength][256];
+};
@@ -20,6 +20,7 @@ Abstract:
 #include "NxXlat.hpp"
 #include "NxTranslationApp.hpp"
 #include "NxPerfTuner.hpp"
+#include "NxPoller.hpp"
 #include <ntstrsafe.h>
 
 TRACELOGGING_DEFINE_PROVIDER(
@@ -302,6 +303,7 @@ NxTranslationAppFactory::~NxTranslationAppFactory(
         ExFreePoolWithTag(NxTranslationApp::s_AppCollection, 'pAxN');
     }
 
+    NxPoller::CleanupCollection();
     NxPerfTunerCleanup();
 
 #ifdef _KERNEL_MODE
@@ -322,6 +324,11 @@ NxTranslationAppFactory::Initialize(
     TraceLoggingRegister(g_hNetAdapterCxXlatProvider);
     status  = NxPerfTunerInitialize();
 
+    if (NT_SUCCESS(status))
+    {
+        status = NxPoller::InitializeCollection();
+    }
+
     if (NT_SUCCESS(status))
     {
         PVOID memory =
@@ -388,6 +395,7 @@ NxTranslationApp::NxTranslationApp(
     m_dispatch(Dispatch),
     m_adapter(Adapter),
     m_adapterDispatch(AdapterDispatch),
+    m_txBufferSend(m_txQueues),
     m_offload(*this, AdapterDispatch->OffloadDispatch)
 {
     NxTranslationApp::s_AppCollection->Add(this);
@@ -406,6 +414,10 @@ NxTranslationApp::Initialize(
     void
 )
 {
+    CX_RETURN_NTSTATUS_IF(
+        STATUS_INSUFFICIENT_RESOURCES,
+        ! m_txStatistics.resize(1));
+
     CX_RETURN_NTSTATUS_IF(
         STATUS_INSUFFICIENT_RESOURCES,
         ! m_rxStatistics.resize(1));
@@ -422,6 +434,15 @@ NxTranslationApp::GetAdapter(
     return m_adapter;
 }
 
+_Use_decl_annotations_
+NET_CLIENT_DISPATCH const *
+NxTranslationApp::GetDispatch(
+    void
+) const
+{
+    return m_dispatch;
+}
+
 _Use_decl_annotations_
 void
 NxTranslationApp::SetDeviceFailed(
@@ -539,19 +560,42 @@ NxTranslationApp::CreateDefaultQueues(
     void
 )
 {
-    auto txQueue = wil::make_unique_nothrow<NxTxXlat>(
-        0,
-        m_dispatch,
-        m_adapter,
-        m_adapterDispatch,
-        m_txStatistics);
+    auto const numberOfTxQueues = GetNumberOfTxQueues();
+
+    KLockThisExclusive lock(m_statisticsLock);
+
+    if (numberOfTxQueues > m_txStatistics.count())
+    {
+        CX_RETURN_NTSTATUS_IF(
+            STATUS_INSUFFICIENT_RESOURCES,
+            ! m_txStatistics.resize(numberOfTxQueues));
+    }
+
+    lock.Release();
 
+    Rtl::KArray<wistd::unique_ptr<NxTxXlat>, NonPagedPoolNx> txQueues;
     CX_RETURN_NTSTATUS_IF(
         STATUS_INSUFFICIENT_RESOURCES,
-        ! txQueue);
+        ! txQueues.resize(numberOfTxQueues));
 
-    CX_RETURN_IF_NOT_NT_SUCCESS(
-        txQueue->Initialize());
+    for (ULONG i = 0; i < numberOfTxQueues; i++)
+    {
+        auto txQueue = wil::make_unique_nothrow<NxTxXlat>(
+            i,
+            m_dispatch,
+            m_adapter,
+            m_adapterDispatch,
+            m_txStatistics[i]);
+
+        CX_RETURN_NTSTATUS_IF(
+            STATUS_INSUFFICIENT_RESOURCES,
+            ! txQueue);
+
+        CX_RETURN_IF_NOT_NT_SUCCESS(
+            txQueue->Initialize());
+
+        txQueues[i] = wistd::move(txQueue);
+    }
 
     auto rxQueue = wil::make_unique_nothrow<NxRxXlat>(
         0,
@@ -571,7 +615,7 @@ NxTranslationApp::CreateDefaultQueues(
     CX_RETURN_IF_NOT_NT_SUCCESS(
         rxQueue->Initialize());
 
-    m_txQueue = wistd::move(txQueue);
+    m_txQueues = wistd::move(txQueues);
     m_rxQueues[0] = wistd::move(rxQueue);
 
     return STATUS_SUCCESS;
@@ -584,7 +628,11 @@ NxTranslationApp::StartDefaultQueues(
     void
 )
 {
-    m_txQueue->Start();
+    for (auto & queue : m_txQueues)
+    {
+        queue->Start();
+    }
+
     m_rxQueues[0]->Start();
 }
 
@@ -690,6 +738,10 @@ NxTranslationApp::StartReceiveScalingQueues(
         {
             m_rxQueues[i]->Start();
         }
+
+        m_receiveScaling->StartRebalancing();
+
+        m_txBufferSend.SetReceiveScaling(m_receiveScaling.get());
     }
 }
 
@@ -708,7 +760,7 @@ NxTranslationApp::StartDatapath(
     m_adapterDispatch->GetProperties(m_adapter, &adapterProperties);
     m_NblDispatcher = static_cast<INxNblDispatcher *>(adapterProperties.NblDispatcher);
     m_NblDispatcher->SetRxHandler(&m_rxBufferReturn);
-    m_NblDispatcher->SetTxHandler(m_txQueue.get());
+    m_NblDispatcher->SetTxHandler(&m_txBufferSend);
 
     StartDefaultQueues();
 
@@ -730,9 +782,25 @@ NxTranslationApp::StopDatapath(
 
     m_NblDispatcher->SetRxHandler(nullptr);
 
-    m_txQueue->Cancel();
+    if (m_receiveScaling)
+    {
+        m_receiveScaling->StopRebalancing();
+    }
+
+    for (auto & queue : m_txQueues)
+    {
+        queue->Cancel();
+    }
+
     m_NblDispatcher->SetTxHandler(nullptr);
-    m_txQueue->Stop();
+
+    // no send is in progress anymore
+    m_txBufferSend.SetReceiveScaling(nullptr);
+
+    for (auto & queue : m_txQueues)
+    {
+        queue->Stop();
+    }
 
     for (auto & queue : m_rxQueues)
     {
@@ -772,7 +840,7 @@ NxTranslationApp::DestroyDatapath(
     m_datapathCreated = false;
     m_receiveScalingDatapath = false;
 
-    m_txQueue.reset();
+    m_txQueues.clear();
     m_rxQueues.clear();
 }
 
@@ -782,7 +850,10 @@ NxTranslationApp::OffloadInitialize(
     void
 )
 {
-    return m_offload.Initialize();
+    auto const enableSoftwareLso =
+        !!m_dispatch->NetClientQueryDriverConfigurationBoolean(TX_SOFTWARE_LSO_ENABLED);
+
+    return m_offload.Initialize(enableSoftwareLso);
 }
 
 _Use_decl_annotations_
@@ -886,12 +957,11 @@ NxTranslationApp::ReportGeneralStatistics(
         statistics->ifHCInUcastPkts = GetRxCounter(NxStatisticsCounters::NumberOfPackets);
     }
 
-    lock.Release();
-
     // Populate transmit statistics
-    statistics->ifOutErrors = m_txStatistics.GetCounter(NxStatisticsCounters::NumberOfErrors);
-    statistics->ifHCOutOctets = m_txStatistics.GetCounter(NxStatisticsCounters::BytesOfData);
+    statistics->ifOutErrors = GetTxCounter(NxStatisticsCounters::NumberOfErrors);
+    statistics->ifHCOutOctets = GetTxCounter(NxStatisticsCounters::BytesOfData);
 
+    lock.Release();
 
     Request.DATA.QUERY_INFORMATION.BytesWritten = byteWritten;
 
@@ -906,12 +976,12 @@ NxTranslationApp::ReportTxPacketStatistics(
 {
     if (Request.DATA.QUERY_INFORMATION.InformationBufferLength >= sizeof(ULONG64))
     {
-        *(ULONG64*)Request.DATA.QUERY_INFORMATION.InformationBuffer = m_txStatistics.GetCounter(NxStatisticsCounters::NumberOfPackets);
+        *(ULONG64*)Request.DATA.QUERY_INFORMATION.InformationBuffer = GetTxCounter(NxStatisticsCounters::NumberOfPackets);
         Request.DATA.QUERY_INFORMATION.BytesWritten = sizeof(ULONG64);
     }
     else if (Request.DATA.QUERY_INFORMATION.InformationBufferLength >= sizeof(ULONG32))
     {
-        *(ULONG32*)Request.DATA.QUERY_INFORMATION.InformationBuffer = (ULONG32) m_txStatistics.GetCounter(NxStatisticsCounters::NumberOfPackets);
+        *(ULONG32*)Request.DATA.QUERY_INFORMATION.InformationBuffer = (ULONG32) GetTxCounter(NxStatisticsCounters::NumberOfPackets);
         Request.DATA.QUERY_INFORMATION.BytesWritten = sizeof(ULONG32);
     }
     else
@@ -963,6 +1033,21 @@ NxTranslationApp::GetRxCounter(
     return count;
 }
 
+_Use_decl_annotations_
+ULONG64
+NxTranslationApp::GetTxCounter(
+    NxStatisticsCounters CounterType
+) const
+{
+    ULONG64 count = 0;
+    for (size_t i = 0; i < m_txStatistics.count(); i++)
+    {
+        count += m_txStatistics[i].GetCounter(CounterType);
+    }
+
+    return count;
+}
+
 _Use_decl_annotations_
 NTSTATUS
 NxTranslationApp::ReportUlong(
@@ -1095,19 +1180,22 @@ NxTranslationApp::FillPerfCounter(
         }
     }
 
-    if (InstanceId == PCW_ANY_INSTANCE_ID ||
-        InstanceId == m_txStatistics.m_StatId)
+    for (size_t i = 0; i < m_txStatistics.count(); i++)
     {
-        (void) RtlUnicodeStringPrintf(&name, L"App %d - TX %d", m_AppId, m_txStatistics.m_StatId);
+        if (InstanceId == PCW_ANY_INSTANCE_ID ||
+            InstanceId == m_txStatistics[i].m_StatId)
+        {
+            (void) RtlUnicodeStringPrintf(&name, L"App %d - TX %d", m_AppId, m_txStatistics[i].m_StatId);
 
-        NETADAPTER_QUEUE_PC perfCounter = {};
-        m_txStatistics.GetPerfCounter(&perfCounter);
+            NETADAPTER_QUEUE_PC perfCounter = {};
+            m_txStatistics[i].GetPerfCounter(&perfCounter);
 
-        AddNetAdapterCxQueueCounterSet(
-            pcwInfoLocal->EnumerateInstances.Buffer,
-            &name,
-            m_txStatistics.m_StatId,
-            &perfCounter);
+            AddNetAdapterCxQueueCounterSet(
+                pcwInfoLocal->EnumerateInstances.Buffer,
+                &name,
+                m_txStatistics[i].m_StatId,
+                &perfCounter);
+        }
     }
 #else
 
@@ -1142,12 +1230,7 @@ NxTranslationApp::GetMaximumPacketSize(
     NET_CLIENT_ADAPTER_PROPERTIES adapterProperties = {};
     m_adapterDispatch->GetProperties(m_adapter, &adapterProperties);
 
-    auto const maxL2HeaderSize =
-        adapterProperties.MediaType == NdisMedium802_3
-            ? 22 // sizeof(ETHERNET_HEADER) + sizeof(SNAP_HEADER)
-            : 0;
-    auto const capabilities = GetDatapathCapabilities();
-    return capabilities.NominalMtu + maxL2HeaderSize;
+    return NxGetMaximumPacketSize(adapterProperties.MediaType, GetDatapathCapabilities());
 }
 
 _Use_decl_annotations_
@@ -1170,6 +1253,36 @@ NxTranslationApp::GetRxFrameSize(
     return static_cast<ULONG>(capabilities.MaximumRxFragmentSize);
 }
 
+//
+// The number of transmit queues defaults to one per active processor, bounded
+// by what the client driver advertised. TX_QUEUE_COUNT overrides the processor
+// count when set.
+//
+_Use_decl_annotations_
+ULONG
+NxTranslationApp::GetNumberOfTxQueues(
+    void
+) const
+{
+    auto const capabilities = GetDatapathCapabilities();
+
+    ULONG numberOfQueues =
+        m_dispatch->NetClientQueryDriverConfigurationUlong(TX_QUEUE_COUNT);
+
+    if (numberOfQueues == 0)
+    {
+#ifdef _KERNEL_MODE
+        numberOfQueues = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+#else
+        numberOfQueues = 1;
+#endif // _KERNEL_MODE
+    }
+
+    numberOfQueues = min(numberOfQueues, static_cast<ULONG>(capabilities.MaximumNumberOfTxQueues));
+
+    return max(numberOfQueues, 1UL);
+}
+
 _Use_decl_annotations_
 ULONG
 NxTranslationApp::GetTxFragmentRingSize(
@@ -1208,8 +1321,12 @@ NxTranslationApp::GetRxFragmentRingSize(
 
     auto const capabilities = GetDatapathCapabilities();
     perfCharacteristics.FragmentRingNumberOfElementsHint = capabilities.PreferredRxFragmentRingSize;
+    perfCharacteristics.MaximumFragmentBufferSize = capabilities.MaximumRxFragmentSize;
     perfCharacteristics.NominalLinkSpeed = capabilities.NominalMaxRxLinkSpeed;
 
+    perfCharacteristics.MaxPacketSizeWithRsc =
+        NxGetMaxPacketSizeWithRsc(adapterProperties.MediaType, capabilities);
+
     NxPerfTunerCalculateRxParameters(&perfCharacteristics, &perfParameters);
 
     return perfParameters.FragmentRingElementCount;
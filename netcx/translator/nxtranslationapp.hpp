@@ -52,6 +52,12 @@ public:
         void
     ) const;
 
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NET_CLIENT_DISPATCH const *
+    GetDispatch(
+        void
+    ) const;
+
     _IRQL_requires_(PASSIVE_LEVEL)
     void
     SetDeviceFailed(
@@ -252,14 +258,26 @@ private:
         void
     );
 
+    _IRQL_requires_(PASSIVE_LEVEL)
+    ULONG
+    GetNumberOfTxQueues(
+        void
+    ) const;
+
     _IRQL_requires_(PASSIVE_LEVEL)
     ULONG64
     GetRxCounter(
         NxStatisticsCounters CounterType
     ) const;
 
-    wistd::unique_ptr<NxTxXlat>
-        m_txQueue;
+    _IRQL_requires_(PASSIVE_LEVEL)
+    ULONG64
+    GetTxCounter(
+        NxStatisticsCounters CounterType
+    ) const;
+
+    Rtl::KArray<wistd::unique_ptr<NxTxXlat>, NonPagedPoolNx>
+        m_txQueues;
 
     Rtl::KArray<wistd::unique_ptr<NxRxXlat>, NonPagedPoolNx>
         m_rxQueues;
@@ -276,6 +294,9 @@ private:
     INxNblDispatcher *
         m_NblDispatcher = nullptr;
 
+    NxNblTx
+        m_txBufferSend;
+
     NxNblRx
         m_rxBufferReturn;
 
@@ -294,7 +315,7 @@ private:
     NxTaskOffload
         m_offload;
 
-    NxStatistics
+    Rtl::KArray<NxStatistics, NonPagedPoolNxCacheAligned>
         m_txStatistics;
 
     Rtl::KArray<NxStatistics, NonPagedPoolNxCacheAligned>
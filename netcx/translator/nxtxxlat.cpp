@@ -23,6 +23,8 @@ Abstract:
 
 #include "NxPacketLayout.hpp"
 #include "NxChecksumInfo.hpp"
+#include "NxPoller.hpp"
+#include "NxReceiveScaling.hpp"
 
 #ifndef _KERNEL_MODE
 #define NDIS_STATUS_PAUSED ((NDIS_STATUS)STATUS_NDIS_PAUSED)
@@ -216,36 +218,144 @@ NetAdapterTransmitThread(
     return EC_RETURN();
 }
 
+static EC_POLL_ROUTINE NetAdapterTransmitPoll;
+
+static
+bool
+NetAdapterTransmitPoll(
+    PVOID Context
+)
+{
+    return reinterpret_cast<NxTxXlat*>(Context)->TransmitPoll();
+}
+
 void
 NxTxXlat::SetupTxThreadProperties()
 {
 #if _KERNEL_MODE
-    // setup thread prioirty;
-    ULONG threadPriority =
-        m_dispatch->NetClientQueryDriverConfigurationUlong(TX_THREAD_PRIORITY);
+    // a hosted EC runs on its poller's thread, which has its own priority and affinity
+    if (! m_executionContext.IsHosted())
+    {
+        // setup thread prioirty;
+        ULONG threadPriority =
+            m_dispatch->NetClientQueryDriverConfigurationUlong(TX_THREAD_PRIORITY);
 
-    KeSetBasePriorityThread(KeGetCurrentThread(), threadPriority - (LOW_REALTIME_PRIORITY + LOW_PRIORITY)/2);
+        KeSetBasePriorityThread(KeGetCurrentThread(), threadPriority - (LOW_REALTIME_PRIORITY + LOW_PRIORITY)/2);
 
-    BOOLEAN setThreadAffinity =
-        m_dispatch->NetClientQueryDriverConfigurationBoolean(TX_THREAD_AFFINITY_ENABLED);
+        BOOLEAN setThreadAffinity =
+            m_dispatch->NetClientQueryDriverConfigurationBoolean(TX_THREAD_AFFINITY_ENABLED);
 
-    ULONG threadAffinity =
-        m_dispatch->NetClientQueryDriverConfigurationUlong(TX_THREAD_AFFINITY);
+        ULONG threadAffinity =
+            m_dispatch->NetClientQueryDriverConfigurationUlong(TX_THREAD_AFFINITY);
 
-    if (setThreadAffinity != FALSE)
-    {
-        GROUP_AFFINITY Affinity = { 0 };
-        GROUP_AFFINITY old;
-        PROCESSOR_NUMBER CpuNum = { 0 };
-        KeGetProcessorNumberFromIndex(threadAffinity, &CpuNum);
-        Affinity.Group = CpuNum.Group;
-        Affinity.Mask =
-            (threadAffinity != THREAD_AFFINITY_NO_MASK) ?
-            AFFINITY_MASK(CpuNum.Number) : ((ULONG_PTR)-1);
-        KeSetSystemGroupAffinityThread(&Affinity, &old);
+        if (setThreadAffinity != FALSE)
+        {
+            GROUP_AFFINITY Affinity = { 0 };
+            GROUP_AFFINITY old;
+            PROCESSOR_NUMBER CpuNum = { 0 };
+            KeGetProcessorNumberFromIndex(threadAffinity, &CpuNum);
+            Affinity.Group = CpuNum.Group;
+            Affinity.Mask =
+                (threadAffinity != THREAD_AFFINITY_NO_MASK) ?
+                AFFINITY_MASK(CpuNum.Number) : ((ULONG_PTR)-1);
+            KeSetSystemGroupAffinityThread(&Affinity, &old);
+        }
     }
 #endif
 
+    m_executionContext.SetBusyPollWindow(
+        m_dispatch->NetClientQueryDriverConfigurationUlong(TX_BUSY_POLL_WINDOW));
+
+    m_completionBatchCount =
+        m_dispatch->NetClientQueryDriverConfigurationUlong(TX_COMPLETION_BATCH_COUNT);
+    m_completionBatchBytes =
+        m_dispatch->NetClientQueryDriverConfigurationUlong(TX_COMPLETION_BATCH_BYTES);
+    m_completionBatchTime =
+        static_cast<ULONG64>(m_dispatch->NetClientQueryDriverConfigurationUlong(TX_COMPLETION_BATCH_TIME)) * 10;
+
+    if (m_dispatch->NetClientQueryDriverConfigurationBoolean(TX_REPORT_PERF_COUNTERS))
+    {
+        m_perfCountersInterval =
+            m_dispatch->NetClientQueryDriverConfigurationUlong(TX_PERF_COUNTERS_ITERATION_INTERVAL);
+    }
+
+    m_doorbellBatch =
+        m_dispatch->NetClientQueryDriverConfigurationUlong(TX_DOORBELL_BATCH);
+    m_doorbellWatermark =
+        m_packetRing.Count() * m_dispatch->NetClientQueryDriverConfigurationUlong(TX_DOORBELL_WATERMARK) / 100;
+}
+
+// Returns true once the queue has wound down after being cancelled
+bool
+NxTxXlat::RunIteration(
+    bool & CancelIssued
+)
+{
+    if (!CancelIssued)
+    {
+        // Check if the NBL serialization has any data
+        PollNetBufferLists();
+
+        // Post NBLs to the producer side of the NBL
+        TranslateNbls();
+    }
+
+    // Allow the NetAdapter to return any packets that it is done with.
+    YieldToNetAdapter();
+
+    // Drain any packets that the NIC has completed.
+    // This means returning the associated NBLs for each completed
+    // NET_PACKET.
+    DrainCompletions();
+
+    UpdatePerfCounter();
+
+    // Arms notifications if no forward progress was made in
+    // this loop.
+    WaitForWork();
+
+    // This represents the wind down of Tx
+    if (m_executionContext.IsStopping())
+    {
+        if (!CancelIssued)
+        {
+            // Indicate cancellation to the adapter
+            // and drop all outstanding NBLs.
+            //
+            // One NBL may remain that has been partially programmed into the NIC.
+            // So that NBL is kept around until the end
+
+            m_queueDispatch->Cancel(m_queue);
+            DropQueuedNetBufferLists();
+
+            CancelIssued = true;
+        }
+
+        // The termination condition is that the NIC has returned all its
+        // packets.
+        if (!m_packetRing.AnyNicPackets())
+        {
+            if (m_packetRing.AnyReturnedPackets())
+            {
+                DrainCompletions();
+                NT_ASSERT(!m_packetRing.AnyReturnedPackets());
+            }
+
+            // DropQueuedNetBufferLists had completed as many NBLs as possible, but there's
+            // a chance that one parital NBL couldn't be completed up there.  Do it now.
+            AbortNbls(m_currentNbl);
+            m_currentNbl = nullptr;
+            m_currentNetBuffer = nullptr;
+
+            FlushCompletions();
+
+            m_queueDispatch->Stop(m_queue);
+            m_executionContext.SignalStopped();
+            return true;
+        }
+    }
+
+    return false;
 }
 
 void
@@ -260,71 +370,38 @@ NxTxXlat::TransmitThread()
         auto cancelIssued = false;
 
         // This represents the core execution of the Tx path
-        while (true)
+        while (! RunIteration(cancelIssued))
         {
-            if (!cancelIssued)
-            {
-                // Check if the NBL serialization has any data
-                PollNetBufferLists();
-
-                // Post NBLs to the producer side of the NBL
-                TranslateNbls();
-            }
-
-            // Allow the NetAdapter to return any packets that it is done with.
-            YieldToNetAdapter();
+        }
+    }
+}
 
-            // Drain any packets that the NIC has completed.
-            // This means returning the associated NBLs for each completed
-            // NET_PACKET.
-            DrainCompletions();
+bool
+NxTxXlat::TransmitPoll()
+{
+    if (! m_queueStarted)
+    {
+        m_queueDispatch->Start(m_queue);
 
-            UpdatePerfCounter();
+        m_queueStarted = true;
+        m_cancelIssued = false;
+        m_halted = false;
+    }
 
-            // Arms notifications if no forward progress was made in
-            // this loop.
-            WaitForWork();
+    // same as the EC thread waking up from a halt
+    if (m_halted)
+    {
+        m_halted = false;
+        m_lastArmedNotifications.Value = 0;
+    }
 
-            // This represents the wind down of Tx
-            if (m_executionContext.IsStopping())
-            {
-                if (!cancelIssued)
-                {
-                    // Indicate cancellation to the adapter
-                    // and drop all outstanding NBLs.
-                    //
-                    // One NBL may remain that has been partially programmed into the NIC.
-                    // So that NBL is kept around until the end
-
-                    m_queueDispatch->Cancel(m_queue);
-                    DropQueuedNetBufferLists();
-
-                    cancelIssued = true;
-                }
-
-                // The termination condition is that the NIC has returned all its
-                // packets.
-                if (!m_packetRing.AnyNicPackets())
-                {
-                    if (m_packetRing.AnyReturnedPackets())
-                    {
-                        DrainCompletions();
-                        NT_ASSERT(!m_packetRing.AnyReturnedPackets());
-                    }
-
-                    // DropQueuedNetBufferLists had completed as many NBLs as possible, but there's
-                    // a chance that one parital NBL couldn't be completed up there.  Do it now.
-                    AbortNbls(m_currentNbl);
-                    m_currentNbl = nullptr;
-                    m_currentNetBuffer = nullptr;
-
-                    m_queueDispatch->Stop(m_queue);
-                    m_executionContext.SignalStopped();
-                    break;
-                }
-            }
-        }
+    if (RunIteration(m_cancelIssued))
+    {
+        m_queueStarted = false;
+        return false;
     }
+
+    return ! m_halted;
 }
 
 void
@@ -335,6 +412,7 @@ NxTxXlat::DrainCompletions()
         m_nblTranslationStats,
         &m_rings,
         m_datapathCapabilities,
+        m_checksumCapabilities,
         m_dmaAdapter.get(),
         m_packetContext,
         m_adapterProperties.MediaType,
@@ -345,13 +423,81 @@ NxTxXlat::DrainCompletions()
 
     m_completedPackets = result.CompletedPackets;
 
+    auto const chainStarted = result.CompletedChain && !m_completionChain;
+
     if (result.CompletedChain)
     {
-        m_nblDispatcher->SendNetBufferListsComplete(
-            result.CompletedChain, result.NumCompletedNbls, 0);
+        result.CompletedChainTail->Next = m_completionChain;
+        m_completionChain = result.CompletedChain;
+        m_completionChainCount += result.NumCompletedNbls;
+        m_completionChainBytes += result.CompletedBytes;
+    }
+
+    if (!m_completionChain)
+    {
+        return;
+    }
+
+    // Each call into NDIS has a fixed cost, so hold completions back until
+    // enough of them have accumulated or the oldest has waited long enough.
+    // Whatever is left is flushed before the EC goes to sleep.
+    if (m_completionChainCount >= m_completionBatchCount ||
+        m_completionChainBytes >= m_completionBatchBytes)
+    {
+        FlushCompletions();
+        return;
+    }
+
+    // The clock is read at most once per pass, and only while a batch is
+    // short of its thresholds
+    auto const now = m_executionContext.QueryTime();
+
+    if (chainStarted)
+    {
+        m_completionChainStartTime = now;
+    }
+    else if (now - m_completionChainStartTime >= m_completionBatchTime)
+    {
+        FlushCompletions();
     }
 }
 
+void
+NxTxXlat::FlushCompletions()
+{
+    if (!m_completionChain)
+    {
+        return;
+    }
+
+    auto const count = m_completionChainCount;
+
+    if (count == 1)
+    {
+        m_statistics.Increment(NxStatisticsCounters::CompletionBatchesOf1);
+    }
+    else if (count <= 8)
+    {
+        m_statistics.Increment(NxStatisticsCounters::CompletionBatchesOf2To8);
+    }
+    else if (count <= 32)
+    {
+        m_statistics.Increment(NxStatisticsCounters::CompletionBatchesOf9To32);
+    }
+    else
+    {
+        m_statistics.Increment(NxStatisticsCounters::CompletionBatchesOver32);
+    }
+
+    auto const chain = m_completionChain;
+
+    m_completionChain = nullptr;
+    m_completionChainCount = 0;
+    m_completionChainBytes = 0;
+
+    m_nblDispatcher->SendNetBufferListsComplete(chain, count, 0);
+}
+
 void
 NxTxXlat::TranslateNbls()
 {
@@ -365,6 +511,7 @@ NxTxXlat::TranslateNbls()
         m_nblTranslationStats,
         &m_rings,
         m_datapathCapabilities,
+        m_checksumCapabilities,
         m_dmaAdapter.get(),
         m_packetContext,
         m_adapterProperties.MediaType,
@@ -383,6 +530,24 @@ NxTxXlat::UpdatePerfCounter()
     m_statistics.IncrementBy(NxStatisticsCounters::NblPending, m_synchronizedNblQueue.GetNblQueueDepth());
     m_statistics.IncrementBy(NxStatisticsCounters::PacketsCompleted, m_completedPackets);
     m_statistics.IncrementBy(NxStatisticsCounters::QueueDepth, NetRingGetRangeCount(pr, pr->BeginIndex, pr->EndIndex));
+
+    if (m_perfCountersInterval != 0 &&
+        m_statistics.GetCounter(NxStatisticsCounters::IterationCount) % m_perfCountersInterval == 0)
+    {
+        TraceLoggingWrite(
+            g_hNetAdapterCxXlatProvider,
+            "NxTxQueuePerfCounters",
+            TraceLoggingDescription("Transmit queue counters, reported every TX_PERF_COUNTERS_ITERATION_INTERVAL iterations"),
+            TraceLoggingUInt64(GetQueueId(), "QueueId"),
+            TraceLoggingUInt64(m_statistics.GetCounter(NxStatisticsCounters::IterationCount), "IterationCount"),
+            TraceLoggingUInt64(m_statistics.GetCounter(NxStatisticsCounters::PacketsCompleted), "PacketsCompleted"),
+            TraceLoggingUInt64(m_statistics.GetCounter(NxStatisticsCounters::CompletionBatchesOf1), "CompletionBatchesOf1"),
+            TraceLoggingUInt64(m_statistics.GetCounter(NxStatisticsCounters::CompletionBatchesOf2To8), "CompletionBatchesOf2To8"),
+            TraceLoggingUInt64(m_statistics.GetCounter(NxStatisticsCounters::CompletionBatchesOf9To32), "CompletionBatchesOf9To32"),
+            TraceLoggingUInt64(m_statistics.GetCounter(NxStatisticsCounters::CompletionBatchesOver32), "CompletionBatchesOver32"),
+            TraceLoggingUInt64(m_statistics.GetCounter(NxStatisticsCounters::Doorbells), "Doorbells"),
+            TraceLoggingUInt64(m_statistics.GetCounter(NxStatisticsCounters::DeferredDoorbells), "DeferredDoorbells"));
+    }
 }
 
 void
@@ -390,12 +555,34 @@ NxTxXlat::WaitForWork()
 {
     auto notificationsToArm = GetNotificationsToArm();
 
+    // Before arming notifications give new work a chance to show up by
+    // polling for a short while. The execution context decides how long
+    // based on how far apart work has recently been arriving.
+    if (notificationsToArm.Value == 0)
+    {
+        m_executionContext.NotifyProgress();
+    }
+    else if (m_lastArmedNotifications.Value == 0 && m_executionContext.BusyPoll())
+    {
+        return;
+    }
+
     // In order to handle race conditions, the notifications that should
     // be armed at halt cannot change between the halt preparation and the
     // actual halt. If they do change, re-arm the necessary notifications
     // and loop again.
     if (notificationsToArm.Value != 0 && notificationsToArm.Value == m_lastArmedNotifications.Value)
     {
+        FlushCompletions();
+
+        // A hosted EC goes back to its poller and picks up from here once
+        // signaled, see TransmitPoll
+        if (m_executionContext.IsHosted())
+        {
+            m_halted = true;
+            return;
+        }
+
         m_executionContext.WaitForWork();
 
         // after halting, don't arm any notifications
@@ -485,23 +672,151 @@ NxTxXlat::SendNetBufferLists(
     }
 }
 
+_Use_decl_annotations_
+NxNblTx::NxNblTx(
+    Rtl::KArray<wistd::unique_ptr<NxTxXlat>, NonPagedPoolNx> const & Queues
+) noexcept :
+    m_queues(Queues)
+{
+}
+
+_Use_decl_annotations_
+void
+NxNblTx::SetReceiveScaling(
+    NxReceiveScaling * ReceiveScaling
+)
+{
+    WritePointerRelease(reinterpret_cast<PVOID volatile *>(&m_receiveScaling), ReceiveScaling);
+}
+
+_Use_decl_annotations_
+NxTxXlat *
+NxNblTx::SelectQueue(
+    NET_BUFFER_LIST * NetBufferList
+) const
+{
+    auto const numberOfQueues = static_cast<ULONG>(m_queues.count());
+
+    // A flow hash computed by the protocol is stable for the lifetime of the
+    // flow, so use it whenever it is present to keep per-flow ordering.
+    if (NET_BUFFER_LIST_GET_HASH_TYPE(NetBufferList) != 0)
+    {
+        return m_queues[NET_BUFFER_LIST_GET_HASH_VALUE(NetBufferList) % numberOfQueues].get();
+    }
+
+#ifdef _KERNEL_MODE
+    auto const processorIndex = KeGetCurrentProcessorIndex();
+#else
+    auto const processorIndex = GetCurrentProcessorNumber();
+#endif // _KERNEL_MODE
+
+    return m_queues[processorIndex % numberOfQueues].get();
+}
+
+void
+NxNblTx::SendNetBufferLists(
+    _In_ NET_BUFFER_LIST * NblChain,
+    _In_ ULONG PortNumber,
+    _In_ ULONG NumberOfNbls,
+    _In_ ULONG SendFlags
+)
+{
+    auto const receiveScaling = static_cast<NxReceiveScaling *>(
+        ReadPointerAcquire(reinterpret_cast<PVOID volatile *>(&m_receiveScaling)));
+
+    if (receiveScaling != nullptr)
+    {
+        for (auto nbl = NblChain; nbl != nullptr; nbl = nbl->Next)
+        {
+            receiveScaling->LearnFlow(nbl);
+        }
+    }
+
+    if (m_queues.count() == 1)
+    {
+        m_queues[0]->SendNetBufferLists(NblChain, PortNumber, NumberOfNbls, SendFlags);
+        return;
+    }
+
+    // Hand the chain over in spans of consecutive NBLs that map to the same
+    // queue. Bursts from a single flow are usually contiguous so this rarely
+    // splits the chain more than necessary.
+    auto nbl = NblChain;
+    while (nbl)
+    {
+        auto const first = nbl;
+        auto const queue = SelectQueue(first);
+        auto last = first;
+        ULONG numberOfNbls = 1;
+
+        for (nbl = first->Next; nbl; nbl = nbl->Next)
+        {
+            if (SelectQueue(nbl) != queue)
+            {
+                break;
+            }
+
+            last = nbl;
+            numberOfNbls++;
+        }
+
+        last->Next = nullptr;
+        queue->SendNetBufferLists(first, PortNumber, numberOfNbls, SendFlags);
+    }
+}
+
 PNET_BUFFER_LIST
 NxTxXlat::DequeueNetBufferListQueue()
 {
     return m_synchronizedNblQueue.DequeueAll();
 }
 
+bool
+NxTxXlat::ShouldDeferAdvance() const
+{
+    // Handing packets to the client driver usually costs it a doorbell
+    // write, so while more NBLs are already queued behind the ones just
+    // translated let a few packets pile up first. Never defer when the
+    // translation stopped short (m_currentNbl is set), as that means it ran
+    // out of ring space, or when the ring is past the fill watermark.
+    if (m_unadvancedPackets == 0 ||
+        m_unadvancedPackets >= m_doorbellBatch ||
+        m_currentNbl != nullptr ||
+        m_synchronizedNblQueue.GetNblQueueDepth() == 0)
+    {
+        return false;
+    }
+
+    auto const pr = m_packetRing.Get();
+
+    return NetRingGetRangeCount(pr, pr->BeginIndex, pr->EndIndex) < m_doorbellWatermark;
+}
+
 void
 NxTxXlat::YieldToNetAdapter()
 {
     if (m_packetRing.AnyNicPackets())
     {
+        m_unadvancedPackets += m_producedPackets;
+
+        if (ShouldDeferAdvance())
+        {
+            m_statistics.Increment(NxStatisticsCounters::DeferredDoorbells);
+            return;
+        }
+
         if (m_dmaAdapter)
         {
             m_dmaAdapter->FlushIoBuffers(m_packetRing.NicPackets());
         }
 
         m_queueDispatch->Advance(m_queue);
+
+        if (m_unadvancedPackets != 0)
+        {
+            m_statistics.Increment(NxStatisticsCounters::Doorbells);
+            m_unadvancedPackets = 0;
+        }
     }
 }
 
@@ -515,6 +830,10 @@ NxTxXlat::Initialize(
 
     m_adapterDispatch->GetDatapathCapabilities(m_adapter, &m_datapathCapabilities);
 
+    // Decides per packet which checksums are left to the NIC
+    m_checksumCapabilities = { sizeof(NET_CLIENT_OFFLOAD_CHECKSUM_CAPABILITIES) };
+    m_adapterDispatch->OffloadDispatch.GetChecksumHardwareCapabilities(m_adapter, &m_checksumCapabilities);
+
     NX_PERF_TX_NIC_CHARACTERISTICS perfCharacteristics = {};
     NX_PERF_TX_TUNING_PARAMETERS perfParameters;
     perfCharacteristics.Nic.IsDriverVerifierEnabled = !!m_adapterProperties.DriverIsVerifying;
@@ -576,22 +895,64 @@ NxTxXlat::Initialize(
         CX_RETURN_IF_NOT_NT_SUCCESS(m_dmaAdapter->Initialize(*m_dispatch));
     }
 
+    // keep the bounce buffers on the node the Tx thread is pinned to, if any
+    NODE_REQUIREMENT bounceBufferNode = MM_ANY_NODE_OK;
+
+#if _KERNEL_MODE
+    if (m_dispatch->NetClientQueryDriverConfigurationBoolean(TX_THREAD_AFFINITY_ENABLED))
+    {
+        auto const threadAffinity = m_dispatch->NetClientQueryDriverConfigurationUlong(TX_THREAD_AFFINITY);
+
+        if (threadAffinity != THREAD_AFFINITY_NO_MASK)
+        {
+            PROCESSOR_NUMBER processor = {};
+            KeGetProcessorNumberFromIndex(threadAffinity, &processor);
+
+            GROUP_AFFINITY affinity = {};
+            affinity.Group = processor.Group;
+            affinity.Mask = AFFINITY_MASK(processor.Number);
+
+            bounceBufferNode = NxExecutionContext::QueryAffinityNode(affinity);
+        }
+    }
+#endif
+
     CX_RETURN_IF_NOT_NT_SUCCESS(
         m_bounceBufferPool.Initialize(
             *m_dispatch,
             m_datapathCapabilities,
-            perfParameters.NumberOfBounceBuffers));
+            perfParameters.NumberOfBounceBuffers,
+            bounceBufferNode));
 
     for (auto i = 0ul; i < m_packetRing.Count(); i++)
     {
         new (&m_packetContext.GetContext<PacketContext>(i)) PacketContext();
     }
 
-    CX_RETURN_IF_NOT_NT_SUCCESS_MSG(
-        m_executionContext.Initialize(this, NetAdapterTransmitThread),
-        "Failed to start Tx execution context. NxTxXlat=%p", this);
+    if (m_dispatch->NetClientQueryDriverConfigurationBoolean(DATAPATH_POLLER_ENABLED))
+    {
+        NxPoller * poller;
+        CX_RETURN_IF_NOT_NT_SUCCESS_MSG(
+            NxPoller::Get(
+                static_cast<ULONG>(GetQueueId() % KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS)),
+                m_dispatch->NetClientQueryDriverConfigurationUlong(TX_THREAD_PRIORITY),
+                &poller),
+            "Failed to get datapath poller. NxTxXlat=%p", this);
+
+        CX_RETURN_IF_NOT_NT_SUCCESS_MSG(
+            m_executionContext.InitializeHosted(this, NetAdapterTransmitPoll, *poller),
+            "Failed to host Tx execution context. NxTxXlat=%p", this);
+
+        SetupTxThreadProperties();
+    }
+    else
+    {
+        CX_RETURN_IF_NOT_NT_SUCCESS_MSG(
+            m_executionContext.Initialize(this, NetAdapterTransmitThread),
+            "Failed to start Tx execution context. NxTxXlat=%p", this);
 
-    m_executionContext.SetDebugNameHint(L"Transmit", GetQueueId(), m_adapterProperties.NetLuid);
+        m_executionContext.SetDebugNameHint(L"Transmit", GetQueueId(), m_adapterProperties.NetLuid);
+    }
 
     return STATUS_SUCCESS;
 }
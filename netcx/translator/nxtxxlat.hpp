@@ -83,6 +83,12 @@ public:
         void
     );
 
+    // the EC poll routine when hosted on a poller
+    bool
+    TransmitPoll(
+        void
+    );
+
     void
     Notify(
         void
@@ -107,6 +113,11 @@ private:
 
     NxExecutionContext m_executionContext;
 
+    // Loop state kept across polls when the EC is hosted on a poller
+    bool m_queueStarted = false;
+    bool m_cancelIssued = false;
+    bool m_halted = false;
+
     NET_CLIENT_DISPATCH const *
         m_dispatch = nullptr;
 
@@ -122,6 +133,9 @@ private:
     NET_CLIENT_ADAPTER_DATAPATH_CAPABILITIES
         m_datapathCapabilities = {};
 
+    NET_CLIENT_OFFLOAD_CHECKSUM_CAPABILITIES
+        m_checksumCapabilities = {};
+
     NDIS_MEDIUM
         m_mediaType;
 
@@ -179,6 +193,46 @@ private:
     ULONG
         m_completedPackets = 0;
 
+    // Completed NBLs are held back and returned to NDIS in batches, see
+    // DrainCompletions
+    NET_BUFFER_LIST *
+        m_completionChain = nullptr;
+
+    ULONG
+        m_completionChainCount = 0;
+
+    ULONG64
+        m_completionChainBytes = 0;
+
+    ULONG64
+        m_completionChainStartTime = 0;
+
+    ULONG
+        m_completionBatchCount = 0;
+
+    ULONG64
+        m_completionBatchBytes = 0;
+
+    // In 100ns units
+    ULONG64
+        m_completionBatchTime = 0;
+
+    // Iterations between two reports of the queue counters, zero unless
+    // TX_REPORT_PERF_COUNTERS is set
+    ULONG
+        m_perfCountersInterval = 0;
+
+    // Packets produced but not yet handed to the client driver, see
+    // ShouldDeferAdvance
+    ULONG
+        m_unadvancedPackets = 0;
+
+    ULONG
+        m_doorbellBatch = 0;
+
+    ULONG
+        m_doorbellWatermark = 0;
+
     struct ArmedNotifications
     {
         union
@@ -223,6 +277,11 @@ private:
         void
     );
 
+    void
+    FlushCompletions(
+        void
+    );
+
     void
     TranslateNbls(
         void
@@ -233,6 +292,11 @@ private:
         void
     );
 
+    bool
+    ShouldDeferAdvance(
+        void
+    ) const;
+
     void
     UpdatePerfCounter(
         void
@@ -243,6 +307,11 @@ private:
         void
     );
 
+    bool
+    RunIteration(
+        _Inout_ bool & CancelIssued
+    );
+
     // These operations are used exclusively while
     // winding down the Tx path
     void
@@ -273,3 +342,58 @@ private:
 
 };
 
+//
+// Spreads NBLs handed down by NDIS across the translator's transmit queues.
+// Each NBL is steered by its flow hash, or by the sending processor when the
+// protocol did not stamp one, so that all NBLs of a flow are serialized on
+// the same NxTxXlat.
+//
+class NxReceiveScaling;
+
+class NxNblTx :
+    public INxNblTx,
+    public NxNonpagedAllocation<'xTxN'>
+{
+
+public:
+
+    NxNblTx(
+        _In_ Rtl::KArray<wistd::unique_ptr<NxTxXlat>, NonPagedPoolNx> const & Queues
+    ) noexcept;
+
+    //
+    // INxNblTx
+    //
+
+    virtual
+    void
+    SendNetBufferLists(
+        _In_ NET_BUFFER_LIST * NblChain,
+        _In_ ULONG PortNumber,
+        _In_ ULONG NumberOfNbls,
+        _In_ ULONG SendFlags
+    );
+
+    // Sends teach receive scaling which processor consumes a flow, set while
+    // the receive scaling queues run
+    _IRQL_requires_(PASSIVE_LEVEL)
+    void
+    SetReceiveScaling(
+        _In_opt_ NxReceiveScaling * ReceiveScaling
+    );
+
+private:
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NxTxXlat *
+    SelectQueue(
+        _In_ NET_BUFFER_LIST * NetBufferList
+    ) const;
+
+    Rtl::KArray<wistd::unique_ptr<NxTxXlat>, NonPagedPoolNx> const &
+        m_queues;
+
+    NxReceiveScaling * volatile
+        m_receiveScaling = nullptr;
+
+};
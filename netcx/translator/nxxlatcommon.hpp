@@ -23,3 +23,33 @@ Abstract:
     ((Value != 0) && !((Value) & ((Value) - 1)))
 #endif
 
+// The NIC's MTU plus the largest layer 2 header of the medium
+inline
+ULONG
+NxGetMaximumPacketSize(
+    _In_ NDIS_MEDIUM MediaType,
+    _In_ NET_CLIENT_ADAPTER_DATAPATH_CAPABILITIES const & Capabilities
+)
+{
+    ULONG const maxL2HeaderSize =
+        MediaType == NdisMedium802_3
+            ? 22 // sizeof(ETHERNET_HEADER) + sizeof(SNAP_HEADER)
+            : 0;
+
+    return static_cast<ULONG>(Capabilities.NominalMtu) + maxL2HeaderSize;
+}
+
+// Largest frame the Rx fragment ring is sized for. A frame larger than the
+// NIC's Rx buffers is received in several fragments.
+inline
+size_t
+NxGetMaxPacketSizeWithRsc(
+    _In_ NDIS_MEDIUM MediaType,
+    _In_ NET_CLIENT_ADAPTER_DATAPATH_CAPABILITIES const & Capabilities
+)
+{
+    return max(
+        static_cast<size_t>(NxGetMaximumPacketSize(MediaType, Capabilities)),
+        Capabilities.MaximumRxFragmentSize);
+}
+
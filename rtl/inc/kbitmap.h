@@ -8,18 +8,14 @@ namespace Rtl
     {
     public:
 
+        static constexpr size_t BitsPerWord = sizeof(SIZE_T) * 8;
+
         KBitmap() = default;
         ~KBitmap() = default;
 
         bool Initialize(size_t numberOfBits)
         {
-#ifdef _WIN64
-            size_t bitsPerMachineWord = 64;
-#else
-            size_t bitsPerMachineWord = 32;
-#endif
-
-            if (!m_storage.resize((numberOfBits + bitsPerMachineWord - 1) / bitsPerMachineWord))
+            if (!m_storage.resize((numberOfBits + BitsPerWord - 1) / BitsPerWord))
                 return false;
 
             RtlInitializeBitMapEx(&m_bitmap, &m_storage[0], numberOfBits);
@@ -42,6 +38,25 @@ namespace Rtl
             RtlClearBitEx(&m_bitmap, bitNumber);
         }
 
+        // Word level accessors, bit n lives in word n / BitsPerWord at
+        // position n % BitsPerWord. These let callers that touch many bits
+        // at once update a whole word with a single read-modify-write.
+
+        SIZE_T GetWord(size_t wordIndex) const
+        {
+            return m_storage[wordIndex];
+        }
+
+        void SetWordBits(size_t wordIndex, SIZE_T mask)
+        {
+            m_storage[wordIndex] |= mask;
+        }
+
+        void ClearWordBits(size_t wordIndex, SIZE_T mask)
+        {
+            m_storage[wordIndex] &= ~mask;
+        }
+
         size_t FindSetBits(size_t numberToFind, size_t hintIndex)
         {
             return RtlFindSetBitsEx(&m_bitmap, numberToFind, hintIndex);